@@ -14,6 +14,16 @@ public:
     m_Radius = 0.0f;
   }
 
+  inline float x() const
+  {
+    return m_Center[0];
+  }
+  
+  inline float y() const
+  {
+    return m_Center[1];
+  }
+  
   inline float z() const
   {
     return m_Center[2];
@@ -31,4 +41,14 @@ public:
     m_Center[2] = pos[2];
     m_Radius = rad;
   }
+  
+  // overlap in the xy plane only.  Everything that casts or receives shadows lives on the same plane,
+  // so depth is ignored.
+  inline bool IntersectsXy(const BSphere& other) const
+  {
+    const float dx = m_Center[0] - other.m_Center[0];
+    const float dy = m_Center[1] - other.m_Center[1];
+    const float r = m_Radius + other.m_Radius;
+    return dx*dx + dy*dy <= r*r;
+  }
 };
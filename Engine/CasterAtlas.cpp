@@ -0,0 +1,169 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Engine/CasterAtlas.h"
+#include "Engine/Scene.h"
+#include "Render/Render.h"
+#include "Render/Texture.h"
+#include "Tool/Utils.h"
+
+#include <assert.h>
+#include <math.h>
+
+// crops are sized in multiples of this so shelves line up
+#define kCropAlign 8
+
+// -------------------------------------------------------------------------------------------------
+CasterAtlas* CasterAtlasCreate(int size, float texelsPerUnit)
+{
+    CasterAtlas* ret = new CasterAtlas();
+    ret->m_Size = size;
+    ret->m_TexelsPerUnit = texelsPerUnit;
+    ret->m_MinCropSize = 32;
+    ret->m_MaxCropSize = size/2;
+    
+    ret->m_Texture = TextureCreateRenderTexture(size, size, 0);
+    ret->m_Texture->SetClearFlags(Texture::RenderTextureFlags::kClearColor, 0,1,0,1);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void CasterAtlasDestroy(CasterAtlas* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    TextureDestroy(victim->m_Texture);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_CasterAtlasShelfPack
+//
+// order is largest first.  Returns false if the crops don't fit at their current sizes.
+static bool s_CasterAtlasShelfPack(CasterCrop* dest, const int* order, int numCrops, int atlasSize)
+{
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
+    
+    for (int i=0; i<numCrops; ++i)
+    {
+        CasterCrop* crop = &dest[order[i]];
+        if (x + crop->m_Size > atlasSize)
+        {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        
+        if (y + crop->m_Size > atlasSize)
+            return false;
+        
+        crop->m_X = x;
+        crop->m_Y = y;
+        
+        x += crop->m_Size;
+        shelfHeight = Max(shelfHeight, crop->m_Size);
+    }
+    
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// CasterAtlasPack
+void CasterAtlasPack(CasterCrop* dest, const CasterAtlas* casterAtlas, const BSphere* bounds, int numBounds)
+{
+    assert(numBounds <= CasterAtlas::kMaxCrops);
+    
+    int order[CasterAtlas::kMaxCrops];
+    
+    float scale = 1.0f;
+    for (;;)
+    {
+        for (int i=0; i<numBounds; ++i)
+        {
+            const float diameter = 2.0f * bounds[i].radius();
+            int size = (int) ceilf(diameter * casterAtlas->m_TexelsPerUnit * scale);
+            size = (size + kCropAlign-1) & ~(kCropAlign-1);
+            
+            dest[i].m_Size = Clamp(size, casterAtlas->m_MinCropSize, casterAtlas->m_MaxCropSize);
+            dest[i].m_Bounds = bounds[i];
+            order[i] = i;
+        }
+        
+        // largest first, a handful of lights so insertion sort is fine
+        for (int i=1; i<numBounds; ++i)
+        {
+            for (int j=i; j>0 && dest[order[j]].m_Size > dest[order[j-1]].m_Size; --j)
+                Utils::swap(order[j], order[j-1]);
+        }
+        
+        if (s_CasterAtlasShelfPack(dest, order, numBounds, casterAtlas->m_Size))
+            break;
+        
+        // kMaxCrops minimum sized crops always fit, so this terminates
+        scale *= 0.75f;
+    }
+    
+    const float invSize = 1.0f / casterAtlas->m_Size;
+    for (int i=0; i<numBounds; ++i)
+    {
+        CasterCrop* crop = &dest[i];
+        crop->m_AtlasRect = Vec4(crop->m_X*invSize, crop->m_Y*invSize, crop->m_Size*invSize, crop->m_Size*invSize);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// CasterAtlasSetupCrop
+//
+// Same camera orientation and depth as the main view, but orthographic and centered on the light.
+// Casters sit on a plane parallel to the screen, so screen uv to crop uv is a scale and offset.
+void CasterAtlasSetupCrop(CasterCrop* crop, const RenderContext* renderContext)
+{
+    const float r = crop->m_Bounds.radius();
+    const Vec3 center(crop->m_Bounds.x(), crop->m_Bounds.y(), crop->m_Bounds.z());
+    
+    Mat4 camera;
+    MatrixInvert(&camera, renderContext->m_View);
+    
+    const Vec3 cameraPos = camera.GetTranslation();
+    camera.SetTranslation(center.m_X[0], center.m_X[1], cameraPos.m_X[2]);
+    MatrixInvert(&crop->m_View, camera);
+    
+    ToolLoadOrthographic(&crop->m_Projection, -r, r, -r, r, 1.0f, 16777216.0f);
+    
+    const Vec2 s0 = RenderGetScreenPos(renderContext, center - Vec3(r, r, 0.0f)).xy();
+    const Vec2 s1 = RenderGetScreenPos(renderContext, center + Vec3(r, r, 0.0f)).xy();
+    const Vec2 scale(1.0f / (s1.m_X[0] - s0.m_X[0]), 1.0f / (s1.m_X[1] - s0.m_X[1]));
+    crop->m_ScreenToCrop = Vec4(scale.m_X[0], scale.m_X[1], -s0.m_X[0]*scale.m_X[0], -s0.m_X[1]*scale.m_X[1]);
+}
+
+// -------------------------------------------------------------------------------------------------
+// CasterAtlasDraw
+void CasterAtlasDraw(RenderContext* renderContext, CasterAtlas* casterAtlas, Scene* scene, int groupId, Shader* casterShader, const CasterCrop* crops, int numCrops)
+{
+    const Mat4 view = renderContext->m_View;
+    const Mat4 projection = renderContext->m_Projection;
+    
+    RenderSetRenderTarget(renderContext, casterAtlas->m_Texture);
+    RenderSetReplacementShader(renderContext, casterShader);
+    
+    for (int i=0; i<numCrops; ++i)
+    {
+        const CasterCrop& crop = crops[i];
+        renderContext->m_View = crop.m_View;
+        renderContext->m_Projection = crop.m_Projection;
+        
+        RenderSetViewport(renderContext, crop.m_X, crop.m_Y, crop.m_Size, crop.m_Size);
+        
+        SceneDraw(scene, renderContext, groupId);
+    }
+    
+    renderContext->m_View = view;
+    renderContext->m_Projection = projection;
+    
+    RenderSetRenderTarget(renderContext, nullptr);
+    RenderClearReplacementShader(renderContext);
+}
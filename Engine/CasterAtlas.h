@@ -0,0 +1,51 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Engine/BSphere.h"
+#include "Engine/Matrix.h"
+
+struct RenderContext;
+struct Scene;
+struct Shader;
+struct Texture;
+
+// Light-local shadow caster crop.  Each shadowed light gets a square region of the atlas centered on
+// it and covering its range at a fixed texel density, so raymarch cost follows the light's size and
+// lights off the edge of the screen still see their casters.
+struct CasterCrop
+{
+    int m_X;
+    int m_Y;
+    int m_Size;                // texels, square
+    
+    BSphere m_Bounds;          // world space area the crop covers
+    Mat4 m_View;
+    Mat4 m_Projection;
+    
+    Vec4 m_AtlasRect;          // xy offset, zw scale: atlas uv = crop uv * zw + xy
+    Vec4 m_ScreenToCrop;       // xy scale, zw offset: crop uv = screen uv * xy + zw
+};
+
+struct CasterAtlas
+{
+    enum { kMaxCrops = 32 };
+    
+    Texture* m_Texture;
+    int m_Size;
+    float m_TexelsPerUnit;
+    int m_MinCropSize;
+    int m_MaxCropSize;
+};
+
+CasterAtlas* CasterAtlasCreate(int size, float texelsPerUnit);
+void         CasterAtlasDestroy(CasterAtlas* victim);
+
+// Shelf pack one crop per bounds.  Crops shrink together until they fit, so every light gets one.
+void         CasterAtlasPack(CasterCrop* dest, const CasterAtlas* casterAtlas, const BSphere* bounds, int numBounds);
+
+// Fill in the camera and screen mapping for a packed crop against the current view
+void         CasterAtlasSetupCrop(CasterCrop* crop, const RenderContext* renderContext);
+
+// Render groupId with casterShader into each crop
+void         CasterAtlasDraw(RenderContext* renderContext, CasterAtlas* casterAtlas, Scene* scene, int groupId, Shader* casterShader, const CasterCrop* crops, int numCrops);
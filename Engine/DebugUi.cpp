@@ -3,6 +3,7 @@
 #include "Engine/DebugUI.h"
 #include "Render/GL.h"
 #include "Render/Render.h"
+#include "Render/RenderState.h"
 
 // mostly copied from imgui_impl_glfw_gl3
 #include "imgui/imgui.h"
@@ -121,6 +122,9 @@ void DebugUi::RenderDrawLists(ImDrawData* draw_data)
     if (last_enable_scissor_test) glEnable(GL_SCISSOR_TEST); else glDisable(GL_SCISSOR_TEST);
     glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
     glScissor(last_scissor_box[0], last_scissor_box[1], (GLsizei)last_scissor_box[2], (GLsizei)last_scissor_box[3]);
+
+    // restored, but not necessarily on the unit RenderState thinks is active
+    RenderStateInvalidate();
 }
 
 static const char* DebugUi::GetClipboardText()
@@ -265,6 +269,7 @@ bool DebugUi::CreateDeviceObjects()
     glBindTexture(GL_TEXTURE_2D, last_texture);
     glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
     glBindVertexArray(last_vertex_array);
+    RenderStateInvalidate();
 
     return true;
 }
@@ -287,6 +292,8 @@ void    DebugUi::InvalidateDeviceObjects()
     glDeleteProgram(g_ShaderHandle);
     g_ShaderHandle = 0;
 
+    RenderStateInvalidate();
+
     if (g_FontTexture)
     {
         glDeleteTextures(1, &g_FontTexture);
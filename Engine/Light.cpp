@@ -60,6 +60,8 @@ void LightInitialize(Light* light, const LightOptions& lightOptions)
             light->m_Color = lightOptions.m_Color;
             light->m_Direction = lightOptions.m_Direction;
             light->m_Position = Vec3(0.0f, 0.0f, 0.0f);
+            light->m_RangeProfile = kProfileLinear;
+            light->m_EdgeProfile = kProfileLinear;
             break;
         }
         case LightType::kPoint:
@@ -68,6 +70,8 @@ void LightInitialize(Light* light, const LightOptions& lightOptions)
             light->m_Range = lightOptions.m_Range;
             light->m_Color = lightOptions.m_Color;
             light->m_Position = lightOptions.m_Position;
+            light->m_RangeProfile = kProfileQuadratic;
+            light->m_EdgeProfile = kProfileLinear;
             break;
         }
         case LightType::kConical:
@@ -79,6 +83,8 @@ void LightInitialize(Light* light, const LightOptions& lightOptions)
             light->m_Color = lightOptions.m_Color;
             light->m_Position = lightOptions.m_Position;
             light->m_Direction = lightOptions.m_Direction;
+            light->m_RangeProfile = kProfileLinear;
+            light->m_EdgeProfile = kProfileLinear;
             break;
         }
         case LightType::kCylindrical:
@@ -89,6 +95,8 @@ void LightInitialize(Light* light, const LightOptions& lightOptions)
             light->m_Color = lightOptions.m_Color;
             light->m_Position = lightOptions.m_Position;
             light->m_Direction = lightOptions.m_Direction;
+            light->m_RangeProfile = kProfileLinear;
+            light->m_EdgeProfile = kProfileCylinderEnd;
             break;
         }
         default:
@@ -143,3 +151,29 @@ void LightGenerateObb(Obb* dest, const LightOptions& lightOptions)
     
     *dest = ToolGenerateObbFromVec3(vertices, n);
 }
+
+// LightGetInfluenceRadius
+//
+// Point lights fade out over the distance of a (range, range) offset and conical lights over range
+// along their axis, so q2*range covers both and matches the box LightGenerateObb builds.  Cylinders
+// sweep their orthogonal range along the axis.
+float LightGetInfluenceRadius(const Light& light)
+{
+    const float q2 = 1.41421356237f;
+    switch (light.m_Type)
+    {
+        case LightType::kPoint:
+        case LightType::kConical:
+        {
+            return q2 * light.m_Range;
+        }
+        case LightType::kCylindrical:
+        {
+            return light.m_Range + light.m_OrthogonalRange;
+        }
+        default:
+        {
+            return -1.0f;
+        }
+    }
+}
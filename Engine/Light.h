@@ -14,10 +14,19 @@ enum LightType : uint32_t
     kCylindrical
 };
 
+// Built in attenuation curves, the first rows of the light profile atlas (Render/LightProfiles.h).
+// Each maps 0..1 across a falloff to attenuation.
+enum LightProfile : uint32_t
+{
+    kProfileQuadratic,         // (1-x)^2
+    kProfileLinear,            // 1-x
+    kProfileCylinderEnd,       // 1 until 0.75, then quadratic to 0
+    kProfileSmooth,            // 1-smoothstep(x)
+    kNumBuiltinProfiles
+};
+
 struct Light
 {
-    enum { kMaxLights = 32 };
-    
     LightType m_Type;
     uint32_t m_Index;
     
@@ -27,7 +36,12 @@ struct Light
     Vec4 m_Position;
     Vec4 m_Direction;
     float m_OrthogonalRange;
-    int m_Pad[3];
+    
+    // profile atlas rows.  Range is the falloff with distance, across the beam for cylinders.  Edge is
+    // across the cone, 0 on its axis, or along a cylinder, 0 at its start
+    uint32_t m_RangeProfile;
+    uint32_t m_EdgeProfile;
+    int m_Pad;
 };
 
 struct LightOptions
@@ -93,3 +107,7 @@ struct LightOptions
 void DumpLight(const Light& light);
 void LightInitialize(Light* light, const LightOptions& lightOptions);
 void LightGenerateObb(Obb* dest, const LightOptions& lightOptions);
+
+// conservative world space radius around the light position beyond which the light has no influence.
+// Directional lights return a negative value, meaning unbounded.
+float LightGetInfluenceRadius(const Light& light);
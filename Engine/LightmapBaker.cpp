@@ -0,0 +1,499 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Engine/LightmapBaker.h"
+#include "Engine/Scene.h"
+#include "Render/LightProfiles.h"
+#include "Render/Lightmap.h"
+#include "Render/Material.h"
+#include "Render/Model.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Texture.h"
+#include "Engine/Utils.h"
+
+#include <atomic>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#define kLightmapBakerMaxLights 1024
+#define kLightmapBakerMaxThreads 64
+
+// a static light as the bake evaluates it
+struct LightmapBakerLight
+{
+    Light m_ScreenLight;       // as RenderGetScreenLight uploads it
+    float m_Center[2];         // world xy
+    float m_Radius;
+};
+
+struct LightmapBakerJob
+{
+    Lightmap* m_Lightmap;
+    const LightProfiles* m_LightProfiles;
+    const LightmapBakerLight* m_Lights;
+    int m_NumLights;
+    const uint8_t* m_Occluders;    // one per texel, nonzero where a caster blocks light
+    float m_AspectRatio;
+    
+    // the kLightZ plane is mapped to screen space affinely, the camera never turns
+    float m_ScreenOrigin[2];       // of m_WorldRect's min corner
+    float m_ScreenPerTexelX[2];
+    float m_ScreenPerTexelY[2];
+    
+    std::atomic<int> m_NextRow;
+};
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerHash
+//
+// FNV-1a
+static uint32_t s_LightmapBakerHash(uint32_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    for (size_t i=0; i<size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerIsStatic
+static bool s_LightmapBakerIsStatic(const SceneObject* sceneObject)
+{
+    const uint32_t flags = SceneObject::kEnabled | SceneObject::kStatic;
+    return (sceneObject->m_Flags & flags) == flags;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerIsBakedLight
+//
+// Directional lights are unbounded and shaded with normals, so they stay dynamic.
+static bool s_LightmapBakerIsBakedLight(const SceneObject* sceneObject)
+{
+    return sceneObject->m_Type == SceneObjectType::kLight && sceneObject->m_Light.m_Type != LightType::kDirectional &&
+           s_LightmapBakerIsStatic(sceneObject);
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightmapBakeHash
+uint32_t LightmapBakeHash(const Scene* scene, const RenderContext* renderContext, int casterGroupId, const LightmapBakeOptions& options)
+{
+    uint32_t hash = 2166136261u;
+    hash = s_LightmapBakerHash(hash, &options.m_TexelsPerUnit, sizeof(options.m_TexelsPerUnit));
+    hash = s_LightmapBakerHash(hash, &options.m_MaxSize, sizeof(options.m_MaxSize));
+    hash = s_LightmapBakerHash(hash, &options.m_AlphaThreshold, sizeof(options.m_AlphaThreshold));
+    
+    // screen space falloff scales with the projection and the camera's distance to the light plane
+    const float cameraDist = (Vec3(0.0f, 0.0f, kLightZ).xyz1() * renderContext->m_View).z();
+    hash = s_LightmapBakerHash(hash, &renderContext->m_Projection, sizeof(Mat4));
+    hash = s_LightmapBakerHash(hash, &renderContext->m_Width, sizeof(renderContext->m_Width));
+    hash = s_LightmapBakerHash(hash, &renderContext->m_Height, sizeof(renderContext->m_Height));
+    hash = s_LightmapBakerHash(hash, &cameraDist, sizeof(cameraDist));
+    
+    const LightProfiles* lightProfiles = renderContext->m_LightProfiles;
+    for (int i=0,n=scene->m_NumObjects; i<n; ++i)
+    {
+        const SceneObject* sceneObject = scene->m_SceneObjects[i];
+        if (!s_LightmapBakerIsBakedLight(sceneObject))
+            continue;
+        
+        // field by field, Light has padding and a slot index
+        Light light;
+        SceneLightToWorld(&light, sceneObject);
+        hash = s_LightmapBakerHash(hash, &light.m_Type, sizeof(light.m_Type));
+        hash = s_LightmapBakerHash(hash, &light.m_Range, sizeof(light.m_Range));
+        hash = s_LightmapBakerHash(hash, &light.m_CosAngle, sizeof(light.m_CosAngle));
+        hash = s_LightmapBakerHash(hash, &light.m_Color, sizeof(light.m_Color));
+        hash = s_LightmapBakerHash(hash, &light.m_Position, sizeof(light.m_Position));
+        hash = s_LightmapBakerHash(hash, &light.m_Direction, sizeof(light.m_Direction));
+        hash = s_LightmapBakerHash(hash, &light.m_OrthogonalRange, sizeof(light.m_OrthogonalRange));
+        
+        const uint32_t profiles[2] = { light.m_RangeProfile, light.m_EdgeProfile };
+        for (int j=0; j<2; ++j)
+        {
+            if ((int) profiles[j] < lightProfiles->m_Count)
+                hash = s_LightmapBakerHash(hash, &lightProfiles->m_Curves[profiles[j]*LightProfiles::kSize], LightProfiles::kSize*sizeof(float));
+        }
+    }
+    
+    if (!scene->m_SceneGroupAllocated[casterGroupId])
+        return hash;
+    
+    for (const SceneObject* itr = scene->m_SceneGroups[casterGroupId]; itr; itr = itr->m_Next)
+    {
+        if (!s_LightmapBakerIsStatic(itr) || itr->m_ModelInstance == nullptr)
+            continue;
+        
+        hash = s_LightmapBakerHash(hash, &itr->m_ModelInstance->m_Po, sizeof(Mat4));
+        
+        const ModelClass* modelClass = itr->m_ModelInstance->m_ModelClass;
+        for (int j=0,m=modelClass->m_NumSubsets; j<m; ++j)
+        {
+            const ModelClassSubset& subset = modelClass->m_Subsets[j];
+            hash = s_LightmapBakerHash(hash, subset.m_Vertices, subset.m_NumVertices*sizeof(SimpleVertex));
+            
+            // the image's own hash, taken when it loaded, so an edited file rebakes without a readback
+            const Texture* texture = subset.m_Material ? subset.m_Material->m_Texture : nullptr;
+            if (texture == nullptr)
+                continue;
+            
+            hash = s_LightmapBakerHash(hash, &texture->m_Width, sizeof(texture->m_Width));
+            hash = s_LightmapBakerHash(hash, &texture->m_Height, sizeof(texture->m_Height));
+            hash = s_LightmapBakerHash(hash, &texture->m_ContentHash, sizeof(texture->m_ContentHash));
+        }
+    }
+    
+    return hash;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerRasterizeSubset
+//
+// Sprites are axis aligned quads in their local space, so uv is linear in local x and y.  Every
+// lightmap texel whose center lands on an opaque enough texel of the sprite is marked.
+static void s_LightmapBakerRasterizeSubset(uint8_t* occluders, const Lightmap* lightmap, const Mat4& localToWorld,
+                                           const ModelClassSubset& subset, const uint8_t* pixels, int pixelsWidth, int pixelsHeight,
+                                           uint8_t alphaThreshold)
+{
+    if (subset.m_NumVertices < 3)
+        return;
+    
+    // uv per unit along each axis, from the first vertex and the one furthest from it
+    const SimpleVertex& a = subset.m_Vertices[0];
+    const SimpleVertex* b = &a;
+    float x0 = a.m_Position[0], y0 = a.m_Position[1], x1 = x0, y1 = y0;
+    for (int i=1; i<subset.m_NumVertices; ++i)
+    {
+        const SimpleVertex& v = subset.m_Vertices[i];
+        x0 = Min(x0, v.m_Position[0]);
+        y0 = Min(y0, v.m_Position[1]);
+        x1 = Max(x1, v.m_Position[0]);
+        y1 = Max(y1, v.m_Position[1]);
+        
+        if (fabsf(v.m_Position[0]-a.m_Position[0]) + fabsf(v.m_Position[1]-a.m_Position[1]) >
+            fabsf(b->m_Position[0]-a.m_Position[0]) + fabsf(b->m_Position[1]-a.m_Position[1]))
+            b = &v;
+    }
+    
+    const float dx = b->m_Position[0]-a.m_Position[0];
+    const float dy = b->m_Position[1]-a.m_Position[1];
+    if (fabsf(dx) < 1e-6f || fabsf(dy) < 1e-6f)
+        return;
+    const float dudx = (b->m_Uv[0]-a.m_Uv[0]) / dx;
+    const float dvdy = (b->m_Uv[1]-a.m_Uv[1]) / dy;
+    
+    // world bounds of the quad, in texels
+    const float z = a.m_Position[2];
+    float wx0 = FLT_MAX, wy0 = FLT_MAX, wx1 = -FLT_MAX, wy1 = -FLT_MAX;
+    for (int i=0; i<4; ++i)
+    {
+        const Vec4 corner = Vec4((i & 1) ? x1 : x0, (i & 2) ? y1 : y0, z, 1.0f) * localToWorld;
+        wx0 = Min(wx0, corner.x());
+        wy0 = Min(wy0, corner.y());
+        wx1 = Max(wx1, corner.x());
+        wy1 = Max(wy1, corner.y());
+    }
+    
+    const Vec4& rect = lightmap->m_WorldRect;
+    const float texelsX = lightmap->m_Width / (rect.m_X[2]-rect.m_X[0]);
+    const float texelsY = lightmap->m_Height / (rect.m_X[3]-rect.m_X[1]);
+    const int tx0 = Max((int) floorf((wx0-rect.m_X[0])*texelsX), 0);
+    const int ty0 = Max((int) floorf((wy0-rect.m_X[1])*texelsY), 0);
+    const int tx1 = Min((int) ceilf((wx1-rect.m_X[0])*texelsX), lightmap->m_Width);
+    const int ty1 = Min((int) ceilf((wy1-rect.m_X[1])*texelsY), lightmap->m_Height);
+    
+    const float worldZ = (Vec4(x0, y0, z, 1.0f) * localToWorld).z();
+    Mat4 worldToLocal;
+    MatrixInvert(&worldToLocal, localToWorld);
+    
+    for (int ty=ty0; ty<ty1; ++ty)
+    {
+        const float wy = rect.m_X[1] + (ty+0.5f)/texelsY;
+        for (int tx=tx0; tx<tx1; ++tx)
+        {
+            const float wx = rect.m_X[0] + (tx+0.5f)/texelsX;
+            const Vec4 local = Vec4(wx, wy, worldZ, 1.0f) * worldToLocal;
+            if (local.x() < x0 || local.x() > x1 || local.y() < y0 || local.y() > y1)
+                continue;
+            
+            const float u = a.m_Uv[0] + (local.x()-a.m_Position[0])*dudx;
+            const float v = a.m_Uv[1] + (local.y()-a.m_Position[1])*dvdy;
+            const int px = Min(Max((int) (u*pixelsWidth), 0), pixelsWidth-1);
+            const int py = Min(Max((int) (v*pixelsHeight), 0), pixelsHeight-1);
+            if (pixels[(py*pixelsWidth + px)*4 + 3] >= alphaThreshold)
+                occluders[ty*lightmap->m_Width + tx] = 1;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerBuildOccluders
+//
+// Reads each caster's texture back once, so it has to run on the GL thread.
+static uint8_t* s_LightmapBakerBuildOccluders(const Scene* scene, int casterGroupId, const Lightmap* lightmap, float alphaThreshold)
+{
+    uint8_t* ret = (uint8_t*) calloc(lightmap->m_Width*lightmap->m_Height, 1);
+    if (!scene->m_SceneGroupAllocated[casterGroupId])
+        return ret;
+    
+    const uint8_t threshold = (uint8_t) Min(Max(alphaThreshold*255.0f + 0.5f, 0.0f), 255.0f);
+    uint8_t* pixels = nullptr;
+    size_t pixelsSize = 0;
+    
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    for (const SceneObject* itr = scene->m_SceneGroups[casterGroupId]; itr; itr = itr->m_Next)
+    {
+        if (!s_LightmapBakerIsStatic(itr) || itr->m_ModelInstance == nullptr)
+            continue;
+        
+        const ModelClass* modelClass = itr->m_ModelInstance->m_ModelClass;
+        for (int j=0,m=modelClass->m_NumSubsets; j<m; ++j)
+        {
+            const ModelClassSubset& subset = modelClass->m_Subsets[j];
+            const Texture* texture = subset.m_Material ? subset.m_Material->m_Texture : nullptr;
+            if (texture == nullptr || texture->m_Width <= 0 || texture->m_Height <= 0)
+                continue;
+            
+            const size_t size = (size_t) texture->m_Width*texture->m_Height*4;
+            if (size > pixelsSize)
+            {
+                pixels = (uint8_t*) realloc(pixels, size);
+                pixelsSize = size;
+            }
+            
+            RenderStateBindTexture(0, GL_TEXTURE_2D, texture->m_TextureId);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            
+            s_LightmapBakerRasterizeSubset(ret, lightmap, itr->m_ModelInstance->m_Po, subset, pixels, texture->m_Width, texture->m_Height, threshold);
+        }
+    }
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    
+    free(pixels);
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerAttenuation
+//
+// Mirrors pointLightAttenuation, conicalLightAttenuation and cylindricalLightAttenuation in light.h,
+// so baked and dynamic versions of a light match.
+static float s_LightmapBakerAttenuation(const LightmapBakerJob* job, const Light& light, float sx, float sy)
+{
+    const LightProfiles* lightProfiles = job->m_LightProfiles;
+    const float px = light.m_Position.m_X[0];
+    const float py = light.m_Position.m_X[1];
+    
+    switch (light.m_Type)
+    {
+        case LightType::kPoint:
+        {
+            const float d0 = sqrtf((px-sx)*(px-sx) + (py-sy)*(py-sy));
+            return LightProfilesEvaluate(lightProfiles, light.m_RangeProfile, d0*light.m_Range);
+        }
+        case LightType::kConical:
+        {
+            const float d0 = sqrtf((px-sx)*(px-sx) + (py-sy)*(py-sy));
+            const float directionLength = light.m_Direction.xy().Length();
+            if (d0 <= 0.0f || directionLength <= 0.0f)
+                return 0.0f;
+            
+            const float theta = -((px-sx)*light.m_Direction.m_X[0] + (py-sy)*light.m_Direction.m_X[1]) / (d0*directionLength);
+            if (theta <= light.m_CosAngle)
+                return 0.0f;
+            
+            const float phi = LightProfilesEvaluate(lightProfiles, light.m_EdgeProfile, (1.0f - theta) / (1.0f - light.m_CosAngle));
+            return phi*LightProfilesEvaluate(lightProfiles, light.m_RangeProfile, d0*light.m_Range);
+        }
+        case LightType::kCylindrical:
+        {
+            // m_Direction holds the end, see s_RenderCylindricalLightToScreen
+            const float axisX = light.m_Direction.m_X[0] - px;
+            const float axisY = light.m_Direction.m_X[1] - py;
+            const float nx = axisX*job->m_AspectRatio;
+            const float nn = nx*nx + axisY*axisY;
+            if (nn <= 0.0f)
+                return 0.0f;
+            
+            const float t = ((sx-px)*job->m_AspectRatio*nx + (sy-py)*axisY) / nn;
+            if (t < 0.0f || t > 1.0f)
+                return 0.0f;
+            
+            const float ox = sx - (px + axisX*t);
+            const float oy = sy - (py + axisY*t);
+            const float orthogonalAttenuation = LightProfilesEvaluate(lightProfiles, light.m_RangeProfile, sqrtf(ox*ox + oy*oy)*light.m_OrthogonalRange);
+            return LightProfilesEvaluate(lightProfiles, light.m_EdgeProfile, t)*orthogonalAttenuation;
+        }
+        default:
+            return 0.0f;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerOccluded
+//
+// March from texel (tx, ty) toward the light a texel at a time.  The texel itself and the light's own
+// texel don't count, as a light sitting on a caster still lights around it.
+static bool s_LightmapBakerOccluded(const LightmapBakerJob* job, int tx, int ty, float lx, float ly)
+{
+    const Lightmap* lightmap = job->m_Lightmap;
+    const float dx = lx - (tx+0.5f);
+    const float dy = ly - (ty+0.5f);
+    const int steps = (int) ceilf(Max(fabsf(dx), fabsf(dy)));
+    if (steps < 2)
+        return false;
+    
+    const float stepX = dx / steps;
+    const float stepY = dy / steps;
+    float x = tx+0.5f;
+    float y = ty+0.5f;
+    for (int i=1; i<steps; ++i)
+    {
+        x += stepX;
+        y += stepY;
+        
+        const int cx = (int) x;
+        const int cy = (int) y;
+        if (cx < 0 || cy < 0 || cx >= lightmap->m_Width || cy >= lightmap->m_Height)
+            continue;
+        if (job->m_Occluders[cy*lightmap->m_Width + cx])
+            return true;
+    }
+    
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightmapBakerWorker
+//
+// Takes rows until there are none left.
+static void s_LightmapBakerWorker(LightmapBakerJob* job)
+{
+    Lightmap* lightmap = job->m_Lightmap;
+    const Vec4& rect = lightmap->m_WorldRect;
+    const float unitsX = (rect.m_X[2]-rect.m_X[0]) / lightmap->m_Width;
+    const float unitsY = (rect.m_X[3]-rect.m_X[1]) / lightmap->m_Height;
+    
+    for (int ty = job->m_NextRow++; ty < lightmap->m_Height; ty = job->m_NextRow++)
+    {
+        float* row = &lightmap->m_Texels[ty*lightmap->m_Width*3];
+        const float wy = rect.m_X[1] + (ty+0.5f)*unitsY;
+        
+        for (int tx=0; tx<lightmap->m_Width; ++tx)
+        {
+            const float wx = rect.m_X[0] + (tx+0.5f)*unitsX;
+            const float sx = job->m_ScreenOrigin[0] + (tx+0.5f)*job->m_ScreenPerTexelX[0] + (ty+0.5f)*job->m_ScreenPerTexelY[0];
+            const float sy = job->m_ScreenOrigin[1] + (tx+0.5f)*job->m_ScreenPerTexelX[1] + (ty+0.5f)*job->m_ScreenPerTexelY[1];
+            
+            float color[3] = { 0.0f, 0.0f, 0.0f };
+            for (int i=0; i<job->m_NumLights; ++i)
+            {
+                const LightmapBakerLight& bakerLight = job->m_Lights[i];
+                const float cx = wx - bakerLight.m_Center[0];
+                const float cy = wy - bakerLight.m_Center[1];
+                if (cx*cx + cy*cy > bakerLight.m_Radius*bakerLight.m_Radius)
+                    continue;
+                
+                const Light& light = bakerLight.m_ScreenLight;
+                const float attenuation = s_LightmapBakerAttenuation(job, light, sx, sy);
+                if (attenuation <= 0.0f)
+                    continue;
+                
+                const float lx = (bakerLight.m_Center[0]-rect.m_X[0]) / unitsX;
+                const float ly = (bakerLight.m_Center[1]-rect.m_X[1]) / unitsY;
+                if (s_LightmapBakerOccluded(job, tx, ty, lx, ly))
+                    continue;
+                
+                for (int c=0; c<3; ++c)
+                    color[c] += attenuation*light.m_Color.m_X[c];
+            }
+            
+            memcpy(&row[tx*3], color, sizeof(color));
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightmapBake
+Lightmap* LightmapBake(const Scene* scene, const RenderContext* renderContext, int casterGroupId, const LightmapBakeOptions& options)
+{
+    LightmapBakerLight* lights = (LightmapBakerLight*) malloc(kLightmapBakerMaxLights*sizeof(LightmapBakerLight));
+    int numLights = 0;
+    
+    // the lightmap covers every static light's range
+    Vec4 rect(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i=0,n=scene->m_NumObjects; i<n && numLights<kLightmapBakerMaxLights; ++i)
+    {
+        const SceneObject* sceneObject = scene->m_SceneObjects[i];
+        BSphere bsphere;
+        if (!s_LightmapBakerIsBakedLight(sceneObject) || !SceneLightGetBSphere(&bsphere, sceneObject))
+            continue;
+        
+        LightmapBakerLight* bakerLight = &lights[numLights++];
+        Light worldLight;
+        SceneLightToWorld(&worldLight, sceneObject);
+        RenderGetScreenLight(renderContext, &bakerLight->m_ScreenLight, &worldLight);
+        bakerLight->m_Center[0] = bsphere.x();
+        bakerLight->m_Center[1] = bsphere.y();
+        bakerLight->m_Radius = bsphere.radius();
+        
+        rect = Vec4(Min(rect.x(), bsphere.x()-bsphere.radius()), Min(rect.y(), bsphere.y()-bsphere.radius()),
+                    Max(rect.z(), bsphere.x()+bsphere.radius()), Max(rect.w(), bsphere.y()+bsphere.radius()));
+    }
+    
+    if (numLights == 0)
+    {
+        free(lights);
+        return nullptr;
+    }
+    
+    const float sizeX = rect.z()-rect.x();
+    const float sizeY = rect.w()-rect.y();
+    const float texelsPerUnit = Min(options.m_TexelsPerUnit, options.m_MaxSize / Max(sizeX, sizeY));
+    const int width = Max((int) ceilf(sizeX*texelsPerUnit), 1);
+    const int height = Max((int) ceilf(sizeY*texelsPerUnit), 1);
+    
+    Lightmap* ret = LightmapCreate(rect, width, height, LightmapBakeHash(scene, renderContext, casterGroupId, options));
+    uint8_t* occluders = s_LightmapBakerBuildOccluders(scene, casterGroupId, ret, options.m_AlphaThreshold);
+    
+    LightmapBakerJob job;
+    job.m_Lightmap = ret;
+    job.m_LightProfiles = renderContext->m_LightProfiles;
+    job.m_Lights = lights;
+    job.m_NumLights = numLights;
+    job.m_Occluders = occluders;
+    job.m_AspectRatio = (float) renderContext->m_Width / renderContext->m_Height;
+    job.m_NextRow = 0;
+    
+    const Vec2 s0 = FromZeroOne(RenderGetScreenPos(renderContext, Vec3(rect.x(), rect.y(), kLightZ)).xy());
+    const Vec2 s1 = FromZeroOne(RenderGetScreenPos(renderContext, Vec3(rect.x() + sizeX/width, rect.y(), kLightZ)).xy());
+    const Vec2 s2 = FromZeroOne(RenderGetScreenPos(renderContext, Vec3(rect.x(), rect.y() + sizeY/height, kLightZ)).xy());
+    for (int i=0; i<2; ++i)
+    {
+        job.m_ScreenOrigin[i] = s0.m_X[i];
+        job.m_ScreenPerTexelX[i] = s1.m_X[i] - s0.m_X[i];
+        job.m_ScreenPerTexelY[i] = s2.m_X[i] - s0.m_X[i];
+    }
+    
+    int numThreads = options.m_NumThreads > 0 ? options.m_NumThreads : (int) std::thread::hardware_concurrency();
+    numThreads = Min(Max(numThreads, 1), Min(height, kLightmapBakerMaxThreads));
+    
+    // this thread is the last worker
+    std::thread workers[kLightmapBakerMaxThreads];
+    for (int i=0; i<numThreads-1; ++i)
+        workers[i] = std::thread(s_LightmapBakerWorker, &job);
+    s_LightmapBakerWorker(&job);
+    for (int i=0; i<numThreads-1; ++i)
+        workers[i].join();
+    
+    Printf("LightmapBake: %d lights, %dx%d texels, %d threads\n", numLights, width, height, numThreads);
+    
+    free(occluders);
+    free(lights);
+    
+    LightmapUpload(ret);
+    return ret;
+}
@@ -0,0 +1,39 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include <stdint.h>
+
+struct Lightmap;
+struct RenderContext;
+struct Scene;
+
+// Offline lighting for the SceneObject::kStatic lights.  Every texel of the kLightZ plane under their
+// ranges is lit on the CPU the way light.h lights it, at the current camera's screen scale, and
+// shadowed by marching toward each light through the alpha masks of the kStatic sprites in a caster
+// group.  Texel rows are shared out to worker threads.
+//
+// The result has no direction, like the ambient term: planar normals don't apply to baked light.
+struct LightmapBakeOptions
+{
+    float m_TexelsPerUnit;
+    int m_MaxSize;             // texels on the longer side
+    int m_NumThreads;          // 0 for one per hardware thread
+    float m_AlphaThreshold;    // caster texels at or over this occlude
+    
+    LightmapBakeOptions()
+        : m_TexelsPerUnit(4.0f)
+        , m_MaxSize(1024)
+        , m_NumThreads(0)
+        , m_AlphaThreshold(0.9f)
+    {
+    }
+};
+
+// everything a bake reads: the static lights and casters, the light profiles they use, the camera's
+// screen scale and the options.  Compare against Lightmap::m_Hash to reuse a saved bake; the screen
+// scale changes with the window and projection, so callers check it every frame
+uint32_t  LightmapBakeHash(const Scene* scene, const RenderContext* renderContext, int casterGroupId, const LightmapBakeOptions& options);
+
+// null if no enabled light is static.  Lights must have been through a SceneUpdate
+Lightmap* LightmapBake(const Scene* scene, const RenderContext* renderContext, int casterGroupId, const LightmapBakeOptions& options);
@@ -0,0 +1,334 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Engine/ParticleLights.h"
+#include "Engine/Light.h"
+#include "Engine/Scene.h"
+#include "Render/Render.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define PARTICLE_LIGHTS_SSE 1
+#else
+#define PARTICLE_LIGHTS_SSE 0
+#endif
+
+// -------------------------------------------------------------------------------------------------
+// s_ParticleLightsAllocate
+//
+// Zeroed so the padding lanes past the last particle step through harmless numbers.
+static float* s_ParticleLightsAllocate(int count)
+{
+    return (float*) calloc(count, sizeof(float));
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_ParticleLightsRandom
+//
+// xorshift, 0..1
+static float s_ParticleLightsRandom(ParticleLights* particleLights)
+{
+    uint32_t x = particleLights->m_Random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    particleLights->m_Random = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// -------------------------------------------------------------------------------------------------
+ParticleLights* ParticleLightsCreate(Scene* scene, int capacity)
+{
+    const int padded = (Max(capacity, 1) + 3) & ~3;
+    
+    ParticleLights* ret = new ParticleLights();
+    ret->m_PositionX = s_ParticleLightsAllocate(padded);
+    ret->m_PositionY = s_ParticleLightsAllocate(padded);
+    ret->m_VelocityX = s_ParticleLightsAllocate(padded);
+    ret->m_VelocityY = s_ParticleLightsAllocate(padded);
+    ret->m_Age = s_ParticleLightsAllocate(padded);
+    ret->m_AgeRate = s_ParticleLightsAllocate(padded);
+    ret->m_Range = s_ParticleLightsAllocate(padded);
+    ret->m_ColorR = s_ParticleLightsAllocate(padded);
+    ret->m_ColorG = s_ParticleLightsAllocate(padded);
+    ret->m_ColorB = s_ParticleLightsAllocate(padded);
+    ret->m_Count = 0;
+    ret->m_Capacity = padded;
+    
+    ret->m_EmitterX = nullptr;
+    ret->m_EmitterY = nullptr;
+    ret->m_EmitterRate = nullptr;
+    ret->m_EmitterAccum = nullptr;
+    ret->m_EmitterOptions = nullptr;
+    ret->m_NumEmitters = 0;
+    ret->m_EmitterCapacity = 0;
+    
+    ret->m_Drag = 1.0f;
+    ret->m_Gravity = 0.0f;
+    
+    ret->m_Scene = scene;
+    ret->m_FirstSlot = SceneReserveLights(scene, LightType::kPoint, padded);
+    ret->m_WrittenCount = 0;
+    ret->m_Lights = (Light*) calloc(padded, sizeof(Light));
+    ret->m_Random = 0x2545f491u;
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void ParticleLightsDestroy(ParticleLights* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    SceneReleaseLights(victim->m_Scene, LightType::kPoint, victim->m_FirstSlot, victim->m_Capacity);
+    
+    free(victim->m_PositionX);
+    free(victim->m_PositionY);
+    free(victim->m_VelocityX);
+    free(victim->m_VelocityY);
+    free(victim->m_Age);
+    free(victim->m_AgeRate);
+    free(victim->m_Range);
+    free(victim->m_ColorR);
+    free(victim->m_ColorG);
+    free(victim->m_ColorB);
+    
+    free(victim->m_EmitterX);
+    free(victim->m_EmitterY);
+    free(victim->m_EmitterRate);
+    free(victim->m_EmitterAccum);
+    delete[] victim->m_EmitterOptions;
+    
+    free(victim->m_Lights);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ParticleLightsAddEmitter
+int ParticleLightsAddEmitter(ParticleLights* particleLights, const ParticleLightEmitterOptions& options)
+{
+    if (particleLights->m_NumEmitters == particleLights->m_EmitterCapacity)
+    {
+        const int oldCapacity = particleLights->m_EmitterCapacity;
+        const int capacity = Max(oldCapacity*2, 16);
+        
+        particleLights->m_EmitterX = (float*) realloc(particleLights->m_EmitterX, capacity*sizeof(float));
+        particleLights->m_EmitterY = (float*) realloc(particleLights->m_EmitterY, capacity*sizeof(float));
+        particleLights->m_EmitterRate = (float*) realloc(particleLights->m_EmitterRate, capacity*sizeof(float));
+        particleLights->m_EmitterAccum = (float*) realloc(particleLights->m_EmitterAccum, capacity*sizeof(float));
+        
+        // the padding lanes accumulate nothing
+        const int extra = capacity - oldCapacity;
+        memset(&particleLights->m_EmitterRate[oldCapacity], 0, extra*sizeof(float));
+        memset(&particleLights->m_EmitterAccum[oldCapacity], 0, extra*sizeof(float));
+        
+        ParticleLightEmitterOptions* emitterOptions = new ParticleLightEmitterOptions[capacity];
+        for (int i=0; i<particleLights->m_NumEmitters; ++i)
+            emitterOptions[i] = particleLights->m_EmitterOptions[i];
+        delete[] particleLights->m_EmitterOptions;
+        particleLights->m_EmitterOptions = emitterOptions;
+        
+        particleLights->m_EmitterCapacity = capacity;
+    }
+    
+    const int ret = particleLights->m_NumEmitters++;
+    particleLights->m_EmitterX[ret] = options.m_Position.m_X[0];
+    particleLights->m_EmitterY[ret] = options.m_Position.m_X[1];
+    particleLights->m_EmitterRate[ret] = options.m_Rate;
+    particleLights->m_EmitterAccum[ret] = 0.0f;
+    particleLights->m_EmitterOptions[ret] = options;
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ParticleLightsSetEmitterPosition
+void ParticleLightsSetEmitterPosition(ParticleLights* particleLights, int emitter, const Vec2& position)
+{
+    particleLights->m_EmitterX[emitter] = position.m_X[0];
+    particleLights->m_EmitterY[emitter] = position.m_X[1];
+}
+
+// -------------------------------------------------------------------------------------------------
+// ParticleLightsSetEmitterRate
+void ParticleLightsSetEmitterRate(ParticleLights* particleLights, int emitter, float rate)
+{
+    particleLights->m_EmitterRate[emitter] = rate;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_ParticleLightsStep
+//
+// Drag, gravity, move and age, four particles at a time.  The arrays are padded to a multiple of
+// four so the last group needs no tail.
+static void s_ParticleLightsStep(ParticleLights* particleLights, float deltaTime)
+{
+    const float damping = Max(1.0f - particleLights->m_Drag*deltaTime, 0.0f);
+    const float fall = -particleLights->m_Gravity*deltaTime;
+    
+    float* positionX = particleLights->m_PositionX;
+    float* positionY = particleLights->m_PositionY;
+    float* velocityX = particleLights->m_VelocityX;
+    float* velocityY = particleLights->m_VelocityY;
+    float* age = particleLights->m_Age;
+    const float* ageRate = particleLights->m_AgeRate;
+
+#if PARTICLE_LIGHTS_SSE
+    const __m128 dt = _mm_set1_ps(deltaTime);
+    const __m128 damp = _mm_set1_ps(damping);
+    const __m128 dvy = _mm_set1_ps(fall);
+    for (int i=0,n=particleLights->m_Count; i<n; i+=4)
+    {
+        const __m128 vx = _mm_mul_ps(_mm_loadu_ps(&velocityX[i]), damp);
+        const __m128 vy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&velocityY[i]), damp), dvy);
+        _mm_storeu_ps(&velocityX[i], vx);
+        _mm_storeu_ps(&velocityY[i], vy);
+        _mm_storeu_ps(&positionX[i], _mm_add_ps(_mm_loadu_ps(&positionX[i]), _mm_mul_ps(vx, dt)));
+        _mm_storeu_ps(&positionY[i], _mm_add_ps(_mm_loadu_ps(&positionY[i]), _mm_mul_ps(vy, dt)));
+        _mm_storeu_ps(&age[i], _mm_add_ps(_mm_loadu_ps(&age[i]), _mm_mul_ps(_mm_loadu_ps(&ageRate[i]), dt)));
+    }
+#else
+    for (int i=0,n=particleLights->m_Count; i<n; ++i)
+    {
+        velocityX[i] *= damping;
+        velocityY[i] = velocityY[i]*damping + fall;
+        positionX[i] += velocityX[i]*deltaTime;
+        positionY[i] += velocityY[i]*deltaTime;
+        age[i] += ageRate[i]*deltaTime;
+    }
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_ParticleLightsKill
+//
+// Dead particles are replaced by the last live one, keeping the live ones packed.
+static void s_ParticleLightsKill(ParticleLights* particleLights)
+{
+    float* arrays[] =
+    {
+        particleLights->m_PositionX, particleLights->m_PositionY, particleLights->m_VelocityX, particleLights->m_VelocityY,
+        particleLights->m_Age, particleLights->m_AgeRate, particleLights->m_Range,
+        particleLights->m_ColorR, particleLights->m_ColorG, particleLights->m_ColorB
+    };
+    
+    const float* age = particleLights->m_Age;
+    for (int i=0; i<particleLights->m_Count; )
+    {
+        if (age[i] < 1.0f)
+        {
+            ++i;
+            continue;
+        }
+        
+        const int last = --particleLights->m_Count;
+        for (float* array : arrays)
+            array[i] = array[last];
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_ParticleLightsEmit
+//
+// What each emitter owes accumulates four emitters at a time; only those owing a whole particle
+// are visited after that.
+static void s_ParticleLightsEmit(ParticleLights* particleLights, float deltaTime)
+{
+    float* accum = particleLights->m_EmitterAccum;
+    const float* rate = particleLights->m_EmitterRate;
+    const int numEmitters = particleLights->m_NumEmitters;
+
+#if PARTICLE_LIGHTS_SSE
+    // capacities are multiples of 16 and the padding lanes have no rate
+    const __m128 dt = _mm_set1_ps(deltaTime);
+    for (int i=0; i<numEmitters; i+=4)
+        _mm_storeu_ps(&accum[i], _mm_add_ps(_mm_loadu_ps(&accum[i]), _mm_mul_ps(_mm_loadu_ps(&rate[i]), dt)));
+#else
+    for (int i=0; i<numEmitters; ++i)
+        accum[i] += rate[i]*deltaTime;
+#endif
+
+    for (int i=0; i<numEmitters; ++i)
+    {
+        if (accum[i] < 1.0f)
+            continue;
+        
+        const int owed = (int) accum[i];
+        accum[i] -= owed;
+        
+        const ParticleLightEmitterOptions& options = particleLights->m_EmitterOptions[i];
+        const int count = Min(owed, particleLights->m_Capacity - particleLights->m_Count);
+        for (int j=0; j<count; ++j)
+        {
+            const int p = particleLights->m_Count++;
+            const float angle = s_ParticleLightsRandom(particleLights) * 2.0f * float(M_PI);
+            const float speed = options.m_Speed * (0.5f + 0.5f*s_ParticleLightsRandom(particleLights));
+            
+            particleLights->m_PositionX[p] = particleLights->m_EmitterX[i];
+            particleLights->m_PositionY[p] = particleLights->m_EmitterY[i];
+            particleLights->m_VelocityX[p] = cosf(angle)*speed;
+            particleLights->m_VelocityY[p] = sinf(angle)*speed;
+            particleLights->m_Age[p] = 0.0f;
+            particleLights->m_AgeRate[p] = options.m_Lifetime > 0.0f ? 1.0f / options.m_Lifetime : 1.0e6f;
+            particleLights->m_Range[p] = options.m_Range;
+            particleLights->m_ColorR[p] = options.m_Color.m_X[0];
+            particleLights->m_ColorG[p] = options.m_Color.m_X[1];
+            particleLights->m_ColorB[p] = options.m_Color.m_X[2];
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// ParticleLightsUpdate
+void ParticleLightsUpdate(ParticleLights* particleLights, float deltaTime)
+{
+    s_ParticleLightsStep(particleLights, deltaTime);
+    s_ParticleLightsKill(particleLights);
+    s_ParticleLightsEmit(particleLights, deltaTime);
+}
+
+// -------------------------------------------------------------------------------------------------
+// ParticleLightsClear
+void ParticleLightsClear(ParticleLights* particleLights)
+{
+    particleLights->m_Count = 0;
+    for (int i=0; i<particleLights->m_NumEmitters; ++i)
+        particleLights->m_EmitterAccum[i] = 0.0f;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ParticleLightsWrite
+//
+// Particles fade out in color and range together.  Slots that were live last time and aren't now
+// go black; the ones past that are black already.
+void ParticleLightsWrite(ParticleLights* particleLights)
+{
+    if (particleLights->m_FirstSlot < 0)
+        return;
+    
+    Light* lights = particleLights->m_Lights;
+    const int count = particleLights->m_Count;
+    for (int i=0; i<count; ++i)
+    {
+        const float fade = 1.0f - particleLights->m_Age[i];
+        
+        Light* light = &lights[i];
+        light->m_Type = LightType::kPoint;
+        light->m_Position = Vec4(particleLights->m_PositionX[i], particleLights->m_PositionY[i], kLightZ, 1.0f);
+        light->m_Color = Vec4(particleLights->m_ColorR[i]*fade, particleLights->m_ColorG[i]*fade, particleLights->m_ColorB[i]*fade, 1.0f);
+        light->m_Range = particleLights->m_Range[i]*fade;
+        light->m_RangeProfile = kProfileQuadratic;
+        light->m_EdgeProfile = kProfileLinear;
+    }
+    
+    const int written = Max(count, particleLights->m_WrittenCount);
+    if (written > count)
+        memset(&lights[count], 0, (written-count)*sizeof(Light));
+    
+    SceneSetLights(particleLights->m_Scene, LightType::kPoint, particleLights->m_FirstSlot, lights, written);
+    particleLights->m_WrittenCount = count;
+}
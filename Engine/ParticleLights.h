@@ -0,0 +1,91 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Engine/Matrix.h"
+
+#include <stdint.h>
+
+struct Light;
+struct Scene;
+
+// Short lived unshadowed point lights for sparks, fireflies and muzzle flashes.  Particles aren't
+// scene objects: they live in SoA arrays stepped four at a time, and each live one is written
+// straight into a block of point light slots reserved once from the scene (SceneReserveLights).
+// The block is m_Capacity long, so however many emitters there are, the light buffer and light
+// tiles never see more than that many particle lights and the per frame cost stays fixed.
+//
+// Live particles are packed at the front of the arrays; slots past m_Count upload black, which the
+// light tiles skip.
+struct ParticleLightEmitterOptions
+{
+    Vec2 m_Position;           // world xy, on the kLightZ plane
+    Vec4 m_Color;
+    float m_Rate;              // particles per second, fractions carry over between frames
+    float m_Speed;             // initial speed, in a random direction
+    float m_Lifetime;          // seconds
+    float m_Range;             // light range at birth, shrinking with the color as the particle ages
+    
+    ParticleLightEmitterOptions()
+        : m_Position(0.0f, 0.0f)
+        , m_Color(1.0f, 1.0f, 1.0f, 1.0f)
+        , m_Rate(10.0f)
+        , m_Speed(2.0f)
+        , m_Lifetime(0.5f)
+        , m_Range(2.0f)
+    {
+    }
+};
+
+struct ParticleLights
+{
+    // particles, SoA, m_Capacity rounded up to a multiple of four
+    float* m_PositionX;
+    float* m_PositionY;
+    float* m_VelocityX;
+    float* m_VelocityY;
+    float* m_Age;              // 0 at birth, 1 at death
+    float* m_AgeRate;          // reciprocal lifetime
+    float* m_Range;
+    float* m_ColorR;
+    float* m_ColorG;
+    float* m_ColorB;
+    int m_Count;
+    int m_Capacity;
+    
+    // emitters, SoA
+    float* m_EmitterX;
+    float* m_EmitterY;
+    float* m_EmitterRate;
+    float* m_EmitterAccum;     // particles owed
+    ParticleLightEmitterOptions* m_EmitterOptions;
+    int m_NumEmitters;
+    int m_EmitterCapacity;
+    
+    float m_Drag;              // fraction of velocity lost per second
+    float m_Gravity;           // world units per second squared, along -y
+    
+    Scene* m_Scene;
+    int m_FirstSlot;           // of the reserved point light block
+    int m_WrittenCount;        // live particles in the last SceneSetLights, the rest are black already
+    Light* m_Lights;           // staging for SceneSetLights
+    uint32_t m_Random;
+};
+
+// reserves capacity point light slots from scene
+ParticleLights* ParticleLightsCreate(Scene* scene, int capacity);
+void            ParticleLightsDestroy(ParticleLights* victim);
+
+// returns the emitter's index
+int             ParticleLightsAddEmitter(ParticleLights* particleLights, const ParticleLightEmitterOptions& options);
+void            ParticleLightsSetEmitterPosition(ParticleLights* particleLights, int emitter, const Vec2& position);
+void            ParticleLightsSetEmitterRate(ParticleLights* particleLights, int emitter, float rate);
+
+// age, move and kill the particles, then emit.  Emission past m_Capacity is dropped
+void            ParticleLightsUpdate(ParticleLights* particleLights, float deltaTime);
+
+// kill every particle
+void            ParticleLightsClear(ParticleLights* particleLights);
+
+// write the particles into their light slots, between SceneUpdate and SceneLightsUpdate
+void            ParticleLightsWrite(ParticleLights* particleLights);
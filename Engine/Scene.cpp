@@ -1,13 +1,17 @@
 // -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
 
+#include "slib/Common/Util.h"
 #include "slib/Container/LinkyList.h"
 #include "Engine/Scene.h"
 #include "Render/Render.h"
 #include "Render/Material.h"
 #include "Render/Model.h"
+#include "Render/ShadowReadback.h"
 #include "Tool/Utils.h"
 
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -17,6 +21,9 @@
 // 1d texture dimension
 #define kShadowMapSize 1024
 
+// quadratic falloff averaged over the rectangle around a light's range, pi/24
+#define kMergedLightFalloff 0.13f
+
 struct SortNode
 {
     SceneObject* m_SceneObject;
@@ -26,6 +33,112 @@ struct SortNode
 
 static void SceneObjectApplyDelta(SceneObject* scene, const Mat4& delta);
 
+// -------------------------------------------------------------------------------------------------
+// s_SceneGetLightArray
+static SceneLightArray* s_SceneGetLightArray(Scene* scene, LightType type)
+{
+    switch (type)
+    {
+        case LightType::kPoint:
+            return &scene->m_PointLights;
+        case LightType::kConical:
+            return &scene->m_ConicalLights;
+        case LightType::kCylindrical:
+            return &scene->m_CylindricalLights;
+        case LightType::kDirectional:
+            return &scene->m_DirectionalLights;
+    }
+    
+    return nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightArrayGrow
+static void s_SceneLightArrayGrow(SceneLightArray* lightArray, int count)
+{
+    if (count <= lightArray->m_Capacity)
+        return;
+    
+    while (lightArray->m_Capacity < count)
+        lightArray->m_Capacity = Max(lightArray->m_Capacity*2, 32);
+    lightArray->m_Lights = (Light*) realloc(lightArray->m_Lights, lightArray->m_Capacity*sizeof(Light));
+    lightArray->m_Versions = (uint32_t*) realloc(lightArray->m_Versions, lightArray->m_Capacity*sizeof(uint32_t));
+    lightArray->m_FreeSlots = (int*) realloc(lightArray->m_FreeSlots, lightArray->m_Capacity*sizeof(int));
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightArrayAllocate
+//
+// Hand out a black slot, reusing free ones first.  It's stamped with the next update's version so
+// it gets uploaded whatever is written to it.
+static int s_SceneLightArrayAllocate(SceneLightArray* lightArray, uint32_t version)
+{
+    int slot;
+    if (lightArray->m_NumFreeSlots > 0)
+    {
+        slot = lightArray->m_FreeSlots[--lightArray->m_NumFreeSlots];
+    }
+    else
+    {
+        s_SceneLightArrayGrow(lightArray, lightArray->m_Count+1);
+        slot = lightArray->m_Count++;
+    }
+    
+    memset(&lightArray->m_Lights[slot], 0, sizeof(Light));
+    lightArray->m_Versions[slot] = version;
+    return slot;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightArrayFree
+static void s_SceneLightArrayFree(SceneLightArray* lightArray, int slot, uint32_t version)
+{
+    memset(&lightArray->m_Lights[slot], 0, sizeof(Light));
+    lightArray->m_Versions[slot] = version;
+    lightArray->m_FreeSlots[lightArray->m_NumFreeSlots++] = slot;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightArraySet
+//
+// Light data is edited in place from all over (the debug ui writes color and range straight into
+// SceneObject::m_Light), so changes are found by comparing against last frame's copy.
+static void s_SceneLightArraySet(SceneLightArray* lightArray, int slot, const Light& light, uint32_t version)
+{
+    Light* dest = &lightArray->m_Lights[slot];
+    if (memcmp(dest, &light, sizeof(Light)) != 0)
+    {
+        *dest = light;
+        lightArray->m_Versions[slot] = version;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightArrayReserve
+//
+// count black slots in a row, always off the end so they stay contiguous.
+static int s_SceneLightArrayReserve(SceneLightArray* lightArray, int count, uint32_t version)
+{
+    s_SceneLightArrayGrow(lightArray, lightArray->m_Count+count);
+    
+    const int first = lightArray->m_Count;
+    memset(&lightArray->m_Lights[first], 0, count*sizeof(Light));
+    for (int i=0; i<count; ++i)
+        lightArray->m_Versions[first+i] = version;
+    
+    lightArray->m_Count += count;
+    return first;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightArrayDestroy
+static void s_SceneLightArrayDestroy(SceneLightArray* lightArray)
+{
+    free(lightArray->m_Lights);
+    free(lightArray->m_Versions);
+    free(lightArray->m_FreeSlots);
+}
+
 void SceneCreate(Scene* scene, int maxSceneObjects)
 {
     scene->m_NumObjects = 0;
@@ -35,6 +148,23 @@ void SceneCreate(Scene* scene, int maxSceneObjects)
     memset(scene->m_SceneGroups, 0, sizeof scene->m_SceneGroups);
     memset(scene->m_SceneGroupAllocated, 0, sizeof scene->m_SceneGroupAllocated);
     scene->m_SortArray = malloc(Scene::kMaxSubsets*sizeof(SortNode));
+    
+    memset(&scene->m_PointLights, 0, sizeof scene->m_PointLights);
+    memset(&scene->m_ConicalLights, 0, sizeof scene->m_ConicalLights);
+    memset(&scene->m_CylindricalLights, 0, sizeof scene->m_CylindricalLights);
+    memset(&scene->m_DirectionalLights, 0, sizeof scene->m_DirectionalLights);
+    scene->m_LightVersion = 1;
+    
+    scene->m_VisibleLights = (SceneObject**) malloc(maxSceneObjects*sizeof(SceneObject*));
+    scene->m_NumVisibleLights = 0;
+    
+    scene->m_LightBudget.m_ShadowMs = 4.0f;
+    scene->m_LightBudget.m_LightingMs = 2.0f;
+    scene->m_LightBudget.m_ShadowCostMs = 0.25f;
+    scene->m_LightBudget.m_LightingCostMs = 0.01f;
+    scene->m_AmbientLight = Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    scene->m_NumAmbientLights = 0;
+    scene->m_StaticLightsBaked = false;
 }
 
 void SceneDestroy(Scene* scene)
@@ -45,19 +175,160 @@ void SceneDestroy(Scene* scene)
         scene->m_SceneObjects[i] = nullptr;
     }
     delete[] scene->m_SceneObjects;
+    
+    s_SceneLightArrayDestroy(&scene->m_PointLights);
+    s_SceneLightArrayDestroy(&scene->m_ConicalLights);
+    s_SceneLightArrayDestroy(&scene->m_CylindricalLights);
+    s_SceneLightArrayDestroy(&scene->m_DirectionalLights);
+    
+    free(scene->m_VisibleLights);
+    scene->m_VisibleLights = nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneLightCoverage
+//
+// Share of the screen covered by the rectangle around a light's range, 0 if it misses the screen.
+// Directional lights are everywhere.
+static float s_SceneLightCoverage(const RenderContext* renderContext, const SceneObject* lightObject)
+{
+    if (renderContext == nullptr)
+        return 1.0f;
+    
+    Vec4 rect;
+    if (!SceneLightGetScreenRect(&rect, renderContext, lightObject))
+        return 1.0f;
+    
+    const float width = Min(rect.m_X[2], 1.0f) - Max(rect.m_X[0], 0.0f);
+    const float height = Min(rect.m_X[3], 1.0f) - Max(rect.m_X[1], 0.0f);
+    if (width <= 0.0f || height <= 0.0f)
+        return 0.0f;
+    
+    return width*height;
 }
 
 // -------------------------------------------------------------------------------------------------
-void SceneUpdate(Scene* scene)
+// s_SceneLightImportance
+static float s_SceneLightImportance(const RenderContext* renderContext, const SceneObject* lightObject, float coverage)
 {
-    // reset light count
-    scene->m_NumPointLights = 0;
-    scene->m_NumConicalLights = 0;
-    scene->m_NumCylindricalLights = 0;
-    scene->m_NumDirectionalLights = 0;
+    const Light& light = lightObject->m_Light;
+    const float intensity = 0.2126f*light.m_Color.m_X[0] + 0.7152f*light.m_Color.m_X[1] + 0.0722f*light.m_Color.m_X[2];
+    
+    float proximity = 1.0f;
+    if (renderContext != nullptr)
+    {
+        const Vec3 delta = lightObject->m_LocalToWorld.GetTranslation() - renderContext->m_Camera.GetTranslation();
+        proximity = 1.0f / (1.0f + delta.Length());
+    }
+    
+    return coverage*intensity*proximity;
+}
+
+// -------------------------------------------------------------------------------------------------
+// SceneLightToWorld
+void SceneLightToWorld(Light* dest, const SceneObject* sceneObject)
+{
+    const Light* light = &sceneObject->m_Light;
+    *dest = *light;
+    
+    // transform position
+    if (light->m_Type != LightType::kDirectional)
+        dest->m_Position = sceneObject->m_LocalToWorld.GetTranslation();
+    
+    if (light->m_Type == LightType::kConical)
+    {
+        // jiv fixme: it's in world space, shouldn't be
+        dest->m_Direction = sceneObject->m_LocalToWorld.GetUp();
+    }
+    
+    if (light->m_Type == LightType::kCylindrical)
+    {
+        // transform direction
+        dest->m_Direction = light->m_Direction.xyz0() * sceneObject->m_LocalToWorld;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_SceneRankLights
+//
+// Sort the lights in view by importance and hand out the budget.  Directional lights are always lit
+// and don't count against it.
+static void s_SceneRankLights(Scene* scene, const RenderContext* renderContext)
+{
+    auto cmp = [](const void* _ap, const void* _bp)
+    {
+        const SceneObject* a = *(const SceneObject**)_ap;
+        const SceneObject* b = *(const SceneObject**)_bp;
+        
+        if (a->m_Importance > b->m_Importance)
+            return -1;
+        else if (a->m_Importance < b->m_Importance)
+            return 1;
+        
+        // steady order between equals so tiers don't flicker
+        return a->m_SceneIndex - b->m_SceneIndex;
+    };
+    
+    qsort(scene->m_VisibleLights, scene->m_NumVisibleLights, sizeof(SceneObject*), cmp);
+    
+    int numShadowed = INT_MAX;
+    int numLit = INT_MAX;
+    if (renderContext != nullptr)
+    {
+        const SceneLightBudget& budget = scene->m_LightBudget;
+        numShadowed = budget.m_ShadowCostMs > 0.0f ? (int) (budget.m_ShadowMs / budget.m_ShadowCostMs) : 0;
+        numLit = budget.m_LightingCostMs > 0.0f ? (int) (budget.m_LightingMs / budget.m_LightingCostMs) : 0;
+    }
+    
+    scene->m_AmbientLight = Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    scene->m_NumAmbientLights = 0;
+    
+    int rank = 0;
+    int write = 0;
+    for (int i=0,n=scene->m_NumVisibleLights; i<n; ++i)
+    {
+        SceneObject* lightObject = scene->m_VisibleLights[i];
+        if (lightObject->m_Light.m_Type == LightType::kDirectional)
+        {
+            lightObject->m_Flags |= SceneObject::kVisible;
+            scene->m_VisibleLights[write++] = lightObject;
+            continue;
+        }
+        
+        if (rank < numShadowed)
+        {
+            lightObject->m_Flags |= SceneObject::kVisible|SceneObject::kShadowed;
+            scene->m_VisibleLights[write++] = lightObject;
+        }
+        else if (rank - numShadowed < numLit)
+        {
+            lightObject->m_Flags |= SceneObject::kVisible;
+            scene->m_VisibleLights[write++] = lightObject;
+        }
+        else
+        {
+            // spread over the screen by the share it covers, at the quadratic falloff's average over
+            // the rectangle around its range
+            const float coverage = s_SceneLightCoverage(renderContext, lightObject);
+            scene->m_AmbientLight += lightObject->m_Light.m_Color * (coverage*kMergedLightFalloff);
+            scene->m_NumAmbientLights++;
+        }
+        ++rank;
+    }
+    scene->m_NumVisibleLights = write;
+}
+
+// -------------------------------------------------------------------------------------------------
+void SceneUpdate(Scene* scene, const RenderContext* renderContext)
+{
+    // lights that differ from last frame's copy get this version
+    const uint32_t lightVersion = ++scene->m_LightVersion;
     
     SortNode* sortNodes = (SortNode*) scene->m_SortArray;
     scene->m_SortIndex = 0;
+    scene->m_NumVisibleLights = 0;
+    
+    // culled and given an importance here, ranked once they all have one
     
     for (int i=0,n=scene->m_NumObjects; i<n; ++i)
     {
@@ -101,61 +372,39 @@ void SceneUpdate(Scene* scene)
         
         if (sceneObject->m_Type == SceneObjectType::kLight)
         {
-            const Light* light = &sceneObject->m_Light;
-            if ((sceneObject->m_Flags & SceneObject::kEnabled) == 0)
-                continue;
+            sceneObject->m_Flags &= ~(SceneObject::kVisible|SceneObject::kShadowed);
+            sceneObject->m_Importance = 0.0f;
             
-            if (light->m_Type == LightType::kPoint)
-            {
-                if (scene->m_NumPointLights == Light::kMaxLights)
-                    continue;
-                
-                Light* dest = &scene->m_PointLights[scene->m_NumPointLights++];
-                *dest = *light;
-                
-                // transform position
-                dest->m_Position = sceneObject->m_LocalToWorld.GetTranslation();
-            }
+            // baked lights are in the lightmap already
+            const bool baked = scene->m_StaticLightsBaked && (sceneObject->m_Flags & SceneObject::kStatic);
             
-            if (light->m_Type == LightType::kConical)
+            const float coverage = s_SceneLightCoverage(renderContext, sceneObject);
+            if ((sceneObject->m_Flags & SceneObject::kEnabled) && !baked && coverage > 0.0f)
             {
-                if (scene->m_NumConicalLights == Light::kMaxLights)
-                    continue;
-                
-                Light* dest = &scene->m_ConicalLights[scene->m_NumConicalLights++];
-                *dest = *light;
-                
-                // transform position
-                dest->m_Position = sceneObject->m_LocalToWorld.GetTranslation();
-                
-                // jiv fixme: it's in world space, shouldn't be
-                dest->m_Direction = sceneObject->m_LocalToWorld.GetUp();
-            }
-            
-            if (light->m_Type == LightType::kCylindrical)
-            {
-                if (scene->m_NumCylindricalLights == Light::kMaxLights)
-                    continue;
-                
-                Light* dest = &scene->m_CylindricalLights[scene->m_NumCylindricalLights++];
-                *dest = *light;
-                
-                // transform position and direction
-                dest->m_Position = sceneObject->m_LocalToWorld.GetTranslation();
-                dest->m_Direction = light->m_Direction.xyz0() * sceneObject->m_LocalToWorld;
-            }
-            
-            if (light->m_Type == LightType::kDirectional)
-            {
-                if (scene->m_NumDirectionalLights == Light::kMaxLights)
-                    continue;
-                
-                Light* dest = &scene->m_DirectionalLights[scene->m_NumDirectionalLights++];
-                *dest = *light;
+                const bool directional = sceneObject->m_Light.m_Type == LightType::kDirectional;
+                sceneObject->m_Importance = directional ? FLT_MAX : s_SceneLightImportance(renderContext, sceneObject, coverage);
+                scene->m_VisibleLights[scene->m_NumVisibleLights++] = sceneObject;
             }
         }
     }
     
+    s_SceneRankLights(scene, renderContext);
+    
+    // lights that aren't lit per pixel keep their slot, black
+    for (int i=0,n=scene->m_NumObjects; i<n; ++i)
+    {
+        const SceneObject* sceneObject = scene->m_SceneObjects[i];
+        if (sceneObject->m_Type != SceneObjectType::kLight)
+            continue;
+        
+        Light dest;
+        SceneLightToWorld(&dest, sceneObject);
+        if ((sceneObject->m_Flags & SceneObject::kVisible) == 0)
+            dest.m_Color = Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+        
+        s_SceneLightArraySet(s_SceneGetLightArray(scene, dest.m_Type), sceneObject->m_LightSlot, dest, lightVersion);
+    }
+    
     auto cmp = [](const void* _ap, const void* _bp)
     {
         const SortNode* a = (SortNode*)_ap;
@@ -199,6 +448,8 @@ static SceneObject* SceneObjectAllocate(Scene* scene, SceneObjectType type)
     {
         sceneObject->m_Type = type;
         sceneObject->m_SceneIndex = sceneIndex;
+        sceneObject->m_LightSlot = -1;
+        sceneObject->m_Importance = 0.0f;
         sceneObject->m_Flags = SceneObject::kEnabled;
         sceneObject->m_DebugName = nullptr;
         sceneObject->m_Next = nullptr;
@@ -209,6 +460,7 @@ static SceneObject* SceneObjectAllocate(Scene* scene, SceneObjectType type)
         sceneObject->m_SiblingNext = nullptr;
         
         sceneObject->m_Shadow1dMap = nullptr;
+        sceneObject->m_ShadowReadback = nullptr;
         
         MatrixMakeIdentity(&sceneObject->m_PrevLocalToWorld);
         MatrixMakeIdentity(&sceneObject->m_LocalToWorld);
@@ -239,6 +491,7 @@ SceneObject* SceneCreateLight(Scene* scene, const LightOptions& lightOptions)
     {
         sceneObject->m_ModelInstance = nullptr;
         LightInitialize(&sceneObject->m_Light, lightOptions);
+        sceneObject->m_LightSlot = s_SceneLightArrayAllocate(s_SceneGetLightArray(scene, lightOptions.m_Type), scene->m_LightVersion+1);
         
         assert(lightOptions.m_Position.m_X[1] < 10000.0f);
         
@@ -246,6 +499,7 @@ SceneObject* SceneCreateLight(Scene* scene, const LightOptions& lightOptions)
         
         // jiv fixme: make some lights not drive shadows
         sceneObject->m_Shadow1dMap = TextureCreateRenderTexture(kShadowMapSize, 1, 0, Texture::RenderTextureFormat::kFloat);
+        sceneObject->m_ShadowReadback = ShadowReadbackCreate(kShadowMapSize);
         
         LightGenerateObb(&sceneObject->m_Obb, lightOptions);
     }
@@ -299,11 +553,50 @@ SceneObject* SceneCreateCube(Scene* scene, RenderContext* renderContext, Materia
 
 void SceneLightsUpdate(Scene* scene, RenderContext* renderContext)
 {
-    // update point lights
-    RenderUpdatePointLights(renderContext, scene->m_PointLights, scene->m_NumPointLights);
-    RenderUpdateConicalLights(renderContext, scene->m_ConicalLights, scene->m_NumConicalLights);
-    RenderUpdateCylindricalLights(renderContext, scene->m_CylindricalLights, scene->m_NumCylindricalLights);
-    RenderUpdateDirectionalLights(renderContext, scene->m_DirectionalLights, scene->m_NumDirectionalLights);
+    RenderBeginLightUpdate(renderContext, scene->m_PointLights.m_Count, scene->m_ConicalLights.m_Count,
+                           scene->m_CylindricalLights.m_Count, scene->m_DirectionalLights.m_Count);
+    
+    const SceneLightArray* pointLights = &scene->m_PointLights;
+    const SceneLightArray* conicalLights = &scene->m_ConicalLights;
+    const SceneLightArray* cylindricalLights = &scene->m_CylindricalLights;
+    const SceneLightArray* directionalLights = &scene->m_DirectionalLights;
+    const uint32_t version = scene->m_LightVersion;
+    
+    RenderUpdatePointLights(renderContext, pointLights->m_Lights, pointLights->m_Versions, pointLights->m_Count, version);
+    RenderUpdateConicalLights(renderContext, conicalLights->m_Lights, conicalLights->m_Versions, conicalLights->m_Count, version);
+    RenderUpdateCylindricalLights(renderContext, cylindricalLights->m_Lights, cylindricalLights->m_Versions, cylindricalLights->m_Count, version);
+    RenderUpdateDirectionalLights(renderContext, directionalLights->m_Lights, directionalLights->m_Versions, directionalLights->m_Count, version);
+    RenderEndLightUpdate(renderContext);
+    RenderUpdateLightTiles(renderContext);
+    RenderSetAmbientLight(renderContext, scene->m_AmbientLight);
+}
+
+// -------------------------------------------------------------------------------------------------
+// SceneReserveLights
+int SceneReserveLights(Scene* scene, LightType type, int count)
+{
+    if (count <= 0)
+        return -1;
+    
+    return s_SceneLightArrayReserve(s_SceneGetLightArray(scene, type), count, scene->m_LightVersion+1);
+}
+
+// -------------------------------------------------------------------------------------------------
+// SceneReleaseLights
+void SceneReleaseLights(Scene* scene, LightType type, int first, int count)
+{
+    SceneLightArray* lightArray = s_SceneGetLightArray(scene, type);
+    for (int i=0; i<count; ++i)
+        s_SceneLightArrayFree(lightArray, first+i, scene->m_LightVersion+1);
+}
+
+// -------------------------------------------------------------------------------------------------
+// SceneSetLights
+void SceneSetLights(Scene* scene, LightType type, int first, const Light* lights, int count)
+{
+    SceneLightArray* lightArray = s_SceneGetLightArray(scene, type);
+    for (int i=0; i<count; ++i)
+        s_SceneLightArraySet(lightArray, first+i, lights[i], scene->m_LightVersion);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -401,6 +694,38 @@ void SceneGroupRemove(Scene* scene, int index, SceneObject* sceneObject)
         LinkyListRemove(scene->m_SceneGroups[index], sceneObject);
 }
 
+// SceneGroupIntersects
+//
+// Broadphase for shadow casting.  Each subset's bounding sphere is taken to world space, scaled by the
+// largest axis so non-uniform sprite scales stay conservative.
+bool SceneGroupIntersects(const Scene* scene, int groupId, const BSphere& bsphere)
+{
+    if (!scene->m_SceneGroupAllocated[groupId])
+        return false;
+    
+    for (const SceneObject* itr = scene->m_SceneGroups[groupId]; itr; itr = itr->m_Next)
+    {
+        if ((itr->m_Flags & SceneObject::kEnabled) == 0 || itr->m_ModelInstance == nullptr)
+            continue;
+        
+        const Mat4& localToWorld = itr->m_ModelInstance->m_Po;
+        const float scale = sqrtf(Max(Max(localToWorld.GetRight().LengthSquared(), localToWorld.GetUp().LengthSquared()),
+                                      localToWorld.GetForward().LengthSquared()));
+        
+        const ModelClass* modelClass = itr->m_ModelInstance->m_ModelClass;
+        for (int j=0,m=modelClass->m_NumSubsets; j<m; ++j)
+        {
+            const BSphere& local = modelClass->m_Subsets[j].m_BSphere;
+            Vec4 center = Vec4(local.x(), local.y(), local.z(), 1.0f) * localToWorld;
+            
+            if (BSphere(center.asFloat(), local.radius()*scale).IntersectsXy(bsphere))
+                return true;
+        }
+    }
+    
+    return false;
+}
+
 void SceneGroupAddChild(SceneObject* parent, SceneObject* child)
 {
     if (child->m_Parent != nullptr)
@@ -485,6 +810,23 @@ void SceneObjectDestroy(Scene* scene, SceneObject* sceneObject)
         for (int i=0; i<Scene::kGroupMax; ++i)
             SceneGroupRemove(scene, i, sceneObject);
         
+        if (sceneObject->m_Type == SceneObjectType::kLight)
+        {
+            s_SceneLightArrayFree(s_SceneGetLightArray(scene, sceneObject->m_Light.m_Type), sceneObject->m_LightSlot, scene->m_LightVersion+1);
+            sceneObject->m_LightSlot = -1;
+            
+            // until the next SceneUpdate rebuilds it
+            for (int i=0; i<scene->m_NumVisibleLights; ++i)
+            {
+                if (scene->m_VisibleLights[i] == sceneObject)
+                {
+                    memmove(&scene->m_VisibleLights[i], &scene->m_VisibleLights[i+1], (scene->m_NumVisibleLights-i-1)*sizeof(SceneObject*));
+                    scene->m_NumVisibleLights--;
+                    break;
+                }
+            }
+        }
+        
         scene->m_SceneObjects[sceneObject->m_SceneIndex] = scene->m_SceneObjects[--scene->m_NumObjects];
         scene->m_SceneObjects[sceneObject->m_SceneIndex]->m_SceneIndex = sceneObject->m_SceneIndex;
         scene->m_SceneObjects[scene->m_NumObjects] = nullptr;
@@ -492,6 +834,9 @@ void SceneObjectDestroy(Scene* scene, SceneObject* sceneObject)
         TextureDestroy(sceneObject->m_Shadow1dMap);
         sceneObject->m_Shadow1dMap = nullptr;
         
+        ShadowReadbackDestroy(sceneObject->m_ShadowReadback);
+        sceneObject->m_ShadowReadback = nullptr;
+        
 #ifndef NDEBUG
         memset(sceneObject, 0xff, sizeof *sceneObject);
 #endif
@@ -507,6 +852,78 @@ SceneObject* SceneCreateEmpty(Scene* scene)
     return sceneObject;
 }
 
+// SceneLightGetBSphere
+bool SceneLightGetBSphere(BSphere* dest, const SceneObject* lightObject)
+{
+    if (lightObject->m_Type != SceneObjectType::kLight)
+        return false;
+    
+    const float radius = LightGetInfluenceRadius(lightObject->m_Light);
+    if (radius < 0.0f)
+        return false;
+    
+    Vec3 center = lightObject->m_LocalToWorld.GetTranslation();
+    *dest = BSphere(center.asFloat(), radius);
+    return true;
+}
+
+// SceneLightGetScreenRect
+bool SceneLightGetScreenRect(Vec4* dest, const RenderContext* renderContext, const SceneObject* lightObject)
+{
+    BSphere bsphere;
+    if (!SceneLightGetBSphere(&bsphere, lightObject))
+        return false;
+    
+    const float r = bsphere.radius();
+    const Vec3 center(bsphere.x(), bsphere.y(), bsphere.z());
+    const Vec2 s0 = RenderGetScreenPos(renderContext, center - Vec3(r, r, 0.0f)).xy();
+    const Vec2 s1 = RenderGetScreenPos(renderContext, center + Vec3(r, r, 0.0f)).xy();
+    
+    *dest = Vec4(Min(s0.m_X[0], s1.m_X[0]), Min(s0.m_X[1], s1.m_X[1]), Max(s0.m_X[0], s1.m_X[0]), Max(s0.m_X[1], s1.m_X[1]));
+    return true;
+}
+
+// SceneQueryLightVisibility
+void SceneQueryLightVisibility(const Scene* scene, LightVisibilityQuery* queries, int numQueries)
+{
+    for (int i=0; i<numQueries; ++i)
+    {
+        LightVisibilityQuery* query = &queries[i];
+        const SceneObject* lightObject = query->m_Light;
+        query->m_Lit = false;
+        
+        if (lightObject->m_Type != SceneObjectType::kLight || (lightObject->m_Flags & SceneObject::kEnabled) == 0)
+            continue;
+        
+        const Light& light = lightObject->m_Light;
+        if (light.m_Type == LightType::kDirectional)
+        {
+            query->m_Lit = true;
+            continue;
+        }
+        
+        BSphere bsphere;
+        SceneLightGetBSphere(&bsphere, lightObject);
+        
+        const Vec3 lightPos = lightObject->m_LocalToWorld.GetTranslation();
+        const Vec2 delta = query->m_Position.xy() - lightPos.xy();
+        if (delta.Length() > bsphere.radius())
+            continue;
+        
+        // same cone test Planar.fsh does
+        if (light.m_Type == LightType::kConical)
+        {
+            const Vec2 direction = lightObject->m_LocalToWorld.GetUp().xy().Normalized();
+            if (VectorDot(delta.Normalized(), direction) <= light.m_CosAngle)
+                continue;
+        }
+        
+        // lights out of view or past the budget skipped their shadow passes, so their maps are stale
+        ShadowReadbackRequest(lightObject->m_ShadowReadback);
+        query->m_Lit = (lightObject->m_Flags & SceneObject::kVisible) == 0 || !ShadowReadbackIsOccluded(lightObject->m_ShadowReadback, query->m_Position);
+    }
+}
+
 // SceneGetSceneObjectsByType
 int SceneGetSceneObjectsByType(SceneObject** dest, int size, Scene* scene, SceneObjectType type)
 {
@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #include "slib/Container/FixedVector.h"
+#include "Engine/BSphere.h"
 #include "Engine/Matrix.h"
 #include "Engine/Obb.h"
 #include "Engine/Light.h"
@@ -15,6 +16,7 @@ struct Material;
 struct SpriteOptions;
 struct LightOptions;
 struct Texture;
+struct ShadowReadback;
 
 enum SceneObjectType : uint32_t
 {
@@ -24,13 +26,39 @@ enum SceneObjectType : uint32_t
     kEmpty
 };
 
+// World space copies of one type of light.  A light keeps its slot for its lifetime so that lights
+// which don't change don't get uploaded; disabled lights and free slots hold a black light.
+struct SceneLightArray
+{
+    Light* m_Lights;
+    uint32_t* m_Versions;      // Scene::m_LightVersion the slot last changed in
+    int* m_FreeSlots;
+    int m_NumFreeSlots;
+    int m_Count;               // slots handed out, free ones included
+    int m_Capacity;
+};
+
+// Per frame light budget, in milliseconds of frame time, and what one light is estimated to cost at
+// each tier.  SceneUpdate turns it into how many of the most important lights in view get shadows and
+// how many more get per pixel lighting.
+struct SceneLightBudget
+{
+    float m_ShadowMs;
+    float m_LightingMs;
+    float m_ShadowCostMs;      // one light's shadow passes
+    float m_LightingCostMs;    // one light's share of the per pixel lighting
+};
+
 struct SceneObject
 {
     enum Flags : uint32_t
     {
         kDirty = 1,
         kUpdatedOnce = 2,
-        kEnabled = 4
+        kEnabled = 4,
+        kVisible = 8,          // lights: lit per pixel this frame, see SceneUpdate
+        kShadowed = 16,        // lights: also within the shadow budget
+        kStatic = 32           // never moves or changes, so it can be baked, see Engine/LightmapBaker.h
     };
     Mat4 m_PrevLocalToWorld;
     Mat4 m_LocalToWorld;
@@ -38,9 +66,12 @@ struct SceneObject
     Obb m_Obb;
     Light m_Light;
     Texture* m_Shadow1dMap;
+    ShadowReadback* m_ShadowReadback;
     uint32_t m_Flags;
     const char* m_DebugName;
     int m_SceneIndex;
+    int m_LightSlot;
+    float m_Importance;        // lights: as of the last SceneUpdate, 0 when out of view
     SceneObjectType m_Type;
     
     SceneObject* m_Parent;
@@ -66,22 +97,42 @@ struct Scene
     SceneObject* m_SceneGroups[kGroupMax];
     bool m_SceneGroupAllocated[kGroupMax];
     
-    Light m_PointLights[Light::kMaxLights];
-    int m_NumPointLights;
+    SceneLightArray m_PointLights;
+    SceneLightArray m_ConicalLights;
+    SceneLightArray m_CylindricalLights;
+    SceneLightArray m_DirectionalLights;
+    uint32_t m_LightVersion;   // bumped by each SceneUpdate
     
-    Light m_ConicalLights[Light::kMaxLights];
-    int m_NumConicalLights;
+    // the kVisible lights, most important first; the kShadowed ones lead
+    SceneObject** m_VisibleLights;
+    int m_NumVisibleLights;
     
-    Light m_CylindricalLights[Light::kMaxLights];
-    int m_NumCylindricalLights;
+    SceneLightBudget m_LightBudget;
     
-    Light m_DirectionalLights[Light::kMaxLights];
-    int m_NumDirectionalLights;
+    // the lights in view past the budget, folded into one unshadowed term
+    Vec4 m_AmbientLight;
+    int m_NumAmbientLights;
+    
+    // kStatic lights are in a lightmap, so SceneUpdate leaves them out like disabled ones
+    bool m_StaticLightsBaked;
+};
+
+// one "can this light see this point" question for SceneQueryLightVisibility
+struct LightVisibilityQuery
+{
+    const SceneObject* m_Light;
+    Vec3 m_Position;
+    bool m_Lit;
 };
 
 void         SceneCreate(Scene* scene, int maxSceneObjects);
 void         SceneDestroy(Scene* scene);
-void         SceneUpdate(Scene* scene);
+// Culls and ranks lights against renderContext's view, if there is one.  A light's importance is its
+// screen coverage times its intensity times its proximity to the camera.  In that order and within
+// m_LightBudget, lights get shadows and lighting, then lighting only; the rest are merged into
+// m_AmbientLight.  Lights that aren't lit per pixel upload black like disabled ones and are left out
+// of m_VisibleLights.  Without a view every enabled light is lit and none are budgeted.
+void         SceneUpdate(Scene* scene, const RenderContext* renderContext = nullptr);
 void         SceneDraw(Scene* scene, RenderContext* renderContext);
 void         SceneDraw(Scene* scene, RenderContext* renderContext, int groupId);
 
@@ -90,11 +141,21 @@ void         SceneDrawObb(Scene* scene, RenderContext* renderContext, const Scen
 
 void         SceneLightsUpdate(Scene* scene, RenderContext* renderContext);
 
+// Light slots for lights that aren't scene objects, such as Engine/ParticleLights.h.  Reserved slots
+// are contiguous and black until set, and SceneUpdate leaves them alone.  Set them between SceneUpdate
+// and SceneLightsUpdate; only lights that changed are uploaded.  Returns the first slot, or -1.
+int          SceneReserveLights(Scene* scene, LightType type, int count);
+void         SceneReleaseLights(Scene* scene, LightType type, int first, int count);
+void         SceneSetLights(Scene* scene, LightType type, int first, const Light* lights, int count);
+
 int          SceneGroupCreate(Scene* scene);
 void         SceneGroupDestroy(Scene* scene, int index);
 void         SceneGroupAdd(Scene* scene, int index, SceneObject* sceneObject);
 void         SceneGroupRemove(Scene* scene, SceneObject* sceneObject);
 
+// true if any enabled member of the group overlaps bsphere in the xy plane
+bool         SceneGroupIntersects(const Scene* scene, int groupId, const BSphere& bsphere);
+
 void         SceneGroupAddChild(SceneObject* parent, SceneObject* child);
 void         SceneGroupRemoveChild(SceneObject* parent, SceneObject* child);
 
@@ -117,6 +178,28 @@ inline Light* SceneObjectGetLight(SceneObject* sceneObject)
 }
 
 
+// SceneLightToWorld
+//
+// A light as the scene uploads it: its object's position and orientation applied.
+void         SceneLightToWorld(Light* dest, const SceneObject* lightObject);
+
+// SceneLightGetBSphere
+//
+// World space bounds of a light's current range.  Returns false for directional lights, which are unbounded.
+bool         SceneLightGetBSphere(BSphere* dest, const SceneObject* lightObject);
+
+// SceneLightGetScreenRect
+//
+// Screen uv rectangle (x0, y0, x1, y1) around SceneLightGetBSphere.  Not clamped to the screen.
+bool         SceneLightGetScreenRect(Vec4* dest, const RenderContext* renderContext, const SceneObject* lightObject);
+
+// SceneQueryLightVisibility
+//
+// Answers a batch of queries on the CPU from each light's range and its read back shadow map.  Shadow
+// results lag rendering by a frame; lights that skipped their shadow passes occlude nothing.  Asking
+// is what keeps a light's readback running, so the first answers after a pause occlude nothing too.
+void         SceneQueryLightVisibility(const Scene* scene, LightVisibilityQuery* queries, int numQueries);
+
 // SceneObjectDestroy
 void         SceneObjectDestroy(Scene* scene, SceneObject* sceneObject);
 
@@ -10,13 +10,26 @@
 #include "slib/Common/Util.h"
 #include "slib/Container/FixedVector.h"
 #include "slib/Container/LinkyList.h"
+#include "Engine/CasterAtlas.h"
 #include "Engine/DebugUi.h"
 #include "Engine/Light.h"
+#include "Engine/LightmapBaker.h"
+#include "Engine/ParticleLights.h"
 #include "Engine/Scene.h"
 #include "Engine/Utils.h"
 #include "Render/Asset.h"
+#include "Render/Blur.h"
+#include "Render/BlurCl.h"
+#include "Render/GBuffer.h"
+#include "Render/IrradianceGrid.h"
+#include "Render/Lightmap.h"
+#include "Render/LightTiles.h"
 #include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/ShadowAccum.h"
 #include "Render/Material.h"
+#include "Render/ShadowCl.h"
+#include "Render/ShadowReadback.h"
 #include "Tool/Utils.h"
 #include "Tool/Test.h"
 
@@ -31,13 +44,21 @@ float s_Angle;
 SceneObject* s_SceneObject;
 
 static void s_ProcessKeys(void* data, int key, int scanCode, int action, int mods);
-static void MainLoop(RenderContext* renderContext);
+static void MainLoop(RenderContext* renderContext, int benchLights);
 
 void Test()
 {
     AssetHandleTableTest();
     
     assert(Mat3Test());
+    
+    TextureTest();
+    
+    // RenderInit's window is never shown
+    RenderContext renderContext;
+    RenderInit(&renderContext, 256, 256);
+    LightingTest(&renderContext);
+    RenderContextDestroy(&renderContext);
 }
 
 static void ApplyUserInput(RenderContext* renderContext, SceneObject* sceneObject, const Vec3& targetPos)
@@ -161,23 +182,37 @@ int main(int argc, char* argv[])
     
     int width = -1;
     int height = -1;
-
+    
+    RenderOptions renderOptions;
+    RenderOptionsInit(&renderOptions, width, height);
+    
+    // --cl-cpu: run OpenCL work on the cpu device, for machines without a usable gpu runtime
+    // --bench <n>: add n static lights and report light update and frame times
+    int benchLights = 0;
+    for (int i=1; i<argc; ++i)
+    {
+        if (!strcmp(argv[i], "--cl-cpu"))
+            renderOptions.m_ComputeDevice = RenderOptions::kComputeCpu;
+        else if (!strcmp(argv[i], "--bench") && i+1 < argc)
+            benchLights = Max(atoi(argv[++i]), 0);
+    }
+    
     RenderContext renderContext;
-    RenderInit(&renderContext, width, height);
+    RenderInit(&renderContext, renderOptions);
     
     RenderSetProcessKeysCallback(&renderContext, s_ProcessKeys);
     
-    MainLoop(&renderContext);
+    MainLoop(&renderContext, benchLights);
     
     RenderContextDestroy(&renderContext);
     
     return 0;
 }
 
-static void MainLoop(RenderContext* renderContext)
+static void MainLoop(RenderContext* renderContext, int benchLights)
 {
     Scene scene;
-    SceneCreate(&scene, 256);
+    SceneCreate(&scene, 256 + benchLights);
     
     // move camera to 40.0f
     renderContext->m_Camera.SetTranslation(0.0f, 0.0f, 40.0f);
@@ -215,7 +250,7 @@ static void MainLoop(RenderContext* renderContext)
     };
     
     Texture* treeAppleTexture = TextureCreateFromFile("TreeApple.png");
-    Texture* treeAppleNormal = TextureCreateFromFile("TreeApple_OUTPUT.png");
+    Texture* treeAppleNormal = TextureCreateFromFile("TreeApple_OUTPUT.png", Texture::kUsagePlanarNormal);
     Shader* planarShader = ShaderCreate("obj/Shader/Planar");
     Material* treeAppleMaterial = MaterialCreate(planarShader, treeAppleTexture);
     treeAppleMaterial->ReserveProperties(2);
@@ -237,7 +272,7 @@ static void MainLoop(RenderContext* renderContext)
         
         SceneObject* sprite1 = sceneObjects[i] = SceneCreateSprite(&scene, renderContext, MaterialRef(treeAppleMaterial), spriteOptionsTree);
         sprite1->m_LocalToWorld.SetTranslation(xes[i], yes[i], -1);
-        sprite1->m_Flags |= SceneObject::Flags::kDirty;
+        sprite1->m_Flags |= SceneObject::Flags::kDirty | SceneObject::Flags::kStatic;
         
         SceneGroupAdd(&scene, shadowCasterGroupId, sprite1);
     }
@@ -315,14 +350,75 @@ static void MainLoop(RenderContext* renderContext)
         dirLights[3] = SceneCreateLight(&scene, LightOptions::MakeDirectionalLight(Vec3( 0.0f,-1.0f, 0.0f), Vec4(0.50f, 0.50f, 0.50f, 0.0f)));
     }
     
-    // blur temp textures
+    // bench lights: a grid of point lights, every fourth one conical, over the play area
+    for (int i=0; i<benchLights; ++i)
+    {
+        const int columns = 24;
+        const float x = -30.0f + 60.0f * (i % columns) / (columns-1);
+        const float y = -20.0f + 2.5f * ((i / columns) % 17);
+        const Vec4 color(0.25f + 0.75f * ((i*7) % 5) / 4.0f, 0.25f + 0.75f * ((i*3) % 4) / 3.0f, 0.5f, 1.0f);
+        
+        SceneObject* benchLight;
+        if ((i & 3) == 3)
+            benchLight = SceneCreateLight(&scene, LightOptions::MakeConicalLight(Vec3(x, y, -1.0f), Vec3(0.0f, -1.0f, 0.0f), color, 30.0f, 4.0f));
+        else
+            benchLight = SceneCreateLight(&scene, LightOptions::MakePointLight(Vec3(x, y, -1.0f), color, 3.0f));
+        
+        if (benchLight == nullptr)
+            break;
+        benchLight->m_DebugName = "BenchLight";
+        benchLight->m_Flags |= SceneObject::Flags::kStatic;
+    }
+    
+    // particle lights: sparks off the mover and fireflies drifting over the whole play area, one
+    // emitter each
+    ParticleLights* particleLights = ParticleLightsCreate(&scene, 4096);
+    particleLights->m_Drag = 2.0f;
+    int sparkEmitter;
+    {
+        ParticleLightEmitterOptions sparkOptions;
+        sparkOptions.m_Color = Vec4(1.0f, 0.6f, 0.2f, 1.0f);
+        sparkOptions.m_Rate = 120.0f;
+        sparkOptions.m_Speed = 12.0f;
+        sparkOptions.m_Lifetime = 0.4f;
+        sparkOptions.m_Range = 1.5f;
+        sparkEmitter = ParticleLightsAddEmitter(particleLights, sparkOptions);
+        
+        ParticleLightEmitterOptions fireflyOptions;
+        fireflyOptions.m_Color = Vec4(0.5f, 1.0f, 0.3f, 1.0f);
+        fireflyOptions.m_Rate = 0.5f;
+        fireflyOptions.m_Speed = 0.5f;
+        fireflyOptions.m_Lifetime = 2.0f;
+        fireflyOptions.m_Range = 1.0f;
+        for (int i=0; i<2000; ++i)
+        {
+            fireflyOptions.m_Position = Vec2(-40.0f + 80.0f * (i % 50) / 49.0f, -30.0f + 60.0f * (i / 50) / 39.0f);
+            ParticleLightsAddEmitter(particleLights, fireflyOptions);
+        }
+    }
+    
+    // --bench accumulators
+    double benchLightsTime = 0.0;
+    double benchFrameStart = glfwGetTime();
+    int benchFrames = 0;
+    
+    // blur temp textures, sized to whatever the blur runs on: the frame buffer or the reduced shadow buffer
     Texture* renderTextureTemp[2];
     for (int i=0; i<2; ++i)
-        renderTextureTemp[i] = TextureCreateRenderTexture(512, 512, 0);
+    {
+        renderTextureTemp[i] = TextureCreateRenderTexture(renderContext->m_Width, renderContext->m_Height, 0);
+        renderTextureTemp[i]->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+    }
     
     Shader* shaderBlurX = ShaderCreate("obj/Shader/BlurX");
     Shader* shaderBlurY = ShaderCreate("obj/Shader/BlurY");
     
+    // runtime kernel alternatives to the BlurX/BlurY chain
+    Blur* blur = BlurCreate(renderContext->m_Width, renderContext->m_Height);
+    
+    // OpenCL tiled blur, null if there's no usable OpenCL device
+    BlurCl* blurCl = BlurClCreate(renderContext, renderContext->m_Width, renderContext->m_Height);
+    
     Texture* shadowCasterRenderTarget = TextureCreateRenderTexture(512, 512, 0);
     shadowCasterRenderTarget->SetClearFlags(Texture::RenderTextureFlags::kClearColor, 0,1,0,1);
     
@@ -340,9 +436,11 @@ static void MainLoop(RenderContext* renderContext)
     {
         Material* shadow1dMaterial = shadow1dMaterials[i] = MaterialCreate(shadowMap1dShaders[i], shadowCasterRenderTarget);
         shadow1dMaterial->m_BlendMode = Material::BlendMode::kOpaque;
-        shadow1dMaterial->ReserveProperties(2);
+        shadow1dMaterial->ReserveProperties(4);
         shadow1dMaterial->SetPropertyType("_LightPosition", Material::MaterialPropertyType::kVec4);
         shadow1dMaterial->SetPropertyType("_LightFacingAngle", Material::MaterialPropertyType::kVec4);
+        shadow1dMaterial->SetPropertyType("_CropRect", Material::MaterialPropertyType::kVec4);
+        shadow1dMaterial->SetPropertyType("_RaymarchSteps", Material::MaterialPropertyType::kFloat);
     }
     
     Shader* sampleShadowMapShader = ShaderCreate("obj/Shader/SampleShadowMap");
@@ -350,18 +448,54 @@ static void MainLoop(RenderContext* renderContext)
     // show map stuff
     Material* shadowMapSampleMaterial = MaterialCreate(sampleShadowMapShader, nullptr);
     shadowMapSampleMaterial->m_BlendMode = Material::BlendMode::kBlend;
-    shadowMapSampleMaterial->ReserveProperties(2);
+    shadowMapSampleMaterial->ReserveProperties(3);
     int shadowMapLightPosition = shadowMapSampleMaterial->SetPropertyType("_LightPosition", Material::MaterialPropertyType::kVec4);
     int shadowMapLightColor = shadowMapSampleMaterial->SetPropertyType("_LightColor", Material::MaterialPropertyType::kVec4);
+    int shadowMapScreenToCrop = shadowMapSampleMaterial->SetPropertyType("_ScreenToCrop", Material::MaterialPropertyType::kVec4);
+    
+    // reduced resolution target for the shadow resolves and blur
+    ShadowAccum* shadowAccum = ShadowAccumCreate();
+    
+    // light shafts: in-scatter evaluated along 256 epipolar lines of 128 samples, then upsampled per light.
+    // Alpha holds the occluder distance the upsample weighs taps by, which needs more than 8 bits
+    Texture* lightShaftTarget = TextureCreateRenderTexture(256, 128, 0, Texture::RenderTextureFormat::kHalf);
+    lightShaftTarget->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+    
+    Shader* lightShaftShader = ShaderCreate("obj/Shader/LightShafts");
+    Material* lightShaftMaterial = MaterialCreate(lightShaftShader, nullptr);
+    lightShaftMaterial->m_BlendMode = Material::BlendMode::kOpaque;
+    lightShaftMaterial->ReserveProperties(4);
+    int lightShaftLightPosition = lightShaftMaterial->SetPropertyType("_LightPosition", Material::MaterialPropertyType::kVec4);
+    int lightShaftLightColor = lightShaftMaterial->SetPropertyType("_LightColor", Material::MaterialPropertyType::kVec4);
+    int lightShaftLightFacing = lightShaftMaterial->SetPropertyType("_LightFacing", Material::MaterialPropertyType::kVec4);
+    int lightShaftParams = lightShaftMaterial->SetPropertyType("_ShaftParams", Material::MaterialPropertyType::kVec4);
+    
+    Shader* lightShaftUpsampleShader = ShaderCreate("obj/Shader/LightShaftsUpsample");
+    Material* lightShaftUpsampleMaterial = MaterialCreate(lightShaftUpsampleShader, nullptr);
+    lightShaftUpsampleMaterial->m_BlendMode = Material::BlendMode::kAdd;
+    lightShaftUpsampleMaterial->ReserveProperties(3);
+    int lightShaftUpsampleShadowMap = lightShaftUpsampleMaterial->SetPropertyType("_ShadowMap", Material::MaterialPropertyType::kTexture);
+    int lightShaftUpsampleLightPosition = lightShaftUpsampleMaterial->SetPropertyType("_LightPosition", Material::MaterialPropertyType::kVec4);
+    int lightShaftUpsampleScreenToCrop = lightShaftUpsampleMaterial->SetPropertyType("_ScreenToCrop", Material::MaterialPropertyType::kVec4);
+    
+    // medium density and the length of medium behind a point that scatters toward it, in screen uv
+    float lightShaftDensity = 0.35f;
+    float lightShaftWindow = 0.15f;
     
-    // light prepass stuff
-    Shader* lightPrepassShader = ShaderCreate("obj/Shader/LightPrepass");
-    int lightBitmaskIndex = RenderAddGlobalProperty(renderContext, "_LightBitmask", Material::MaterialPropertyType::kUInt);
-    int lightPrepassTextureIndex = RenderAddGlobalProperty(renderContext, "_LightPrepassTex", Material::MaterialPropertyType::kTexture);
-    Texture* renderTextureInt = TextureCreateRenderTexture(512, 512, 0, Texture::RenderTextureFormat::kUInt);
-    RenderGlobalSetTexture(renderContext, lightPrepassTextureIndex, renderTextureInt);
+    // light-local caster crops, roughly the screen target's texel density
+    CasterAtlas* casterAtlas = CasterAtlasCreate(1024, 16.0f);
     
-    Shader* debugLightPrepassSampleShader = ShaderCreate("obj/Shader/DebugLightPrepassSample");
+    // OpenCL raymarch + resolve, null if there's no usable OpenCL device
+    ShadowCl* shadowCl = ShadowClCreate(renderContext, shadowCasterRenderTarget, light0->m_Shadow1dMap->m_Width);
+    
+    // light tile debug view
+    Shader* debugLightTilesShader = ShaderCreate("obj/Shader/DebugLightTiles");
+    
+    // deferred lighting for the planar sprites
+    GBuffer* gbuffer = GBufferCreate(planarShader);
+    
+    // probe lighting for the sprites and models that aren't planar
+    IrradianceGrid* irradianceGrid = IrradianceGridCreate();
     
     // which light are we rendering?
     int light_state = 0;
@@ -376,13 +510,46 @@ static void MainLoop(RenderContext* renderContext)
     SceneSetEnabledRecursive(lightSprite0, true);
     SceneSetEnabledRecursive(lightSprite1, false);
     SceneSetEnabledRecursive(lightSprite2, false);
-
+    
     // do we enable directional mode or not?
     int directional_mode = 0;
     
     // blur enabled or not?
     int blur_mode = 0;
     
+    // which blur, and how wide.  The fixed chain is about sigma 4
+    int blur_kernel_mode = 0;
+    float blur_sigma = 4.0f;
+    
+    // shadows through GL or OpenCL
+    int shadow_compute_mode = 0;
+    
+    // casters rendered from the screen or per light crops
+    int caster_crop_mode = 0;
+    
+    // shadows resolved straight into the frame buffer, or into a half/quarter resolution buffer
+    int shadow_resolution_mode = 0;
+    
+    // planar sprites lit as they're drawn, or once per pixel from a G-buffer at full, half or quarter
+    // resolution
+    int lighting_mode = 0;
+    int lighting_resolution_mode = 0;
+    
+    // deferred lights gathered from the tile lists, or one stencil marked volume per light
+    int light_path_mode = 0;
+    
+    // non planar sprites and models unlit, or lit from the probe grid
+    int probe_mode = 0;
+    
+    // static lights lit per pixel, or baked with their shadows into a lightmap kept in obj/
+    int lightmap_mode = 0;
+    Lightmap* lightmap = nullptr;
+    uint32_t lightmapHash = 0;     // bake inputs lightmap was last checked against
+    LightmapBakeOptions lightmapBakeOptions;
+    
+    // particle lights on or off
+    int particle_mode = 0;
+    
     bool running = true;
     while (running)
     {
@@ -391,7 +558,7 @@ static void MainLoop(RenderContext* renderContext)
         
         // IMGUI
         DebugUi::NewFrame();
-
+        
         ImGui::Text("translate: a/s/d/f");
         ImGui::Text("rotate: <-/->");
         
@@ -415,10 +582,165 @@ static void MainLoop(RenderContext* renderContext)
             constexpr const char* blur_labels[] =
             {
                 "blur on",
-                "blur off"
+                "blur off",
+                "light shafts"
             };
             if (ImGui::Button(blur_labels[blur_mode]))
-                blur_mode = (blur_mode+1) & 1;
+                blur_mode = (blur_mode+1) % 3;
+            
+            if (blur_mode == 0)
+            {
+                constexpr const char* blur_kernel_labels[] =
+                {
+                    "kernel: fixed 8x",
+                    "kernel: gaussian",
+                    "kernel: gaussian linear taps",
+                    "kernel: dual kawase",
+                    "kernel: opencl tiled"
+                };
+                const int numBlurKernels = blurCl ? 5 : 4;
+                if (ImGui::Button(blur_kernel_labels[blur_kernel_mode]))
+                    blur_kernel_mode = (blur_kernel_mode+1) % numBlurKernels;
+                
+                if (blur_kernel_mode != 0)
+                    ImGui::DragFloat("blur sigma", &blur_sigma, 0.05f, 0.5f, 16.0f);
+            }
+            
+            if (blur_mode == 2)
+            {
+                ImGui::DragFloat("shaft density", &lightShaftDensity, 0.01f, 0.0f, 4.0f);
+                ImGui::DragFloat("shaft window", &lightShaftWindow, 0.005f, 0.0f, 1.0f);
+            }
+        }
+        
+        // DEBUG: toggle OpenCL shadows
+        if (shadowCl)
+        {
+            constexpr const char* shadow_compute_labels[] =
+            {
+                "shadows: gl",
+                "shadows: opencl"
+            };
+            if (ImGui::Button(shadow_compute_labels[shadow_compute_mode]))
+                shadow_compute_mode = (shadow_compute_mode+1) & 1;
+        }
+        
+        // DEBUG: toggle light-local caster crops
+        {
+            constexpr const char* caster_crop_labels[] =
+            {
+                "casters: screen",
+                "casters: light crops"
+            };
+            if (ImGui::Button(caster_crop_labels[caster_crop_mode]))
+                caster_crop_mode = (caster_crop_mode+1) & 1;
+        }
+        
+        // DEBUG: shadow accumulation resolution
+        {
+            constexpr const char* shadow_resolution_labels[] =
+            {
+                "shadow buffer: full",
+                "shadow buffer: half",
+                "shadow buffer: quarter"
+            };
+            if (ImGui::Button(shadow_resolution_labels[shadow_resolution_mode]))
+                shadow_resolution_mode = (shadow_resolution_mode+1) % 3;
+        }
+        
+        // DEBUG: forward or deferred lighting
+        {
+            constexpr const char* lighting_labels[] =
+            {
+                "lighting: forward",
+                "lighting: deferred"
+            };
+            if (ImGui::Button(lighting_labels[lighting_mode]))
+                lighting_mode = (lighting_mode+1) & 1;
+            
+            if (lighting_mode == 1)
+            {
+                constexpr const char* lighting_resolution_labels[] =
+                {
+                    "light buffer: full",
+                    "light buffer: half",
+                    "light buffer: quarter"
+                };
+                if (ImGui::Button(lighting_resolution_labels[lighting_resolution_mode]))
+                    lighting_resolution_mode = (lighting_resolution_mode+1) % 3;
+                
+                constexpr const char* light_path_labels[] =
+                {
+                    "light lists: tiles",
+                    "light lists: stencil volumes"
+                };
+                if (ImGui::Button(light_path_labels[light_path_mode]))
+                    light_path_mode = (light_path_mode+1) & 1;
+                
+                // lit lights past this resolve through the tiles anyway, 0 for no limit
+                if (light_path_mode == 1)
+                    ImGui::DragInt("volume light limit", &gbuffer->m_MaxVolumeLights, 1.0f, 0, 4096);
+            }
+            
+            constexpr const char* probe_labels[] =
+            {
+                "probes: off",
+                "probes: on"
+            };
+            if (ImGui::Button(probe_labels[probe_mode]))
+                probe_mode = (probe_mode+1) & 1;
+            
+            constexpr const char* lightmap_labels[] =
+            {
+                "static lights: dynamic",
+                "static lights: baked"
+            };
+            if (ImGui::Button(lightmap_labels[lightmap_mode]))
+                lightmap_mode = (lightmap_mode+1) & 1;
+            
+            // the bake is at the screen's scale, so resizes and projection changes stale it as much as
+            // light and caster edits do; checked every frame, rebaked only when the saved one was
+            // made from other inputs
+            const Lightmap* bakedLightmap = nullptr;
+            bool lightmapChanged = false;
+            if (lightmap_mode == 1)
+            {
+                const uint32_t hash = LightmapBakeHash(&scene, renderContext, shadowCasterGroupId, lightmapBakeOptions);
+                if (hash != lightmapHash)
+                {
+                    lightmapHash = hash;
+                    lightmapChanged = true;
+                    LightmapDestroy(lightmap);
+                    lightmap = LightmapLoad("obj/Lightmap.bin", hash);
+                    
+                    if (lightmap == nullptr)
+                    {
+                        lightmap = LightmapBake(&scene, renderContext, shadowCasterGroupId, lightmapBakeOptions);
+                        if (lightmap != nullptr)
+                            LightmapSave(lightmap, "obj/Lightmap.bin");
+                    }
+                }
+                bakedLightmap = lightmap;
+            }
+            
+            if (lightmapChanged || renderContext->m_Lightmap != bakedLightmap)
+            {
+                scene.m_StaticLightsBaked = bakedLightmap != nullptr;
+                RenderSetLightmap(renderContext, bakedLightmap);
+            }
+            
+            constexpr const char* particle_labels[] =
+            {
+                "particle lights: off",
+                "particle lights: on"
+            };
+            if (ImGui::Button(particle_labels[particle_mode]))
+            {
+                particle_mode = (particle_mode+1) & 1;
+                ParticleLightsClear(particleLights);
+            }
+            if (particle_mode == 1)
+                ImGui::Text("particle lights: %d", particleLights->m_Count);
         }
         
         // DEBUG: switch which light we're using
@@ -501,11 +823,39 @@ static void MainLoop(RenderContext* renderContext)
                 }
             }
             
+            // falloff curve of the active light, cycling through the builtin profiles
+            {
+                constexpr const char* profile_labels[] = { "falloff: quadratic", "falloff: linear", "falloff: cylinder end", "falloff: smooth" };
+                
+                SceneObject* activeLights[LightState::kCount] = { light0, light1, light2 };
+                Light* light = SceneObjectGetLight(activeLights[light_state]);
+                if (ImGui::Button(profile_labels[light->m_RangeProfile % kNumBuiltinProfiles]))
+                    light->m_RangeProfile = (light->m_RangeProfile + 1) % kNumBuiltinProfiles;
+            }
+            
+            // which trees the active light reaches, as of last frame's shadow readback
+            {
+                const SceneObject* activeLights[LightState::kCount] = { light0, light1, light2 };
+                
+                LightVisibilityQuery queries[ELEMENTSOF(sceneObjects)];
+                for (int i=0,n=ELEMENTSOF(sceneObjects); i<n; ++i)
+                {
+                    queries[i].m_Light = activeLights[light_state];
+                    queries[i].m_Position = sceneObjects[i]->m_LocalToWorld.GetTranslation();
+                }
+                SceneQueryLightVisibility(&scene, queries, ELEMENTSOF(queries));
+                
+                int numLit = 0;
+                for (int i=0,n=ELEMENTSOF(queries); i<n; ++i)
+                    numLit += queries[i].m_Lit ? 1 : 0;
+                ImGui::Text("lit trees: %d/%d", numLit, (int) ELEMENTSOF(queries));
+            }
+            
             // render mode debug
             constexpr const char* render_mode_debug_labels[]
             {
                 "normal",
-                "coverage mask",
+                "light tiles",
                 "fullframe"
             };
             
@@ -515,11 +865,46 @@ static void MainLoop(RenderContext* renderContext)
                 render_mode %= 3;
             }
             
+            // light budget, in ms of frame time per tier and per light
+            ImGui::DragFloat("shadow budget ms", &scene.m_LightBudget.m_ShadowMs, 0.1f, 0.0f, 16.0f);
+            ImGui::DragFloat("lighting budget ms", &scene.m_LightBudget.m_LightingMs, 0.1f, 0.0f, 16.0f);
+            ImGui::DragFloat("shadow cost ms", &scene.m_LightBudget.m_ShadowCostMs, 0.01f, 0.01f, 4.0f);
+            ImGui::DragFloat("lighting cost ms", &scene.m_LightBudget.m_LightingCostMs, 0.001f, 0.001f, 1.0f);
+            ImGui::Text("lights in view: %d lit, %d ambient", scene.m_NumVisibleLights, scene.m_NumAmbientLights);
+            ImGui::Text("most lights in a tile: %d", renderContext->m_LightTiles->m_MaxLightsPerTile);
+            
+            // last frame's GL state calls, sent and filtered as already set
+            const RenderStateStats& stateStats = RenderStateGetStats();
+            int stateIssued = 0;
+            int stateFiltered = 0;
+            for (int i=0; i<RenderStateStats::kNumTypes; ++i)
+            {
+                stateIssued += stateStats.m_Issued[i];
+                stateFiltered += stateStats.m_Filtered[i];
+            }
+            ImGui::Text("state changes: %d sent, %d filtered", stateIssued, stateFiltered);
+            ImGui::Text("  program %d/%d, texture %d/%d, blend %d/%d",
+                        stateStats.m_Issued[RenderStateStats::kProgram], stateStats.m_Filtered[RenderStateStats::kProgram],
+                        stateStats.m_Issued[RenderStateStats::kTexture], stateStats.m_Filtered[RenderStateStats::kTexture],
+                        stateStats.m_Issued[RenderStateStats::kBlend], stateStats.m_Filtered[RenderStateStats::kBlend]);
+            ImGui::Text("  depth %d/%d, vertex array %d/%d, frame buffer %d/%d",
+                        stateStats.m_Issued[RenderStateStats::kDepth], stateStats.m_Filtered[RenderStateStats::kDepth],
+                        stateStats.m_Issued[RenderStateStats::kVertexArray], stateStats.m_Filtered[RenderStateStats::kVertexArray],
+                        stateStats.m_Issued[RenderStateStats::kFrameBuffer], stateStats.m_Filtered[RenderStateStats::kFrameBuffer]);
+            
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         }
         
-        SceneUpdate(&scene);
-
+        SceneUpdate(&scene, renderContext);
+        
+        // particles go straight into their reserved light slots, after SceneUpdate has written the rest
+        if (particle_mode == 1)
+        {
+            ParticleLightsSetEmitterPosition(particleLights, sparkEmitter, s_SceneObject->m_LocalToWorld.GetTranslation().xy());
+            ParticleLightsUpdate(particleLights, ImGui::GetIO().DeltaTime);
+        }
+        ParticleLightsWrite(particleLights);
+        
         // 
         //        __                   __ 
         //       /\ \                 /\ \
@@ -531,52 +916,174 @@ static void MainLoop(RenderContext* renderContext)
         //                                                       
         //
         
+        // broadphase: only lights within the shadow budget whose range overlaps a shadow caster need the
+        // raymarch and resolve passes.  The first kMaxCrops of those get shadows, the rest light unshadowed
+        FixedVector<SceneObject*,CasterAtlas::kMaxCrops> shadowLights;
+        {
+            int numShadowLights = 0;
+            for (int i=0; i<scene.m_NumVisibleLights; ++i)
+            {
+                SceneObject* lightObject = scene.m_VisibleLights[i];
+                
+                BSphere lightBounds;
+                if (!SceneLightGetBSphere(&lightBounds, lightObject))
+                    continue;
+                
+                const bool shadowed = (lightObject->m_Flags & SceneObject::kShadowed) != 0;
+                if (!shadowed || numShadowLights == CasterAtlas::kMaxCrops || !SceneGroupIntersects(&scene, shadowCasterGroupId, lightBounds))
+                {
+                    // nothing to occlude, keep visibility queries from seeing a stale map
+                    ShadowReadbackUpdate(renderContext, lightObject->m_ShadowReadback, nullptr, Vec4(0.0f, 0.0f, 0.0f, 0.0f), Vec4(1.0f, 1.0f, 0.0f, 0.0f));
+                    continue;
+                }
+                
+                shadowLights[numShadowLights++] = lightObject;
+            }
+            shadowLights.SetCount(numShadowLights);
+        }
+        
+        // the OpenCL path reads the screen caster target
+        const bool useShadowCl = shadowCl && shadow_compute_mode == 1;
+        const bool useCasterCrops = caster_crop_mode == 1 && !useShadowCl;
+        
+        // one crop per shadowed light, centered on it and sized by its range
+        CasterCrop casterCrops[CasterAtlas::kMaxCrops];
+        
+        // screen area each shadowed light can darken, and their union.  The OpenCL resolve covers the
+        // whole screen
+        Vec4 shadowLightRect[CasterAtlas::kMaxCrops];
+        Vec4 shadowRegion(1.0f, 1.0f, 0.0f, 0.0f);
+        for (int i=0,n=shadowLights.Count(); i<n; ++i)
+        {
+            Vec4 rect(0.0f, 0.0f, 1.0f, 1.0f);
+            if (!useShadowCl && SceneLightGetScreenRect(&rect, renderContext, shadowLights[i]))
+                rect = Vec4(Max(rect.m_X[0], 0.0f), Max(rect.m_X[1], 0.0f), Min(rect.m_X[2], 1.0f), Min(rect.m_X[3], 1.0f));
+            
+            shadowLightRect[i] = rect;
+            shadowRegion = Vec4(Min(shadowRegion.m_X[0], rect.m_X[0]), Min(shadowRegion.m_X[1], rect.m_X[1]),
+                                Max(shadowRegion.m_X[2], rect.m_X[2]), Max(shadowRegion.m_X[3], rect.m_X[3]));
+        }
+        
+        // where each shadowed light's 1d map was built, for the light shaft pass
+        Vec4 shadowLightMapPos[CasterAtlas::kMaxCrops];
+        Vec4 shadowLightScreenToCrop[CasterAtlas::kMaxCrops];
+        if (useCasterCrops && shadowLights.Count() > 0)
+        {
+            BSphere cropBounds[CasterAtlas::kMaxCrops];
+            for (int i=0,n=shadowLights.Count(); i<n; ++i)
+                SceneLightGetBSphere(&cropBounds[i], shadowLights[i]);
+            
+            CasterAtlasPack(casterCrops, casterAtlas, cropBounds, shadowLights.Count());
+            for (int i=0,n=shadowLights.Count(); i<n; ++i)
+                CasterAtlasSetupCrop(&casterCrops[i], renderContext);
+            
+            CasterAtlasDraw(renderContext, casterAtlas, &scene, shadowCasterGroupId, shadowCasterShader, casterCrops, shadowLights.Count());
+        }
+        
         // setup shadow caster render target
-        RenderSetRenderTarget(renderContext, shadowCasterRenderTarget);
-        RenderSetReplacementShader(renderContext, shadowCasterShader);
+        else if (shadowLights.Count() > 0)
+        {
+            RenderSetRenderTarget(renderContext, shadowCasterRenderTarget);
+            RenderSetReplacementShader(renderContext, shadowCasterShader);
+            
+            // draw shadow casters
+            SceneDraw(&scene, renderContext, shadowCasterGroupId);
+            
+            // tear down shadow caster render target
+            RenderSetRenderTarget(renderContext, nullptr);
+            RenderClearReplacementShader(renderContext);
+        }
         
-        // draw shadow casters
-        SceneDraw(&scene, renderContext, shadowCasterGroupId);
+        // resolve, blur and shafts all draw into shadowTarget, null for the frame buffer
+        Texture* shadowTarget = nullptr;
+        if (shadow_resolution_mode != 0)
+        {
+            constexpr PostEffectResolution shadow_resolutions[] = { kFull, kHalf, kQuarter };
+            ShadowAccumBegin(renderContext, shadowAccum, shadow_resolutions[shadow_resolution_mode]);
+            shadowTarget = shadowAccum->m_Texture;
+        }
+        
+        // same passes as below for all lights in two kernel launches
+        if (useShadowCl)
+        {
+            ShadowClLight clLights[ShadowCl::kMaxLights];
+            Texture* clShadow1dMaps[ShadowCl::kMaxLights];
+            Vec4 clScreenPos[ShadowCl::kMaxLights];
+            
+            const int numClLights = Min(shadowLights.Count(), (int) ShadowCl::kMaxLights);
+            for (int i=0; i<numClLights; ++i)
+            {
+                SceneObject* lightObject = shadowLights[i];
+                Light* light = SceneObjectGetLight(lightObject);
+                
+                clScreenPos[i] = RenderGetScreenPos(renderContext, lightObject->m_LocalToWorld.GetTranslation());
+                
+                ShadowClLight* clLight = &clLights[i];
+                clLight->m_Position = clScreenPos[i];
+                clLight->m_Color = light->m_Color;
+                clLight->m_Facing = Vec4(0.0f, 0.0f, 0.0f, -2.0f);
+                if (light->m_Type == LightType::kConical)
+                {
+                    clLight->m_Facing = lightObject->m_LocalToWorld.GetUp();
+                    clLight->m_Facing.m_X[3] = light->m_CosAngle;
+                }
+                
+                clShadow1dMaps[i] = lightObject->m_Shadow1dMap;
+            }
+            
+            ShadowClRender(renderContext, shadowCl, clLights, clShadow1dMaps, numClLights);
+            
+            for (int i=0; i<numClLights; ++i)
+            {
+                shadowLightMapPos[i] = clScreenPos[i];
+                shadowLightScreenToCrop[i] = Vec4(1.0f, 1.0f, 0.0f, 0.0f);
+                ShadowReadbackUpdate(renderContext, shadowLights[i]->m_ShadowReadback, shadowLights[i]->m_Shadow1dMap, clScreenPos[i], shadowLightScreenToCrop[i]);
+            }
+        }
         
-        // tear down shadow caster render target
-        RenderSetRenderTarget(renderContext, nullptr);
-        RenderClearReplacementShader(renderContext);
-
         // for each light
         // - raymarch shadow casters into 1d polar coordinate render texture
         // - generate 2d fullscreen map from 1d render texture
-        if (true)
+        else
         {
             // 4ms
-            FixedVector<SceneObject*,32> lights;
-            SceneGetSceneObjectsByType(&lights, &scene, SceneObjectType::kLight);
-            for (int i=0,n=lights.Count(); i<n; ++i)
+            for (int i=0,n=shadowLights.Count(); i<n; ++i)
             {
-                SceneObject* lightObject = lights[i];
-                if (!SceneGetEnabled(lightObject))
-                    continue;
-                
+                SceneObject* lightObject = shadowLights[i];
                 Light* light = SceneObjectGetLight(lightObject);
-                if (light == nullptr)
-                    continue;
-                
-                if (light->m_Type == LightType::kDirectional)
-                    continue;
                 
                 // calculate the sceen position of our light source
                 // jiv fixme: we already calculate this and cache it via SceneDraw
                 Vec4 screenPos = RenderGetScreenPos(renderContext, lightObject->m_LocalToWorld.GetTranslation());
                 
+                // where the 1d map is built: the whole screen, or the light's crop with the light at its center
+                Texture* casterTexture = shadowCasterRenderTarget;
+                Vec4 lightPos = screenPos;
+                Vec4 cropRect(0.0f, 0.0f, 1.0f, 1.0f);
+                Vec4 screenToCrop(1.0f, 1.0f, 0.0f, 0.0f);
+                float raymarchSteps = 1024.0f;
+                if (useCasterCrops)
+                {
+                    casterTexture = casterAtlas->m_Texture;
+                    lightPos = Vec4(0.5f, 0.5f, 0.0f, 1.0f);
+                    cropRect = casterCrops[i].m_AtlasRect;
+                    screenToCrop = casterCrops[i].m_ScreenToCrop;
+                    raymarchSteps = (float) casterCrops[i].m_Size;
+                }
+                
                 // 1d mapping material
                 Material* shadow1dMaterial = shadow1dMaterials[light->m_Type];
                 
                 // sample the 1d raycast texture.  Point/Spotlight sample based on light position to fragment, cylinder lights need to
                 // raycast to the nearest intersection point
-                shadowMapSampleMaterial->SetVector(shadowMapLightPosition, screenPos);
+                shadowMapSampleMaterial->SetVector(shadowMapLightPosition, lightPos);
                 shadowMapSampleMaterial->SetVector(shadowMapLightColor, light->m_Color);
+                shadowMapSampleMaterial->SetVector(shadowMapScreenToCrop, screenToCrop);
                 
                 // set light position in screen space.  Relying on initialization order instead of explicit index
-                shadow1dMaterial->SetVector(0, screenPos);
+                shadow1dMaterial->SetVector(0, lightPos);
+                shadow1dMaterial->SetVector(2, cropRect);
+                shadow1dMaterial->SetFloat(3, raymarchSteps);
                 
                 if (light->m_Type == LightType::kConical)
                 {
@@ -587,113 +1094,204 @@ static void MainLoop(RenderContext* renderContext)
                 
                 // raymarch 1d polar coordinate map
                 RenderSetRenderTarget(renderContext, lightObject->m_Shadow1dMap);
-                RenderDrawFullscreen(renderContext, shadow1dMaterial, shadowCasterRenderTarget);
-                RenderSetRenderTarget(renderContext, nullptr);
+                RenderDrawFullscreen(renderContext, shadow1dMaterial, casterTexture);
+                RenderSetRenderTarget(renderContext, shadowTarget);
+                
+                shadowLightMapPos[i] = lightPos;
+                shadowLightScreenToCrop[i] = screenToCrop;
+                
+                // queue the cpu copy for visibility queries
+                ShadowReadbackUpdate(renderContext, lightObject->m_ShadowReadback, lightObject->m_Shadow1dMap, lightPos, screenToCrop);
                 
-                // fullscreen 1d->2d pass
+                // fullscreen 1d->2d pass, limited to the light's range
+                RenderSetScissor(renderContext, shadowLightRect[i]);
                 RenderDrawFullscreen(renderContext, shadowMapSampleMaterial, lightObject->m_Shadow1dMap);
+                RenderClearScissor(renderContext);
             }
         }
-
+        
         // Run multiple blur passes on the current framebuffer, which just now consists only of the shadowed portions.
+        // Those all lie in shadowRegion, so the passes are scissored to it, padded by how far the blur reaches.
         // 3ms
         if (blur_mode == 0)
         {
-            // ping pong blur buffers.  jesus this is a lot of passes
-            const int limit=8;
-            for (int i=0; i<limit; ++i)
+            // opencl blurs with the same gaussian
+            constexpr Blur::Mode blur_kernel_modes[] =
             {
-                const int current_render_target       = i&1;
-                const int prev_and_next_render_target = current_render_target^1;
-                
-                Texture* source = renderTextureTemp[prev_and_next_render_target];
-                if (i==0)
-                    source = nullptr; // first read comes from frame buffer
+                Blur::Mode::kGaussian,
+                Blur::Mode::kGaussian,
+                Blur::Mode::kGaussianLinear,
+                Blur::Mode::kDualKawase,
+                Blur::Mode::kGaussian
+            };
+            
+            // follow the shadow buffer's resolution and window resizes, so a reduced buffer is blurred at its
+            // own size rather than upsampled into full size intermediates
+            const int blurWidth = shadowTarget ? shadowTarget->m_Width : renderContext->m_Width;
+            const int blurHeight = shadowTarget ? shadowTarget->m_Height : renderContext->m_Height;
+            if (blurWidth != renderTextureTemp[0]->m_Width || blurHeight != renderTextureTemp[0]->m_Height)
+            {
+                for (int i=0; i<2; ++i)
+                {
+                    TextureDestroy(renderTextureTemp[i]);
+                    renderTextureTemp[i] = TextureCreateRenderTexture(blurWidth, blurHeight, 0);
+                    renderTextureTemp[i]->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+                }
                 
-                RenderSetRenderTarget(renderContext, renderTextureTemp[current_render_target]);
-                RenderDrawFullscreen(renderContext, shaderBlurX, source);
+                BlurDestroy(blur);
+                blur = BlurCreate(blurWidth, blurHeight);
                 
-                if (i==limit-1)
-                    RenderSetRenderTarget(renderContext, nullptr);
-                else
-                    RenderSetRenderTarget(renderContext, renderTextureTemp[prev_and_next_render_target]);
+                if (blurCl)
+                {
+                    BlurClDestroy(blurCl);
+                    blurCl = BlurClCreate(renderContext, blurWidth, blurHeight);
+                    if (blurCl == nullptr && blur_kernel_mode == 4)
+                        blur_kernel_mode = 0;
+                }
+            }
+            
+            // the fixed chain is 8 iterations of a 4 texel radius.  Radii are in texels of the blur targets
+            const int blurRadius = blur_kernel_mode == 0 ? 32 : BlurGetRadius(blur_kernel_modes[blur_kernel_mode], blur_sigma);
+            const float paddingX = (float) blurRadius / blurWidth;
+            const float paddingY = (float) blurRadius / blurHeight;
+            RenderSetScissor(renderContext, Vec4(shadowRegion.m_X[0] - paddingX, shadowRegion.m_X[1] - paddingY, shadowRegion.m_X[2] + paddingX, shadowRegion.m_X[3] + paddingY));
+            
+            if (blur_kernel_mode == 4)
+            {
+                BlurClRender(renderContext, blurCl, blur_sigma, shadowTarget);
+            }
+            else if (blur_kernel_mode != 0)
+            {
+                BlurRender(renderContext, blur, blur_kernel_modes[blur_kernel_mode], blur_sigma, shadowTarget);
+            }
+            else
+            {
+                // only the scissored part of the temp targets gets written, and taps reach one radius past it.
+                // Start that much of them from what an unshadowed frame holds
+                const Vec4 clearRect(shadowRegion.m_X[0] - 2.0f*paddingX, shadowRegion.m_X[1] - 2.0f*paddingY, shadowRegion.m_X[2] + 2.0f*paddingX, shadowRegion.m_X[3] + 2.0f*paddingY);
+                for (int i=0; i<2; ++i)
+                {
+                    RenderSetRenderTarget(renderContext, renderTextureTemp[i]);
+                    RenderClearRect(renderContext, clearRect, renderContext->m_ClearColor);
+                }
                 
-                RenderDrawFullscreen(renderContext, shaderBlurY, renderTextureTemp[current_render_target]);
+                // ping pong blur buffers.  jesus this is a lot of passes
+                const int limit=8;
+                for (int i=0; i<limit; ++i)
+                {
+                    const int current_render_target       = i&1;
+                    const int prev_and_next_render_target = current_render_target^1;
+                    
+                    Texture* source = renderTextureTemp[prev_and_next_render_target];
+                    if (i==0)
+                        source = shadowTarget; // first read comes from the frame buffer or shadow buffer
+                    
+                    RenderSetRenderTarget(renderContext, renderTextureTemp[current_render_target]);
+                    RenderDrawFullscreen(renderContext, shaderBlurX, source);
+                    
+                    if (i==limit-1)
+                        RenderSetRenderTarget(renderContext, shadowTarget);
+                    else
+                        RenderSetRenderTarget(renderContext, renderTextureTemp[prev_and_next_render_target]);
+                    
+                    RenderDrawFullscreen(renderContext, shaderBlurY, renderTextureTemp[current_render_target]);
+                }
             }
         }
         
-        if (true)
+        // single scattering instead of the blur: integrate each light's in-scatter along the lines of its
+        // 1d map at low resolution, then upsample additively over the shadow layer
+        else if (blur_mode == 2)
         {
-            // light prepass
-            
-            // setup one of the temporary render texture targets to receive the light pass.  We'll render
-            // out each light as an opaque OBB which approximates (conservatively) their area of influence
-            renderTextureInt->SetClearFlags(Texture::RenderTextureFlags::kClearColor, 0,0,0,1);
-            
-#if 1
-            RenderSetRenderTarget(renderContext, renderTextureInt);
-            RenderSetReplacementShader(renderContext, lightPrepassShader);
-#else
-            // see the obb and faces in perspective projection
-            RenderSetReplacementShader(renderContext, g_SimpleColorShader);
-#endif
-            
-            // RenderSetReplacementShader resets this for now
-            RenderSetBlendMode(Material::BlendMode::kOr);
-            
-            // save projection matrix
-            FixedVector<SceneObject*,32> lights;
-            SceneGetSceneObjectsByType(&lights, &scene, SceneObjectType::kLight);
-            for (int i=0,n=lights.Count(); i<n; ++i)
+            for (int i=0,n=shadowLights.Count(); i<n; ++i)
             {
-                SceneObject* lightObject = lights[i];
-                if (!SceneGetEnabled(lightObject))
-                    continue;
-                
+                SceneObject* lightObject = shadowLights[i];
                 Light* light = SceneObjectGetLight(lightObject);
-                if (light == nullptr)
-                    continue;
-                
-                if (light->m_Type == LightType::kDirectional)
-                    continue;
                 
-                light->m_Index = i;
-                RenderGlobalSetInt(renderContext, lightBitmaskIndex, 1U<<light->m_Index);
+                // light range in the 1d map's uv space, crops are square so x scale covers it
+                const Vec3 lightPosition = lightObject->m_LocalToWorld.GetTranslation();
+                const Vec2 screenPos = RenderGetScreenPos(renderContext, lightPosition).xy();
+                const Vec2 screenEdge = RenderGetScreenPos(renderContext, lightPosition + Vec3(light->m_Range, 0.0f, 0.0f)).xy();
+                const float mapScale = shadowLightScreenToCrop[i].m_X[0];
+                const float mapRange = Max((screenEdge - screenPos).Length() * mapScale, 1e-4f);
                 
-                const Vec3 cpMinusF = (renderContext->m_Camera.GetTranslation() - lightObject->m_LocalToWorld.GetTranslation()).Normalized();
+                Vec4 facing(0.0f, 0.0f, 0.0f, -2.0f);
+                if (light->m_Type == LightType::kConical)
+                {
+                    facing = lightObject->m_LocalToWorld.GetUp();
+                    facing.m_X[3] = light->m_CosAngle;
+                }
                 
-                // rotate toward camera
-                Mat4 transform;
-                transform.SetRight(-PlaneProj(lightObject->m_LocalToWorld.GetRight(), cpMinusF));
-                transform.SetUp(PlaneProj(lightObject->m_LocalToWorld.GetUp(), cpMinusF));
-                transform.SetForward(cpMinusF);
-                transform.SetTranslation(lightObject->m_LocalToWorld.GetTranslation());
+                lightShaftMaterial->SetVector(lightShaftLightPosition, shadowLightMapPos[i]);
+                lightShaftMaterial->SetVector(lightShaftLightColor, light->m_Color);
+                lightShaftMaterial->SetVector(lightShaftLightFacing, facing);
+                lightShaftMaterial->SetVector(lightShaftParams, Vec4(lightShaftDensity, lightShaftWindow*mapScale, 1.0f/mapRange, 0.0f));
                 
-                Mat4 axes;
-                MatrixMakeIdentity(&axes);
-                axes.SetRot(lightObject->m_Obb.m_Axes);
+                RenderSetRenderTarget(renderContext, lightShaftTarget);
+                RenderDrawFullscreen(renderContext, lightShaftMaterial, lightObject->m_Shadow1dMap);
+                RenderSetRenderTarget(renderContext, shadowTarget);
                 
-                Mat4 localToWorld = transform * axes;
-                SceneDrawObb(&scene, renderContext, lightObject, localToWorld);
+                lightShaftUpsampleMaterial->SetTexture(lightShaftUpsampleShadowMap, lightObject->m_Shadow1dMap);
+                lightShaftUpsampleMaterial->SetVector(lightShaftUpsampleLightPosition, shadowLightMapPos[i]);
+                lightShaftUpsampleMaterial->SetVector(lightShaftUpsampleScreenToCrop, shadowLightScreenToCrop[i]);
+                RenderDrawFullscreen(renderContext, lightShaftUpsampleMaterial, lightShaftTarget);
             }
-            
-            RenderSetReplacementShader(renderContext, nullptr);
-            RenderSetRenderTarget(renderContext, nullptr);
-            renderTextureInt->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
         }
         
-        // upload light data
+        // back up to the frame buffer.  The screen caster target guides the upsample when it was drawn this frame
+        if (shadowTarget != nullptr)
+        {
+            const bool hasScreenCasters = !useCasterCrops && shadowLights.Count() > 0;
+            ShadowAccumResolve(renderContext, shadowAccum, hasScreenCasters ? shadowCasterRenderTarget : nullptr);
+        }
+        
+        // the blur's scissor covered the upsample too
+        RenderClearScissor(renderContext);
+        
+        // upload light data and bin it into the light tiles
+        const double lightsStart = glfwGetTime();
         SceneLightsUpdate(&scene, renderContext);
+        benchLightsTime += glfwGetTime() - lightsStart;
+        
+        // gather the lights just uploaded into the probes, less what this frame's 1d maps occlude
+        if (probe_mode == 1)
+        {
+            IrradianceGridBegin(renderContext, irradianceGrid);
+            for (int i=0,n=shadowLights.Count(); i<n; ++i)
+            {
+                SceneObject* lightObject = shadowLights[i];
+                IrradianceGridShadow(renderContext, irradianceGrid, lightObject->m_Light.m_Type, lightObject->m_LightSlot,
+                                     lightObject->m_Shadow1dMap, shadowLightMapPos[i], shadowLightScreenToCrop[i]);
+            }
+            IrradianceGridEnd(renderContext, irradianceGrid, 1.0f);
+        }
         
         // draw actual scene
-        SceneDraw(&scene, renderContext);
+        if (lighting_mode == 0)
+        {
+            SceneDraw(&scene, renderContext);
+        }
+        else
+        {
+            // lit sprites into the G-buffer, light it, then the unlit sprites over the top
+            GBufferBegin(renderContext, gbuffer);
+            SceneDraw(&scene, renderContext);
+            constexpr PostEffectResolution lighting_resolutions[] = { kFull, kHalf, kQuarter };
+            GBufferResolve(renderContext, gbuffer, lighting_resolutions[lighting_resolution_mode],
+                           light_path_mode == 1 ? GBuffer::kLightVolumes : GBuffer::kLightTiles);
+            SceneDraw(&scene, renderContext);
+            GBufferEnd(renderContext, gbuffer);
+        }
+        
+        // only the scene samples the probes; next frame's shadow composite draws with the same shader
+        RenderSetIrradianceGrid(renderContext, nullptr, 0.0f);
         
         // debug: draw fullscreen
         switch (render_mode)
         {
             case 1:
             {
-                RenderDrawFullscreen(renderContext, debugLightPrepassSampleShader, renderTextureInt);
+                RenderDrawFullscreen(renderContext, debugLightTilesShader, whiteTexture);
                 break;
             }
             case 2:
@@ -705,10 +1303,21 @@ static void MainLoop(RenderContext* renderContext)
         
         // apply the user input
         ApplyUserInput(renderContext, s_SceneObject, s_Target);
-
+        
         ImGui::Render();
         
         running = RenderFrameEnd(renderContext);
+        
+        if (benchLights > 0 && ++benchFrames == kNumFramesStep)
+        {
+            const double frameTime = (glfwGetTime() - benchFrameStart) / benchFrames;
+            Printf("bench: %d lights, light update %.3f ms, frame %.3f ms\n", scene.m_PointLights.m_Count + scene.m_ConicalLights.m_Count + scene.m_CylindricalLights.m_Count,
+                   1000.0 * benchLightsTime / benchFrames, 1000.0 * frameTime);
+            
+            benchLightsTime = 0.0;
+            benchFrameStart = glfwGetTime();
+            benchFrames = 0;
+        }
     }
     
     DebugUi::Shutdown();
@@ -730,6 +1339,9 @@ static void MainLoop(RenderContext* renderContext)
     
     ShaderDestroy(shaderBlurX);
     ShaderDestroy(shaderBlurY);
+    BlurDestroy(blur);
+    BlurClDestroy(blurCl);
+    ShadowAccumDestroy(shadowAccum);
     
     for (int i=0; i<4; ++i)
         ShaderDestroy(shadowMap1dShaders[i]);
@@ -739,6 +1351,13 @@ static void MainLoop(RenderContext* renderContext)
         MaterialDestroy(shadow1dMaterials[i]);
     
     MaterialDestroy(shadowMapSampleMaterial);
+    MaterialDestroy(lightShaftMaterial);
+    MaterialDestroy(lightShaftUpsampleMaterial);
+    ShaderDestroy(lightShaftShader);
+    ShaderDestroy(lightShaftUpsampleShader);
+    TextureDestroy(lightShaftTarget);
+    ShadowClDestroy(shadowCl);
+    CasterAtlasDestroy(casterAtlas);
     
     TextureDestroy(treeAppleTexture);
     TextureDestroy(treeAppleNormal);
@@ -746,8 +1365,11 @@ static void MainLoop(RenderContext* renderContext)
     ShaderDestroy(planarShader);
     MaterialDestroy(treeAppleMaterial);
     
-    ShaderDestroy(lightPrepassShader);
-    ShaderDestroy(debugLightPrepassSampleShader);
+    ShaderDestroy(debugLightTilesShader);
+    GBufferDestroy(gbuffer);
+    IrradianceGridDestroy(irradianceGrid);
+    LightmapDestroy(lightmap);
+    ParticleLightsDestroy(particleLights);
     
     MaterialDestroy(debugMaterial);
     
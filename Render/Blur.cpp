@@ -0,0 +1,300 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/Blur.h"
+#include "Render/Material.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Shader.h"
+#include "Render/Texture.h"
+
+#include <math.h>
+
+// -------------------------------------------------------------------------------------------------
+int BlurGaussianWeights(float* dest, float sigma, int maxRadius)
+{
+    const int radius = Clamp((int) ceilf(3.0f*sigma), 1, maxRadius);
+    const float invTwoSigmaSquared = 1.0f / (2.0f*Max(sigma*sigma, 1e-4f));
+    
+    float sum = 0.0f;
+    for (int i=0; i<=radius; ++i)
+    {
+        dest[i] = expf(-float(i*i)*invTwoSigmaSquared);
+        sum += i == 0 ? dest[i] : 2.0f*dest[i];
+    }
+    
+    for (int i=0; i<=radius; ++i)
+        dest[i] /= sum;
+    
+    return radius;
+}
+
+// -------------------------------------------------------------------------------------------------
+int BlurKernelMaxRadius(bool linearTaps)
+{
+    // linear taps cover two texels each past the center
+    return linearTaps ? 2*(BlurKernel::kMaxTaps-1) : BlurKernel::kMaxTaps-1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// BlurKernelInit
+//
+// Linear taps merge texels (2i-1, 2i) into one fetch at their weighted centroid:
+// w = w0 + w1, offset = (o0*w0 + o1*w1) / w.
+void BlurKernelInit(BlurKernel* dest, float sigma, bool linearTaps)
+{
+    float discrete[2*BlurKernel::kMaxTaps];
+    const int radius = BlurGaussianWeights(discrete, sigma, BlurKernelMaxRadius(linearTaps));
+    
+    dest->m_Offsets[0] = 0.0f;
+    dest->m_Weights[0] = discrete[0];
+    
+    if (!linearTaps)
+    {
+        for (int i=1; i<=radius; ++i)
+        {
+            dest->m_Offsets[i] = float(i);
+            dest->m_Weights[i] = discrete[i];
+        }
+        dest->m_NumTaps = radius+1;
+        return;
+    }
+    
+    int numTaps = 1;
+    for (int i=1; i<=radius; i+=2)
+    {
+        const float w0 = discrete[i];
+        const float w1 = i+1 <= radius ? discrete[i+1] : 0.0f;
+        const float w = w0 + w1;
+        
+        dest->m_Weights[numTaps] = w;
+        dest->m_Offsets[numTaps] = (float(i)*w0 + float(i+1)*w1) / w;
+        numTaps++;
+    }
+    dest->m_NumTaps = numTaps;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_BlurCreateTarget
+//
+// Linear taps and the Kawase passes rely on bilinear filtering; render textures default to nearest.
+// BlurRender clears only what the passes will read, so binding never clears.
+static Texture* s_BlurCreateTarget(int width, int height)
+{
+    Texture* ret = TextureCreateRenderTexture(width, height, 0);
+    ret->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+    
+    RenderStateBindTexture(0, GL_TEXTURE_2D, ret->m_TextureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+Blur* BlurCreate(int width, int height)
+{
+    GL_ERROR_SCOPE();
+    
+    Blur* ret = new Blur();
+    
+    for (int i=0; i<2; ++i)
+        ret->m_Temp[i] = s_BlurCreateTarget(width, height);
+    
+    for (int i=0; i<Blur::kMaxLevels; ++i)
+    {
+        width = Max(width/2, 1);
+        height = Max(height/2, 1);
+        ret->m_Pyramid[i] = s_BlurCreateTarget(width, height);
+    }
+    
+    // passes write alpha 1, so blending overwrites without the depth writes kOpaque would do
+    ret->m_GaussianShader = ShaderCreate("obj/Shader/BlurGaussian");
+    ret->m_GaussianMaterial = MaterialCreate(ret->m_GaussianShader, nullptr);
+    ret->m_GaussianMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_GaussianMaterial->ReserveProperties(5);
+    ret->m_GaussianDirection = ret->m_GaussianMaterial->SetPropertyType("_BlurDirection", Material::MaterialPropertyType::kVec4);
+    ret->m_GaussianWeights[0] = ret->m_GaussianMaterial->SetPropertyType("_BlurWeights0", Material::MaterialPropertyType::kVec4);
+    ret->m_GaussianWeights[1] = ret->m_GaussianMaterial->SetPropertyType("_BlurWeights1", Material::MaterialPropertyType::kVec4);
+    ret->m_GaussianOffsets[0] = ret->m_GaussianMaterial->SetPropertyType("_BlurOffsets0", Material::MaterialPropertyType::kVec4);
+    ret->m_GaussianOffsets[1] = ret->m_GaussianMaterial->SetPropertyType("_BlurOffsets1", Material::MaterialPropertyType::kVec4);
+    
+    ret->m_KawaseDownShader = ShaderCreate("obj/Shader/BlurKawaseDown");
+    ret->m_KawaseDownMaterial = MaterialCreate(ret->m_KawaseDownShader, nullptr);
+    ret->m_KawaseDownMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_KawaseDownMaterial->ReserveProperties(1);
+    ret->m_KawaseDownOffset = ret->m_KawaseDownMaterial->SetPropertyType("_KawaseOffset", Material::MaterialPropertyType::kFloat);
+    
+    ret->m_KawaseUpShader = ShaderCreate("obj/Shader/BlurKawaseUp");
+    ret->m_KawaseUpMaterial = MaterialCreate(ret->m_KawaseUpShader, nullptr);
+    ret->m_KawaseUpMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_KawaseUpMaterial->ReserveProperties(1);
+    ret->m_KawaseUpOffset = ret->m_KawaseUpMaterial->SetPropertyType("_KawaseOffset", Material::MaterialPropertyType::kFloat);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void BlurDestroy(Blur* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    MaterialDestroy(victim->m_GaussianMaterial);
+    MaterialDestroy(victim->m_KawaseDownMaterial);
+    MaterialDestroy(victim->m_KawaseUpMaterial);
+    
+    ShaderDestroy(victim->m_GaussianShader);
+    ShaderDestroy(victim->m_KawaseDownShader);
+    ShaderDestroy(victim->m_KawaseUpShader);
+    
+    for (int i=0; i<2; ++i)
+        TextureDestroy(victim->m_Temp[i]);
+    for (int i=0; i<Blur::kMaxLevels; ++i)
+        TextureDestroy(victim->m_Pyramid[i]);
+    
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_BlurGaussian
+//
+// Variances add, so n passes of sigma/sqrt(n) blur by sigma.  Use the fewest passes whose kernel
+// still fits in BlurKernel::kMaxTaps.
+static void s_BlurGaussian(RenderContext* renderContext, Blur* blur, float sigma, bool linearTaps, Texture* target, const Vec4& clearRect)
+{
+    const float maxRadius = (float) BlurKernelMaxRadius(linearTaps);
+    const float reach = 3.0f*sigma / maxRadius;
+    const int numPasses = Max((int) ceilf(reach*reach), 1);
+    
+    // the second temp only carries results between passes
+    for (int i=0, n=numPasses > 1 ? 2 : 1; i<n; ++i)
+    {
+        RenderSetRenderTarget(renderContext, blur->m_Temp[i]);
+        RenderClearRect(renderContext, clearRect, renderContext->m_ClearColor);
+    }
+    
+    BlurKernel kernel;
+    BlurKernelInit(&kernel, sigma / sqrtf((float) numPasses), linearTaps);
+    
+    Material* material = blur->m_GaussianMaterial;
+    float weights[BlurKernel::kMaxTaps] = { 0.0f };
+    float offsets[BlurKernel::kMaxTaps] = { 0.0f };
+    for (int i=0; i<kernel.m_NumTaps; ++i)
+    {
+        weights[i] = kernel.m_Weights[i];
+        offsets[i] = kernel.m_Offsets[i];
+    }
+    material->SetVector(blur->m_GaussianWeights[0], Vec4(weights[0], weights[1], weights[2], weights[3]));
+    material->SetVector(blur->m_GaussianWeights[1], Vec4(weights[4], weights[5], weights[6], weights[7]));
+    material->SetVector(blur->m_GaussianOffsets[0], Vec4(offsets[0], offsets[1], offsets[2], offsets[3]));
+    material->SetVector(blur->m_GaussianOffsets[1], Vec4(offsets[4], offsets[5], offsets[6], offsets[7]));
+    
+    const float numTaps = (float) kernel.m_NumTaps;
+    for (int i=0; i<numPasses; ++i)
+    {
+        // first read comes from the target, last write goes back to it
+        Texture* source = i == 0 ? target : blur->m_Temp[1];
+        
+        material->SetVector(blur->m_GaussianDirection, Vec4(1.0f, 0.0f, numTaps, 0.0f));
+        RenderSetRenderTarget(renderContext, blur->m_Temp[0]);
+        RenderDrawFullscreen(renderContext, material, source);
+        
+        material->SetVector(blur->m_GaussianDirection, Vec4(0.0f, 1.0f, numTaps, 0.0f));
+        RenderSetRenderTarget(renderContext, i == numPasses-1 ? target : blur->m_Temp[1]);
+        RenderDrawFullscreen(renderContext, material, blur->m_Temp[0]);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_BlurKawaseLevels
+//
+// Each level of the pyramid roughly doubles the blur radius, so go about log2(sigma) levels deep.
+static int s_BlurKawaseLevels(float sigma)
+{
+    return Clamp((int) ceilf(log2f(Max(sigma, 1.0f))) + 1, 1, (int) Blur::kMaxLevels);
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_BlurDualKawase
+static void s_BlurDualKawase(RenderContext* renderContext, Blur* blur, float sigma, Texture* target, const Vec4& clearRect)
+{
+    const int numLevels = s_BlurKawaseLevels(sigma);
+    
+    for (int i=0; i<numLevels; ++i)
+    {
+        RenderSetRenderTarget(renderContext, blur->m_Pyramid[i]);
+        RenderClearRect(renderContext, clearRect, renderContext->m_ClearColor);
+    }
+    
+    blur->m_KawaseDownMaterial->SetFloat(blur->m_KawaseDownOffset, 1.0f);
+    blur->m_KawaseUpMaterial->SetFloat(blur->m_KawaseUpOffset, 1.0f);
+    
+    Texture* source = target;
+    for (int i=0; i<numLevels; ++i)
+    {
+        RenderSetRenderTarget(renderContext, blur->m_Pyramid[i]);
+        RenderDrawFullscreen(renderContext, blur->m_KawaseDownMaterial, source);
+        source = blur->m_Pyramid[i];
+    }
+    
+    for (int i=numLevels-2; i>=-1; --i)
+    {
+        RenderSetRenderTarget(renderContext, i >= 0 ? blur->m_Pyramid[i] : target);
+        RenderDrawFullscreen(renderContext, blur->m_KawaseUpMaterial, source);
+        if (i >= 0)
+            source = blur->m_Pyramid[i];
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// BlurGetRadius
+//
+// A level's down and up passes reach 1.5 of its texels each, 3 << level in the base resolution.
+int BlurGetRadius(Blur::Mode mode, float sigma)
+{
+    if (mode == Blur::Mode::kDualKawase)
+        return 3 << s_BlurKawaseLevels(sigma);
+    
+    return (int) ceilf(3.0f*sigma);
+}
+
+// -------------------------------------------------------------------------------------------------
+// BlurRender
+//
+// Under a scissor only part of each intermediate is written, and taps reach past that part by up to
+// the blur's radius.  Only that much of the intermediates this mode uses is cleared to what an
+// unshadowed frame holds, so the cost follows the shadowed region rather than the target.
+void BlurRender(RenderContext* renderContext, Blur* blur, Blur::Mode mode, float sigma, Texture* target)
+{
+    Vec4 clearRect(0.0f, 0.0f, 1.0f, 1.0f);
+    if (renderContext->m_ScissorEnabled)
+    {
+        const int radius = BlurGetRadius(mode, sigma);
+        const float paddingX = (float) radius / blur->m_Temp[0]->m_Width;
+        const float paddingY = (float) radius / blur->m_Temp[0]->m_Height;
+        
+        const Vec4& scissorRect = renderContext->m_ScissorRect;
+        clearRect = Vec4(scissorRect.m_X[0] - paddingX, scissorRect.m_X[1] - paddingY, scissorRect.m_X[2] + paddingX, scissorRect.m_X[3] + paddingY);
+    }
+    
+    switch (mode)
+    {
+        case Blur::Mode::kGaussian:
+        {
+            s_BlurGaussian(renderContext, blur, sigma, false, target, clearRect);
+            break;
+        }
+        case Blur::Mode::kGaussianLinear:
+        {
+            s_BlurGaussian(renderContext, blur, sigma, true, target, clearRect);
+            break;
+        }
+        case Blur::Mode::kDualKawase:
+        {
+            s_BlurDualKawase(renderContext, blur, sigma, target, clearRect);
+            break;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+struct Material;
+struct RenderContext;
+struct Shader;
+struct Texture;
+
+// Gaussian weights for one direction of a separable blur.  Tap 0 is the center; the rest are mirrored.
+// With linear taps each offset lands between two texels so one bilinear fetch returns both weights.
+struct BlurKernel
+{
+    enum { kMaxTaps = 8 };
+    
+    float m_Offsets[kMaxTaps];  // texels
+    float m_Weights[kMaxTaps];
+    int m_NumTaps;
+};
+
+// Normalized one sided Gaussian weights dest[0..radius], truncated at 3 sigma and at most maxRadius.
+// Returns the radius.
+int  BlurGaussianWeights(float* dest, float sigma, int maxRadius);
+
+// widest single pass radius, in texels, that fits in kMaxTaps
+int  BlurKernelMaxRadius(bool linearTaps);
+
+// weights for a kernel of standard deviation sigma texels
+void BlurKernelInit(BlurKernel* dest, float sigma, bool linearTaps);
+
+// Alternatives to the fixed 8x BlurX/BlurY chain in Main.cpp
+struct Blur
+{
+    enum Mode
+    {
+        kGaussian,        // point taps, runtime weights
+        kGaussianLinear,  // bilinear taps, half the fetches
+        kDualKawase       // downsample/upsample pyramid
+    };
+    
+    enum { kMaxLevels = 4 };
+    
+    Texture* m_Temp[2];
+    Texture* m_Pyramid[kMaxLevels];
+    
+    Shader* m_GaussianShader;
+    Shader* m_KawaseDownShader;
+    Shader* m_KawaseUpShader;
+    
+    Material* m_GaussianMaterial;
+    Material* m_KawaseDownMaterial;
+    Material* m_KawaseUpMaterial;
+    
+    int m_GaussianDirection;
+    int m_GaussianWeights[2];
+    int m_GaussianOffsets[2];
+    int m_KawaseDownOffset;
+    int m_KawaseUpOffset;
+};
+
+// width, height of the intermediate targets; the pyramid halves from there
+Blur* BlurCreate(int width, int height);
+void  BlurDestroy(Blur* victim);
+
+// how far one BlurRender spreads, in texels of the Blur's width and height
+int   BlurGetRadius(Blur::Mode mode, float sigma);
+
+// blur target in place, null for the frame buffer.  Gaussian modes split sigma over as many separable
+// passes as the kernel needs; dual Kawase picks a pyramid depth that roughly matches it.
+void  BlurRender(RenderContext* renderContext, Blur* blur, Blur::Mode mode, float sigma, Texture* target);
@@ -0,0 +1,313 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/BlurCl.h"
+#include "Render/Blur.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Shader.h"
+#include "Render/Texture.h"
+#include "Engine/Utils.h"
+
+#include <string.h>
+
+#if USE_CL
+
+#define kKernelPath "Render/Kernels/Blur.cl"
+
+// must match Blur.cl
+#define kTileSize 16
+#define kLineSize 64
+
+// -------------------------------------------------------------------------------------------------
+// s_BlurClCreateImages
+//
+// Same arrangement as ShadowCl: alias the GL textures when the context shares, otherwise stage.
+static bool s_BlurClCreateImages(RenderContext* renderContext, BlurCl* blurCl)
+{
+    int err = CL_SUCCESS;
+    
+    const int width = blurCl->m_Input->m_Width;
+    const int height = blurCl->m_Input->m_Height;
+    
+    cl_image_desc imageDesc;
+    memset(&imageDesc, 0, sizeof imageDesc);
+    imageDesc.image_type = CL_MEM_OBJECT_IMAGE2D;
+    imageDesc.image_width = width;
+    imageDesc.image_height = height;
+    
+    // row results between the two line dispatches never leave CL
+    cl_image_format tempFormat;
+    tempFormat.image_channel_order = CL_RGBA;
+    tempFormat.image_channel_data_type = CL_HALF_FLOAT;
+    blurCl->m_TempImage = clCreateImage(renderContext->m_Context, CL_MEM_READ_WRITE, &tempFormat, &imageDesc, nullptr, &err);
+    if (!blurCl->m_TempImage)
+        return false;
+    
+    if (renderContext->m_ClGlSharing)
+    {
+        blurCl->m_InputImage = clCreateFromGLTexture(renderContext->m_Context, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, blurCl->m_Input->m_TextureId, &err);
+        blurCl->m_OutputImage = clCreateFromGLTexture(renderContext->m_Context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, blurCl->m_Output->m_TextureId, &err);
+        
+        blurCl->m_Shared = blurCl->m_InputImage && blurCl->m_OutputImage;
+        if (blurCl->m_Shared)
+            return true;
+        
+        if (blurCl->m_InputImage)
+            clReleaseMemObject(blurCl->m_InputImage);
+        if (blurCl->m_OutputImage)
+            clReleaseMemObject(blurCl->m_OutputImage);
+    }
+    
+    blurCl->m_Shared = false;
+    
+    cl_image_format imageFormat;
+    imageFormat.image_channel_order = CL_RGBA;
+    imageFormat.image_channel_data_type = CL_UNORM_INT8;
+    
+    blurCl->m_InputImage = clCreateImage(renderContext->m_Context, CL_MEM_READ_ONLY, &imageFormat, &imageDesc, nullptr, &err);
+    blurCl->m_OutputImage = clCreateImage(renderContext->m_Context, CL_MEM_WRITE_ONLY, &imageFormat, &imageDesc, nullptr, &err);
+    blurCl->m_Staging = new uint8_t[width*height*4];
+    
+    return blurCl->m_InputImage && blurCl->m_OutputImage;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_BlurClMaxGroupSize
+//
+// What this kernel can run per group on the device, which its registers and the device's own limit
+// both cap.
+static size_t s_BlurClMaxGroupSize(RenderContext* renderContext, cl_kernel kernel)
+{
+    size_t deviceMax = 0;
+    size_t kernelMax = 0;
+    clGetDeviceInfo(renderContext->m_DeviceId, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof deviceMax, &deviceMax, nullptr);
+    clGetKernelWorkGroupInfo(kernel, renderContext->m_DeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof kernelMax, &kernelMax, nullptr);
+    return Min(deviceMax, kernelMax);
+}
+
+// -------------------------------------------------------------------------------------------------
+static size_t s_RoundUp(size_t value, size_t multiple)
+{
+    return (value + multiple-1) / multiple * multiple;
+}
+
+#endif
+
+// -------------------------------------------------------------------------------------------------
+BlurCl* BlurClCreate(RenderContext* renderContext, int width, int height)
+{
+#if USE_CL
+    GL_ERROR_SCOPE();
+    
+    if (renderContext->m_Context == nullptr)
+        return nullptr;
+    
+    BlurCl* ret = new BlurCl();
+    memset(ret, 0, sizeof *ret);
+    
+    ret->m_Input = TextureCreateRenderTexture(width, height, 0);
+    ret->m_Output = TextureCreateRenderTexture(width, height, 0);
+    
+    ret->m_Program = RenderClBuildProgram(renderContext, kKernelPath);
+    if (!ret->m_Program || !s_BlurClCreateImages(renderContext, ret))
+    {
+        BlurClDestroy(ret);
+        return nullptr;
+    }
+    
+    int err = CL_SUCCESS;
+    ret->m_TileKernel = clCreateKernel(ret->m_Program, "BlurTile", &err);
+    ret->m_LineKernel = clCreateKernel(ret->m_Program, "BlurLine", &err);
+    ret->m_Weights = clCreateBuffer(renderContext->m_Context, CL_MEM_READ_ONLY, (BlurCl::kMaxRadius+1)*sizeof(float), nullptr, &err);
+    
+    cl_ulong localMemSize = 0;
+    clGetDeviceInfo(renderContext->m_DeviceId, CL_DEVICE_LOCAL_MEM_SIZE, sizeof localMemSize, &localMemSize, nullptr);
+    ret->m_LocalMemSize = (size_t) localMemSize;
+    ret->m_WeightsSigma = -1.0f;
+    
+    if (!ret->m_TileKernel || !ret->m_LineKernel || !ret->m_Weights)
+    {
+        Printf("Error: Failed to create blur kernels!\n");
+        BlurClDestroy(ret);
+        return nullptr;
+    }
+    
+    // the group sizes are fixed in Blur.cl; a device that can't run a tile uses the line kernel for
+    // every radius, and one that can't run a line leaves the blur to GL
+    ret->m_TileFits = s_BlurClMaxGroupSize(renderContext, ret->m_TileKernel) >= kTileSize*kTileSize;
+    if (s_BlurClMaxGroupSize(renderContext, ret->m_LineKernel) < kLineSize)
+    {
+        Printf("Error: OpenCL work groups are too small for the blur kernels\n");
+        BlurClDestroy(ret);
+        return nullptr;
+    }
+    
+    return ret;
+#else
+    return nullptr;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+void BlurClDestroy(BlurCl* victim)
+{
+    if (victim == nullptr)
+        return;
+
+#if USE_CL
+    cl_mem memObjects[] = { victim->m_InputImage, victim->m_OutputImage, victim->m_TempImage, victim->m_Weights };
+    for (int i=0; i<(int)ELEMENTSOF(memObjects); ++i)
+    {
+        if (memObjects[i])
+            clReleaseMemObject(memObjects[i]);
+    }
+    
+    if (victim->m_TileKernel)
+        clReleaseKernel(victim->m_TileKernel);
+    if (victim->m_LineKernel)
+        clReleaseKernel(victim->m_LineKernel);
+    if (victim->m_Program)
+        clReleaseProgram(victim->m_Program);
+    
+    delete[] victim->m_Staging;
+#endif
+
+    TextureDestroy(victim->m_Input);
+    TextureDestroy(victim->m_Output);
+    
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// BlurClRender
+//
+// Nothing here drains either queue.  Shared images change hands through GL fences where the context
+// has cl_khr_gl_event; staged ones chain the upload, the kernels and the download by events, and the
+// host only waits on the download, right before GL needs it.
+void BlurClRender(RenderContext* renderContext, BlurCl* blurCl, float sigma, Texture* target)
+{
+#if USE_CL
+    GL_ERROR_SCOPE();
+    
+    cl_command_queue commands = renderContext->m_CommandQueue;
+    const int width = blurCl->m_Input->m_Width;
+    const int height = blurCl->m_Input->m_Height;
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { (size_t) width, (size_t) height, 1 };
+    
+    // the weights only change with sigma.  Uploading them blocking keeps a stack array from having to
+    // outlive the call, and costs nothing on the frames that skip it
+    if (sigma != blurCl->m_WeightsSigma)
+    {
+        float weights[BlurCl::kMaxRadius+1];
+        blurCl->m_Radius = BlurGaussianWeights(weights, sigma, BlurCl::kMaxRadius);
+        blurCl->m_WeightsSigma = sigma;
+        clEnqueueWriteBuffer(commands, blurCl->m_Weights, CL_TRUE, 0, (blurCl->m_Radius+1)*sizeof(float), weights, 0, nullptr, nullptr);
+    }
+    const int radius = blurCl->m_Radius;
+    
+    // bring the source over.  Under a scissor only part of it is copied, the rest holds the clear color
+    const Vec3& clearColor = renderContext->m_ClearColor;
+    blurCl->m_Input->SetClearFlags(Texture::RenderTextureFlags::kClearColor, clearColor.m_X[0], clearColor.m_X[1], clearColor.m_X[2]);
+    RenderSetRenderTarget(renderContext, blurCl->m_Input);
+    RenderDrawFullscreen(renderContext, g_SimpleShader, target);
+    
+    cl_mem glObjects[] = { blurCl->m_InputImage, blurCl->m_OutputImage };
+    cl_event uploaded = nullptr;
+    if (blurCl->m_Shared)
+    {
+        RenderClAcquireGLObjects(renderContext, glObjects, ELEMENTSOF(glObjects));
+    }
+    else
+    {
+        const GLuint prevReadFrameBuffer = RenderStateGetFrameBuffer(GL_READ_FRAMEBUFFER);
+        RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, blurCl->m_Input->m_FrameBufferId);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, blurCl->m_Staging);
+        RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, prevReadFrameBuffer);
+        
+        clEnqueueWriteImage(commands, blurCl->m_InputImage, CL_FALSE, origin, region, 0, 0, blurCl->m_Staging, 0, nullptr, &uploaded);
+    }
+    
+    const cl_uint numWaits = uploaded ? 1 : 0;
+    cl_event blurred = nullptr;
+    
+    const size_t apronSize = kTileSize + 2*radius;
+    const size_t tileLocalSize = (apronSize*apronSize + apronSize*kTileSize) * 4*sizeof(float);
+    if (blurCl->m_TileFits && tileLocalSize <= blurCl->m_LocalMemSize)
+    {
+        cl_kernel kernel = blurCl->m_TileKernel;
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &blurCl->m_InputImage);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &blurCl->m_OutputImage);
+        clSetKernelArg(kernel, 2, sizeof(cl_mem), &blurCl->m_Weights);
+        clSetKernelArg(kernel, 3, sizeof(int), &radius);
+        clSetKernelArg(kernel, 4, apronSize*apronSize*4*sizeof(float), nullptr);
+        clSetKernelArg(kernel, 5, apronSize*kTileSize*4*sizeof(float), nullptr);
+        
+        const size_t globalSize[2] = { s_RoundUp(width, kTileSize), s_RoundUp(height, kTileSize) };
+        const size_t localSize[2] = { kTileSize, kTileSize };
+        clEnqueueNDRangeKernel(commands, kernel, 2, nullptr, globalSize, localSize, numWaits, numWaits ? &uploaded : nullptr, &blurred);
+    }
+    else
+    {
+        // rows into the temp image, then columns out of it
+        const cl_mem inputs[2] = { blurCl->m_InputImage, blurCl->m_TempImage };
+        const cl_mem outputs[2] = { blurCl->m_TempImage, blurCl->m_OutputImage };
+        const cl_int2 directions[2] = { {{ 1, 0 }}, {{ 0, 1 }} };
+        const size_t lineLocalSize = (kLineSize + 2*radius) * 4*sizeof(float);
+        
+        cl_kernel kernel = blurCl->m_LineKernel;
+        for (int i=0; i<2; ++i)
+        {
+            clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputs[i]);
+            clSetKernelArg(kernel, 1, sizeof(cl_mem), &outputs[i]);
+            clSetKernelArg(kernel, 2, sizeof(cl_mem), &blurCl->m_Weights);
+            clSetKernelArg(kernel, 3, sizeof(int), &radius);
+            clSetKernelArg(kernel, 4, sizeof(cl_int2), &directions[i]);
+            clSetKernelArg(kernel, 5, lineLocalSize, nullptr);
+            
+            const size_t along = i == 0 ? width : height;
+            const size_t across = i == 0 ? height : width;
+            const size_t globalSize[2] = { s_RoundUp(along, kLineSize), across };
+            const size_t localSize[2] = { kLineSize, 1 };
+            
+            // rows wait on the upload, columns on the rows
+            cl_event waitFor = i == 0 ? uploaded : blurred;
+            cl_event done = nullptr;
+            clEnqueueNDRangeKernel(commands, kernel, 2, nullptr, globalSize, localSize, waitFor ? 1 : 0, waitFor ? &waitFor : nullptr, &done);
+            
+            if (blurred)
+                clReleaseEvent(blurred);
+            blurred = done;
+        }
+    }
+    
+    if (uploaded)
+        clReleaseEvent(uploaded);
+    
+    if (blurCl->m_Shared)
+    {
+        RenderClReleaseGLObjects(renderContext, glObjects, ELEMENTSOF(glObjects));
+    }
+    else
+    {
+        cl_event downloaded = nullptr;
+        clEnqueueReadImage(commands, blurCl->m_OutputImage, CL_FALSE, origin, region, 0, 0, blurCl->m_Staging, blurred ? 1 : 0, blurred ? &blurred : nullptr, &downloaded);
+        clFlush(commands);
+        
+        clWaitForEvents(1, &downloaded);
+        clReleaseEvent(downloaded);
+        
+        RenderStateBindTexture(0, GL_TEXTURE_2D, blurCl->m_Output->m_TextureId);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, blurCl->m_Staging);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    }
+    
+    if (blurred)
+        clReleaseEvent(blurred);
+    
+    // and back
+    RenderSetRenderTarget(renderContext, target);
+    RenderDrawFullscreen(renderContext, g_SimpleShader, blurCl->m_Output);
+#endif
+}
@@ -0,0 +1,46 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+
+struct RenderContext;
+struct Texture;
+
+// OpenCL Gaussian blur.  Work groups stage a tile and its apron in local memory and run both passes
+// out of it in one dispatch; radii whose apron doesn't fit, and devices whose work groups can't
+// hold a whole tile, fall back to a row dispatch and a column dispatch.  The source is copied into m_Input and the result drawn back from m_Output, so it costs
+// two fullscreen passes where the fragment chain in Main.cpp takes sixteen.
+struct BlurCl
+{
+    enum { kMaxRadius = 64 };
+    
+    Texture* m_Input;
+    Texture* m_Output;
+
+#if USE_CL
+    cl_program m_Program;
+    cl_kernel m_TileKernel;
+    cl_kernel m_LineKernel;
+    
+    cl_mem m_InputImage;
+    cl_mem m_OutputImage;
+    cl_mem m_TempImage;
+    cl_mem m_Weights;
+    
+    size_t m_LocalMemSize;
+    bool m_TileFits;       // the device runs BlurTile's kTileSize x kTileSize groups
+    float m_WeightsSigma;  // what m_Weights holds, uploaded only when sigma changes
+    int m_Radius;
+    bool m_Shared;
+    uint8_t* m_Staging;    // w*h rgba8, only without sharing
+#endif
+};
+
+// null if OpenCL isn't available, the kernels don't build or the device's work groups are too small
+// for either of them.  width, height of the blur targets
+BlurCl* BlurClCreate(RenderContext* renderContext, int width, int height);
+void    BlurClDestroy(BlurCl* victim);
+
+// blur target in place, null for the frame buffer.  The radius is 3 sigma, at most kMaxRadius
+void    BlurClRender(RenderContext* renderContext, BlurCl* blurCl, float sigma, Texture* target);
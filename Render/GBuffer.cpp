@@ -0,0 +1,360 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Engine/Utils.h"
+#include "Render/GBuffer.h"
+#include "Render/LightTiles.h"
+#include "Render/Material.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Shader.h"
+#include "Render/Texture.h"
+
+// how fast a light tap's weight falls off as its normal departs from the pixel's
+#define kNormalSharpness 2.0f
+
+// vertices in light.h's lightVolumeVertex shapes: a fan of kLightVolumeSegments triangles for point
+// and conical lights, a quad for cylindrical ones
+#define kVolumeFanVertices  (16*3)
+#define kVolumeBandVertices 6
+
+// where the volume path hands over to the tile lists.  A starting point rather than a measurement;
+// tune m_MaxVolumeLights for the target hardware
+#define kDefaultMaxVolumeLights 256
+
+// -------------------------------------------------------------------------------------------------
+// s_GBufferAllocate
+//
+// The targets are plain render textures, so they sample like any other; the G-buffer's own frame
+// buffer writes both at once.
+static bool s_GBufferAllocate(GBuffer* gbuffer, int width, int height)
+{
+    TextureDestroy(gbuffer->m_Albedo);
+    TextureDestroy(gbuffer->m_Normal);
+    gbuffer->m_Albedo = TextureCreateRenderTexture(width, height, 0, Texture::RenderTextureFormat::kRgba);
+    gbuffer->m_Normal = TextureCreateRenderTexture(width, height, 0, Texture::RenderTextureFormat::kRgba);
+    gbuffer->m_Width = width;
+    gbuffer->m_Height = height;
+    
+    if (gbuffer->m_FrameBufferId == 0)
+        glGenFramebuffers(1, &gbuffer->m_FrameBufferId);
+    
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, gbuffer->m_FrameBufferId);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gbuffer->m_Albedo->m_TextureId, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gbuffer->m_Normal->m_TextureId, 0);
+    
+    const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(ELEMENTSOF(drawBuffers), drawBuffers);
+    
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        Printf("Error - G-buffer %dx%d is not complete\n", width, height);
+        return false;
+    }
+    
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_GBufferAllocateLight
+//
+// Float, light goes past 1.  A new m_Light takes a new stencil frame buffer.
+static void s_GBufferAllocateLight(GBuffer* gbuffer, int width, int height)
+{
+    if (gbuffer->m_Light != nullptr && width == gbuffer->m_LightWidth && height == gbuffer->m_LightHeight)
+        return;
+    
+    TextureDestroy(gbuffer->m_Light);
+    gbuffer->m_Light = TextureCreateRenderTexture(width, height, 0, Texture::RenderTextureFormat::kFloat);
+    gbuffer->m_LightWidth = width;
+    gbuffer->m_LightHeight = height;
+    
+    if (gbuffer->m_VolumeFrameBufferId != 0)
+    {
+        RenderStateForgetFrameBuffer(gbuffer->m_VolumeFrameBufferId);
+        glDeleteFramebuffers(1, &gbuffer->m_VolumeFrameBufferId);
+        glDeleteRenderbuffers(1, &gbuffer->m_VolumeStencilId);
+        gbuffer->m_VolumeFrameBufferId = 0;
+        gbuffer->m_VolumeStencilId = 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_GBufferAllocateVolumes
+//
+// Packed depth and stencil, the stencil format every driver can attach.
+static bool s_GBufferAllocateVolumes(GBuffer* gbuffer)
+{
+    if (gbuffer->m_VolumeFrameBufferId != 0)
+        return true;
+    
+    glGenRenderbuffers(1, &gbuffer->m_VolumeStencilId);
+    glBindRenderbuffer(GL_RENDERBUFFER, gbuffer->m_VolumeStencilId);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, gbuffer->m_LightWidth, gbuffer->m_LightHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    
+    glGenFramebuffers(1, &gbuffer->m_VolumeFrameBufferId);
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, gbuffer->m_VolumeFrameBufferId);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gbuffer->m_Light->m_TextureId, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, gbuffer->m_VolumeStencilId);
+    
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        Printf("Error - light volume buffer %dx%d is not complete\n", gbuffer->m_LightWidth, gbuffer->m_LightHeight);
+        RenderStateForgetFrameBuffer(gbuffer->m_VolumeFrameBufferId);
+        glDeleteFramebuffers(1, &gbuffer->m_VolumeFrameBufferId);
+        glDeleteRenderbuffers(1, &gbuffer->m_VolumeStencilId);
+        gbuffer->m_VolumeFrameBufferId = 0;
+        gbuffer->m_VolumeStencilId = 0;
+        return false;
+    }
+    
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+GBuffer* GBufferCreate(const Shader* litShader)
+{
+    GBuffer* ret = new GBuffer();
+    ret->m_Albedo = nullptr;
+    ret->m_Normal = nullptr;
+    ret->m_FrameBufferId = 0;
+    ret->m_Width = 0;
+    ret->m_Height = 0;
+    ret->m_Light = nullptr;
+    ret->m_LightWidth = 0;
+    ret->m_LightHeight = 0;
+    ret->m_LitShader = litShader;
+    
+    ret->m_GBufferShader = ShaderCreate("obj/Shader/PlanarGBuffer");
+    
+    // blends over the frame buffer by coverage, the same way the lit sprites would have
+    ret->m_LightingShader = ShaderCreate("obj/Shader/DeferredLighting");
+    ret->m_LightingMaterial = MaterialCreate(ret->m_LightingShader, nullptr);
+    ret->m_LightingMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_LightingMaterial->ReserveProperties(1);
+    ret->m_NormalTexIndex = ret->m_LightingMaterial->SetPropertyType("_NormalTex", Material::MaterialPropertyType::kTexture);
+    
+    // reduced resolution: the light term overwrites its target, the upsample blends like the above
+    ret->m_AccumShader = ShaderCreate("obj/Shader/DeferredLightAccum");
+    ret->m_AccumMaterial = MaterialCreate(ret->m_AccumShader, nullptr);
+    ret->m_AccumMaterial->m_BlendMode = Material::BlendMode::kOpaque;
+    
+    ret->m_UpsampleShader = ShaderCreate("obj/Shader/DeferredLightingUpsample");
+    ret->m_UpsampleMaterial = MaterialCreate(ret->m_UpsampleShader, nullptr);
+    ret->m_UpsampleMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_UpsampleMaterial->ReserveProperties(3);
+    ret->m_UpsampleNormalTexIndex = ret->m_UpsampleMaterial->SetPropertyType("_NormalTex", Material::MaterialPropertyType::kTexture);
+    ret->m_UpsampleLightTexIndex = ret->m_UpsampleMaterial->SetPropertyType("_LightTex", Material::MaterialPropertyType::kTexture);
+    ret->m_UpsampleParamsIndex = ret->m_UpsampleMaterial->SetPropertyType("_UpsampleParams", Material::MaterialPropertyType::kVec4);
+    ret->m_UpsampleMaterial->SetVector(ret->m_UpsampleParamsIndex, Vec4(kNormalSharpness, 0.0f, 0.0f, 0.0f));
+    
+    // stencil light volumes: the mark pass writes stencil only, the light pass adds
+    ret->m_VolumeFrameBufferId = 0;
+    ret->m_VolumeStencilId = 0;
+    ret->m_VolumeBaseShader = ShaderCreate("obj/Shader/DeferredLightBase");
+    ret->m_MaxVolumeLights = kDefaultMaxVolumeLights;
+    
+    ret->m_VolumeMarkShader = ShaderCreate("obj/Shader/DeferredLightVolumeMark");
+    ret->m_VolumeMarkMaterial = MaterialCreate(ret->m_VolumeMarkShader, nullptr);
+    ret->m_VolumeMarkMaterial->m_BlendMode = Material::BlendMode::kOpaque;
+    ret->m_VolumeMarkMaterial->ReserveProperties(1);
+    ret->m_VolumeMarkLightIndex = ret->m_VolumeMarkMaterial->SetPropertyType("_VolumeLight", Material::MaterialPropertyType::kVec4);
+    
+    ret->m_VolumeShader = ShaderCreate("obj/Shader/DeferredLightVolume");
+    ret->m_VolumeMaterial = MaterialCreate(ret->m_VolumeShader, nullptr);
+    ret->m_VolumeMaterial->m_BlendMode = Material::BlendMode::kAdd;
+    ret->m_VolumeMaterial->ReserveProperties(1);
+    ret->m_VolumeLightIndex = ret->m_VolumeMaterial->SetPropertyType("_VolumeLight", Material::MaterialPropertyType::kVec4);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void GBufferDestroy(GBuffer* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    MaterialDestroy(victim->m_VolumeMaterial);
+    ShaderDestroy(victim->m_VolumeShader);
+    MaterialDestroy(victim->m_VolumeMarkMaterial);
+    ShaderDestroy(victim->m_VolumeMarkShader);
+    ShaderDestroy(victim->m_VolumeBaseShader);
+    if (victim->m_VolumeFrameBufferId != 0)
+    {
+        RenderStateForgetFrameBuffer(victim->m_VolumeFrameBufferId);
+        glDeleteFramebuffers(1, &victim->m_VolumeFrameBufferId);
+        glDeleteRenderbuffers(1, &victim->m_VolumeStencilId);
+    }
+    
+    MaterialDestroy(victim->m_UpsampleMaterial);
+    ShaderDestroy(victim->m_UpsampleShader);
+    MaterialDestroy(victim->m_AccumMaterial);
+    ShaderDestroy(victim->m_AccumShader);
+    MaterialDestroy(victim->m_LightingMaterial);
+    ShaderDestroy(victim->m_LightingShader);
+    ShaderDestroy(victim->m_GBufferShader);
+    TextureDestroy(victim->m_Albedo);
+    TextureDestroy(victim->m_Normal);
+    TextureDestroy(victim->m_Light);
+    if (victim->m_FrameBufferId != 0)
+    {
+        RenderStateForgetFrameBuffer(victim->m_FrameBufferId);
+        glDeleteFramebuffers(1, &victim->m_FrameBufferId);
+    }
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// GBufferBegin
+//
+// Cleared to zero: no albedo, no normal and no coverage.
+void GBufferBegin(RenderContext* renderContext, GBuffer* gbuffer)
+{
+    GL_ERROR_SCOPE();
+    
+    // follow window resizes
+    const int width = renderContext->m_Width;
+    const int height = renderContext->m_Height;
+    if (gbuffer->m_Albedo == nullptr || width != gbuffer->m_Width || height != gbuffer->m_Height)
+        s_GBufferAllocate(gbuffer, width, height);
+    
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, gbuffer->m_FrameBufferId);
+    glViewport(0, 0, width, height);
+    renderContext->m_TargetWidth = width;
+    renderContext->m_TargetHeight = height;
+    
+    glDisable(GL_SCISSOR_TEST);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    if (renderContext->m_ScissorEnabled)
+        RenderSetScissor(renderContext, renderContext->m_ScissorRect);
+    
+    renderContext->m_DeferredPass = RenderContext::kDeferredGBuffer;
+    renderContext->m_DeferredLitShader = gbuffer->m_LitShader;
+    renderContext->m_DeferredGBufferShader = gbuffer->m_GBufferShader;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_GBufferNumVolumeLights
+//
+// Black lights draw nothing, so only lit ones count toward m_MaxVolumeLights.
+static int s_GBufferNumVolumeLights(const LightTiles* lightTiles)
+{
+    int ret = 0;
+    for (int c=0; c<LightTiles::kNumClasses; ++c)
+    {
+        const LightTiles::Bounds& bounds = lightTiles->m_Bounds[c];
+        for (int i=0,n=bounds.m_Count; i<n; ++i)
+            ret += bounds.m_Radius[i] > 0.0f;
+    }
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_GBufferLightVolumes
+//
+// Light m_Light through the stencil, see GBuffer.h.  Every slot the light tiles hold is an instance;
+// the vertex shaders collapse the black ones.  The shapes mark the stencil together, so where they
+// overlap each still adds its own light, and a single clear per resolve is enough.
+static void s_GBufferLightVolumes(RenderContext* renderContext, GBuffer* gbuffer)
+{
+    static const int s_NumVertices[LightTiles::kNumClasses] = { kVolumeFanVertices, kVolumeFanVertices, kVolumeBandVertices };
+    
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, gbuffer->m_VolumeFrameBufferId);
+    glViewport(0, 0, gbuffer->m_LightWidth, gbuffer->m_LightHeight);
+    renderContext->m_TargetWidth = gbuffer->m_LightWidth;
+    renderContext->m_TargetHeight = gbuffer->m_LightHeight;
+    
+    glDisable(GL_SCISSOR_TEST);
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    
+    // overwrites every pixel
+    RenderDrawFullscreen(renderContext, gbuffer->m_VolumeBaseShader, gbuffer->m_Normal);
+    
+    const LightTiles* lightTiles = renderContext->m_LightTiles;
+    glEnable(GL_STENCIL_TEST);
+    
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilFunc(GL_ALWAYS, 1, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    for (int c=0; c<LightTiles::kNumClasses; ++c)
+    {
+        gbuffer->m_VolumeMarkMaterial->SetVector(gbuffer->m_VolumeMarkLightIndex, Vec4((float) c, 0.0f, 0.0f, 0.0f));
+        RenderDrawProcedural(renderContext, gbuffer->m_VolumeMarkMaterial, gbuffer->m_Normal, s_NumVertices[c], lightTiles->m_Bounds[c].m_Count);
+    }
+    
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilFunc(GL_EQUAL, 1, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    for (int c=0; c<LightTiles::kNumClasses; ++c)
+    {
+        gbuffer->m_VolumeMaterial->SetVector(gbuffer->m_VolumeLightIndex, Vec4((float) c, 0.0f, 0.0f, 0.0f));
+        RenderDrawProcedural(renderContext, gbuffer->m_VolumeMaterial, gbuffer->m_Normal, s_NumVertices[c], lightTiles->m_Bounds[c].m_Count);
+    }
+    
+    glDisable(GL_STENCIL_TEST);
+}
+
+// -------------------------------------------------------------------------------------------------
+// GBufferResolve
+//
+// Lighting in our art style is low frequency, so below full resolution only the albedo and the
+// edges the normals guide the upsample along need every pixel.  Light volumes always go through
+// m_Light, since the stencil lives with it.
+void GBufferResolve(RenderContext* renderContext, GBuffer* gbuffer, PostEffectResolution resolution, GBuffer::LightPath lightPath)
+{
+    GL_ERROR_SCOPE();
+    
+    // the lighting materials use their own shaders, so they can draw in the forward pass
+    renderContext->m_DeferredPass = RenderContext::kDeferredForward;
+    
+    // too many volumes overlap more than the tile lists cost
+    if (lightPath == GBuffer::kLightVolumes && gbuffer->m_MaxVolumeLights > 0 &&
+        s_GBufferNumVolumeLights(renderContext->m_LightTiles) > gbuffer->m_MaxVolumeLights)
+        lightPath = GBuffer::kLightTiles;
+    
+    if (resolution == kFull && lightPath == GBuffer::kLightTiles)
+    {
+        Material* material = gbuffer->m_LightingMaterial;
+        material->SetTexture(gbuffer->m_NormalTexIndex, gbuffer->m_Normal);
+        
+        RenderSetRenderTarget(renderContext, nullptr);
+        RenderDrawFullscreen(renderContext, material, gbuffer->m_Albedo);
+        return;
+    }
+    
+    // follow window resizes and resolution changes
+    const int divisor = PostEffectResolutionDivisor(resolution);
+    s_GBufferAllocateLight(gbuffer, Max(gbuffer->m_Width / divisor, 1), Max(gbuffer->m_Height / divisor, 1));
+    
+    if (lightPath == GBuffer::kLightVolumes && s_GBufferAllocateVolumes(gbuffer))
+    {
+        s_GBufferLightVolumes(renderContext, gbuffer);
+    }
+    else
+    {
+        gbuffer->m_Light->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+        RenderSetRenderTarget(renderContext, gbuffer->m_Light);
+        RenderDrawFullscreen(renderContext, gbuffer->m_AccumMaterial, gbuffer->m_Normal);
+    }
+    
+    Material* material = gbuffer->m_UpsampleMaterial;
+    material->SetTexture(gbuffer->m_UpsampleNormalTexIndex, gbuffer->m_Normal);
+    material->SetTexture(gbuffer->m_UpsampleLightTexIndex, gbuffer->m_Light);
+    
+    RenderSetRenderTarget(renderContext, nullptr);
+    RenderDrawFullscreen(renderContext, material, gbuffer->m_Albedo);
+}
+
+// -------------------------------------------------------------------------------------------------
+// GBufferEnd
+void GBufferEnd(RenderContext* renderContext, GBuffer* gbuffer)
+{
+    renderContext->m_DeferredPass = RenderContext::kDeferredNone;
+    renderContext->m_DeferredLitShader = nullptr;
+    renderContext->m_DeferredGBufferShader = nullptr;
+}
@@ -0,0 +1,91 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+#include "Render/PostEffect.h"
+
+struct Material;
+struct RenderContext;
+struct Shader;
+struct Texture;
+
+// Deferred path for planar lit sprites.  Instead of every lit sprite fragment running the light loop,
+// the scene is drawn twice around one lighting pass:
+//
+//   GBufferBegin       materials using the lit shader draw their albedo and _PlanarTex normal into
+//                      the G-buffer through PlanarGBuffer; everything else is skipped
+//   GBufferResolve     DeferredLighting runs the tile light lists once per covered pixel and blends
+//                      the result over the frame buffer.  At half or quarter resolution the light
+//                      term goes into m_Light on its own, and DeferredLightingUpsample applies albedo
+//                      at full resolution with an upsample guided by the G-buffer normals
+//   (scene again)      the remaining materials draw forward over it; lit ones are skipped
+//   GBufferEnd         back to drawing everything forward
+//
+// With kLightVolumes the light term is gathered without the tile lists.  DeferredLightBase starts
+// m_Light from the ambient, baked and directional light.  Every point, conical and cylindrical light
+// is then drawn twice as its shape, a disc, a fan or a band built in the vertex shader, with one
+// instanced draw per class each time: DeferredLightVolumeMark sets m_Light's stencil under the
+// shapes where something lit was drawn, and DeferredLightVolume adds each light where the stencil
+// is set.  DeferredLightingUpsample applies albedo at any resolution.  Past m_MaxVolumeLights the
+// overlapping shapes can cost more than the tile lists, so resolves fall back to them.
+//
+// Lighting cost no longer scales with sprite overdraw.  Lit sprites layered over one another light
+// with their blended normal, and unlit sprites land over every lit one rather than in sort order.
+struct GBuffer
+{
+    enum LightPath
+    {
+        kLightTiles,
+        kLightVolumes
+    };
+    
+    Texture* m_Albedo;           // rgba, premultiplied by coverage
+    Texture* m_Normal;           // planar normal in rg premultiplied by coverage, coverage in b
+    GLuint m_FrameBufferId;      // both of the above
+    int m_Width;
+    int m_Height;
+    
+    Texture* m_Light;            // reduced resolution light term, rgb
+    int m_LightWidth;
+    int m_LightHeight;
+    
+    const Shader* m_LitShader;   // not owned
+    Shader* m_GBufferShader;
+    Shader* m_LightingShader;
+    Material* m_LightingMaterial;
+    int m_NormalTexIndex;
+    
+    Shader* m_AccumShader;
+    Material* m_AccumMaterial;
+    Shader* m_UpsampleShader;
+    Material* m_UpsampleMaterial;
+    int m_UpsampleNormalTexIndex;
+    int m_UpsampleLightTexIndex;
+    int m_UpsampleParamsIndex;
+    
+    GLuint m_VolumeFrameBufferId; // m_Light with a stencil buffer, 0 until kLightVolumes is used
+    GLuint m_VolumeStencilId;
+    Shader* m_VolumeBaseShader;
+    Shader* m_VolumeMarkShader;
+    Material* m_VolumeMarkMaterial;
+    int m_VolumeMarkLightIndex;
+    Shader* m_VolumeShader;
+    Material* m_VolumeMaterial;
+    int m_VolumeLightIndex;
+    int m_MaxVolumeLights;        // lit lights kLightVolumes draws before using the tiles, 0 for any
+};
+
+// materials drawn with litShader go through the G-buffer
+GBuffer* GBufferCreate(const Shader* litShader);
+void     GBufferDestroy(GBuffer* victim);
+
+// size the G-buffer for the current screen, clear it and make it the render target
+void     GBufferBegin(RenderContext* renderContext, GBuffer* gbuffer);
+
+// light the G-buffer into the frame buffer, evaluating the lights at resolution through lightPath, and
+// switch to the forward draws
+void     GBufferResolve(RenderContext* renderContext, GBuffer* gbuffer, PostEffectResolution resolution,
+                        GBuffer::LightPath lightPath = GBuffer::kLightTiles);
+
+void     GBufferEnd(RenderContext* renderContext, GBuffer* gbuffer);
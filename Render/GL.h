@@ -15,14 +15,35 @@
 
 #include "Render/WindowsGL.h"
 
+// OpenCL is opt-in on Windows: define USE_CL=1 and link against an ICD loader (OpenCL.lib)
+#ifndef USE_CL
 #define USE_CL 0
+#endif
 
-#else
+#if USE_CL
+#define CL_TARGET_OPENCL_VERSION 120
+#include <CL/cl.h>
+#include <CL/cl_gl.h>
+#endif
+
+#elif defined(__APPLE__)
 
 #include <OpenCL/opencl.h>
 #include <OpenGL/gl3.h>
 #include <OpenGL/OpenGL.h>
 
+#define USE_CL 1
+
+#else
+
+// Linux and the other unixes: any ICD loader (ocl-icd, pocl, a vendor's) provides CL/cl.h
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/glcorearb.h>
+
+#define CL_TARGET_OPENCL_VERSION 120
+#include <CL/cl.h>
+#include <CL/cl_gl.h>
+
 #define USE_CL 1
 #endif
 
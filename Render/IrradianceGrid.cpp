@@ -0,0 +1,92 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/IrradianceGrid.h"
+#include "Render/Material.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Shader.h"
+#include "Render/Texture.h"
+
+// -------------------------------------------------------------------------------------------------
+IrradianceGrid* IrradianceGridCreate()
+{
+    IrradianceGrid* ret = new IrradianceGrid();
+    ret->m_Texture = nullptr;
+    ret->m_Width = 0;
+    ret->m_Height = 0;
+    
+    ret->m_AccumShader = ShaderCreate("obj/Shader/IrradianceGrid");
+    
+    // the occluded part comes off what the accumulation put in
+    ret->m_ShadowShader = ShaderCreate("obj/Shader/IrradianceGridShadow");
+    ret->m_ShadowMaterial = MaterialCreate(ret->m_ShadowShader, nullptr);
+    ret->m_ShadowMaterial->m_BlendMode = Material::BlendMode::kSubtract;
+    ret->m_ShadowMaterial->ReserveProperties(3);
+    ret->m_ShadowLightPositionIndex = ret->m_ShadowMaterial->SetPropertyType("_LightPosition", Material::MaterialPropertyType::kVec4);
+    ret->m_ShadowScreenToCropIndex = ret->m_ShadowMaterial->SetPropertyType("_ScreenToCrop", Material::MaterialPropertyType::kVec4);
+    ret->m_ShadowLightIndex = ret->m_ShadowMaterial->SetPropertyType("_ProbeLight", Material::MaterialPropertyType::kVec4);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void IrradianceGridDestroy(IrradianceGrid* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    MaterialDestroy(victim->m_ShadowMaterial);
+    ShaderDestroy(victim->m_ShadowShader);
+    ShaderDestroy(victim->m_AccumShader);
+    TextureDestroy(victim->m_Texture);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// IrradianceGridBegin
+void IrradianceGridBegin(RenderContext* renderContext, IrradianceGrid* irradianceGrid)
+{
+    const int width = Max((renderContext->m_Width + IrradianceGrid::kCellSize - 1) / IrradianceGrid::kCellSize, 1);
+    const int height = Max((renderContext->m_Height + IrradianceGrid::kCellSize - 1) / IrradianceGrid::kCellSize, 1);
+    
+    // follow window resizes.  Objects sample between probes, so unlike other render textures it filters
+    if (irradianceGrid->m_Texture == nullptr || width != irradianceGrid->m_Width || height != irradianceGrid->m_Height)
+    {
+        TextureDestroy(irradianceGrid->m_Texture);
+        irradianceGrid->m_Texture = TextureCreateRenderTexture(width, height, 0, Texture::RenderTextureFormat::kFloat);
+        irradianceGrid->m_Texture->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+        irradianceGrid->m_Width = width;
+        irradianceGrid->m_Height = height;
+        
+        RenderStateBindTexture(0, GL_TEXTURE_2D, irradianceGrid->m_Texture->m_TextureId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    }
+    
+    // every probe is written, nothing to clear
+    RenderSetRenderTarget(renderContext, irradianceGrid->m_Texture);
+    RenderDrawFullscreen(renderContext, irradianceGrid->m_AccumShader, (Texture*) nullptr);
+}
+
+// -------------------------------------------------------------------------------------------------
+// IrradianceGridShadow
+void IrradianceGridShadow(RenderContext* renderContext, IrradianceGrid* irradianceGrid, LightType type, int slot,
+                          Texture* shadow1dMap, const Vec4& mapPosition, const Vec4& screenToCrop)
+{
+    Material* material = irradianceGrid->m_ShadowMaterial;
+    material->SetVector(irradianceGrid->m_ShadowLightPositionIndex, mapPosition);
+    material->SetVector(irradianceGrid->m_ShadowScreenToCropIndex, screenToCrop);
+    material->SetVector(irradianceGrid->m_ShadowLightIndex, Vec4((float) type, (float) slot, 0.0f, 0.0f));
+    
+    RenderDrawFullscreen(renderContext, material, shadow1dMap);
+}
+
+// -------------------------------------------------------------------------------------------------
+// IrradianceGridEnd
+void IrradianceGridEnd(RenderContext* renderContext, IrradianceGrid* irradianceGrid, float weight)
+{
+    RenderSetRenderTarget(renderContext, nullptr);
+    RenderSetIrradianceGrid(renderContext, irradianceGrid->m_Texture, weight);
+}
@@ -0,0 +1,52 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Engine/Light.h"
+#include "Engine/Matrix.h"
+
+struct Material;
+struct RenderContext;
+struct Shader;
+struct Texture;
+
+// Coarse screen space probes for everything that isn't planar lit.  One probe per kCellSize pixel
+// cell gathers every uploaded point, conical and cylindrical light plus the ambient and baked
+// terms, facing every way at once, into a small float texture:
+//
+//   IrradianceGridBegin    one fullscreen pass over the probes loops over all of the lights
+//   IrradianceGridShadow   per shadowed light, subtracts the part its 1d map says is occluded
+//   IrradianceGridEnd      hands the grid to RenderSetIrradianceGrid
+//
+// SimpleTransparent and LitWaveFront2 then sample it once per vertex, so the cost is probes times
+// lights however many objects there are.  Directional lights are left to the shaders that have
+// normals for them.
+struct IrradianceGrid
+{
+    enum { kCellSize = 32 };     // pixels per probe
+    
+    Texture* m_Texture;          // rgb, linearly filtered
+    int m_Width;                 // probes
+    int m_Height;
+    
+    Shader* m_AccumShader;
+    Shader* m_ShadowShader;
+    Material* m_ShadowMaterial;
+    int m_ShadowLightPositionIndex;
+    int m_ShadowScreenToCropIndex;
+    int m_ShadowLightIndex;
+};
+
+IrradianceGrid* IrradianceGridCreate();
+void            IrradianceGridDestroy(IrradianceGrid* victim);
+
+// size the grid for the current screen and gather the lights uploaded this frame into it
+void            IrradianceGridBegin(RenderContext* renderContext, IrradianceGrid* irradianceGrid);
+
+// Take out what shadow1dMap occludes of the light in slot of type's array.  mapPosition and
+// screenToCrop are where the map was built, as for SampleShadowMap.
+void            IrradianceGridShadow(RenderContext* renderContext, IrradianceGrid* irradianceGrid, LightType type, int slot,
+                                     Texture* shadow1dMap, const Vec4& mapPosition, const Vec4& screenToCrop);
+
+// back to the frame buffer, with the grid applied to the non planar shaders at weight
+void            IrradianceGridEnd(RenderContext* renderContext, IrradianceGrid* irradianceGrid, float weight);
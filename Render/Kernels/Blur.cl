@@ -0,0 +1,86 @@
+// -*- mode: c; tab-width: 4; c-basic-offset: 4; -*-
+
+// Separable Gaussian blur with local memory tiling, see BlurCl.h.  weights[0..radius] are the one
+// sided weights from BlurGaussianWeights.
+
+#define kTileSize 16   // BlurTile work group is kTileSize x kTileSize, must match BlurCl.cpp
+#define kLineSize 64   // BlurLine work group is kLineSize x 1, must match BlurCl.cpp
+
+__constant sampler_t kSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// -------------------------------------------------------------------------------------------------
+// BlurTile
+//
+// One dispatch for both directions.  tile holds the group's pixels plus radius on every side, rows
+// the horizontal result for every row of the apron.  Out of range work items still load and hit the
+// barriers, they just don't write.
+__kernel void BlurTile(__read_only image2d_t input,
+                       __write_only image2d_t output,
+                       __constant float* weights,
+                       int radius,
+                       __local float4* tile,
+                       __local float4* rows)
+{
+    const int2 groupOrigin = (int2)(get_group_id(0), get_group_id(1)) * kTileSize;
+    const int2 lid = (int2)(get_local_id(0), get_local_id(1));
+    const int apronSize = kTileSize + 2*radius;
+    
+    for (int y=lid.y; y<apronSize; y+=kTileSize)
+    {
+        for (int x=lid.x; x<apronSize; x+=kTileSize)
+            tile[y*apronSize + x] = read_imagef(input, kSampler, groupOrigin + (int2)(x - radius, y - radius));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    // horizontal, every apron row for this column
+    for (int y=lid.y; y<apronSize; y+=kTileSize)
+    {
+        __local const float4* center = &tile[y*apronSize + lid.x + radius];
+        float4 c = center[0]*weights[0];
+        for (int i=1; i<=radius; ++i)
+            c += (center[i] + center[-i])*weights[i];
+        rows[y*kTileSize + lid.x] = c;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    // vertical
+    __local const float4* center = &rows[(lid.y + radius)*kTileSize + lid.x];
+    float4 c = center[0]*weights[0];
+    for (int i=1; i<=radius; ++i)
+        c += (center[i*kTileSize] + center[-i*kTileSize])*weights[i];
+    
+    const int2 pixel = groupOrigin + lid;
+    if (pixel.x < get_image_width(output) && pixel.y < get_image_height(output))
+        write_imagef(output, pixel, (float4)(c.xyz, 1.0f));
+}
+
+// -------------------------------------------------------------------------------------------------
+// BlurLine
+//
+// One direction for radii too wide for BlurTile's apron.  Each group covers kLineSize pixels of one
+// row (direction (1,0)) or column (direction (0,1)).
+__kernel void BlurLine(__read_only image2d_t input,
+                       __write_only image2d_t output,
+                       __constant float* weights,
+                       int radius,
+                       int2 direction,
+                       __local float4* line)
+{
+    const int lid = get_local_id(0);
+    const int along = get_group_id(0) * kLineSize;
+    const int2 across = (int2)(direction.y, direction.x) * (int) get_global_id(1);
+    const int apronSize = kLineSize + 2*radius;
+    
+    for (int i=lid; i<apronSize; i+=kLineSize)
+        line[i] = read_imagef(input, kSampler, direction*(along + i - radius) + across);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    __local const float4* center = &line[lid + radius];
+    float4 c = center[0]*weights[0];
+    for (int i=1; i<=radius; ++i)
+        c += (center[i] + center[-i])*weights[i];
+    
+    const int2 pixel = direction*(along + lid) + across;
+    if (pixel.x < get_image_width(output) && pixel.y < get_image_height(output))
+        write_imagef(output, pixel, (float4)(c.xyz, 1.0f));
+}
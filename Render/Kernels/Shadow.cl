@@ -0,0 +1,127 @@
+// -*- mode: c; tab-width: 4; c-basic-offset: 4; -*-
+
+// OpenCL versions of ShadowMap1d*.fsh and SampleShadowMap.fsh.  Plain OpenCL 1.1 with no vendor
+// extensions so CPU runtimes (pocl, Intel) can build it; work items are independent and branch
+// light, which is what lets their compilers vectorize across a work group.
+
+#define kPi         3.14159265359f
+#define kTwoPi      6.28318530718f
+#define kRootTwo    1.41421356237f
+
+#define kAlphaThreshold    0.9f
+#define kShadowBlendFactor 0.5f
+#define kDarkenFactor      0.5f
+#define kRaymarchSteps     1024
+
+// must match ShadowClLight in ShadowCl.h
+typedef struct
+{
+    float4 m_Position; // xy screen position in 0..1
+    float4 m_Facing;   // xy cone direction, w cos of the half angle.  w < -1 for lights without a cone
+    float4 m_Color;
+} ShadowClLight;
+
+__constant sampler_t kCasterSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// -------------------------------------------------------------------------------------------------
+// clampCircle from shader.h
+float2 ClampCircle(float2 uv)
+{
+    float2 absUv = fabs(uv);
+    uv /= fmax(absUv.x, absUv.y);
+    return (uv+1.0f)*0.5f;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowRaymarch
+//
+// One work item per 1d map texel per light, global size (shadowMapSize, numLights).  The shader walks
+// from the screen edge toward the light and keeps the last hit; walking from the light end and
+// stopping at the first hit visits the same samples and returns the same distance.
+__kernel void ShadowRaymarch(__read_only image2d_t casters,
+                             __global const ShadowClLight* lights,
+                             __global float* shadowMaps,
+                             int shadowMapSize)
+{
+    const int x = get_global_id(0);
+    const int lightIndex = get_global_id(1);
+    if (x >= shadowMapSize)
+        return;
+    
+    const ShadowClLight light = lights[lightIndex];
+    const float2 lightPos = light.m_Position.xy;
+    
+    const float theta = kPi + ((x + 0.5f) / shadowMapSize) * kTwoPi;
+    const float2 borderPoint = ClampCircle(kRootTwo*(float2)(cos(theta), sin(theta)));
+    const float2 ray = (lightPos - borderPoint) / (float) kRaymarchSteps;
+    
+    float d = kRootTwo;
+    for (int count=kRaymarchSteps-1; count>=0; --count)
+    {
+        const float2 itr = borderPoint + ray*(float)count;
+        if (itr.x>0.0f && itr.y>0.0f && itr.x<1.0f && itr.y<1.0f)
+        {
+            if (read_imagef(casters, kCasterSampler, itr).x > kAlphaThreshold)
+            {
+                d = distance(lightPos, itr);
+                break;
+            }
+        }
+    }
+    
+    // conical attenuation, ShadowMap1dConical.fsh
+    const float2 facingRay = normalize(lightPos - borderPoint);
+    if (dot(facingRay, -light.m_Facing.xy) < light.m_Facing.w)
+        d = kRootTwo;
+    
+    shadowMaps[lightIndex*shadowMapSize + x] = d;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowResolve
+//
+// One work item per output pixel.  Folds every light into a single layer: stacking n alpha blended
+// layers gives dst*T + C, so writing (C/(1-T), 1-T) and blending once is exact.
+__kernel void ShadowResolve(__global const ShadowClLight* lights,
+                            int numLights,
+                            __global const float* shadowMaps,
+                            int shadowMapSize,
+                            __write_only image2d_t output)
+{
+    const int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+    const int2 size = get_image_dim(output);
+    if (pixel.x >= size.x || pixel.y >= size.y)
+        return;
+    
+    const float2 uv = ((float2)(pixel.x, pixel.y) + 0.5f) / (float2)(size.x, size.y);
+    
+    float3 color = (float3)(0.0f, 0.0f, 0.0f);
+    float transmittance = 1.0f;
+    
+    for (int i=0; i<numLights; ++i)
+    {
+        const ShadowClLight light = lights[i];
+        const float2 lightPos = light.m_Position.xy;
+        const float lr = distance(lightPos, uv);
+        
+        // exit point of the ray from the light through uv on the -1,1 box, border() in shader.h
+        const float2 p0 = lightPos*2.0f - 1.0f;
+        const float2 dir = normalize((uv*2.0f - 1.0f) - p0);
+        const float2 tx = (float2)(dir.x > 0.0f ? ( 1.0f - p0.x) / dir.x : (dir.x < 0.0f ? (-1.0f - p0.x) / dir.x : MAXFLOAT),
+                                   dir.y > 0.0f ? ( 1.0f - p0.y) / dir.y : (dir.y < 0.0f ? (-1.0f - p0.y) / dir.y : MAXFLOAT));
+        const float2 exitPoint = p0 + dir*fmin(tx.x, tx.y);
+        
+        const float theta = (atan2(exitPoint.y, exitPoint.x) + kPi) / kTwoPi;
+        const int texel = clamp((int) (theta*shadowMapSize), 0, shadowMapSize-1);
+        
+        if (shadowMaps[i*shadowMapSize + texel] <= lr)
+        {
+            color = mix(color, light.m_Color.xyz*kDarkenFactor, kShadowBlendFactor);
+            transmittance *= 1.0f - kShadowBlendFactor;
+        }
+    }
+    
+    const float alpha = 1.0f - transmittance;
+    const float3 straight = alpha > 0.0f ? color/alpha : color;
+    write_imagef(output, pixel, (float4)(straight, alpha));
+}
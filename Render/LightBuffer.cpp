@@ -0,0 +1,239 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/LightBuffer.h"
+#include "Render/RenderState.h"
+
+#include <string.h>
+
+// glBufferStorage is GL 4.4; the macOS core profile stops at 4.1 so it only exists on Windows, and
+// there only if the driver hands back the entry point
+#if defined(WINDOWS) && defined(GL_MAP_PERSISTENT_BIT)
+#define LIGHT_BUFFER_PERSISTENT 1
+#else
+#define LIGHT_BUFFER_PERSISTENT 0
+#endif
+
+// smallest per type capacity
+#define kMinCapacity 32
+
+static const int s_LightTexels[LightBuffer::kNumTypes] =
+{
+    sizeof(LightBuffer::PointLight) / LightBuffer::kTexelSize,
+    sizeof(LightBuffer::ConicalLight) / LightBuffer::kTexelSize,
+    sizeof(LightBuffer::CylindricalLight) / LightBuffer::kTexelSize,
+    sizeof(LightBuffer::DirectionalLight) / LightBuffer::kTexelSize
+};
+
+// -------------------------------------------------------------------------------------------------
+// s_LightBufferWait
+static void s_LightBufferWait(LightBuffer* lightBuffer, int slice)
+{
+    GLsync fence = lightBuffer->m_Fences[slice];
+    if (fence == nullptr)
+        return;
+    
+    // flush on the first wait so the fence can't sit in an unsubmitted command buffer
+    GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    while (result == GL_TIMEOUT_EXPIRED)
+        result = glClientWaitSync(fence, 0, 1000000);
+    
+    glDeleteSync(fence);
+    lightBuffer->m_Fences[slice] = nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightBufferAllocate
+//
+// (Re)create the ring with kNumSlices slices of sliceSize bytes.  Any store still in flight stays
+// alive in the driver until the gpu is done with it, so nothing needs to wait here.
+static void s_LightBufferAllocate(LightBuffer* lightBuffer, GLsizeiptr sliceSize)
+{
+    for (int i=0; i<LightBuffer::kNumSlices; ++i)
+    {
+        if (lightBuffer->m_Fences[i] != nullptr)
+            glDeleteSync(lightBuffer->m_Fences[i]);
+        lightBuffer->m_Fences[i] = nullptr;
+    }
+    
+    if (lightBuffer->m_Buffer != 0)
+        glDeleteBuffers(1, &lightBuffer->m_Buffer);
+    
+    const GLsizeiptr size = sliceSize*LightBuffer::kNumSlices;
+    lightBuffer->m_SliceSize = sliceSize;
+    lightBuffer->m_Slice = -1;
+    lightBuffer->m_Mapped = nullptr;
+    memset(lightBuffer->m_SliceVersions, 0, sizeof(lightBuffer->m_SliceVersions));
+    memset(lightBuffer->m_SliceViews, 0, sizeof(lightBuffer->m_SliceViews));
+    
+    glGenBuffers(1, &lightBuffer->m_Buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer->m_Buffer);
+
+#if LIGHT_BUFFER_PERSISTENT
+    if (lightBuffer->m_Persistent)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_TEXTURE_BUFFER, size, nullptr, flags);
+        lightBuffer->m_Mapped = (uint8_t*) glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags);
+    }
+    else
+#endif
+    {
+        glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    
+    RenderStateBindTexture(0, GL_TEXTURE_BUFFER, lightBuffer->m_Texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer->m_Buffer);
+    
+    RenderStateBindTexture(0, GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// -------------------------------------------------------------------------------------------------
+LightBuffer* LightBufferCreate()
+{
+    LightBuffer* ret = new LightBuffer();
+    ret->m_Buffer = 0;
+#if LIGHT_BUFFER_PERSISTENT
+    ret->m_Persistent = glBufferStorage != nullptr;
+#else
+    ret->m_Persistent = false;
+#endif
+
+    for (int i=0; i<LightBuffer::kNumSlices; ++i)
+        ret->m_Fences[i] = nullptr;
+    GLsizeiptr sliceSize = 0;
+    for (int i=0; i<LightBuffer::kNumTypes; ++i)
+    {
+        ret->m_Capacities[i] = kMinCapacity;
+        ret->m_Offsets[i] = 0;
+        ret->m_Counts[i] = 0;
+        sliceSize += kMinCapacity*s_LightTexels[i]*LightBuffer::kTexelSize;
+    }
+    ret->m_FlushBegin = 0;
+    ret->m_FlushEnd = 0;
+    
+    glGenTextures(1, &ret->m_Texture);
+    s_LightBufferAllocate(ret, sliceSize);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void LightBufferDestroy(LightBuffer* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    for (int i=0; i<LightBuffer::kNumSlices; ++i)
+    {
+        if (victim->m_Fences[i] != nullptr)
+            glDeleteSync(victim->m_Fences[i]);
+    }
+    
+    RenderStateForgetTexture(victim->m_Texture);
+    glDeleteTextures(1, &victim->m_Texture);
+    glDeleteBuffers(1, &victim->m_Buffer);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightBufferBegin
+void LightBufferBegin(LightBuffer* lightBuffer, const int counts[LightBuffer::kNumTypes])
+{
+    // the previous slice's draws have all been issued by now
+    if (lightBuffer->m_Slice >= 0)
+    {
+        const int previous = lightBuffer->m_Slice;
+        if (lightBuffer->m_Fences[previous] != nullptr)
+            glDeleteSync(lightBuffer->m_Fences[previous]);
+        lightBuffer->m_Fences[previous] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    
+    // capacities only change when a type outgrows its array, which moves the arrays after it
+    bool grown = false;
+    for (int i=0; i<LightBuffer::kNumTypes; ++i)
+    {
+        lightBuffer->m_Counts[i] = counts[i];
+        while (counts[i] > lightBuffer->m_Capacities[i])
+        {
+            lightBuffer->m_Capacities[i] *= 2;
+            grown = true;
+        }
+    }
+    
+    int local[LightBuffer::kNumTypes];
+    int texels = 0;
+    for (int i=0; i<LightBuffer::kNumTypes; ++i)
+    {
+        local[i] = texels;
+        texels += lightBuffer->m_Capacities[i]*s_LightTexels[i];
+    }
+    
+    const GLsizeiptr sliceSize = texels*LightBuffer::kTexelSize;
+    if (sliceSize > lightBuffer->m_SliceSize)
+    {
+        s_LightBufferAllocate(lightBuffer, Max(sliceSize, lightBuffer->m_SliceSize*2));
+    }
+    else if (grown)
+    {
+        memset(lightBuffer->m_SliceVersions, 0, sizeof(lightBuffer->m_SliceVersions));
+        memset(lightBuffer->m_SliceViews, 0, sizeof(lightBuffer->m_SliceViews));
+    }
+    
+    const int slice = (lightBuffer->m_Slice + 1) % LightBuffer::kNumSlices;
+    s_LightBufferWait(lightBuffer, slice);
+    lightBuffer->m_Slice = slice;
+    
+    const int sliceTexels = (int) (lightBuffer->m_SliceSize / LightBuffer::kTexelSize);
+    for (int i=0; i<LightBuffer::kNumTypes; ++i)
+        lightBuffer->m_Offsets[i] = slice*sliceTexels + local[i];
+    
+    lightBuffer->m_FlushBegin = lightBuffer->m_SliceSize;
+    lightBuffer->m_FlushEnd = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightBufferWrite
+//
+// Without a persistent mapping the slice is mapped on the first write, unsynchronized since the fence
+// already covers it, and not invalidated since the rest of it is still good.
+void* LightBufferWrite(LightBuffer* lightBuffer, LightBuffer::Type type, int first, int count)
+{
+    const GLintptr sliceStart = lightBuffer->m_Slice*lightBuffer->m_SliceSize;
+    const GLintptr begin = (GLintptr) (lightBuffer->m_Offsets[type] + first*s_LightTexels[type])*LightBuffer::kTexelSize - sliceStart;
+    const GLintptr end = begin + count*s_LightTexels[type]*LightBuffer::kTexelSize;
+    
+    lightBuffer->m_FlushBegin = Min(lightBuffer->m_FlushBegin, begin);
+    lightBuffer->m_FlushEnd = Max(lightBuffer->m_FlushEnd, end);
+    
+    if (lightBuffer->m_Persistent)
+        return lightBuffer->m_Mapped + sliceStart + begin;
+    
+    if (lightBuffer->m_Mapped == nullptr)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer->m_Buffer);
+        lightBuffer->m_Mapped = (uint8_t*) glMapBufferRange(GL_TEXTURE_BUFFER, sliceStart, lightBuffer->m_SliceSize,
+                                                            GL_MAP_WRITE_BIT|GL_MAP_UNSYNCHRONIZED_BIT|GL_MAP_FLUSH_EXPLICIT_BIT);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+    
+    return lightBuffer->m_Mapped + begin;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightBufferEnd
+//
+// Persistent mappings are coherent, so only the per slice mapping has anything to do.  The written
+// bytes are flushed as one range; lights that change tend to sit together.
+void LightBufferEnd(LightBuffer* lightBuffer)
+{
+    if (lightBuffer->m_Persistent || lightBuffer->m_Mapped == nullptr)
+        return;
+    
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer->m_Buffer);
+    glFlushMappedBufferRange(GL_TEXTURE_BUFFER, lightBuffer->m_FlushBegin, lightBuffer->m_FlushEnd - lightBuffer->m_FlushBegin);
+    glUnmapBuffer(GL_TEXTURE_BUFFER);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    lightBuffer->m_Mapped = nullptr;
+}
@@ -0,0 +1,118 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+
+#include <stdint.h>
+
+// Every light the shaders read, in one buffer object viewed as an RGBA32F texture buffer.  The
+// buffer is a ring of kNumSlices frame slices; each frame writes the next slice through a mapping
+// and fences it once the frame's draws are queued, so the cpu never writes a slice the gpu may still
+// be reading and the driver never has to copy or stall.  Where glBufferStorage is available the
+// buffer stays mapped, otherwise a slice is mapped unsynchronized when something is written to it.
+//
+// Slices keep their contents, so a frame only rewrites the lights that changed since that slice was
+// last written; m_SliceVersions and m_SliceViews record what each one holds.  A static scene writes
+// nothing once every slice has caught up.
+//
+// Within a slice each type is a tight array of its own struct, mirrored in light.h, with room for
+// m_Capacities lights:
+//
+//   [point]        PointLight,       2 texels
+//   [conical]      ConicalLight,     3 texels
+//   [cylindrical]  CylindricalLight, 3 texels
+//   [directional]  DirectionalLight, 2 texels
+struct LightBuffer
+{
+    enum { kNumSlices = 3 };
+    enum { kTexelSize = 16 };
+    
+    enum Type
+    {
+        kPoint,
+        kConical,
+        kCylindrical,
+        kDirectional,
+        kNumTypes
+    };
+    
+    // screen space, see RenderUpdate*Lights
+    // profiles are LightProfiles rows, as floats
+    struct PointLight
+    {
+        float m_Position[2];
+        float m_Range;             // reciprocal
+        float m_RangeProfile;
+        float m_Color[4];
+    };
+    
+    struct ConicalLight
+    {
+        float m_Position[2];
+        float m_Direction[2];
+        float m_Color[3];
+        float m_Range;             // reciprocal
+        float m_CosAngle;
+        float m_RangeProfile;
+        float m_EdgeProfile;
+        float m_Pad;
+    };
+    
+    struct CylindricalLight
+    {
+        float m_Start[2];
+        float m_End[2];
+        float m_Color[3];
+        float m_OrthogonalRange;   // reciprocal
+        float m_RangeProfile;
+        float m_EdgeProfile;
+        float m_Pad[2];
+    };
+    
+    // world space
+    struct DirectionalLight
+    {
+        float m_Direction[4];
+        float m_Color[4];
+    };
+    
+    GLuint m_Buffer;
+    GLuint m_Texture;
+    bool m_Persistent;         // m_Mapped covers the whole ring for the buffer's lifetime
+    uint8_t* m_Mapped;         // the ring when persistent, else the current slice while it's open
+    
+    GLsizeiptr m_SliceSize;
+    int m_Slice;               // -1 before the first frame
+    GLsync m_Fences[kNumSlices];
+    
+    // slots per type, powers of two that only grow.  Growing moves the arrays and empties every slice
+    int m_Capacities[kNumTypes];
+    
+    // per slice, the light version each type's array is current to and the view generation its screen
+    // space lights were written with.  Maintained by the writer
+    uint32_t m_SliceVersions[kNumSlices][kNumTypes];
+    uint32_t m_SliceViews[kNumSlices];
+    
+    // current slice, texels from the start of the buffer
+    int m_Offsets[kNumTypes];
+    int m_Counts[kNumTypes];
+    
+    // bytes of the current slice written this frame, to flush
+    GLintptr m_FlushBegin;
+    GLintptr m_FlushEnd;
+};
+
+LightBuffer* LightBufferCreate();
+void         LightBufferDestroy(LightBuffer* victim);
+
+// Fence the slice the last frame drew from and move to the next, growing the ring if counts don't
+// fit.  Waits only if the gpu is still kNumSlices frames behind.
+void         LightBufferBegin(LightBuffer* lightBuffer, const int counts[LightBuffer::kNumTypes]);
+
+// write pointer for slots [first, first+count) of type's array in the current slice.  Write only, it
+// may be uncached memory.
+void*        LightBufferWrite(LightBuffer* lightBuffer, LightBuffer::Type type, int first, int count);
+
+// flush and unmap whatever was written
+void         LightBufferEnd(LightBuffer* lightBuffer);
@@ -0,0 +1,138 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Engine/Light.h"
+#include "Render/LightProfiles.h"
+#include "Render/RenderState.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// where kProfileCylinderEnd starts to fall off
+#define kCylinderEndCutoff 0.75f
+
+// -------------------------------------------------------------------------------------------------
+// s_LightProfilesUpload
+//
+// The whole atlas; it's a few kilobytes and only changes when a curve is added.
+static void s_LightProfilesUpload(LightProfiles* lightProfiles)
+{
+    RenderStateBindTexture(0, GL_TEXTURE_2D, lightProfiles->m_Texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, LightProfiles::kSize, lightProfiles->m_Count, 0, GL_RED, GL_FLOAT, lightProfiles->m_Curves);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightProfilesBuiltin
+static float s_LightProfilesBuiltin(LightProfile profile, float x)
+{
+    switch (profile)
+    {
+        case kProfileQuadratic:
+        {
+            return (1.0f - x)*(1.0f - x);
+        }
+        case kProfileLinear:
+        {
+            return 1.0f - x;
+        }
+        case kProfileCylinderEnd:
+        {
+            if (x < kCylinderEndCutoff)
+                return 1.0f;
+            
+            const float t = 1.0f - (x - kCylinderEndCutoff)/(1.0f - kCylinderEndCutoff);
+            return t*t;
+        }
+        case kProfileSmooth:
+        {
+            return 1.0f - x*x*(3.0f - 2.0f*x);
+        }
+        default:
+        {
+            return 0.0f;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+LightProfiles* LightProfilesCreate()
+{
+    LightProfiles* ret = new LightProfiles();
+    ret->m_Count = 0;
+    ret->m_Capacity = kNumBuiltinProfiles;
+    ret->m_Curves = (float*) malloc(ret->m_Capacity*LightProfiles::kSize*sizeof(float));
+    
+    glGenTextures(1, &ret->m_Texture);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, ret->m_Texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    
+    for (int i=0; i<kNumBuiltinProfiles; ++i)
+    {
+        float* curve = &ret->m_Curves[i*LightProfiles::kSize];
+        for (int j=0; j<LightProfiles::kSize; ++j)
+            curve[j] = s_LightProfilesBuiltin((LightProfile) i, (float) j / (LightProfiles::kSize-1));
+    }
+    ret->m_Count = kNumBuiltinProfiles;
+    
+    s_LightProfilesUpload(ret);
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void LightProfilesDestroy(LightProfiles* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    RenderStateForgetTexture(victim->m_Texture);
+    glDeleteTextures(1, &victim->m_Texture);
+    free(victim->m_Curves);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightProfilesAdd
+int LightProfilesAdd(LightProfiles* lightProfiles, const float* samples, int numSamples)
+{
+    if (samples == nullptr || numSamples < 1)
+        return -1;
+    
+    if (lightProfiles->m_Count == lightProfiles->m_Capacity)
+    {
+        lightProfiles->m_Capacity *= 2;
+        lightProfiles->m_Curves = (float*) realloc(lightProfiles->m_Curves, lightProfiles->m_Capacity*LightProfiles::kSize*sizeof(float));
+    }
+    
+    // linear resample onto kSize samples
+    const int row = lightProfiles->m_Count++;
+    float* curve = &lightProfiles->m_Curves[row*LightProfiles::kSize];
+    for (int j=0; j<LightProfiles::kSize; ++j)
+    {
+        const float s = (float) j / (LightProfiles::kSize-1) * (numSamples-1);
+        const int s0 = Min((int) s, numSamples-1);
+        const int s1 = Min(s0+1, numSamples-1);
+        const float f = s - s0;
+        curve[j] = samples[s0]*(1.0f-f) + samples[s1]*f;
+    }
+    
+    s_LightProfilesUpload(lightProfiles);
+    return row;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightProfilesEvaluate
+float LightProfilesEvaluate(const LightProfiles* lightProfiles, int profile, float x)
+{
+    const int row = Min(Max(profile, 0), lightProfiles->m_Count-1);
+    const float* curve = &lightProfiles->m_Curves[row*LightProfiles::kSize];
+    
+    const float s = Min(Max(x, 0.0f), 1.0f) * (LightProfiles::kSize-1);
+    const int s0 = Min((int) s, LightProfiles::kSize-2);
+    const float f = s - s0;
+    return curve[s0]*(1.0f-f) + curve[s0+1]*f;
+}
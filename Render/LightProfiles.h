@@ -0,0 +1,29 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+
+// Attenuation curves for the planar lights, one row each of an R32F texture that light.h samples
+// with linear filtering.  A light picks its rows by index (Light::m_RangeProfile, m_EdgeProfile), so
+// any falloff shape costs one fetch.  The first kNumBuiltinProfiles rows are the LightProfile curves.
+struct LightProfiles
+{
+    enum { kSize = 256 };      // samples per curve, over 0..1
+    
+    float* m_Curves;           // m_Count rows of kSize
+    int m_Count;
+    int m_Capacity;
+    
+    GLuint m_Texture;
+};
+
+LightProfiles* LightProfilesCreate();
+void           LightProfilesDestroy(LightProfiles* victim);
+
+// Add a curve from numSamples evenly spaced over 0..1, resampled to kSize, and upload the atlas.
+// Returns its row.
+int            LightProfilesAdd(LightProfiles* lightProfiles, const float* samples, int numSamples);
+
+// a curve at x on the CPU, filtered as light.h samples it
+float          LightProfilesEvaluate(const LightProfiles* lightProfiles, int profile, float x);
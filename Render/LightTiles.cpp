@@ -0,0 +1,318 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/LightTiles.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define LIGHT_TILES_SSE 1
+#else
+#define LIGHT_TILES_SSE 0
+#endif
+
+// radius for lights whose range is zero or negative, which Planar.fsh doesn't attenuate
+#define kUnboundedRadius 1.0e6f
+
+// -------------------------------------------------------------------------------------------------
+LightTiles* LightTilesCreate()
+{
+    LightTiles* ret = new LightTiles();
+    memset(ret->m_Bounds, 0, sizeof(ret->m_Bounds));
+    
+    ret->m_Width = 0;
+    ret->m_Height = 0;
+    ret->m_TilesX = 0;
+    ret->m_TilesY = 0;
+    
+    ret->m_Data = nullptr;
+    ret->m_DataSize = 0;
+    ret->m_DataCapacity = 0;
+    ret->m_Pairs = nullptr;
+    ret->m_NumPairs = 0;
+    ret->m_PairsCapacity = 0;
+    ret->m_Cursors = nullptr;
+    ret->m_MaxLightsPerTile = 0;
+    
+    glGenBuffers(1, &ret->m_Buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, ret->m_Buffer);
+    glBufferData(GL_TEXTURE_BUFFER, LightTiles::kHeaderSize*sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+    ret->m_BufferSize = LightTiles::kHeaderSize*sizeof(uint32_t);
+    
+    glGenTextures(1, &ret->m_Texture);
+    RenderStateBindTexture(0, GL_TEXTURE_BUFFER, ret->m_Texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, ret->m_Buffer);
+    
+    RenderStateBindTexture(0, GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void LightTilesDestroy(LightTiles* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    RenderStateForgetTexture(victim->m_Texture);
+    glDeleteTextures(1, &victim->m_Texture);
+    glDeleteBuffers(1, &victim->m_Buffer);
+    
+    for (int i=0; i<LightTiles::kNumClasses; ++i)
+    {
+        // one allocation, see s_LightTilesReserveBounds
+        free(victim->m_Bounds[i].m_MinX);
+    }
+    
+    free(victim->m_Data);
+    free(victim->m_Pairs);
+    free(victim->m_Cursors);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightTilesReserveBounds
+//
+// The seven arrays share one block, each a multiple of four floats so they stay 16 byte aligned.
+static void s_LightTilesReserveBounds(LightTiles::Bounds* bounds, int numLights)
+{
+    if (numLights <= bounds->m_Capacity)
+        return;
+    
+    const int capacity = (Max(numLights, bounds->m_Capacity*2) + 3) & ~3;
+    float* block = (float*) realloc(bounds->m_MinX, 7*capacity*sizeof(float));
+    
+    bounds->m_MinX = block;
+    bounds->m_MinY = block + capacity;
+    bounds->m_MaxX = block + 2*capacity;
+    bounds->m_MaxY = block + 3*capacity;
+    bounds->m_CenterX = block + 4*capacity;
+    bounds->m_CenterY = block + 5*capacity;
+    bounds->m_Radius = block + 6*capacity;
+    bounds->m_Capacity = capacity;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightTilesSetLights
+//
+// Planar.fsh works in ndc, twice screen uv, and fades point and conical lights out at 1/m_Range from
+// their position.  Cylinders only light points within 1/m_OrthogonalRange of the segment between
+// m_Position and m_Direction, so their rectangle is the segment's, grown by that much; the circle
+// around the rectangle adds nothing to the test.
+void LightTilesSetLights(LightTiles* lightTiles, LightTiles::Class lightClass, const Light* screenLights, int numLights)
+{
+    LightTiles::Bounds* bounds = &lightTiles->m_Bounds[lightClass];
+    s_LightTilesReserveBounds(bounds, numLights);
+    bounds->m_Count = numLights;
+    
+    for (int i=0,n=bounds->m_Count; i<n; ++i)
+    {
+        const Light& light = screenLights[i];
+        const Vec2 p0 = (light.m_Position.xy() + Vec2(1.0f, 1.0f)) * 0.5f;
+        
+        // black lights, which is what disabled lights and free slots are, reach nothing
+        if (light.m_Color.m_X[0] == 0.0f && light.m_Color.m_X[1] == 0.0f && light.m_Color.m_X[2] == 0.0f)
+        {
+            bounds->m_MinX[i] = bounds->m_MinY[i] = bounds->m_MaxX[i] = bounds->m_MaxY[i] = -1.0f;
+            bounds->m_CenterX[i] = bounds->m_CenterY[i] = -1.0f;
+            bounds->m_Radius[i] = 0.0f;
+            continue;
+        }
+        
+        if (lightClass == LightTiles::kCylindrical)
+        {
+            const Vec2 p1 = (light.m_Direction.xy() + Vec2(1.0f, 1.0f)) * 0.5f;
+            const float r = light.m_OrthogonalRange > 0.0f ? 0.5f / light.m_OrthogonalRange : kUnboundedRadius;
+            
+            bounds->m_MinX[i] = Min(p0.m_X[0], p1.m_X[0]) - r;
+            bounds->m_MinY[i] = Min(p0.m_X[1], p1.m_X[1]) - r;
+            bounds->m_MaxX[i] = Max(p0.m_X[0], p1.m_X[0]) + r;
+            bounds->m_MaxY[i] = Max(p0.m_X[1], p1.m_X[1]) + r;
+            
+            const float halfWidth = 0.5f * (bounds->m_MaxX[i] - bounds->m_MinX[i]);
+            const float halfHeight = 0.5f * (bounds->m_MaxY[i] - bounds->m_MinY[i]);
+            bounds->m_CenterX[i] = bounds->m_MinX[i] + halfWidth;
+            bounds->m_CenterY[i] = bounds->m_MinY[i] + halfHeight;
+            bounds->m_Radius[i] = sqrtf(halfWidth*halfWidth + halfHeight*halfHeight);
+        }
+        else
+        {
+            const float r = light.m_Range > 0.0f ? 0.5f / light.m_Range : kUnboundedRadius;
+            
+            bounds->m_MinX[i] = p0.m_X[0] - r;
+            bounds->m_MinY[i] = p0.m_X[1] - r;
+            bounds->m_MaxX[i] = p0.m_X[0] + r;
+            bounds->m_MaxY[i] = p0.m_X[1] + r;
+            bounds->m_CenterX[i] = p0.m_X[0];
+            bounds->m_CenterY[i] = p0.m_X[1];
+            bounds->m_Radius[i] = r;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightTilesTest4
+//
+// One bit per tile for the four tiles starting at column tx of a row: set if the tile comes within
+// sqrt(r2) of centerX, with dy2 the row's squared vertical distance from the center.
+static inline int s_LightTilesTest4(int tx, float tileWidth, float centerX, float dy2, float r2)
+{
+#if LIGHT_TILES_SSE
+    const __m128 x0 = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float) tx), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)), _mm_set1_ps(tileWidth));
+    const __m128 x1 = _mm_add_ps(x0, _mm_set1_ps(tileWidth));
+    const __m128 c = _mm_set1_ps(centerX);
+    
+    const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(x0, c), _mm_sub_ps(c, x1)), _mm_setzero_ps());
+    const __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(dy2));
+    
+    return _mm_movemask_ps(_mm_cmple_ps(d2, _mm_set1_ps(r2)));
+#else
+    int ret = 0;
+    for (int i=0; i<4; ++i)
+    {
+        const float x0 = (tx+i) * tileWidth;
+        const float x1 = x0 + tileWidth;
+        const float dx = Max(Max(x0 - centerX, centerX - x1), 0.0f);
+        if (dx*dx + dy2 <= r2)
+            ret |= 1<<i;
+    }
+    return ret;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_LightTilesAddPair
+static inline void s_LightTilesAddPair(LightTiles* lightTiles, int tile, int lightClass, int slot)
+{
+    if (lightTiles->m_NumPairs == lightTiles->m_PairsCapacity)
+    {
+        lightTiles->m_PairsCapacity = Max(lightTiles->m_PairsCapacity*2, 1024);
+        lightTiles->m_Pairs = (LightTiles::Pair*) realloc(lightTiles->m_Pairs, lightTiles->m_PairsCapacity*sizeof(LightTiles::Pair));
+    }
+    
+    LightTiles::Pair* pair = &lightTiles->m_Pairs[lightTiles->m_NumPairs++];
+    pair->m_Tile = (uint32_t) tile;
+    pair->m_Light = (uint32_t) lightClass<<LightTiles::kClassShift | (uint32_t) slot;
+    lightTiles->m_Cursors[tile*LightTiles::kNumClasses + lightClass]++;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightTilesBuild
+//
+// Bin every light into the tiles under its rectangle that pass the circle test, count per tile and
+// class, then lay the lists out in tile order.  Pairs are binned class by class and slot by slot, so
+// each list comes out sorted.
+void LightTilesBuild(LightTiles* lightTiles, int width, int height)
+{
+    const int tilesX = (Max(width, 1) + LightTiles::kTileSize-1) / LightTiles::kTileSize;
+    const int tilesY = (Max(height, 1) + LightTiles::kTileSize-1) / LightTiles::kTileSize;
+    const int numTiles = tilesX*tilesY;
+    
+    if (numTiles != lightTiles->m_TilesX*lightTiles->m_TilesY)
+        lightTiles->m_Cursors = (uint32_t*) realloc(lightTiles->m_Cursors, numTiles*LightTiles::kNumClasses*sizeof(uint32_t));
+    
+    lightTiles->m_Width = width;
+    lightTiles->m_Height = height;
+    lightTiles->m_TilesX = tilesX;
+    lightTiles->m_TilesY = tilesY;
+    lightTiles->m_NumPairs = 0;
+    memset(lightTiles->m_Cursors, 0, numTiles*LightTiles::kNumClasses*sizeof(uint32_t));
+    
+    // tiles per unit of screen uv, and the reverse
+    const float scaleX = (float) width / LightTiles::kTileSize;
+    const float scaleY = (float) height / LightTiles::kTileSize;
+    const float tileWidth = 1.0f / scaleX;
+    const float tileHeight = 1.0f / scaleY;
+    
+    for (int c=0; c<LightTiles::kNumClasses; ++c)
+    {
+        const LightTiles::Bounds* bounds = &lightTiles->m_Bounds[c];
+        for (int i=0,n=bounds->m_Count; i<n; ++i)
+        {
+            if (bounds->m_MaxX[i] < 0.0f || bounds->m_MaxY[i] < 0.0f || bounds->m_MinX[i] > 1.0f || bounds->m_MinY[i] > 1.0f)
+                continue;
+            
+            const int tx0 = Clamp((int) floorf(bounds->m_MinX[i]*scaleX), 0, tilesX-1);
+            const int ty0 = Clamp((int) floorf(bounds->m_MinY[i]*scaleY), 0, tilesY-1);
+            const int tx1 = Clamp((int) floorf(bounds->m_MaxX[i]*scaleX), 0, tilesX-1);
+            const int ty1 = Clamp((int) floorf(bounds->m_MaxY[i]*scaleY), 0, tilesY-1);
+            
+            const float centerX = bounds->m_CenterX[i];
+            const float centerY = bounds->m_CenterY[i];
+            const float r2 = bounds->m_Radius[i]*bounds->m_Radius[i];
+            
+            for (int ty=ty0; ty<=ty1; ++ty)
+            {
+                const float y0 = ty*tileHeight;
+                const float dy = Max(Max(y0 - centerY, centerY - (y0 + tileHeight)), 0.0f);
+                
+                for (int tx=tx0; tx<=tx1; tx+=4)
+                {
+                    int mask = s_LightTilesTest4(tx, tileWidth, centerX, dy*dy, r2);
+                    mask &= (1 << Min(tx1-tx+1, 4)) - 1;
+                    
+                    for (int k=0; mask != 0; ++k, mask >>= 1)
+                    {
+                        if (mask & 1)
+                            s_LightTilesAddPair(lightTiles, ty*tilesX + tx+k, c, i);
+                    }
+                }
+            }
+        }
+    }
+    
+    // headers, turning the counts into write cursors
+    const int dataSize = numTiles*LightTiles::kHeaderSize + lightTiles->m_NumPairs;
+    if (dataSize > lightTiles->m_DataCapacity)
+    {
+        lightTiles->m_DataCapacity = Max(dataSize, lightTiles->m_DataCapacity*2);
+        lightTiles->m_Data = (uint32_t*) realloc(lightTiles->m_Data, lightTiles->m_DataCapacity*sizeof(uint32_t));
+    }
+    lightTiles->m_DataSize = dataSize;
+    
+    uint32_t* data = lightTiles->m_Data;
+    uint32_t offset = numTiles*LightTiles::kHeaderSize;
+    int maxLightsPerTile = 0;
+    
+    for (int tile=0; tile<numTiles; ++tile)
+    {
+        uint32_t* header = &data[tile*LightTiles::kHeaderSize];
+        uint32_t* cursors = &lightTiles->m_Cursors[tile*LightTiles::kNumClasses];
+        
+        header[0] = offset;
+        for (int c=0; c<LightTiles::kNumClasses; ++c)
+        {
+            const uint32_t count = cursors[c];
+            header[1+c] = count;
+            cursors[c] = offset;
+            offset += count;
+        }
+        
+        maxLightsPerTile = Max(maxLightsPerTile, (int) (offset - header[0]));
+    }
+    lightTiles->m_MaxLightsPerTile = maxLightsPerTile;
+    
+    for (int i=0,n=lightTiles->m_NumPairs; i<n; ++i)
+    {
+        const LightTiles::Pair& pair = lightTiles->m_Pairs[i];
+        const uint32_t lightClass = pair.m_Light >> LightTiles::kClassShift;
+        const uint32_t slot = pair.m_Light & ((1u<<LightTiles::kClassShift) - 1);
+        data[lightTiles->m_Cursors[pair.m_Tile*LightTiles::kNumClasses + lightClass]++] = slot;
+    }
+    
+    // upload, orphaning last frame's store
+    const GLsizeiptr size = dataSize*sizeof(uint32_t);
+    if (size > lightTiles->m_BufferSize)
+        lightTiles->m_BufferSize = Max(size, lightTiles->m_BufferSize*2);
+    
+    glBindBuffer(GL_TEXTURE_BUFFER, lightTiles->m_Buffer);
+    glBufferData(GL_TEXTURE_BUFFER, lightTiles->m_BufferSize, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,84 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+#include "Engine/Light.h"
+
+#include <stdint.h>
+
+// Screen space light lists for Planar.fsh, binned on the CPU each frame.  The screen is cut into
+// kTileSize pixel tiles and each tile lists the point, conical and cylindrical lights that can reach
+// it.  Everything goes up in one R32UI texture buffer:
+//
+//   [tile*4 + 0]       offset of the tile's list
+//   [tile*4 + 1..3]    number of point, conical and cylindrical lights in it
+//   [offset ...]       slots into _PointLights, then _ConicalLights, then _CylindricalLights
+struct LightTiles
+{
+    enum { kTileSize = 16 };
+    enum { kHeaderSize = 4 };
+    
+    // order of the per tile lists, and of the RenderUpdate*Lights bounds
+    enum Class : uint32_t
+    {
+        kPoint,
+        kConical,
+        kCylindrical,
+        kNumClasses
+    };
+    
+    // screen uv influence of each uploaded light, SoA so the tile tests run four tiles at a time.  A
+    // light reaches a tile if the tile overlaps its rectangle and comes within radius of its center.
+    struct Bounds
+    {
+        float* m_MinX;
+        float* m_MinY;
+        float* m_MaxX;
+        float* m_MaxY;
+        float* m_CenterX;
+        float* m_CenterY;
+        float* m_Radius;
+        int m_Count;
+        int m_Capacity;
+    };
+    
+    // light is class << kClassShift | slot
+    enum { kClassShift = 30 };
+    struct Pair
+    {
+        uint32_t m_Tile;
+        uint32_t m_Light;
+    };
+    
+    Bounds m_Bounds[kNumClasses];
+    
+    int m_Width;               // pixels the tiles were built for
+    int m_Height;
+    int m_TilesX;
+    int m_TilesY;
+    
+    uint32_t* m_Data;          // header followed by the lists
+    int m_DataSize;
+    int m_DataCapacity;
+    
+    Pair* m_Pairs;             // in the order they were binned
+    int m_NumPairs;
+    int m_PairsCapacity;
+    
+    uint32_t* m_Cursors;       // kNumClasses per tile
+    int m_MaxLightsPerTile;    // last build, for the debug ui
+    
+    GLuint m_Buffer;
+    GLuint m_Texture;
+    GLsizeiptr m_BufferSize;
+};
+
+LightTiles* LightTilesCreate();
+void        LightTilesDestroy(LightTiles* victim);
+
+// replace one class's bounds from its uploaded (screen space, Planar.fsh units) lights
+void        LightTilesSetLights(LightTiles* lightTiles, LightTiles::Class lightClass, const Light* screenLights, int numLights);
+
+// bin everything set so far into width x height pixel tiles and upload the lists
+void        LightTilesBuild(LightTiles* lightTiles, int width, int height);
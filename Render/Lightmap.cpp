@@ -0,0 +1,130 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/Lightmap.h"
+#include "Render/RenderState.h"
+#include "Engine/Utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kLightmapMagic   0x50414d4c    // "LMAP"
+#define kLightmapVersion 1
+
+struct LightmapFileHeader
+{
+    uint32_t m_Magic;
+    uint32_t m_Version;
+    uint32_t m_Hash;
+    int32_t m_Width;
+    int32_t m_Height;
+    float m_WorldRect[4];
+};
+
+// -------------------------------------------------------------------------------------------------
+Lightmap* LightmapCreate(const Vec4& worldRect, int width, int height, uint32_t hash)
+{
+    Lightmap* ret = new Lightmap();
+    ret->m_WorldRect = worldRect;
+    ret->m_Width = width;
+    ret->m_Height = height;
+    ret->m_Hash = hash;
+    ret->m_Texels = (float*) calloc(width*height*3, sizeof(float));
+
+    glGenTextures(1, &ret->m_Texture);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, ret->m_Texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void LightmapDestroy(Lightmap* victim)
+{
+    if (victim == nullptr)
+        return;
+
+    RenderStateForgetTexture(victim->m_Texture);
+    glDeleteTextures(1, &victim->m_Texture);
+    free(victim->m_Texels);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightmapUpload
+void LightmapUpload(Lightmap* lightmap)
+{
+    // rows are 12 bytes a texel
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, lightmap->m_Texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, lightmap->m_Width, lightmap->m_Height, 0, GL_RGB, GL_FLOAT, lightmap->m_Texels);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightmapSave
+bool LightmapSave(const Lightmap* lightmap, const char* path)
+{
+    FILE* fh = fopen(path, "wb");
+    if (fh == nullptr)
+    {
+        Printf("LightmapSave: can't write %s\n", path);
+        return false;
+    }
+
+    LightmapFileHeader header;
+    header.m_Magic = kLightmapMagic;
+    header.m_Version = kLightmapVersion;
+    header.m_Hash = lightmap->m_Hash;
+    header.m_Width = lightmap->m_Width;
+    header.m_Height = lightmap->m_Height;
+    memcpy(header.m_WorldRect, lightmap->m_WorldRect.asFloat(), sizeof(header.m_WorldRect));
+
+    const size_t numFloats = (size_t) lightmap->m_Width*lightmap->m_Height*3;
+    const bool ok = fwrite(&header, sizeof(header), 1, fh) == 1 &&
+                    fwrite(lightmap->m_Texels, sizeof(float), numFloats, fh) == numFloats;
+    fclose(fh);
+
+    if (!ok)
+        Printf("LightmapSave: short write to %s\n", path);
+    return ok;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightmapLoad
+Lightmap* LightmapLoad(const char* path, uint32_t hash)
+{
+    FILE* fh = fopen(path, "rb");
+    if (fh == nullptr)
+        return nullptr;
+
+    LightmapFileHeader header;
+    if (fread(&header, sizeof(header), 1, fh) != 1 || header.m_Magic != kLightmapMagic || header.m_Version != kLightmapVersion ||
+        header.m_Hash != hash || header.m_Width <= 0 || header.m_Height <= 0)
+    {
+        fclose(fh);
+        return nullptr;
+    }
+
+    const Vec4 worldRect(header.m_WorldRect[0], header.m_WorldRect[1], header.m_WorldRect[2], header.m_WorldRect[3]);
+    Lightmap* ret = LightmapCreate(worldRect, header.m_Width, header.m_Height, hash);
+
+    const size_t numFloats = (size_t) header.m_Width*header.m_Height*3;
+    const bool ok = fread(ret->m_Texels, sizeof(float), numFloats, fh) == numFloats;
+    fclose(fh);
+
+    if (!ok)
+    {
+        Printf("LightmapLoad: %s is truncated\n", path);
+        LightmapDestroy(ret);
+        return nullptr;
+    }
+
+    LightmapUpload(ret);
+    return ret;
+}
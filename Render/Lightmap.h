@@ -0,0 +1,35 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+#include "Engine/Matrix.h"
+
+#include <stdint.h>
+
+// Baked light from the lights and shadow casters that never move, see Engine/LightmapBaker.h.  It
+// covers m_WorldRect of the kLightZ plane the screen lights are placed on, so it doesn't depend on
+// where the camera is.  RenderSetLightmap adds it to the planar and probe lighting.
+//
+// Saved as a small binary asset: a LightmapFileHeader, then m_Width*m_Height rgb floats, rows from
+// m_WorldRect's min y up.
+struct Lightmap
+{
+    Vec4 m_WorldRect;          // xy min, zw max
+    int m_Width;
+    int m_Height;
+    uint32_t m_Hash;           // of the bake inputs, to tell a stale asset from a current one
+    float* m_Texels;           // rgb
+    GLuint m_Texture;          // RGB16F, linearly filtered
+};
+
+Lightmap* LightmapCreate(const Vec4& worldRect, int width, int height, uint32_t hash);
+void      LightmapDestroy(Lightmap* victim);
+
+// copy m_Texels to m_Texture
+void      LightmapUpload(Lightmap* lightmap);
+
+bool      LightmapSave(const Lightmap* lightmap, const char* path);
+
+// null if the file is missing or unreadable, or was baked from other inputs than hash
+Lightmap* LightmapLoad(const char* path, uint32_t hash);
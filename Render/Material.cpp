@@ -6,12 +6,22 @@
 #include <string.h>
 #include <assert.h>
 
+#include "slib/Common/Util.h"
 #include "Engine/Matrix.h"
 #include "Render/Model.h"
 #include "Render/Render.h"
+#include "Render/RenderState.h"
 #include "Engine/Utils.h"
 #include "Render/Material.h"
 
+// -------------------------------------------------------------------------------------------------
+// s_MaterialNextVersion
+static inline uint32_t s_MaterialNextVersion()
+{
+    static uint32_t s_Version = 0;
+    return ++s_Version;
+}
+
 // -------------------------------------------------------------------------------------------------
 // create/destroy material
 Material* MaterialRef(Material* material)
@@ -24,6 +34,7 @@ Material* MaterialRef(Material* material)
     ret->m_NumMaterialProperties = material->m_NumMaterialProperties;
     ret->m_MaterialPropertyBlock = new Material::MaterialProperty[material->m_NumMaterialProperties];
     memcpy(ret->m_MaterialPropertyBlock, material->m_MaterialPropertyBlock, material->m_NumMaterialProperties*sizeof(Material::MaterialProperty));
+    ret->m_Version = s_MaterialNextVersion();
     
     return ret;
 }
@@ -39,6 +50,7 @@ Material* MaterialCreate(Shader* shader, Texture* texture)
     material->m_Texture = TextureRef(texture);
     material->m_NumMaterialProperties = 0;
     material->m_MaterialPropertyBlock = nullptr;
+    material->m_Version = s_MaterialNextVersion();
     
     return material;
 }
@@ -67,9 +79,12 @@ void MaterialDestroy(Material* victim)
 }
 
 // -------------------------------------------------------------------------------------------------
-void RenderSetMaterialProperty(int* textureSlots, GLuint programName, const Material::MaterialProperty* materialProperty)
+void RenderSetMaterialProperty(int* textureSlots, const Shader* shader, const Material::MaterialProperty* materialProperty)
 {
-    GLint slot = glGetUniformLocation(programName, materialProperty->m_Key);
+    if (materialProperty->m_Type == Material::kUnused)
+        return;
+    
+    GLint slot = ShaderGetUniformLocation(shader, materialProperty->m_Hash, materialProperty->m_Key);
     if (slot < 0)
         return;
     
@@ -99,9 +114,8 @@ void RenderSetMaterialProperty(int* textureSlots, GLuint programName, const Mate
         }
         case Material::kTexture:
         {
-            glActiveTexture(GL_TEXTURE0 + *textureSlots);
-            glBindTexture(GL_TEXTURE_2D, materialProperty->m_TextureId);
-            glProgramUniform1i(programName, slot, (*textureSlots)++);
+            RenderStateBindTexture(*textureSlots, GL_TEXTURE_2D, materialProperty->m_TextureId);
+            glProgramUniform1i(shader->m_ProgramName, slot, (*textureSlots)++);
             break;
         }
         case Material::kMat4:
@@ -129,6 +143,7 @@ void Material::ReserveProperties(int numProperties)
     m_NumMaterialProperties = numProperties;
     for (int i=0; i<numProperties; ++i)
         m_MaterialPropertyBlock[i].m_Type = Material::MaterialPropertyType::kUnused;
+    m_Version = s_MaterialNextVersion();
 }
 
 void Material::SetFloat(int index, float value)
@@ -137,6 +152,7 @@ void Material::SetFloat(int index, float value)
     Material::MaterialProperty* materialProperty = &m_MaterialPropertyBlock[index];
     assert(materialProperty->m_Type == Material::MaterialPropertyType::kFloat);
     materialProperty->m_Float = value;
+    m_Version = s_MaterialNextVersion();
 }
 
 void Material::SetInt(int index, int value)
@@ -145,6 +161,7 @@ void Material::SetInt(int index, int value)
     Material::MaterialProperty* materialProperty = &m_MaterialPropertyBlock[index];
     assert(materialProperty->m_Type == Material::MaterialPropertyType::kUInt);
     materialProperty->m_Int = value;
+    m_Version = s_MaterialNextVersion();
 }
 
 void Material::SetVector(int index, Vec4 value)
@@ -153,6 +170,7 @@ void Material::SetVector(int index, Vec4 value)
     Material::MaterialProperty* materialProperty = &m_MaterialPropertyBlock[index];
     assert(materialProperty->m_Type == Material::MaterialPropertyType::kVec4);
     materialProperty->m_Vector = value;
+    m_Version = s_MaterialNextVersion();
 }
 
 void Material::SetMatrix(int index, const Mat4& value)
@@ -161,6 +179,7 @@ void Material::SetMatrix(int index, const Mat4& value)
     Material::MaterialProperty* materialProperty = &m_MaterialPropertyBlock[index];
     assert(materialProperty->m_Type == Material::MaterialPropertyType::kMat4);
     materialProperty->m_Matrix = value;
+    m_Version = s_MaterialNextVersion();
 }
 
 void Material::SetTexture(int index, int textureId)
@@ -169,6 +188,7 @@ void Material::SetTexture(int index, int textureId)
     Material::MaterialProperty* materialProperty = &m_MaterialPropertyBlock[index];
     assert(materialProperty->m_Type == Material::MaterialPropertyType::kTexture);
     materialProperty->m_TextureId = textureId;
+    m_Version = s_MaterialNextVersion();
 }
 
 void Material::SetTexture(int index, Texture* texture)
@@ -195,6 +215,8 @@ int Material::SetPropertyType(const char* materialPropertyName, Material::Materi
         
         strncpy(materialProperty->m_Key, materialPropertyName, sizeof materialProperty->m_Key-1);
         materialProperty->m_Key[sizeof materialProperty->m_Key-1] = '\0';
+        materialProperty->m_Hash = Djb(materialProperty->m_Key);
+        m_Version = s_MaterialNextVersion();
     }
     
     return index;
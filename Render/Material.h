@@ -16,7 +16,9 @@ struct Material
         kOpaque,
         kCutout,
         kBlend,
-        kOr
+        kOr,
+        kAdd,
+        kSubtract      // destination minus source
     };
     
     enum MaterialPropertyType : uint32_t
@@ -34,6 +36,7 @@ struct Material
         enum { kNameMax = 31 };
         MaterialPropertyType m_Type;
         char m_Key[kNameMax+1];
+        uint32_t m_Hash;       // Djb of m_Key, for ShaderGetUniformLocation
         union
         {
             float m_Float;
@@ -65,6 +68,10 @@ struct Material
     BlendMode m_BlendMode;
     Shader* m_Shader;
     Texture* m_Texture;
+    
+    // restamped, unique across materials, whenever a property changes, so RenderUseMaterial can tell
+    // its uniforms are already in the program
+    uint32_t m_Version;
 };
 
 // create/destroy material
@@ -16,6 +16,7 @@
 #include "Render/Material.h"
 #include "Render/Model.h"
 #include "Render/PostEffect.h"
+#include "Render/RenderState.h"
 #include "Render/Texture.h"
 #include "Engine/Utils.h"
 #include "Tool/Utils.h"
@@ -44,6 +45,7 @@ void ModelClassManager::DestroyModelClass(ModelClass* victim)
         
         glDeleteBuffers(1, &modelClassSubset->m_VertexBufferName);
         glDeleteBuffers(1, &modelClassSubset->m_IndexBufferName);
+        RenderStateForgetVertexArray(modelClassSubset->m_VaoName);
         glDeleteVertexArrays(1, &modelClassSubset->m_VaoName);
         
         delete [] modelClassSubset->m_Vertices;
@@ -160,7 +162,7 @@ ModelClass* ModelClassManager::CreateModelClass(RenderContext* renderContext, co
                 
                 // generate vertex name
                 glGenVertexArrays(1, &modelClassSubset->m_VaoName);
-                glBindVertexArray(modelClassSubset->m_VaoName);
+                RenderStateBindVertexArray(modelClassSubset->m_VaoName);
                 
                 // generate vertex buffer name
                 glGenBuffers(1, &modelClassSubset->m_VertexBufferName);
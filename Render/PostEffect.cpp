@@ -14,6 +14,7 @@ PostEffect* PostEffectCreate(Shader* shader, PostEffectResolution resolution)
 {
     PostEffect* ret = new PostEffect();
     ret->m_Shader = ShaderRef(shader);
+    ret->m_Resolution = resolution;
     return ret;
 }
 
@@ -22,3 +23,17 @@ void PostEffectDestroy(PostEffect* victim)
     ShaderDestroy(victim->m_Shader);
     delete victim;
 }
+
+int PostEffectResolutionDivisor(PostEffectResolution resolution)
+{
+    switch (resolution)
+    {
+        case kFull:
+            return 1;
+        case kHalf:
+            return 2;
+        case kQuarter:
+            return 4;
+    }
+    return 1;
+}
@@ -9,11 +9,6 @@ struct Shader;
 struct Texture;
 struct RenderContext;
 
-struct PostEffect
-{
-    Shader* m_Shader;
-};
-
 enum PostEffectResolution : uint32_t
 {
     kFull,
@@ -21,5 +16,14 @@ enum PostEffectResolution : uint32_t
     kQuarter
 };
 
+struct PostEffect
+{
+    Shader* m_Shader;
+    PostEffectResolution m_Resolution;
+};
+
 PostEffect* PostEffectCreate(Shader* shader, PostEffectResolution resolution=kFull);
 void        PostEffectDestroy(PostEffect* victim);
+
+// screen width and height are divided by this at the given resolution
+int         PostEffectResolutionDivisor(PostEffectResolution resolution);
@@ -4,4 +4,4 @@
 
 #include "Render/Material.h"
 
-void RenderSetMaterialProperty(int* textureSlots, GLuint programName, const Material::MaterialProperty* materialProperty);
+void RenderSetMaterialProperty(int* textureSlots, const Shader* shader, const Material::MaterialProperty* materialProperty);
@@ -6,7 +6,7 @@ struct RenderContext;
 struct ModelClass;
 struct ModelClassSubset;
 
-void RenderSetGlobalConstants(RenderContext* renderContext, int* textureSlotItr, int programName);
+void RenderSetGlobalConstants(RenderContext* renderContext, int* textureSlotItr, const Shader* shader);
 void RenderSetLightConstants(RenderContext* renderContext, const Shader* shader);
 
 float RenderWorldToScreenDistance(RenderContext* renderContext, float worldDistance);
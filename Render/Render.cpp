@@ -2,6 +2,7 @@
 
 #include "Render/GL.h"
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -13,15 +14,26 @@
 #include "Engine/Matrix.h"
 #include "Render/Material.h"
 #include "Render/Model.h"
+#include "Render/LightBuffer.h"
+#include "Render/Lightmap.h"
+#include "Render/LightProfiles.h"
+#include "Render/LightTiles.h"
 #include "Render/PostEffect.h"
+#include "Render/RenderState.h"
 #include "Render/Texture.h"
 #include "Engine/Utils.h"
 #include "Tool/Utils.h"
 
-#define kPointLightBinding 2
-#define kCylindricalLightBinding 3
-#define kConicalLightBinding 4
-#define kDirectionalLightBinding 5
+#if USE_CL && !defined(WINDOWS) && !defined(__APPLE__)
+#include <GL/glx.h>
+#endif
+
+// texture units for _Lightmap, _IrradianceGrid, _LightProfiles, _Lights and _LightTiles, out of the way of material and global textures
+#define kLightmapTextureUnit 11
+#define kIrradianceGridTextureUnit 12
+#define kLightProfilesTextureUnit 13
+#define kLightsTextureUnit 14
+#define kLightTilesTextureUnit 15
 
 // -------------------------------------------------------------------------------------------------
 const char* GetGLErrorString(GLenum error)
@@ -94,38 +106,141 @@ GLErrorScope::~GLErrorScope()
 }
 #endif
 
+// -------------------------------------------------------------------------------------------------
+// s_CgFindDevice
+//
+// First device of the requested type on any platform.
+#if USE_CL
+static bool s_CgFindDevice(cl_platform_id* platformDest, cl_device_id* deviceDest, cl_device_type deviceType)
+{
+    cl_platform_id platformIds[8];
+    cl_uint numPlatforms = 0;
+    if (clGetPlatformIDs(ELEMENTSOF(platformIds), platformIds, &numPlatforms) != CL_SUCCESS)
+        return false;
+    
+    for (cl_uint i=0; i<numPlatforms && i<ELEMENTSOF(platformIds); ++i)
+    {
+        cl_uint numDevices = 0;
+        if (clGetDeviceIDs(platformIds[i], deviceType, 1, deviceDest, &numDevices) == CL_SUCCESS && numDevices > 0)
+        {
+            *platformDest = platformIds[i];
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_CgHasExtension
+static bool s_CgHasExtension(cl_device_id deviceId, const char* extension)
+{
+    size_t extensionSize = 0;
+    clGetDeviceInfo(deviceId, CL_DEVICE_EXTENSIONS, 0, nullptr, &extensionSize);
+    
+    char* extensions = new char[extensionSize+1];
+    clGetDeviceInfo(deviceId, CL_DEVICE_EXTENSIONS, extensionSize, extensions, nullptr);
+    extensions[extensionSize] = 0;
+    
+    const bool ret = strstr(extensions, extension) != nullptr;
+    delete[] extensions;
+    
+    return ret;
+}
+#endif
+
 // -------------------------------------------------------------------------------------------------
 // s_CgInit
 //
-// Initialize GL
-static bool s_CgInit(RenderContext* renderContext)
+// Initialize OpenCL.  Any conformant runtime works, including CPU only ones like pocl.  A context
+// that shares with GL is tried first and a plain one otherwise, in which case users of m_Context
+// have to stage GL data through host memory.  Not finding a device isn't fatal, m_Context is just
+// left null.
+static bool s_CgInit(RenderContext* renderContext, const RenderOptions& renderOptions)
 {
 #if USE_CL
-    CGLContextObj glContext = CGLGetCurrentContext();
-    CGLShareGroupObj shareGroup = CGLGetShareGroup(glContext);
-    // cl_context_properties properties[] =
-    // {
-    //     CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE,
-    //     (cl_context_properties)shareGroup,
-    //     0
-    // };
+    renderContext->m_Context = nullptr;
+    renderContext->m_CommandQueue = nullptr;
+    renderContext->m_DeviceId = nullptr;
+    renderContext->m_ClGlSharing = false;
+    renderContext->m_ClCreateEventFromGLsync = nullptr;
+    renderContext->m_NumClGlFences = 0;
+    
+    const bool preferCpu = renderOptions.m_ComputeDevice == RenderOptions::kComputeCpu;
+    const cl_device_type preferred = preferCpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU;
+    const cl_device_type fallback  = preferCpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+    
+    cl_platform_id platformId;
+    cl_device_id deviceId;
+    if (!s_CgFindDevice(&platformId, &deviceId, preferred) && !s_CgFindDevice(&platformId, &deviceId, fallback))
+    {
+        Printf("OpenCL: no device found, compute paths disabled\n");
+        return true;
+    }
     
-    gcl_gl_set_sharegroup(shareGroup);
+    char deviceName[256] = { 0 };
+    clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof deviceName - 1, deviceName, nullptr);
     
-    cl_device_id device_ids[2];
-    cl_uint num_devices;
-    int err = clGetDeviceIDs(NULL, CL_DEVICE_TYPE_GPU, 2, device_ids, &num_devices);
-    if (err != CL_SUCCESS)
+    int err = CL_SUCCESS;
+    cl_context context = nullptr;
+    
+#if defined(__APPLE__)
+    if (s_CgHasExtension(deviceId, "cl_APPLE_gl_sharing"))
     {
-        Printf("Error: Failed to create a device group!\n");
-        return false;
+        CGLContextObj glContext = CGLGetCurrentContext();
+        CGLShareGroupObj shareGroup = CGLGetShareGroup(glContext);
+        cl_context_properties properties[] =
+        {
+            CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE, (cl_context_properties) shareGroup,
+            0
+        };
+        context = clCreateContext(properties, 1, &deviceId, nullptr, nullptr, &err);
+    }
+#elif defined(WINDOWS)
+    if (s_CgHasExtension(deviceId, "cl_khr_gl_sharing"))
+    {
+        cl_context_properties properties[] =
+        {
+            CL_GL_CONTEXT_KHR,   (cl_context_properties) wglGetCurrentContext(),
+            CL_WGL_HDC_KHR,      (cl_context_properties) wglGetCurrentDC(),
+            CL_CONTEXT_PLATFORM, (cl_context_properties) platformId,
+            0
+        };
+        context = clCreateContext(properties, 1, &deviceId, nullptr, nullptr, &err);
+    }
+#else
+    // GLX only, there's no current GLX context under a native Wayland or EGL window
+    GLXContext glxContext = glXGetCurrentContext();
+    if (glxContext && s_CgHasExtension(deviceId, "cl_khr_gl_sharing"))
+    {
+        cl_context_properties properties[] =
+        {
+            CL_GL_CONTEXT_KHR,   (cl_context_properties) glxContext,
+            CL_GLX_DISPLAY_KHR,  (cl_context_properties) glXGetCurrentDisplay(),
+            CL_CONTEXT_PLATFORM, (cl_context_properties) platformId,
+            0
+        };
+        context = clCreateContext(properties, 1, &deviceId, nullptr, nullptr, &err);
+    }
+#endif
+    
+    renderContext->m_ClGlSharing = context != nullptr;
+    if (context && s_CgHasExtension(deviceId, "cl_khr_gl_event"))
+    {
+        void* function = clGetExtensionFunctionAddressForPlatform(platformId, "clCreateEventFromGLsyncKHR");
+        renderContext->m_ClCreateEventFromGLsync = (cl_event (CL_API_CALL*)(cl_context, cl_GLsync, cl_int*)) function;
     }
     
-    // cl_device_id device_id = device_ids[0];
-    cl_device_id device_id = device_ids[1];
+    if (context == nullptr)
+    {
+        cl_context_properties properties[] =
+        {
+            CL_CONTEXT_PLATFORM, (cl_context_properties) platformId,
+            0
+        };
+        context = clCreateContext(properties, 1, &deviceId, nullptr, nullptr, &err);
+    }
     
-    // create a compute context
-    cl_context context = renderContext->m_Context = clCreateContext(0, 1, &device_id, nullptr, nullptr, &err);
     if (!context)
     {
         Printf("Error: Failed to create a compute context!\n");
@@ -133,31 +248,171 @@ static bool s_CgInit(RenderContext* renderContext)
     }
     
     // create a command queue
-    cl_command_queue commands = renderContext->m_CommandQueue = clCreateCommandQueue(context, device_id, 0, &err);
+    cl_command_queue commands = clCreateCommandQueue(context, deviceId, 0, &err);
     if (!commands)
     {
         Printf("Error: Failed to create a command commands!\n");
+        clReleaseContext(context);
         return false;
     }
     
-    // size_t extensionSize;
-    // clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, 0, nullptr, &extensionSize);
-    // 
-    // char* extensions = new char[extensionSize];
-    // clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, extensionSize, extensions, nullptr);
-    // FPrintf(stderr, "\nDevice Extensions:\n");
-    // for (int i=0; i<(int)strlen(extensions); ++i)
-    // {
-    //     if (extensions[i] == ' ')
-    //         extensions[i] = '\n';
-    // }
-    // FPrintf(stderr, "%s\n", extensions);
-    // delete[] extensions;
+    renderContext->m_Context = context;
+    renderContext->m_CommandQueue = commands;
+    renderContext->m_DeviceId = deviceId;
+    
+    const char* sharing = renderContext->m_ClGlSharing ? (renderContext->m_ClCreateEventFromGLsync ? "gl sharing, gl events" : "gl sharing") : "host copies";
+    Printf("OpenCL: %s (%s)\n", deviceName, sharing);
 #endif
     
     return true;
 }
 
+// -------------------------------------------------------------------------------------------------
+// RenderClBuildProgram
+#if USE_CL
+cl_program RenderClBuildProgram(RenderContext* renderContext, const char* path)
+{
+    char* source = FileGetAsText(path);
+    if (source == nullptr)
+    {
+        Printf("Unable to find %s\n", path);
+        return nullptr;
+    }
+    
+    int err = CL_SUCCESS;
+    const char* sources[] = { source };
+    cl_program program = clCreateProgramWithSource(renderContext->m_Context, 1, sources, nullptr, &err);
+    delete[] source;
+    
+    if (!program)
+    {
+        Printf("Error: Failed to create compute program!\n");
+        return nullptr;
+    }
+    
+    err = clBuildProgram(program, 1, &renderContext->m_DeviceId, "-cl-fast-relaxed-math", nullptr, nullptr);
+    if (err != CL_SUCCESS)
+    {
+        size_t logLength = 0;
+        clGetProgramBuildInfo(program, renderContext->m_DeviceId, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logLength);
+        
+        char* log = new char[logLength+1];
+        clGetProgramBuildInfo(program, renderContext->m_DeviceId, CL_PROGRAM_BUILD_LOG, logLength, log, nullptr);
+        log[logLength] = 0;
+        Printf("%s build log:%s\n", path, log);
+        delete[] log;
+        
+        clReleaseProgram(program);
+        return nullptr;
+    }
+    
+    return program;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderClRetireFences
+//
+// cl_khr_gl_event leaves the sync object undefined for CL once it's deleted, so each fence lives
+// until its event has completed.  Completed ones are dropped, and with wait set the rest are waited
+// for first.
+static void s_RenderClRetireFences(RenderContext* renderContext, bool wait)
+{
+    int kept = 0;
+    for (int i=0; i<renderContext->m_NumClGlFences; ++i)
+    {
+        cl_event event = renderContext->m_ClGlFenceEvents[i];
+        if (wait)
+            clWaitForEvents(1, &event);
+        
+        cl_int status = CL_COMPLETE;
+        clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof status, &status, nullptr);
+        
+        // negative statuses are errors, the event won't be waited on either way
+        if (status <= CL_COMPLETE)
+        {
+            clReleaseEvent(event);
+            glDeleteSync(renderContext->m_ClGlFences[i]);
+            continue;
+        }
+        
+        renderContext->m_ClGlFences[kept] = renderContext->m_ClGlFences[i];
+        renderContext->m_ClGlFenceEvents[kept] = event;
+        ++kept;
+    }
+    
+    renderContext->m_NumClGlFences = kept;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderClAcquireGLObjects
+//
+// With cl_khr_gl_event the acquire waits on a fence behind the GL commands issued so far, so the
+// CPU carries on and the GPU goes straight from one to the other.  Without it the spec only promises
+// anything once GL has drained.
+void RenderClAcquireGLObjects(RenderContext* renderContext, const cl_mem* objects, int numObjects)
+{
+    cl_event glDone = nullptr;
+    if (renderContext->m_ClCreateEventFromGLsync)
+    {
+        s_RenderClRetireFences(renderContext, renderContext->m_NumClGlFences == RenderContext::kMaxClGlFences);
+        
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        
+        int err = CL_SUCCESS;
+        glDone = renderContext->m_ClCreateEventFromGLsync(renderContext->m_Context, (cl_GLsync) fence, &err);
+        if (glDone)
+        {
+            int index = renderContext->m_NumClGlFences++;
+            renderContext->m_ClGlFences[index] = fence;
+            renderContext->m_ClGlFenceEvents[index] = glDone;
+        }
+        else
+        {
+            glDeleteSync(fence);
+        }
+    }
+    
+    if (glDone == nullptr)
+        glFinish();
+    
+    clEnqueueAcquireGLObjects(renderContext->m_CommandQueue, numObjects, objects, glDone ? 1 : 0, glDone ? &glDone : nullptr, nullptr);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderClReleaseGLObjects
+//
+// cl_khr_gl_event also makes GL commands issued after the release wait for it, so the queue only
+// needs submitting.  Without it CL has to drain before GL touches the textures again.
+void RenderClReleaseGLObjects(RenderContext* renderContext, const cl_mem* objects, int numObjects)
+{
+    cl_command_queue commands = renderContext->m_CommandQueue;
+    clEnqueueReleaseGLObjects(commands, numObjects, objects, 0, nullptr, nullptr);
+    
+    if (renderContext->m_ClCreateEventFromGLsync)
+        clFlush(commands);
+    else
+        clFinish(commands);
+}
+#endif
+
+// -------------------------------------------------------------------------------------------------
+// s_CgFini
+static void s_CgFini(RenderContext* renderContext)
+{
+#if USE_CL
+    s_RenderClRetireFences(renderContext, true);
+    
+    if (renderContext->m_CommandQueue)
+        clReleaseCommandQueue(renderContext->m_CommandQueue);
+    if (renderContext->m_Context)
+        clReleaseContext(renderContext->m_Context);
+    
+    renderContext->m_CommandQueue = nullptr;
+    renderContext->m_Context = nullptr;
+#endif
+}
+
 // -------------------------------------------------------------------------------------------------
 // ResetFrameBufferTextureBuffers
 //
@@ -167,7 +422,7 @@ static void ResetFrameBufferTextureBuffers(RenderContext* renderContext)
     
     for (int i=0; i<2; ++i)
     {
-        glBindTexture(GL_TEXTURE_2D, renderContext->m_FrameBufferColorIds[i]);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, renderContext->m_FrameBufferColorIds[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -177,12 +432,12 @@ static void ResetFrameBufferTextureBuffers(RenderContext* renderContext)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         
-        glBindTexture(GL_TEXTURE_2D, 0);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
         
         renderContext->m_FrameBufferDepthIds[i] = -1;
         
         glGenTextures(1, &renderContext->m_FrameBufferDepthIds[i]);
-        glBindTexture(GL_TEXTURE_2D, renderContext->m_FrameBufferDepthIds[i]);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, renderContext->m_FrameBufferDepthIds[i]);
         
         glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, renderContext->m_Width, renderContext->m_Height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
         
@@ -194,12 +449,12 @@ static void ResetFrameBufferTextureBuffers(RenderContext* renderContext)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
         
-        glBindFramebuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[i]);
+        RenderStateBindFrameBuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[i]);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderContext->m_FrameBufferColorIds[i], 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderContext->m_FrameBufferDepthIds[i], 0);
     }
     
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, 0);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -287,6 +542,10 @@ void RenderInit(RenderContext* renderContext, const RenderOptions& renderOptions
     WindowsGLInit();
 #endif
     
+    // nothing is known about the new context
+    RenderStateInvalidate();
+    renderContext->m_CachedMaterial = nullptr;
+    
     // view setup
     glfwGetFramebufferSize(renderContext->m_Window, &width, &height);
     renderContext->m_Width = width;
@@ -326,23 +585,27 @@ void RenderInit(RenderContext* renderContext, const RenderOptions& renderOptions
     ModelClassInit(renderContext); // must happen after shader, texture init
     
     // enable depth test
-    glEnable(GL_DEPTH_TEST);
+    RenderStateSetDepthTest(true);
     
     // cull back faces
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     
     // initialize GL
-    if (!s_CgInit(renderContext))
+    if (!s_CgInit(renderContext, renderOptions))
         exit(1);
     
     renderContext->m_LastTime = 0.0f;
     renderContext->m_FrameCount = 0;
     renderContext->m_FrameRollover = 0;
     
+    renderContext->m_TargetWidth = renderContext->m_Width;
+    renderContext->m_TargetHeight = renderContext->m_Height;
+    renderContext->m_ScissorEnabled = false;
+    
     GLuint quadVertexArrayId;
     glGenVertexArrays(1, &quadVertexArrayId);
-    glBindVertexArray(quadVertexArrayId);
+    RenderStateBindVertexArray(quadVertexArrayId);
     
     const GLfloat quadVertexBufferData[] =
     {
@@ -377,30 +640,32 @@ void RenderInit(RenderContext* renderContext, const RenderOptions& renderOptions
     // replacement shader
     renderContext->m_ReplacementShader = nullptr;
     
-    // light ubo
-    glGenBuffers(1, &renderContext->m_PointLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_PointLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, kPointLightBinding, renderContext->m_PointLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    
-    glGenBuffers(1, &renderContext->m_ConicalLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_ConicalLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, kConicalLightBinding, renderContext->m_ConicalLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    
-    glGenBuffers(1, &renderContext->m_CylindricalLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_CylindricalLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, kCylindricalLightBinding, renderContext->m_CylindricalLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    
-    glGenBuffers(1, &renderContext->m_DirectionalLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_DirectionalLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, kDirectionalLightBinding, renderContext->m_DirectionalLightUbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    // forward until a G-buffer says otherwise
+    renderContext->m_DeferredPass = RenderContext::kDeferredNone;
+    renderContext->m_DeferredLitShader = nullptr;
+    renderContext->m_DeferredGBufferShader = nullptr;
+    
+    // light storage
+    renderContext->m_LightBuffer = LightBufferCreate();
+    memset(renderContext->m_ScreenLights, 0, sizeof(renderContext->m_ScreenLights));
+    memset(&renderContext->m_LightView, 0, sizeof(Mat4));
+    memset(&renderContext->m_LightProjection, 0, sizeof(Mat4));
+    renderContext->m_LightWidth = 0;
+    renderContext->m_LightHeight = 0;
+    renderContext->m_LightViewGeneration = 0;
+    renderContext->m_LightViewChanged = false;
+    renderContext->m_LightTilesDirty = true;
+    
+    // per tile light lists
+    renderContext->m_LightTiles = LightTilesCreate();
+    
+    // attenuation curves
+    renderContext->m_LightProfiles = LightProfilesCreate();
+    renderContext->m_AmbientLight = Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    renderContext->m_IrradianceGrid = nullptr;
+    renderContext->m_IrradianceGridWeight = 0.0f;
+    renderContext->m_Lightmap = nullptr;
+    renderContext->m_LightmapTransform = Vec4(0.0f, 0.0f, 0.0f, 0.0f);
     
     glfwSetFramebufferSizeCallback(renderContext->m_Window, s_WindowSizeCallback);
     glfwSetWindowUserPointer(renderContext->m_Window, renderContext);
@@ -429,6 +694,8 @@ void RenderInit(RenderContext* renderContext, const RenderOptions& renderOptions
 // RenderContextDestroy
 void RenderContextDestroy(RenderContext* renderContext)
 {
+    s_CgFini(renderContext);
+    
     // destroy "singleton" graphics assets
     TextureDestroy(renderContext->m_WhiteTexture);
     renderContext->m_WhiteTexture = nullptr;
@@ -440,146 +707,363 @@ void RenderContextDestroy(RenderContext* renderContext)
     
     free(renderContext->m_PostEffects);
     renderContext->m_PostEffects = nullptr;
+    
+    LightTilesDestroy(renderContext->m_LightTiles);
+    renderContext->m_LightTiles = nullptr;
+    
+    LightProfilesDestroy(renderContext->m_LightProfiles);
+    renderContext->m_LightProfiles = nullptr;
+    
+    LightBufferDestroy(renderContext->m_LightBuffer);
+    renderContext->m_LightBuffer = nullptr;
+    
+    for (int i=0; i<3; ++i)
+    {
+        free(renderContext->m_ScreenLights[i].m_Lights);
+        renderContext->m_ScreenLights[i].m_Lights = nullptr;
+    }
 }
 
 // -------------------------------------------------------------------------------------------------
-void RenderUpdatePointLights(RenderContext* renderContext, const Light* pointLights, int numPointLights)
+// s_RenderPointLightToScreen
+//
+// Lights are converted to screen space on the CPU so the light tiles can be binned from the same
+// data the shaders see.
+static void s_RenderPointLightToScreen(const RenderContext* renderContext, Light* dest, const Light* source)
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_PointLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY|GL_MAP_UNSYNCHRONIZED_BIT);
+    *dest = *source;
     
-    memset(p, 0, Light::kMaxLights*sizeof(Light));
+    const float range = source->m_Range;
+    const Vec3 adjustedLightPosition = Vec3(source->m_Position.xy(), kLightZ); // camera has fixed orientation, making this easier
+    const Vec3 adjustedLightPosition2 = adjustedLightPosition + Vec3(range, range, 0.0f);
     
-    uint32_t pointLightMask = 0;
+    const Vec3 screenPosition = RenderGetScreenPos(renderContext, adjustedLightPosition).xyz();
+    const Vec3 screenPosition2 = RenderGetScreenPos(renderContext, adjustedLightPosition2).xyz();
+    const float screenRange = (screenPosition - screenPosition2).Length();
+    dest->m_Position = Vec4(FromZeroOne(screenPosition), 1.0f);
+    dest->m_Range = 1.0f / screenRange;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderConicalLightToScreen
+static void s_RenderConicalLightToScreen(const RenderContext* renderContext, Light* dest, const Light* source)
+{
+    *dest = *source;
     
-    Light* base = (Light*)p;
-    for (int i=0; i<numPointLights; ++i)
-    {
-        const Light* source = &pointLights[i];
-        Light* dest = &base[source->m_Index];
-        
-        pointLightMask |= 1ULL<<source->m_Index;
-        
-        *dest = *source;
-        
-        const float range = pointLights[i].m_Range;
-        const Vec3 adjustedLightPosition = Vec3(pointLights[i].m_Position.xy(), kLightZ); // camera has fixed orientation, making this easier
-        const Vec3 adjustedLightPosition2 = adjustedLightPosition + Vec3(range, range, 0.0f);
-        
-        const Vec3 screenPosition = RenderGetScreenPos(renderContext, adjustedLightPosition).xyz();
-        const Vec3 screenPosition2 = RenderGetScreenPos(renderContext, adjustedLightPosition2).xyz();
-        const float screenRange = (screenPosition - screenPosition2).Length();
-        dest[i].m_Position = Vec4(FromZeroOne(screenPosition), 1.0f);
-        dest[i].m_Range = 1.0f / screenRange;
-        dest[i].m_Index = pointLights[i].m_Index;
-    }
+    const float range = source->m_Range;
     
-    glUnmapBuffer(GL_UNIFORM_BUFFER);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    const Vec3 adjustedLightPosition = Vec3(source->m_Position.xy(), kLightZ); // camera has fixed orientation, making this easier
+    const Vec3 adjustedLightPosition2 = adjustedLightPosition + Vec3(range*source->m_Direction.xy(), 0.0f);
+    const Vec3 screenPosition = RenderGetScreenPos(renderContext, adjustedLightPosition).xyz();
+    const Vec3 screenPosition2 = RenderGetScreenPos(renderContext, adjustedLightPosition2).xyz();
     
-    renderContext->m_PointLightMask = pointLightMask;
+    const float screenRange = (screenPosition - screenPosition2).Length();
+    dest->m_Position = Vec4(FromZeroOne(screenPosition), 1.0f);
+    dest->m_Range = 1.0f/screenRange;
 }
 
 // -------------------------------------------------------------------------------------------------
-// void RenderUpdateConicalLights(RenderContext* renderContext, const Light* conicalLights, int numConicalLights)
-//
-// 
-void RenderUpdateConicalLights(RenderContext* renderContext, const Light* conicalLights, int numConicalLights)
+// s_RenderCylindricalLightToScreen
+static void s_RenderCylindricalLightToScreen(const RenderContext* renderContext, Light* dest, const Light* source)
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_ConicalLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY|GL_MAP_UNSYNCHRONIZED_BIT);
+    *dest = *source;
     
-    uint32_t conicalLightMask = 0;
+    const Vec3 adjustedLightPosition1 = Vec3(source->m_Position.xy(), kLightZ);
+    dest->m_Position = FromZeroOne(RenderGetScreenPos(renderContext, adjustedLightPosition1)).xyz1();
     
-    Light* base = (Light*)p;
-    for (int i=0; i<numConicalLights; ++i)
+    const Vec3 adjustedLightPosition2 = Vec3(source->m_Position.xy() + dest->m_Direction.xy()*dest->m_Range, kLightZ);
+    dest->m_Direction = FromZeroOne(RenderGetScreenPos(renderContext, adjustedLightPosition2)).xyz1();
+    dest->m_Range = 1.0f / (dest->m_Position.xy() - dest->m_Direction.xy()).Length();
+    
+    float cameraDist = (adjustedLightPosition1.xyz1() * renderContext->m_View).z();
+    dest->m_OrthogonalRange = (-cameraDist / dest->m_OrthogonalRange);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderGetScreenLight
+void RenderGetScreenLight(const RenderContext* renderContext, Light* dest, const Light* source)
+{
+    switch (source->m_Type)
     {
-        const Light* source = &conicalLights[i];
-        Light* dest = &base[source->m_Index];
-        
-        *dest = *source;
-        
-        conicalLightMask |= 1ULL<<source->m_Index;
+        case LightType::kPoint:
+        {
+            s_RenderPointLightToScreen(renderContext, dest, source);
+            break;
+        }
+        case LightType::kConical:
+        {
+            s_RenderConicalLightToScreen(renderContext, dest, source);
+            break;
+        }
+        case LightType::kCylindrical:
+        {
+            s_RenderCylindricalLightToScreen(renderContext, dest, source);
+            break;
+        }
+        default:
+        {
+            *dest = *source;
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderPackLight
+//
+// Only the fields the shaders read.  Each light is written whole since the destination may be write
+// combined memory.
+static void s_RenderPackLight(LightBuffer::PointLight* dest, const Light& light)
+{
+    const LightBuffer::PointLight pointLight =
+    {
+        { light.m_Position.m_X[0], light.m_Position.m_X[1] }, light.m_Range, (float) light.m_RangeProfile,
+        { light.m_Color.m_X[0], light.m_Color.m_X[1], light.m_Color.m_X[2], light.m_Color.m_X[3] }
+    };
+    *dest = pointLight;
+}
+
+static void s_RenderPackLight(LightBuffer::ConicalLight* dest, const Light& light)
+{
+    const LightBuffer::ConicalLight conicalLight =
+    {
+        { light.m_Position.m_X[0], light.m_Position.m_X[1] },
+        { light.m_Direction.m_X[0], light.m_Direction.m_X[1] },
+        { light.m_Color.m_X[0], light.m_Color.m_X[1], light.m_Color.m_X[2] }, light.m_Range,
+        light.m_CosAngle, (float) light.m_RangeProfile, (float) light.m_EdgeProfile, 0.0f
+    };
+    *dest = conicalLight;
+}
+
+static void s_RenderPackLight(LightBuffer::CylindricalLight* dest, const Light& light)
+{
+    const LightBuffer::CylindricalLight cylindricalLight =
+    {
+        { light.m_Position.m_X[0], light.m_Position.m_X[1] },
+        { light.m_Direction.m_X[0], light.m_Direction.m_X[1] },
+        { light.m_Color.m_X[0], light.m_Color.m_X[1], light.m_Color.m_X[2] }, light.m_OrthogonalRange,
+        (float) light.m_RangeProfile, (float) light.m_EdgeProfile, { 0.0f, 0.0f }
+    };
+    *dest = cylindricalLight;
+}
+
+static void s_RenderPackLight(LightBuffer::DirectionalLight* dest, const Light& light)
+{
+    const LightBuffer::DirectionalLight directionalLight =
+    {
+        { light.m_Direction.m_X[0], light.m_Direction.m_X[1], light.m_Direction.m_X[2], 0.0f },
+        { light.m_Color.m_X[0], light.m_Color.m_X[1], light.m_Color.m_X[2], light.m_Color.m_X[3] }
+    };
+    *dest = directionalLight;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderWriteLights
+//
+// Write the slots the current slice is missing, those that changed after since, a run at a time.
+// Pass zero for since to write them all.
+template <typename T>
+static void s_RenderWriteLights(LightBuffer* lightBuffer, LightBuffer::Type type, const Light* lights, const uint32_t* versions, int numLights, uint32_t since)
+{
+    int i = 0;
+    while (i < numLights)
+    {
+        if (versions[i] <= since)
+        {
+            ++i;
+            continue;
+        }
         
-        const float range = source->m_Range;
+        int end = i+1;
+        while (end < numLights && versions[end] > since)
+            ++end;
         
-        const Vec3 adjustedLightPosition = Vec3(source->m_Position.xy(), kLightZ); // camera has fixed orientation, making this easier
-        const Vec3 adjustedLightPosition2 = adjustedLightPosition + Vec3(range*source->m_Direction.xy(), 0.0f);
-        const Vec3 screenPosition = RenderGetScreenPos(renderContext, adjustedLightPosition).xyz();
-        const Vec3 screenPosition2 = RenderGetScreenPos(renderContext, adjustedLightPosition2).xyz();
+        T* dest = (T*) LightBufferWrite(lightBuffer, type, i, end-i);
+        for (; i<end; ++i)
+            s_RenderPackLight(dest++, lights[i]);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderUpdateScreenLights
+//
+// Bring one type's screen space copies up to date, all of them after a view change and otherwise
+// just the slots the scene changed, rebinning its tile bounds if any moved.  Then fill in what the
+// current slice is missing.
+template <typename T>
+static void s_RenderUpdateScreenLights(RenderContext* renderContext, LightBuffer::Type type, const Light* lights, const uint32_t* versions, int numLights, uint32_t version,
+                                       void (*toScreen)(const RenderContext*, Light*, const Light*))
+{
+    RenderScreenLights* screenLights = &renderContext->m_ScreenLights[type];
+    if (numLights > screenLights->m_Capacity)
+    {
+        screenLights->m_Capacity = Max(numLights, screenLights->m_Capacity*2);
+        screenLights->m_Lights = (Light*) realloc(screenLights->m_Lights, screenLights->m_Capacity*sizeof(Light));
+    }
+    
+    bool changed = false;
+    for (int i=0; i<numLights; ++i)
+    {
+        if (!renderContext->m_LightViewChanged && versions[i] <= screenLights->m_Version)
+            continue;
         
-        const float screenRange = (screenPosition - screenPosition2).Length();
-        dest[i].m_Position = Vec4(FromZeroOne(screenPosition), 1.0f);
-        dest[i].m_Range = 1.0f/screenRange;
-        dest[i].m_Index = source->m_Index;
+        toScreen(renderContext, &screenLights->m_Lights[i], &lights[i]);
+        screenLights->m_Lights[i].m_Index = i;
+        changed = true;
     }
+    screenLights->m_Version = version;
     
-    glUnmapBuffer(GL_UNIFORM_BUFFER);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    if (changed)
+    {
+        // light buffer types and tile classes share their order
+        LightTilesSetLights(renderContext->m_LightTiles, (LightTiles::Class) type, screenLights->m_Lights, numLights);
+        renderContext->m_LightTilesDirty = true;
+    }
     
-    renderContext->m_ConicalLightMask = conicalLightMask;
+    // a slice written under another view has nothing worth keeping
+    LightBuffer* lightBuffer = renderContext->m_LightBuffer;
+    const int slice = lightBuffer->m_Slice;
+    const uint32_t since = lightBuffer->m_SliceViews[slice] == renderContext->m_LightViewGeneration ? lightBuffer->m_SliceVersions[slice][type] : 0;
+    
+    s_RenderWriteLights<T>(lightBuffer, type, screenLights->m_Lights, versions, numLights, since);
+    lightBuffer->m_SliceVersions[slice][type] = version;
 }
 
 // -------------------------------------------------------------------------------------------------
-void RenderUpdateCylindricalLights(RenderContext* renderContext, const Light* cylindricalLights, int numCylindricalLights)
+// s_RenderUpdateLightmapTransform
+//
+// The camera keeps its orientation, so the lightmap's corners on the kLightZ plane are all it takes
+// to map screen space onto it.
+static void s_RenderUpdateLightmapTransform(RenderContext* renderContext)
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_CylindricalLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY|GL_MAP_UNSYNCHRONIZED_BIT);
+    const Lightmap* lightmap = renderContext->m_Lightmap;
+    if (lightmap == nullptr)
+        return;
     
-    uint32_t cylindricalLightMask = 0;
+    const Vec4& rect = lightmap->m_WorldRect;
+    const Vec2 s0 = FromZeroOne(RenderGetScreenPos(renderContext, Vec3(rect.m_X[0], rect.m_X[1], kLightZ)).xy());
+    const Vec2 s1 = FromZeroOne(RenderGetScreenPos(renderContext, Vec3(rect.m_X[2], rect.m_X[3], kLightZ)).xy());
     
-    Light* base = (Light*)p;
-    for (int i=0; i<numCylindricalLights; ++i)
+    const float scaleX = 1.0f / (s1.m_X[0] - s0.m_X[0]);
+    const float scaleY = 1.0f / (s1.m_X[1] - s0.m_X[1]);
+    renderContext->m_LightmapTransform = Vec4(scaleX, scaleY, -s0.m_X[0]*scaleX, -s0.m_X[1]*scaleY);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderBeginLightUpdate
+//
+// Screen space lights depend on the view, so any change to it makes every one of them dirty.
+void RenderBeginLightUpdate(RenderContext* renderContext, int numPointLights, int numConicalLights, int numCylindricalLights, int numDirectionalLights)
+{
+    const bool viewChanged = memcmp(&renderContext->m_LightView, &renderContext->m_View, sizeof(Mat4)) != 0 ||
+                             memcmp(&renderContext->m_LightProjection, &renderContext->m_Projection, sizeof(Mat4)) != 0 ||
+                             renderContext->m_LightWidth != renderContext->m_Width || renderContext->m_LightHeight != renderContext->m_Height;
+    if (viewChanged)
     {
-        const Light* source = &cylindricalLights[i];
-        Light* dest = &base[source->m_Index];
-        
-        *dest = *source;
-        
-        cylindricalLightMask |= 1ULL<<source->m_Index;
-        
-        const Vec3 adjustedLightPosition1 = Vec3(source->m_Position.xy(), kLightZ);
-        dest->m_Position = FromZeroOne(RenderGetScreenPos(renderContext, adjustedLightPosition1)).xyz1();
-        
-        const Vec3 adjustedLightPosition2 = Vec3(source->m_Position.xy() + dest->m_Direction.xy()*dest->m_Range, kLightZ);
-        dest->m_Direction = FromZeroOne(RenderGetScreenPos(renderContext, adjustedLightPosition2)).xyz1();
-        dest->m_Range = 1.0f / (dest->m_Position.xy() - dest->m_Direction.xy()).Length();
-        
-        float cameraDist = (adjustedLightPosition1.xyz1() * renderContext->m_View).z();
-        dest->m_OrthogonalRange = (-cameraDist / dest->m_OrthogonalRange);
-        
-        dest->m_Index = cylindricalLights[i].m_Index;
+        renderContext->m_LightView = renderContext->m_View;
+        renderContext->m_LightProjection = renderContext->m_Projection;
+        renderContext->m_LightWidth = renderContext->m_Width;
+        renderContext->m_LightHeight = renderContext->m_Height;
+        renderContext->m_LightViewGeneration++;
     }
+    renderContext->m_LightViewChanged = viewChanged;
+    if (viewChanged)
+        s_RenderUpdateLightmapTransform(renderContext);
     
-    glUnmapBuffer(GL_UNIFORM_BUFFER);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    
-    renderContext->m_CylindricalLightMask = cylindricalLightMask;
+    const int counts[LightBuffer::kNumTypes] = { numPointLights, numConicalLights, numCylindricalLights, numDirectionalLights };
+    LightBufferBegin(renderContext->m_LightBuffer, counts);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderEndLightUpdate
+void RenderEndLightUpdate(RenderContext* renderContext)
+{
+    LightBuffer* lightBuffer = renderContext->m_LightBuffer;
+    lightBuffer->m_SliceViews[lightBuffer->m_Slice] = renderContext->m_LightViewGeneration;
+    LightBufferEnd(lightBuffer);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderSetAmbientLight
+void RenderSetAmbientLight(RenderContext* renderContext, const Vec4& color)
+{
+    renderContext->m_AmbientLight = color;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderSetIrradianceGrid
+void RenderSetIrradianceGrid(RenderContext* renderContext, Texture* grid, float weight)
+{
+    renderContext->m_IrradianceGrid = grid;
+    renderContext->m_IrradianceGridWeight = grid != nullptr ? weight : 0.0f;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderSetLightmap
+void RenderSetLightmap(RenderContext* renderContext, const Lightmap* lightmap)
+{
+    renderContext->m_Lightmap = lightmap;
+    s_RenderUpdateLightmapTransform(renderContext);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderUpdatePointLights
+//
+// versions[i] is the scene light version slot i last changed in, and version the current one.  Only
+// slots that changed since the current light buffer slice was written are uploaded.
+void RenderUpdatePointLights(RenderContext* renderContext, const Light* pointLights, const uint32_t* versions, int numPointLights, uint32_t version)
+{
+    s_RenderUpdateScreenLights<LightBuffer::PointLight>(renderContext, LightBuffer::kPoint, pointLights, versions, numPointLights, version, s_RenderPointLightToScreen);
+}
+
+// -------------------------------------------------------------------------------------------------
+// void RenderUpdateConicalLights(RenderContext* renderContext, const Light* conicalLights, const uint32_t* versions, int numConicalLights, uint32_t version)
+//
+// 
+void RenderUpdateConicalLights(RenderContext* renderContext, const Light* conicalLights, const uint32_t* versions, int numConicalLights, uint32_t version)
+{
+    s_RenderUpdateScreenLights<LightBuffer::ConicalLight>(renderContext, LightBuffer::kConical, conicalLights, versions, numConicalLights, version, s_RenderConicalLightToScreen);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderUpdateCylindricalLights(RenderContext* renderContext, const Light* cylindricalLights, const uint32_t* versions, int numCylindricalLights, uint32_t version)
+{
+    s_RenderUpdateScreenLights<LightBuffer::CylindricalLight>(renderContext, LightBuffer::kCylindrical, cylindricalLights, versions, numCylindricalLights, version, s_RenderCylindricalLightToScreen);
 }
 
 // -------------------------------------------------------------------------------------------------
 // RenderUpdateDirectionalLights
-void RenderUpdateDirectionalLights(RenderContext* renderContext, const Light* directionalLights, int numDirectionalLights)
+//
+// World space, so untouched by view changes.
+void RenderUpdateDirectionalLights(RenderContext* renderContext, const Light* directionalLights, const uint32_t* versions, int numDirectionalLights, uint32_t version)
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, renderContext->m_DirectionalLightUbo);
-    glBufferData(GL_UNIFORM_BUFFER, Light::kMaxLights*sizeof(Light), nullptr, GL_DYNAMIC_DRAW);
-    
-    GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY|GL_MAP_UNSYNCHRONIZED_BIT);
-    memcpy(p, directionalLights, numDirectionalLights*sizeof(Light));
+    LightBuffer* lightBuffer = renderContext->m_LightBuffer;
+    const int slice = lightBuffer->m_Slice;
     
-    glUnmapBuffer(GL_UNIFORM_BUFFER);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    s_RenderWriteLights<LightBuffer::DirectionalLight>(lightBuffer, LightBuffer::kDirectional, directionalLights, versions, numDirectionalLights,
+                                                       lightBuffer->m_SliceVersions[slice][LightBuffer::kDirectional]);
+    lightBuffer->m_SliceVersions[slice][LightBuffer::kDirectional] = version;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderUpdateLightTiles
+//
+// Only rebinned when a light's screen bounds or the screen size changed.
+void RenderUpdateLightTiles(RenderContext* renderContext)
+{
+    LightTiles* lightTiles = renderContext->m_LightTiles;
+    if (!renderContext->m_LightTilesDirty && lightTiles->m_Width == renderContext->m_Width && lightTiles->m_Height == renderContext->m_Height)
+        return;
     
-    renderContext->m_NumDirectionalLights = numDirectionalLights;
+    LightTilesBuild(lightTiles, renderContext->m_Width, renderContext->m_Height);
+    renderContext->m_LightTilesDirty = false;
 }
 
 // -------------------------------------------------------------------------------------------------
 void RenderOptionsInit(RenderOptions* renderOptions, int width, int height)
 {
     renderOptions->m_CameraType = RenderOptions::kPerspective;
+    renderOptions->m_ComputeDevice = RenderOptions::kComputeGpu;
     renderOptions->m_Width = width;
     renderOptions->m_Height = height;
 }
@@ -638,7 +1122,7 @@ void RenderDumpModelTransformed(const ModelInstance* model, const Mat4& a)
 // -------------------------------------------------------------------------------------------------
 // RenderSetBlendMode
 //
-// Set the blend mode
+// Set the blend mode.  Blending off leaves the blend function alone, nothing reads it then
 void RenderSetBlendMode(Material::BlendMode blendMode)
 {
     GL_ERROR_SCOPE();
@@ -647,35 +1131,55 @@ void RenderSetBlendMode(Material::BlendMode blendMode)
     {
         case Material::BlendMode::kOpaque:
         {
-            glDisable(GL_COLOR_LOGIC_OP);
-            glDepthMask(GL_TRUE);
+            RenderStateSetLogicOp(false, GL_COPY);
+            RenderStateSetDepthMask(true);
             
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_LESS);
+            RenderStateSetDepthTest(true);
+            RenderStateSetDepthFunc(GL_LESS);
             
-            glDisable(GL_BLEND);
-            glBlendFunc(GL_ONE, GL_ZERO);
+            RenderStateSetBlend(false);
             
             break;
         }
         case Material::BlendMode::kCutout:
         case Material::BlendMode::kBlend:
         {
-            glDisable(GL_COLOR_LOGIC_OP);
-            glDepthMask(GL_FALSE);
+            RenderStateSetLogicOp(false, GL_COPY);
+            RenderStateSetDepthMask(false);
             
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            glBlendEquation(GL_FUNC_ADD);
+            RenderStateSetBlend(true);
+            RenderStateSetBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            RenderStateSetBlendEquation(GL_FUNC_ADD);
             
             break;
         }
         case Material::BlendMode::kOr:
         {
-            glDepthMask(GL_FALSE);
-            glDisable(GL_BLEND);
-            glEnable(GL_COLOR_LOGIC_OP);
-            glLogicOp(GL_OR);
+            RenderStateSetDepthMask(false);
+            RenderStateSetBlend(false);
+            RenderStateSetLogicOp(true, GL_OR);
+            
+            break;
+        }
+        case Material::BlendMode::kAdd:
+        {
+            RenderStateSetLogicOp(false, GL_COPY);
+            RenderStateSetDepthMask(false);
+            
+            RenderStateSetBlend(true);
+            RenderStateSetBlendFunc(GL_ONE, GL_ONE);
+            RenderStateSetBlendEquation(GL_FUNC_ADD);
+            
+            break;
+        }
+        case Material::BlendMode::kSubtract:
+        {
+            RenderStateSetLogicOp(false, GL_COPY);
+            RenderStateSetDepthMask(false);
+            
+            RenderStateSetBlend(true);
+            RenderStateSetBlendFunc(GL_ONE, GL_ONE);
+            RenderStateSetBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
             
             break;
         }
@@ -697,12 +1201,28 @@ static inline void RenderUseProgram(const Shader* shader)
 {
     // Printf("Using %s\n", shader->m_DebugName);
     if (shader)
-        glUseProgram(shader->m_ProgramName);
+        RenderStateUseProgram(shader->m_ProgramName);
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderMaterialShader
+//
+// The program a material draws with.  While a G-buffer is being filled, lit materials write their
+// surface instead of lighting it.
+static inline const Shader* s_RenderMaterialShader(const RenderContext* renderContext, const Material* material)
+{
+    if (renderContext->m_DeferredPass == RenderContext::kDeferredGBuffer && material->m_Shader == renderContext->m_DeferredLitShader)
+        return renderContext->m_DeferredGBufferShader;
+    
+    return material->m_Shader;
 }
 
 // -------------------------------------------------------------------------------------------------
 // RenderUseMaterial
 //
+// Uniforms stay in a program between draws, so drawing the material RenderSetMaterialConstants last
+// set up, unchanged and with the same program, only has to put its textures back.  Blend state is
+// always set, RenderState filters it.
 void RenderUseMaterial(RenderContext* renderContext, int* textureSlotItr, const Material* material)
 {
     GL_ERROR_SCOPE();
@@ -710,30 +1230,39 @@ void RenderUseMaterial(RenderContext* renderContext, int* textureSlotItr, const
     const Shader* replacementShader = renderContext->m_ReplacementShader;
     if (replacementShader == nullptr)
     {
-        RenderUseProgram(material->m_Shader);
+        const Shader* shader = s_RenderMaterialShader(renderContext, material);
+        RenderUseProgram(shader);
+        RenderSetBlendMode(material->m_BlendMode);
         
-        if (true || renderContext->m_CachedMaterial != material)
+        if (renderContext->m_CachedMaterial == material &&
+            renderContext->m_CachedMaterialVersion == material->m_Version &&
+            renderContext->m_CachedMaterialShader == shader &&
+            renderContext->m_CachedMaterialFirstSlot == *textureSlotItr)
+        {
+            RenderStateBindTexture(0, GL_TEXTURE_2D, material->m_Texture ? material->m_Texture->m_TextureId : 0);
+            for (int i=0; i<renderContext->m_CachedMaterialNumTextures; ++i)
+                RenderStateBindTexture((*textureSlotItr)++, GL_TEXTURE_2D, renderContext->m_CachedMaterialTextures[i]);
+        }
+        else
         {
-            renderContext->m_CachedMaterial = material;
             RenderSetMaterialConstants(renderContext, textureSlotItr, material);
-            RenderSetBlendMode(material->m_BlendMode);
         }
     }
     else
     {
-        glBindTexture(GL_TEXTURE_2D, material->m_Texture->m_TextureId);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, material->m_Texture->m_TextureId);
     }
 }
 
 // -------------------------------------------------------------------------------------------------
 // RenderSetGlobalConstants
 //
-void RenderSetGlobalConstants(RenderContext* renderContext, int* textureSlotItr, int programName)
+void RenderSetGlobalConstants(RenderContext* renderContext, int* textureSlotItr, const Shader* shader)
 {    
     for (int i=0; i<renderContext->m_MaterialProperties.kMaxSize; ++i)
     {
         const Material::MaterialProperty* materialProperty = &renderContext->m_MaterialProperties[i];
-        RenderSetMaterialProperty(textureSlotItr, programName, materialProperty);
+        RenderSetMaterialProperty(textureSlotItr, shader, materialProperty);
     }
 }
 
@@ -744,30 +1273,46 @@ void RenderSetMaterialConstants(RenderContext* renderContext, int* textureSlotIt
 {
     GL_ERROR_SCOPE();
     
-    const Shader* shader = material->m_Shader;
-    
-    glActiveTexture(GL_TEXTURE0);
+    const Shader* shader = s_RenderMaterialShader(renderContext, material);
+    const int firstSlot = *textureSlotItr;
     
     if (material->m_Texture)
-        glBindTexture(GL_TEXTURE_2D, material->m_Texture->m_TextureId);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, material->m_Texture->m_TextureId);
     else
-        glBindTexture(GL_TEXTURE_2D, 0);
+        RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
     
-    GLint mainTextureSlot = glGetUniformLocation(shader->m_ProgramName, "_MainTex");
+    GLint mainTextureSlot = shader->m_BuiltinUniforms[Shader::kUniformMainTex];
     glProgramUniform1i(shader->m_ProgramName, mainTextureSlot, 0);
     
-    GLint cameraPosSlot = glGetUniformLocation(shader->m_ProgramName, "_CameraPos");
+    GLint cameraPosSlot = shader->m_BuiltinUniforms[Shader::kUniformCameraPos];
     if (cameraPosSlot >= 0)
     {
         const Vec4& cameraPos = renderContext->m_Camera.GetTranslation();
         glUniform4f(cameraPosSlot, cameraPos.m_X[0], cameraPos.m_X[1], cameraPos.m_X[2], cameraPos.m_X[2]);
     }
     
+    int numTextures = 0;
     for (int i=0; i<material->m_NumMaterialProperties; ++i)
     {
         const Material::MaterialProperty* materialProperty = &material->m_MaterialPropertyBlock[i];
-        RenderSetMaterialProperty(textureSlotItr, shader->m_ProgramName, materialProperty);
+        const int slot = *textureSlotItr;
+        RenderSetMaterialProperty(textureSlotItr, shader, materialProperty);
+        
+        // bound, so it's one the program samples
+        if (*textureSlotItr != slot)
+        {
+            if (numTextures < RenderContext::kMaxCachedMaterialTextures)
+                renderContext->m_CachedMaterialTextures[numTextures] = materialProperty->m_TextureId;
+            numTextures++;
+        }
     }
+    
+    // what RenderUseMaterial can skip next time; materials with more textures always upload
+    renderContext->m_CachedMaterial = numTextures <= RenderContext::kMaxCachedMaterialTextures ? material : nullptr;
+    renderContext->m_CachedMaterialVersion = material->m_Version;
+    renderContext->m_CachedMaterialShader = shader;
+    renderContext->m_CachedMaterialFirstSlot = firstSlot;
+    renderContext->m_CachedMaterialNumTextures = numTextures;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -777,10 +1322,13 @@ void RenderFrameInit(RenderContext* renderContext)
 {
     GL_ERROR_SCOPE();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[0]);
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[0]);
     
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
+    // _CameraPos goes up with the material constants, and the camera moves between frames
+    renderContext->m_CachedMaterial = nullptr;
+    
     glfwMakeContextCurrent(renderContext->m_Window);
     
     float currentTime = (float) glfwGetTime()*0.125f;
@@ -816,6 +1364,7 @@ void RenderAttachPostEffect(RenderContext* renderContext, PostEffect* effect)
 //
 void RenderFullscreenSetVertexAttributes(RenderContext* renderContext)
 {
+    RenderStateBindVertexArray(renderContext->m_QuadVertexArrayId);
     glBindBuffer(GL_ARRAY_BUFFER, renderContext->m_QuadVertexBufferId);
     
     glDisableVertexAttribArray(kVertexAttributeColor);
@@ -892,49 +1441,97 @@ void RenderSetLightConstants(RenderContext* renderContext, const Shader* shader)
 {
     GL_ERROR_SCOPE();
     
-    GLuint pointLightsBlockIndex = shader->m_PointLightBlockIndex;
-    if (pointLightsBlockIndex != GL_INVALID_INDEX)
+    GLint lightsIndex = shader->m_BuiltinUniforms[Shader::kUniformLights];
+    if (lightsIndex >= 0)
     {
-        glUniformBlockBinding(shader->m_ProgramName, pointLightsBlockIndex, kPointLightBinding);
+        const LightBuffer* lightBuffer = renderContext->m_LightBuffer;
+        
+        RenderStateBindTexture(kLightsTextureUnit, GL_TEXTURE_BUFFER, lightBuffer->m_Texture);
+        glUniform1i(lightsIndex, kLightsTextureUnit);
+        
+        // where this frame's point, conical, cylindrical and directional arrays start
+        GLint lightOffsetsIndex = shader->m_BuiltinUniforms[Shader::kUniformLightOffsets];
+        if (lightOffsetsIndex >= 0)
+            glUniform4iv(lightOffsetsIndex, 1, lightBuffer->m_Offsets);
+        
+        GLint lightCountsIndex = shader->m_BuiltinUniforms[Shader::kUniformLightCounts];
+        if (lightCountsIndex >= 0)
+            glUniform4iv(lightCountsIndex, 1, lightBuffer->m_Counts);
         
-        GLint pointLightMaskIndex = glGetUniformLocation(shader->m_ProgramName, "pointLightMask");
-        if (pointLightMaskIndex != GL_INVALID_INDEX)
-            glUniform1ui(pointLightMaskIndex, renderContext->m_PointLightMask);
+        GLint directionalLightNumIndex = shader->m_BuiltinUniforms[Shader::kUniformNumDirectionalLights];
+        if (directionalLightNumIndex >= 0)
+            glUniform1ui(directionalLightNumIndex, lightBuffer->m_Counts[LightBuffer::kDirectional]);
     }
     
-    GLuint conicalLightsBlockIndex = shader->m_ConicalLightBlockIndex;
-    if (conicalLightsBlockIndex != GL_INVALID_INDEX)
+    GLint lightProfilesIndex = shader->m_BuiltinUniforms[Shader::kUniformLightProfiles];
+    if (lightProfilesIndex >= 0)
     {
-        glUniformBlockBinding(shader->m_ProgramName, conicalLightsBlockIndex, kConicalLightBinding);
+        RenderStateBindTexture(kLightProfilesTextureUnit, GL_TEXTURE_2D, renderContext->m_LightProfiles->m_Texture);
+        glUniform1i(lightProfilesIndex, kLightProfilesTextureUnit);
+    }
+    
+    GLint ambientLightIndex = shader->m_BuiltinUniforms[Shader::kUniformAmbientLight];
+    if (ambientLightIndex >= 0)
+    {
+        const Vec4& ambientLight = renderContext->m_AmbientLight;
+        glUniform3f(ambientLightIndex, ambientLight.m_X[0], ambientLight.m_X[1], ambientLight.m_X[2]);
+    }
+    
+    GLint lightmapIndex = shader->m_BuiltinUniforms[Shader::kUniformLightmap];
+    if (lightmapIndex >= 0)
+    {
+        const Lightmap* lightmap = renderContext->m_Lightmap;
+        
+        RenderStateBindTexture(kLightmapTextureUnit, GL_TEXTURE_2D, lightmap != nullptr ? lightmap->m_Texture : 0);
+        glUniform1i(lightmapIndex, kLightmapTextureUnit);
+        
+        GLint lightmapTransformIndex = shader->m_BuiltinUniforms[Shader::kUniformLightmapTransform];
+        if (lightmapTransformIndex >= 0)
+            glUniform4fv(lightmapTransformIndex, 1, renderContext->m_LightmapTransform.asFloat());
         
-        GLint conicalLightMaskIndex = glGetUniformLocation(shader->m_ProgramName, "conicalLightMask");
-        if (conicalLightMaskIndex != GL_INVALID_INDEX)
-            glUniform1ui(conicalLightMaskIndex, renderContext->m_ConicalLightMask);
+        GLint lightmapWeightIndex = shader->m_BuiltinUniforms[Shader::kUniformLightmapWeight];
+        if (lightmapWeightIndex >= 0)
+            glUniform1f(lightmapWeightIndex, lightmap != nullptr ? 1.0f : 0.0f);
     }
     
-    GLuint cylindricalLightsBlockIndex = shader->m_CylindricalLightBlockIndex;
-    if (cylindricalLightsBlockIndex != GL_INVALID_INDEX)
+    GLint irradianceGridIndex = shader->m_BuiltinUniforms[Shader::kUniformIrradianceGrid];
+    if (irradianceGridIndex >= 0)
     {
-        glUniformBlockBinding(shader->m_ProgramName, cylindricalLightsBlockIndex, kCylindricalLightBinding);
+        const Texture* grid = renderContext->m_IrradianceGrid;
         
-        GLint cylindricalLightMaskIndex = glGetUniformLocation(shader->m_ProgramName, "cylindricalLightMask");
-        if (cylindricalLightMaskIndex != GL_INVALID_INDEX)
-            glUniform1ui(cylindricalLightMaskIndex, renderContext->m_CylindricalLightMask);
+        RenderStateBindTexture(kIrradianceGridTextureUnit, GL_TEXTURE_2D, grid != nullptr ? grid->m_TextureId : 0);
+        glUniform1i(irradianceGridIndex, kIrradianceGridTextureUnit);
+        
+        GLint irradianceGridWeightIndex = shader->m_BuiltinUniforms[Shader::kUniformIrradianceGridWeight];
+        if (irradianceGridWeightIndex >= 0)
+            glUniform1f(irradianceGridWeightIndex, renderContext->m_IrradianceGridWeight);
     }
     
-    GLuint directionalLightsBlockIndex = shader->m_DirectionalLightBlockIndex;
-    if (directionalLightsBlockIndex != GL_INVALID_INDEX)
+    GLint lightTilesIndex = shader->m_BuiltinUniforms[Shader::kUniformLightTiles];
+    if (lightTilesIndex >= 0)
     {
-        glUniformBlockBinding(shader->m_ProgramName, directionalLightsBlockIndex, kDirectionalLightBinding);
+        const LightTiles* lightTiles = renderContext->m_LightTiles;
+        
+        RenderStateBindTexture(kLightTilesTextureUnit, GL_TEXTURE_BUFFER, lightTiles->m_Texture);
+        glUniform1i(lightTilesIndex, kLightTilesTextureUnit);
         
-        GLint direcitonalLightNumIndex = glGetUniformLocation(shader->m_ProgramName, "numDirectionalLights");
-        if (direcitonalLightNumIndex != GL_INVALID_INDEX)
-            glUniform1ui(direcitonalLightNumIndex, renderContext->m_NumDirectionalLights);
+        // tiles per unit of screen uv, tile counts
+        GLint lightTileParamsIndex = shader->m_BuiltinUniforms[Shader::kUniformLightTileParams];
+        if (lightTileParamsIndex >= 0)
+        {
+            glUniform4f(lightTileParamsIndex,
+                        (float) lightTiles->m_Width / LightTiles::kTileSize, (float) lightTiles->m_Height / LightTiles::kTileSize,
+                        (float) lightTiles->m_TilesX, (float) lightTiles->m_TilesY);
+        }
     }
 }
 
 // -------------------------------------------------------------------------------------------------
-void RenderDrawFullscreen(RenderContext* renderContext, Material* material, int textureId)
+// s_RenderDrawScreenSpace
+//
+// The fullscreen quad's attributes stay bound; shaders drawing more than its six vertices build
+// their own from gl_VertexID and gl_InstanceID.
+static void s_RenderDrawScreenSpace(RenderContext* renderContext, Material* material, int textureId, int numVertices, int numInstances)
 {
     GL_ERROR_SCOPE();
     
@@ -951,33 +1548,35 @@ void RenderDrawFullscreen(RenderContext* renderContext, Material* material, int
     RenderSetMaterialConstants(renderContext, &textureSlotItr, material);
     RenderSetBlendMode(material->m_BlendMode);
     
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureId);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, textureId);
     
     // global constants
-    RenderSetGlobalConstants(renderContext, &textureSlotItr, shader->m_ProgramName);
+    RenderSetGlobalConstants(renderContext, &textureSlotItr, shader);
     
     Mat4 identity;
     MatrixMakeIdentity(&identity);
     
-    GLint pi = glGetUniformLocation(shader->m_ProgramName, "project");
+    GLint pi = shader->m_BuiltinUniforms[Shader::kUniformProject];
     glUniformMatrix4fv(pi, 1, GL_FALSE, identity.asFloat());
     
-    GLint nmi = glGetUniformLocation(shader->m_ProgramName, "normalModel");
+    GLint nmi = shader->m_BuiltinUniforms[Shader::kUniformNormalModel];
     glUniformMatrix4fv(nmi, 1, GL_FALSE, identity.asFloat());
     
-    GLint mvi = glGetUniformLocation(shader->m_ProgramName, "modelView");
+    GLint mvi = shader->m_BuiltinUniforms[Shader::kUniformModelView];
     glUniformMatrix4fv(mvi, 1, GL_FALSE, identity.asFloat());
     
-    GLint viewIndex = glGetUniformLocation(shader->m_ProgramName, "view");
+    GLint viewIndex = shader->m_BuiltinUniforms[Shader::kUniformView];
     glUniformMatrix4fv(viewIndex, 1, GL_FALSE, identity.asFloat());
     
-    GLint mainTextureSlot = glGetUniformLocation(shader->m_ProgramName, "_MainTex");
+    GLint mainTextureSlot = shader->m_BuiltinUniforms[Shader::kUniformMainTex];
     glProgramUniform1i(shader->m_ProgramName, mainTextureSlot, 0);
     
     RenderSetLightConstants(renderContext, shader);
     
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    if (numInstances == 1)
+        glDrawArrays(GL_TRIANGLES, 0, numVertices);
+    else
+        glDrawArraysInstanced(GL_TRIANGLES, 0, numVertices, numInstances);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -993,31 +1592,30 @@ void RenderDrawFullscreen(RenderContext* renderContext, Shader* shader, int text
 
     // overwrite existing contents
     RenderSetBlendMode(Material::BlendMode::kOpaque);
-    glDisable(GL_DEPTH_TEST);
+    RenderStateSetDepthTest(false);
     
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureId);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, textureId);
     
     // global constants
     int textureSlotItr=1;
-    RenderSetGlobalConstants(renderContext, &textureSlotItr, shader->m_ProgramName);
+    RenderSetGlobalConstants(renderContext, &textureSlotItr, shader);
     
     Mat4 identity;
     MatrixMakeIdentity(&identity);
     
-    GLint pi = glGetUniformLocation(shader->m_ProgramName, "project");
+    GLint pi = shader->m_BuiltinUniforms[Shader::kUniformProject];
     glUniformMatrix4fv(pi, 1, GL_FALSE, identity.asFloat());
     
-    GLint nmi = glGetUniformLocation(shader->m_ProgramName, "normalModel");
+    GLint nmi = shader->m_BuiltinUniforms[Shader::kUniformNormalModel];
     glUniformMatrix4fv(nmi, 1, GL_FALSE, identity.asFloat());
     
-    GLint mvi = glGetUniformLocation(shader->m_ProgramName, "modelView");
+    GLint mvi = shader->m_BuiltinUniforms[Shader::kUniformModelView];
     glUniformMatrix4fv(mvi, 1, GL_FALSE, identity.asFloat());
     
-    GLint viewIndex = glGetUniformLocation(shader->m_ProgramName, "view");
+    GLint viewIndex = shader->m_BuiltinUniforms[Shader::kUniformView];
     glUniformMatrix4fv(viewIndex, 1, GL_FALSE, identity.asFloat());
     
-    GLint mainTextureSlot = glGetUniformLocation(shader->m_ProgramName, "_MainTex");
+    GLint mainTextureSlot = shader->m_BuiltinUniforms[Shader::kUniformMainTex];
     glProgramUniform1i(shader->m_ProgramName, mainTextureSlot, 0);
     
     RenderSetLightConstants(renderContext, shader);
@@ -1047,16 +1645,37 @@ void RenderDrawFullscreen(RenderContext* renderContext, Material* material, Text
     if (texture != nullptr)
         textureId = texture->m_TextureId;
     
-    RenderDrawFullscreen(renderContext, material, textureId);
+    s_RenderDrawScreenSpace(renderContext, material, textureId, 6, 1);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderDrawProcedural
+void RenderDrawProcedural(RenderContext* renderContext, Material* material, Texture* texture, int numVertices, int numInstances)
+{
+    GL_ERROR_SCOPE();
+    
+    if (numVertices <= 0 || numInstances <= 0)
+        return;
+    
+    int textureId = renderContext->m_FrameBufferColorIds[0];
+    if (texture != nullptr)
+        textureId = texture->m_TextureId;
+    
+    s_RenderDrawScreenSpace(renderContext, material, textureId, numVertices, numInstances);
 }
 
 // -------------------------------------------------------------------------------------------------
 void RenderSetRenderTarget(RenderContext* renderContext, Texture* texture)
 {
+    // clears below cover the whole target
+    glDisable(GL_SCISSOR_TEST);
+    
     if (texture && texture->m_FrameBufferId>0)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, texture->m_FrameBufferId);
+        RenderStateBindFrameBuffer(GL_FRAMEBUFFER, texture->m_FrameBufferId);
         glViewport(0, 0, texture->m_Width, texture->m_Height);
+        renderContext->m_TargetWidth = texture->m_Width;
+        renderContext->m_TargetHeight = texture->m_Height;
 
         switch (texture->m_RenderTextureFlags & (Texture::RenderTextureFlags::kClearColor|Texture::RenderTextureFlags::kClearDepth))
         {
@@ -1088,10 +1707,70 @@ void RenderSetRenderTarget(RenderContext* renderContext, Texture* texture)
         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
             Printf("Error - framebuffer is not ready\n");
         
-        glBindFramebuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[0]);
+        RenderStateBindFrameBuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[0]);
         glViewport(0, 0, renderContext->m_Width, renderContext->m_Height);
         glClearColor(renderContext->m_ClearColor.m_X[0], renderContext->m_ClearColor.m_X[1], renderContext->m_ClearColor.m_X[2], 0);
+        renderContext->m_TargetWidth = renderContext->m_Width;
+        renderContext->m_TargetHeight = renderContext->m_Height;
     }
+    
+    if (renderContext->m_ScissorEnabled)
+        RenderSetScissor(renderContext, renderContext->m_ScissorRect);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderSetViewport
+//
+// Restrict drawing to part of the current render target.  RenderSetRenderTarget resets it.
+void RenderSetViewport(RenderContext* renderContext, int x, int y, int width, int height)
+{
+    glViewport(x, y, width, height);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderSetScissor
+//
+// Rounded outward to whole pixels of the current target.
+void RenderSetScissor(RenderContext* renderContext, const Vec4& uvRect)
+{
+    renderContext->m_ScissorRect = uvRect;
+    renderContext->m_ScissorEnabled = true;
+    
+    const float width = (float) renderContext->m_TargetWidth;
+    const float height = (float) renderContext->m_TargetHeight;
+    const int x0 = Clamp((int) floorf(uvRect.m_X[0]*width), 0, renderContext->m_TargetWidth);
+    const int y0 = Clamp((int) floorf(uvRect.m_X[1]*height), 0, renderContext->m_TargetHeight);
+    const int x1 = Clamp((int) ceilf(uvRect.m_X[2]*width), x0, renderContext->m_TargetWidth);
+    const int y1 = Clamp((int) ceilf(uvRect.m_X[3]*height), y0, renderContext->m_TargetHeight);
+    
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x0, y0, x1-x0, y1-y0);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderClearScissor(RenderContext* renderContext)
+{
+    renderContext->m_ScissorEnabled = false;
+    glDisable(GL_SCISSOR_TEST);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderClearRect
+//
+// glClear honors the scissor, so clear under one set to uvRect and put back whatever was there.
+void RenderClearRect(RenderContext* renderContext, const Vec4& uvRect, const Vec3& color)
+{
+    const bool scissorEnabled = renderContext->m_ScissorEnabled;
+    const Vec4 scissorRect = renderContext->m_ScissorRect;
+    
+    RenderSetScissor(renderContext, uvRect);
+    glClearColor(color.m_X[0], color.m_X[1], color.m_X[2], 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    if (scissorEnabled)
+        RenderSetScissor(renderContext, scissorRect);
+    else
+        RenderClearScissor(renderContext);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -1108,11 +1787,10 @@ void RenderSetReplacementShader(RenderContext* renderContext, Shader* shader)
     {
         RenderUseProgram(shader);
         
-        GLint pi = glGetUniformLocation(shader->m_ProgramName, "project");
+        GLint pi = shader->m_BuiltinUniforms[Shader::kUniformProject];
         glUniformMatrix4fv(pi, 1, GL_FALSE, renderContext->m_Projection.asFloat());
         
-        glActiveTexture(GL_TEXTURE0);
-        GLint mainTextureSlot = glGetUniformLocation(shader->m_ProgramName, "_MainTex");
+        GLint mainTextureSlot = shader->m_BuiltinUniforms[Shader::kUniformMainTex];
         glProgramUniform1i(shader->m_ProgramName, mainTextureSlot, 0);
         
         // jiv fixme: set blend mode externally
@@ -1136,17 +1814,17 @@ bool RenderFrameEnd(RenderContext* renderContext)
             int frameBufferColorId = renderContext->m_FrameBufferColorIds[i&1];
             
             if (i != renderContext->m_NumPostEffects-1)
-                glBindFramebuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[~i&1]); // target next post effect
+                RenderStateBindFrameBuffer(GL_FRAMEBUFFER, renderContext->m_FrameBufferIds[~i&1]); // target next post effect
             else
-                glBindFramebuffer(GL_FRAMEBUFFER, 0); // target final destination
+                RenderStateBindFrameBuffer(GL_FRAMEBUFFER, 0); // target final destination
             
             RenderDrawFullscreen(renderContext, renderContext->m_PostEffects[i]->m_Shader, frameBufferColorId);
         }
     }
     else
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0); // target final destination
-        glDisable(GL_DEPTH_TEST);
+        RenderStateBindFrameBuffer(GL_FRAMEBUFFER, 0); // target final destination
+        RenderStateSetDepthTest(false);
         RenderDrawFullscreen(renderContext, g_SimpleShader, renderContext->m_FrameBufferColorIds[0]);
     }
     
@@ -1157,6 +1835,8 @@ bool RenderFrameEnd(RenderContext* renderContext)
     glfwSwapBuffers(renderContext->m_Window);
     glfwPollEvents();
     
+    RenderStateEndFrame();
+    
     return ret;
 }
 
@@ -1289,7 +1969,7 @@ ModelInstance* RenderGenerateSprite(RenderContext* renderContext, const SpriteOp
     
     // generate vertex name
     glGenVertexArrays(1, &modelClassSubset->m_VaoName);
-    glBindVertexArray(modelClassSubset->m_VaoName);
+    RenderStateBindVertexArray(modelClassSubset->m_VaoName);
     
     // generate vertex buffer name
     glGenBuffers(1, &modelClassSubset->m_VertexBufferName);
@@ -1506,7 +2186,7 @@ void RenderGenerateCubeModelClass(RenderContext* renderContext, ModelClass* mode
     
     // generate vertex name
     glGenVertexArrays(1, &modelClassSubset->m_VaoName);
-    glBindVertexArray(modelClassSubset->m_VaoName);
+    RenderStateBindVertexArray(modelClassSubset->m_VaoName);
     
     // generate vertex buffer name
     glGenBuffers(1, &modelClassSubset->m_VertexBufferName);
@@ -1603,6 +2283,7 @@ int RenderAddGlobalProperty(RenderContext* renderContext, const char* materialPr
         materialProperty->m_Type = type;
         strncpy(materialProperty->m_Key, materialPropertyName, sizeof materialProperty->m_Key-1);
         materialProperty->m_Key[sizeof materialProperty->m_Key-1] = '\0';
+        materialProperty->m_Hash = Djb(materialProperty->m_Key);
         
         index = renderContext->m_MaterialProperties.IndexOf(materialProperty);
     }
@@ -1702,7 +2383,15 @@ void RenderDrawModelSubset(RenderContext* renderContext, const Mat4& localToWorl
     GL_ERROR_SCOPE();
     
     const Material* material = modelClassSubset->m_Material;
-    const Shader* shader = material->m_Shader;
+    const Shader* shader = s_RenderMaterialShader(renderContext, material);
+    
+    // deferred lighting draws lit materials into the G-buffer and everything else forward after it
+    if (renderContext->m_DeferredPass != RenderContext::kDeferredNone)
+    {
+        const bool lit = material->m_Shader == renderContext->m_DeferredLitShader;
+        if (lit != (renderContext->m_DeferredPass == RenderContext::kDeferredGBuffer))
+            return;
+    }
     
     if (renderContext->m_ReplacementShader)
         shader = renderContext->m_ReplacementShader;
@@ -1716,32 +2405,33 @@ void RenderDrawModelSubset(RenderContext* renderContext, const Mat4& localToWorl
     RenderUseMaterial(renderContext, &textureSlotItr, material);
     
     // global constants
-    RenderSetGlobalConstants(renderContext, &textureSlotItr, shader->m_ProgramName);
+    RenderSetGlobalConstants(renderContext, &textureSlotItr, shader);
     
-    GLint pi = glGetUniformLocation(shader->m_ProgramName, "project");
+    GLint pi = shader->m_BuiltinUniforms[Shader::kUniformProject];
     glUniformMatrix4fv(pi, 1, GL_FALSE, renderContext->m_Projection.asFloat());
     
-    GLint nmi = glGetUniformLocation(shader->m_ProgramName, "normalModel");
+    GLint nmi = shader->m_BuiltinUniforms[Shader::kUniformNormalModel];
     glUniformMatrix4fv(nmi, 1, GL_FALSE, normalModel.asFloat());
     
-    GLint l2wi = glGetUniformLocation(shader->m_ProgramName, "localToWorld");
+    GLint l2wi = shader->m_BuiltinUniforms[Shader::kUniformLocalToWorld];
     glUniformMatrix4fv(l2wi, 1, GL_FALSE, localToWorld.asFloat());
     
     Mat4 modelView;
     MatrixMultiply(&modelView, localToWorld, renderContext->m_View);
     
-    GLint mvi = glGetUniformLocation(shader->m_ProgramName, "modelView");
+    GLint mvi = shader->m_BuiltinUniforms[Shader::kUniformModelView];
     glUniformMatrix4fv(mvi, 1, GL_FALSE, modelView.asFloat());
     
-    GLint viewIndex = glGetUniformLocation(shader->m_ProgramName, "view");
+    GLint viewIndex = shader->m_BuiltinUniforms[Shader::kUniformView];
     glUniformMatrix4fv(viewIndex, 1, GL_FALSE, renderContext->m_View.asFloat());
     
     RenderSetLightConstants(renderContext, shader);
     
+    RenderStateBindVertexArray(modelClassSubset->m_VaoName);
     ModelInstanceSetVertexAttributes(modelClassSubset);
     
+    // blending stays as the material left it, every draw sets its own
     glDrawElements(GL_TRIANGLES, modelClassSubset->m_NumIndices, GL_UNSIGNED_SHORT, (void*) 0);
-    glDisable(GL_BLEND);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -15,13 +15,34 @@ struct ModelClass;
 struct ModelInstance;
 struct Material;
 struct GLFWwindow;
+struct LightBuffer;
+struct Lightmap;
+struct LightProfiles;
+struct LightTiles;
 struct PostEffect;
 struct Texture;
 struct Shader;
 
+// screen space copies of one type of light, converted as the scene's copies change
+struct RenderScreenLights
+{
+    Light* m_Lights;
+    int m_Capacity;
+    uint32_t m_Version;        // scene light version the copies are current to
+};
+
 struct RenderContext
 {
+    // The material whose properties are in its program's uniforms, by Material::m_Version, with the
+    // program it drew with and the textures it bound from m_CachedMaterialFirstSlot.  A draw of the
+    // same material only rebinds the textures, through RenderState
+    enum { kMaxCachedMaterialTextures = 8 };
     const Material* m_CachedMaterial;
+    uint32_t m_CachedMaterialVersion;
+    const Shader* m_CachedMaterialShader;
+    int m_CachedMaterialFirstSlot;
+    GLuint m_CachedMaterialTextures[kMaxCachedMaterialTextures];
+    int m_CachedMaterialNumTextures;
     Mat4 m_Projection;
     Mat4 m_Camera;
     Mat4 m_View;
@@ -36,6 +57,17 @@ struct RenderContext
 #if USE_CL
     cl_context m_Context;
     cl_command_queue m_CommandQueue;
+    cl_device_id m_DeviceId;
+    bool m_ClGlSharing; // context can alias GL textures, otherwise transfers go through host memory
+    
+    // cl_khr_gl_event: the queue can wait on a GL fence, so neither side drains for the other
+    cl_event (CL_API_CALL *m_ClCreateEventFromGLsync)(cl_context context, cl_GLsync sync, cl_int* errcodeRet);
+    
+    // fences behind those acquires, kept alive until CL is done waiting on them
+    enum { kMaxClGlFences = 4 };
+    GLsync m_ClGlFences[kMaxClGlFences];
+    cl_event m_ClGlFenceEvents[kMaxClGlFences];
+    int m_NumClGlFences;
 #endif
     
     GLuint m_QuadVertexArrayId;
@@ -52,17 +84,50 @@ struct RenderContext
     
     Shader* m_ReplacementShader;
     
+    // Deferred lighting, see GBuffer.h.  In the G-buffer pass materials using m_DeferredLitShader draw
+    // with m_DeferredGBufferShader and the rest are skipped; in the forward pass it's the other way round
+    enum DeferredPass
+    {
+        kDeferredNone,
+        kDeferredGBuffer,
+        kDeferredForward
+    };
+    DeferredPass m_DeferredPass;
+    const Shader* m_DeferredLitShader;
+    const Shader* m_DeferredGBufferShader;
+    
     Vec3 m_ClearColor;
     
-    GLuint m_PointLightUbo;
-    GLuint m_ConicalLightUbo;
-    GLuint m_CylindricalLightUbo;
-    GLuint m_DirectionalLightUbo;
+    // size of the bound render target, and a scissor in its uv that every target switch reapplies
+    int m_TargetWidth;
+    int m_TargetHeight;
+    Vec4 m_ScissorRect;       // x0, y0, x1, y1
+    bool m_ScissorEnabled;
+    
+    LightBuffer* m_LightBuffer;
+    
+    // point, conical and cylindrical, and the view they were converted with
+    RenderScreenLights m_ScreenLights[3];
+    Mat4 m_LightView;
+    Mat4 m_LightProjection;
+    int m_LightWidth;
+    int m_LightHeight;
+    uint32_t m_LightViewGeneration;
+    bool m_LightViewChanged;
+    bool m_LightTilesDirty;
+    
+    LightTiles* m_LightTiles;
+    LightProfiles* m_LightProfiles;
+    Vec4 m_AmbientLight;
     
-    uint32_t m_PointLightMask;
-    uint32_t m_CylindricalLightMask;
-    uint32_t m_ConicalLightMask;
-    uint32_t m_NumDirectionalLights;
+    // probe lighting for objects that aren't planar, see IrradianceGrid.h.  Not owned
+    Texture* m_IrradianceGrid;
+    float m_IrradianceGridWeight;
+    
+    // baked static lights, see Lightmap.h.  Not owned.  The transform takes screen space to its uv
+    // for the current view
+    const Lightmap* m_Lightmap;
+    Vec4 m_LightmapTransform;
     
     Texture* m_WhiteTexture;
     
@@ -80,7 +145,14 @@ struct RenderOptions
         kOrthographic
     };
     
+    enum ComputeDevice
+    {
+        kComputeGpu,
+        kComputeCpu
+    };
+    
     CameraType m_CameraType;
+    ComputeDevice m_ComputeDevice; // preferred OpenCL device, the other type is used if it's missing
     int m_Width;
     int m_Height;
 };
@@ -189,6 +261,16 @@ void RenderUseMaterial(RenderContext* context, int* textureSlotItr, const Materi
 void RenderSetMaterialConstants(RenderContext* renderContext, int* textureSlotItr, const Material* material);
 
 void RenderSetRenderTarget(RenderContext* renderContexxt, Texture* texture);
+void RenderSetViewport(RenderContext* renderContext, int x, int y, int width, int height);
+
+// Restrict drawing to uvRect (x0, y0, x1, y1) of whichever target is bound, now and on later
+// RenderSetRenderTarget calls.  Their clears still cover the whole target.
+void RenderSetScissor(RenderContext* renderContext, const Vec4& uvRect);
+void RenderClearScissor(RenderContext* renderContext);
+
+// clear uvRect of the bound target to color, for targets only partly drawn under a scissor.  The
+// scissor is left as it was
+void RenderClearRect(RenderContext* renderContext, const Vec4& uvRect, const Vec3& color);
 void RenderSetReplacementShader(RenderContext* renderContext, Shader* shader);
 void RenderClearReplacementShader(RenderContext* renderContext);
 
@@ -206,6 +288,10 @@ void RenderDrawModelSubset(RenderContext* renderContext, const Mat4& localToWorl
 void RenderDrawFullscreen(RenderContext* renderContext, Shader* shader, Texture* texture);
 void RenderDrawFullscreen(RenderContext* renderContext, Material* material, Texture* texture);
 
+// numInstances copies of numVertices triangle list vertices with no vertex data of their own, set up
+// like RenderDrawFullscreen's material draw; the vertex shader places them
+void RenderDrawProcedural(RenderContext* renderContext, Material* material, Texture* texture, int numVertices, int numInstances);
+
 void RenderDrawBillboard(RenderContext* renderContext, Material* material, Texture* texture, const Vec2 points[4]);
 
 void RenderAttachPostEffect(RenderContext* renderContext, PostEffect* effect);
@@ -217,6 +303,16 @@ Vec3 RenderGetWorldPos(const RenderContext* renderContext, const Vec2& screenPos
 
 void RenderSetBlendMode(Material::BlendMode blendMode);
 
+#if USE_CL
+// build an OpenCL program for renderContext's device.  null on failure, with the build log printed
+cl_program RenderClBuildProgram(RenderContext* renderContext, const char* path);
+
+// hand shared GL textures to the CL queue and back.  Commands enqueued between the two see everything
+// GL issued before the acquire, and GL commands issued after the release see everything CL wrote
+void       RenderClAcquireGLObjects(RenderContext* renderContext, const cl_mem* objects, int numObjects);
+void       RenderClReleaseGLObjects(RenderContext* renderContext, const cl_mem* objects, int numObjects);
+#endif
+
 ModelInstance* RenderGenerateCube(RenderContext* renderContext, float halfExtent);
 ModelInstance* RenderGenerateSprite(RenderContext* renderContext, const SpriteOptions& spriteOptions, Material* material);
 
@@ -224,10 +320,30 @@ void RenderDumpModel(const ModelInstance* model);
 void RenderDumpModelTransformed(const ModelInstance* model, const Mat4& a);
 void RenderDrawModel(RenderContext* renderContext, const ModelInstance* model);
 
-void RenderUpdatePointLights(RenderContext* renderContext, const Light* pointLights, int numPointLights);
-void RenderUpdateConicalLights(RenderContext* renderContext, const Light* conicalLights, int numConicalLights);
-void RenderUpdateCylindricalLights(RenderContext* renderContext, const Light* cylindricalLights, int numCylindricalLights);
-void RenderUpdateDirectionalLights(RenderContext* renderContext, const Light* directionalLights, int numDirectionalLights);
+// light updates go between a begin, which sizes this frame's slice of the light buffer, and an end
+void RenderBeginLightUpdate(RenderContext* renderContext, int numPointLights, int numConicalLights, int numCylindricalLights, int numDirectionalLights);
+void RenderEndLightUpdate(RenderContext* renderContext);
+
+// versions[i] is the scene light version slot i last changed in, version the current one
+void RenderUpdatePointLights(RenderContext* renderContext, const Light* pointLights, const uint32_t* versions, int numPointLights, uint32_t version);
+void RenderUpdateConicalLights(RenderContext* renderContext, const Light* conicalLights, const uint32_t* versions, int numConicalLights, uint32_t version);
+void RenderUpdateCylindricalLights(RenderContext* renderContext, const Light* cylindricalLights, const uint32_t* versions, int numCylindricalLights, uint32_t version);
+void RenderUpdateDirectionalLights(RenderContext* renderContext, const Light* directionalLights, const uint32_t* versions, int numDirectionalLights, uint32_t version);
+
+// bin the lights uploaded above into screen tiles for Planar.fsh, after all of the updates
+void RenderUpdateLightTiles(RenderContext* renderContext);
+
+// unshadowed light reaching every planar surface regardless of its normal
+void RenderSetAmbientLight(RenderContext* renderContext, const Vec4& color);
+
+// probe texture the non planar shaders sample, blended in by weight.  Null and 0 turn it off
+void RenderSetIrradianceGrid(RenderContext* renderContext, Texture* grid, float weight);
+
+// baked light added to the planar and probe lighting, null for none
+void RenderSetLightmap(RenderContext* renderContext, const Lightmap* lightmap);
+
+// a world space light as it's uploaded for the current view, as RenderUpdate*Lights converts it
+void RenderGetScreenLight(const RenderContext* renderContext, Light* dest, const Light* source);
 
 // global properties
 int  RenderAddGlobalProperty(RenderContext* renderContext, const char* materialPropertyName, Material::MaterialPropertyType type);
@@ -0,0 +1,318 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "Render/RenderState.h"
+
+#include <string.h>
+
+// anything GL can't hand back, so the first set after an invalidate always goes through
+#define kUnknown 0xffffffffu
+
+struct RenderState
+{
+    enum { kNumTextureUnits = 16 };
+    enum { kNumTextureTargets = 2 };     // GL_TEXTURE_2D, GL_TEXTURE_BUFFER
+    
+    GLuint m_Program;
+    GLuint m_ActiveTexture;              // unit
+    GLuint m_Textures[kNumTextureUnits][kNumTextureTargets];
+    
+    GLuint m_Blend;
+    GLuint m_BlendSource;
+    GLuint m_BlendDestination;
+    GLuint m_BlendEquation;
+    GLuint m_LogicOp;                    // 0 when disabled, the op otherwise
+    
+    GLuint m_DepthTest;
+    GLuint m_DepthMask;
+    GLuint m_DepthFunc;
+    
+    GLuint m_VertexArray;
+    GLuint m_DrawFrameBuffer;
+    GLuint m_ReadFrameBuffer;
+    
+    RenderStateStats m_Frame;
+    RenderStateStats m_LastFrame;
+};
+
+static RenderState s_RenderState;
+
+// -------------------------------------------------------------------------------------------------
+// s_RenderStateChange
+//
+// True when value differs from the shadow, which then takes it.
+static inline bool s_RenderStateChange(GLuint* shadow, GLuint value, RenderStateStats::Type type)
+{
+    if (*shadow == value)
+    {
+        s_RenderState.m_Frame.m_Filtered[type]++;
+        return false;
+    }
+    
+    *shadow = value;
+    s_RenderState.m_Frame.m_Issued[type]++;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+static inline int s_RenderStateTextureTarget(GLenum target)
+{
+    switch (target)
+    {
+        case GL_TEXTURE_2D:
+            return 0;
+        case GL_TEXTURE_BUFFER:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateInvalidate()
+{
+    s_RenderState.m_Program = kUnknown;
+    s_RenderState.m_ActiveTexture = kUnknown;
+    for (int i=0; i<RenderState::kNumTextureUnits; ++i)
+    {
+        for (int j=0; j<RenderState::kNumTextureTargets; ++j)
+            s_RenderState.m_Textures[i][j] = kUnknown;
+    }
+    
+    s_RenderState.m_Blend = kUnknown;
+    s_RenderState.m_BlendSource = kUnknown;
+    s_RenderState.m_BlendDestination = kUnknown;
+    s_RenderState.m_BlendEquation = kUnknown;
+    s_RenderState.m_LogicOp = kUnknown;
+    
+    s_RenderState.m_DepthTest = kUnknown;
+    s_RenderState.m_DepthMask = kUnknown;
+    s_RenderState.m_DepthFunc = kUnknown;
+    
+    s_RenderState.m_VertexArray = kUnknown;
+    s_RenderState.m_DrawFrameBuffer = kUnknown;
+    s_RenderState.m_ReadFrameBuffer = kUnknown;
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateUseProgram(GLuint program)
+{
+    if (s_RenderStateChange(&s_RenderState.m_Program, program, RenderStateStats::kProgram))
+        glUseProgram(program);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderStateBindTexture
+//
+// The active unit is left wherever the last bind put it; nothing else here depends on it.
+void RenderStateBindTexture(int unit, GLenum target, GLuint texture)
+{
+    if (s_RenderStateChange(&s_RenderState.m_ActiveTexture, (GLuint) unit, RenderStateStats::kTexture))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    
+    const int targetIndex = s_RenderStateTextureTarget(target);
+    if (unit >= RenderState::kNumTextureUnits || targetIndex < 0)
+    {
+        s_RenderState.m_Frame.m_Issued[RenderStateStats::kTexture]++;
+        glBindTexture(target, texture);
+        return;
+    }
+    
+    if (s_RenderStateChange(&s_RenderState.m_Textures[unit][targetIndex], texture, RenderStateStats::kTexture))
+        glBindTexture(target, texture);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetBlend(bool enabled)
+{
+    if (s_RenderStateChange(&s_RenderState.m_Blend, enabled, RenderStateStats::kBlend))
+    {
+        if (enabled)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetBlendFunc(GLenum source, GLenum destination)
+{
+    // one call sets both, so it counts once
+    if (s_RenderState.m_BlendSource == source && s_RenderState.m_BlendDestination == destination)
+    {
+        s_RenderState.m_Frame.m_Filtered[RenderStateStats::kBlend]++;
+        return;
+    }
+    
+    s_RenderState.m_BlendSource = source;
+    s_RenderState.m_BlendDestination = destination;
+    s_RenderState.m_Frame.m_Issued[RenderStateStats::kBlend]++;
+    glBlendFunc(source, destination);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetBlendEquation(GLenum equation)
+{
+    if (s_RenderStateChange(&s_RenderState.m_BlendEquation, equation, RenderStateStats::kBlend))
+        glBlendEquation(equation);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetLogicOp(bool enabled, GLenum op)
+{
+    const GLuint previous = s_RenderState.m_LogicOp;
+    if (!s_RenderStateChange(&s_RenderState.m_LogicOp, enabled ? op : 0, RenderStateStats::kBlend))
+        return;
+    
+    if (!enabled)
+    {
+        glDisable(GL_COLOR_LOGIC_OP);
+        return;
+    }
+    
+    if (previous == 0 || previous == kUnknown)
+        glEnable(GL_COLOR_LOGIC_OP);
+    glLogicOp(op);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetDepthTest(bool enabled)
+{
+    if (s_RenderStateChange(&s_RenderState.m_DepthTest, enabled, RenderStateStats::kDepth))
+    {
+        if (enabled)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetDepthMask(bool enabled)
+{
+    if (s_RenderStateChange(&s_RenderState.m_DepthMask, enabled, RenderStateStats::kDepth))
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateSetDepthFunc(GLenum func)
+{
+    if (s_RenderStateChange(&s_RenderState.m_DepthFunc, func, RenderStateStats::kDepth))
+        glDepthFunc(func);
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateBindVertexArray(GLuint vertexArray)
+{
+    if (s_RenderStateChange(&s_RenderState.m_VertexArray, vertexArray, RenderStateStats::kVertexArray))
+        glBindVertexArray(vertexArray);
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderStateBindFrameBuffer
+//
+// GL_FRAMEBUFFER is both binds in one call.
+void RenderStateBindFrameBuffer(GLenum target, GLuint frameBuffer)
+{
+    switch (target)
+    {
+        case GL_DRAW_FRAMEBUFFER:
+        {
+            if (s_RenderStateChange(&s_RenderState.m_DrawFrameBuffer, frameBuffer, RenderStateStats::kFrameBuffer))
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frameBuffer);
+            break;
+        }
+        case GL_READ_FRAMEBUFFER:
+        {
+            if (s_RenderStateChange(&s_RenderState.m_ReadFrameBuffer, frameBuffer, RenderStateStats::kFrameBuffer))
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, frameBuffer);
+            break;
+        }
+        default:
+        {
+            if (s_RenderState.m_DrawFrameBuffer == frameBuffer && s_RenderState.m_ReadFrameBuffer == frameBuffer)
+            {
+                s_RenderState.m_Frame.m_Filtered[RenderStateStats::kFrameBuffer]++;
+                break;
+            }
+            
+            s_RenderState.m_DrawFrameBuffer = frameBuffer;
+            s_RenderState.m_ReadFrameBuffer = frameBuffer;
+            s_RenderState.m_Frame.m_Issued[RenderStateStats::kFrameBuffer]++;
+            glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderStateGetFrameBuffer
+//
+// Only asks GL, and stalls, when the shadow doesn't know.
+GLuint RenderStateGetFrameBuffer(GLenum target)
+{
+    const bool read = target == GL_READ_FRAMEBUFFER;
+    GLuint* shadow = read ? &s_RenderState.m_ReadFrameBuffer : &s_RenderState.m_DrawFrameBuffer;
+    if (*shadow == kUnknown)
+    {
+        GLint frameBuffer = 0;
+        glGetIntegerv(read ? GL_READ_FRAMEBUFFER_BINDING : GL_DRAW_FRAMEBUFFER_BINDING, &frameBuffer);
+        *shadow = (GLuint) frameBuffer;
+    }
+    
+    return *shadow;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderStateForgetProgram
+//
+// A program in use outlives its glDeleteProgram, so don't guess what's current after it.
+void RenderStateForgetProgram(GLuint program)
+{
+    if (s_RenderState.m_Program == program)
+        s_RenderState.m_Program = kUnknown;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RenderStateForgetTexture
+//
+// GL unbinds a deleted texture from every unit.
+void RenderStateForgetTexture(GLuint texture)
+{
+    for (int i=0; i<RenderState::kNumTextureUnits; ++i)
+    {
+        for (int j=0; j<RenderState::kNumTextureTargets; ++j)
+        {
+            if (s_RenderState.m_Textures[i][j] == texture)
+                s_RenderState.m_Textures[i][j] = 0;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateForgetVertexArray(GLuint vertexArray)
+{
+    if (s_RenderState.m_VertexArray == vertexArray)
+        s_RenderState.m_VertexArray = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateForgetFrameBuffer(GLuint frameBuffer)
+{
+    if (s_RenderState.m_DrawFrameBuffer == frameBuffer)
+        s_RenderState.m_DrawFrameBuffer = 0;
+    if (s_RenderState.m_ReadFrameBuffer == frameBuffer)
+        s_RenderState.m_ReadFrameBuffer = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+void RenderStateEndFrame()
+{
+    s_RenderState.m_LastFrame = s_RenderState.m_Frame;
+    memset(&s_RenderState.m_Frame, 0, sizeof s_RenderState.m_Frame);
+}
+
+// -------------------------------------------------------------------------------------------------
+const RenderStateStats& RenderStateGetStats()
+{
+    return s_RenderState.m_LastFrame;
+}
@@ -0,0 +1,65 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+
+#include <stdint.h>
+
+// A shadow of the GL state the renderer changes per draw: the program, the textures bound to each
+// unit, blend and depth state, the vertex array and the frame buffers.  Each setter compares against
+// the shadow and only calls GL when the value really changes, so drawing the same material twice in
+// a row costs no state calls at all.
+//
+// The shadow is only right if every change goes through it.  Code that calls GL directly (ImGui) has
+// to RenderStateInvalidate afterwards, and deleted names have to be forgotten, since GL hands them
+// out again.
+struct RenderStateStats
+{
+    enum Type
+    {
+        kProgram,
+        kTexture,              // binds and active unit switches
+        kBlend,                // blending, blend function and equation, logic op
+        kDepth,
+        kVertexArray,
+        kFrameBuffer,
+        kNumTypes
+    };
+    
+    uint32_t m_Issued[kNumTypes];       // reached the driver
+    uint32_t m_Filtered[kNumTypes];     // already set
+};
+
+// forget everything, the next call of each setter goes to GL
+void     RenderStateInvalidate();
+
+void     RenderStateUseProgram(GLuint program);
+
+// target is GL_TEXTURE_2D or GL_TEXTURE_BUFFER; other targets and units past the shadow pass through
+void     RenderStateBindTexture(int unit, GLenum target, GLuint texture);
+
+void     RenderStateSetBlend(bool enabled);
+void     RenderStateSetBlendFunc(GLenum source, GLenum destination);
+void     RenderStateSetBlendEquation(GLenum equation);
+void     RenderStateSetLogicOp(bool enabled, GLenum op);
+
+void     RenderStateSetDepthTest(bool enabled);
+void     RenderStateSetDepthMask(bool enabled);
+void     RenderStateSetDepthFunc(GLenum func);
+
+void     RenderStateBindVertexArray(GLuint vertexArray);
+
+// target is GL_FRAMEBUFFER, GL_DRAW_FRAMEBUFFER or GL_READ_FRAMEBUFFER
+void     RenderStateBindFrameBuffer(GLenum target, GLuint frameBuffer);
+GLuint   RenderStateGetFrameBuffer(GLenum target);
+
+// call before glDelete* on the name
+void     RenderStateForgetProgram(GLuint program);
+void     RenderStateForgetTexture(GLuint texture);
+void     RenderStateForgetVertexArray(GLuint vertexArray);
+void     RenderStateForgetFrameBuffer(GLuint frameBuffer);
+
+// Counts roll over here, once a frame.  RenderStateGetStats returns the last whole frame's
+void     RenderStateEndFrame();
+const RenderStateStats& RenderStateGetStats();
@@ -11,8 +11,34 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Shader::BuiltinUniform order
+static const char* s_BuiltinUniformNames[Shader::kNumBuiltinUniforms] =
+{
+    "project",
+    "normalModel",
+    "localToWorld",
+    "modelView",
+    "view",
+    "_MainTex",
+    "_CameraPos",
+    "_Lights",
+    "_LightOffsets",
+    "_LightCounts",
+    "numDirectionalLights",
+    "_LightProfiles",
+    "_AmbientLight",
+    "_Lightmap",
+    "_LightmapTransform",
+    "_LightmapWeight",
+    "_IrradianceGrid",
+    "_IrradianceGridWeight",
+    "_LightTiles",
+    "_LightTileParams",
+};
+
 // internal singleton
 struct ShaderManager : SimpleAssetManager<Shader>
 {
@@ -39,11 +65,79 @@ ShaderManager::ShaderManager()
 void ShaderManager::DestroyShader(Shader* victim)
 {
     // jiv fixme delete shader for real
+    free(victim->m_Uniforms);
+    free(victim->m_UniformNames);
+    victim->m_Uniforms = nullptr;
+    victim->m_UniformNames = nullptr;
+    victim->m_NumUniforms = 0;
     
     // destroy bookkeeping
     DestroyAsset(victim);
 }
 
+static int s_ShaderCompareUniforms(const void* a, const void* b)
+{
+    const ShaderUniform* uniformA = (const ShaderUniform*) a;
+    const ShaderUniform* uniformB = (const ShaderUniform*) b;
+    if (uniformA->m_Hash != uniformB->m_Hash)
+        return uniformA->m_Hash < uniformB->m_Hash ? -1 : 1;
+    return strcmp(uniformA->m_Name, uniformB->m_Name);
+}
+
+// Every active uniform with a location, by the hash of its name with the name kept beside it, and
+// the builtins Render sets looked up in that.  Uniform block members have no location and are left out; the blocks
+// themselves are bound here once instead of per draw.
+static void s_ShaderReflect(Shader* shader)
+{
+    const GLuint program = shader->m_ProgramName;
+    
+    GLint numUniforms = 0;
+    GLint maxNameLength = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    
+    // names live in one block, maxNameLength+1 apart
+    shader->m_Uniforms = (ShaderUniform*) malloc(sizeof(ShaderUniform)*Max(numUniforms, 1));
+    shader->m_UniformNames = (char*) malloc((size_t) (maxNameLength+1)*Max(numUniforms, 1));
+    shader->m_NumUniforms = 0;
+    
+    for (int i=0; i<numUniforms; ++i)
+    {
+        char* name = &shader->m_UniformNames[(size_t) shader->m_NumUniforms*(maxNameLength+1)];
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = GL_ZERO;
+        glGetActiveUniform(program, (GLuint) i, maxNameLength+1, &length, &size, &type, name);
+        name[length] = '\0';
+        
+        const GLint location = glGetUniformLocation(program, name);
+        if (location < 0)
+            continue;
+        
+        // arrays are reported as name[0], and set by their plain name
+        if (length > 3 && !strcmp(name+length-3, "[0]"))
+            name[length-3] = '\0';
+        
+        ShaderUniform* uniform = &shader->m_Uniforms[shader->m_NumUniforms++];
+        uniform->m_Hash = Djb(name);
+        uniform->m_Name = name;
+        uniform->m_Location = location;
+        uniform->m_Type = type;
+        uniform->m_Size = size;
+    }
+    
+    qsort(shader->m_Uniforms, shader->m_NumUniforms, sizeof(ShaderUniform), s_ShaderCompareUniforms);
+    
+    GLint numUniformBlocks = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numUniformBlocks);
+    for (int i=0; i<numUniformBlocks; ++i)
+        glUniformBlockBinding(program, (GLuint) i, (GLuint) i);
+    shader->m_NumUniformBlocks = numUniformBlocks;
+    
+    for (int i=0; i<Shader::kNumBuiltinUniforms; ++i)
+        shader->m_BuiltinUniforms[i] = ShaderGetUniformLocation(shader, Djb(s_BuiltinUniformNames[i]), s_BuiltinUniformNames[i]);
+}
+
 Shader* ShaderManager::CreateShader(const char* fname)
 {
     const uint32_t crc = Djb(fname);
@@ -181,6 +275,7 @@ Shader* ShaderManager::CreateShader(const char* fname)
     }
     
     glValidateProgram(temp.m_ProgramName);
+    s_ShaderReflect(&temp);
     
     delete[] vShaderSource;
     delete[] fShaderSource;
@@ -193,11 +288,6 @@ Shader* ShaderManager::CreateShader(const char* fname)
     Shader* ret = AllocateAsset(crc);
     *ret = temp;
     
-    ret->m_PointLightBlockIndex = glGetUniformBlockIndex(ret->m_ProgramName, "PointLightData");
-    ret->m_CylindricalLightBlockIndex = glGetUniformBlockIndex(ret->m_ProgramName, "CylindricalLightData");
-    ret->m_ConicalLightBlockIndex = glGetUniformBlockIndex(ret->m_ProgramName, "ConicalLightData");
-    ret->m_DirectionalLightBlockIndex = glGetUniformBlockIndex(ret->m_ProgramName, "DirectionalLightData");
-    
     return ret;
 }
 
@@ -237,6 +327,30 @@ void ShaderDestroy(Shader* victim)
         g_ShaderManager->DestroyShader(victim);
 }
 
+// binary search for the first uniform with hash, the tables are a few dozen long; then a strcmp per
+// uniform sharing it, which is one unless two names collide
+GLint ShaderGetUniformLocation(const Shader* shader, uint32_t hash, const char* name)
+{
+    int lo = 0;
+    int hi = shader->m_NumUniforms;
+    while (lo < hi)
+    {
+        const int mid = (lo+hi) >> 1;
+        if (shader->m_Uniforms[mid].m_Hash < hash)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    
+    for (int i=lo; i<shader->m_NumUniforms && shader->m_Uniforms[i].m_Hash == hash; ++i)
+    {
+        if (!strcmp(shader->m_Uniforms[i].m_Name, name))
+            return shader->m_Uniforms[i].m_Location;
+    }
+    
+    return -1;
+}
+
 // internal
 
 Shader* g_SimpleShader;
@@ -6,19 +6,58 @@
 #include <stdint.h>
 #include <stdio.h>
 
+// an active uniform, found once when the program links
+struct ShaderUniform
+{
+    uint32_t m_Hash;           // Djb of m_Name
+    const char* m_Name;        // arrays without their [0], in the shader's m_UniformNames
+    GLint m_Location;
+    GLenum m_Type;
+    GLint m_Size;              // array elements
+};
+
 struct Shader
 {
+    // the uniforms Render sets on every draw, in m_BuiltinUniforms
+    enum BuiltinUniform
+    {
+        kUniformProject,
+        kUniformNormalModel,
+        kUniformLocalToWorld,
+        kUniformModelView,
+        kUniformView,
+        kUniformMainTex,
+        kUniformCameraPos,
+        kUniformLights,
+        kUniformLightOffsets,
+        kUniformLightCounts,
+        kUniformNumDirectionalLights,
+        kUniformLightProfiles,
+        kUniformAmbientLight,
+        kUniformLightmap,
+        kUniformLightmapTransform,
+        kUniformLightmapWeight,
+        kUniformIrradianceGrid,
+        kUniformIrradianceGridWeight,
+        kUniformLightTiles,
+        kUniformLightTileParams,
+        kNumBuiltinUniforms
+    };
+    
     const char* m_DebugName;
     GLuint m_ProgramName;
     int m_RefCount;
     uint32_t m_Crc;
     
-    GLuint m_PointLightBlockIndex;
-    GLuint m_ConicalLightBlockIndex;
-    GLuint m_CylindricalLightBlockIndex;
-    GLuint m_DirectionalLightBlockIndex;
+    // Reflection, so drawing never looks a uniform up by name.  Uniform blocks are bound to the
+    // binding point of their index
+    ShaderUniform* m_Uniforms; // sorted by m_Hash, then m_Name
+    char* m_UniformNames;
+    int m_NumUniforms;
+    int m_NumUniformBlocks;
+    GLint m_BuiltinUniforms[kNumBuiltinUniforms];   // -1 where the program doesn't use one
     
-    Shader() : m_RefCount(0), m_Crc(0)
+    Shader() : m_RefCount(0), m_Crc(0), m_Uniforms(nullptr), m_UniformNames(nullptr), m_NumUniforms(0), m_NumUniformBlocks(0)
     {
     }
     
@@ -50,4 +89,8 @@ inline Shader* ShaderRef(Shader* shader)
 
 void    ShaderDestroy(Shader* victim);
 
+// location of the uniform called name, whose Djb is hash, -1 if the program doesn't use it.  The
+// hash finds it, the name settles collisions
+GLint   ShaderGetUniformLocation(const Shader* shader, uint32_t hash, const char* name);
+
 
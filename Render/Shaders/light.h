@@ -1,52 +1,285 @@
 // -*- mode: glsl; tab-width: 4; c-basic-offset: 4; -*-
 
-struct Light
+// compact per type layouts, mirroring LightBuffer in Render/LightBuffer.h.  Screen space except
+// for directional lights.  Ranges are reciprocal, profiles are rows of _LightProfiles.
+struct PointLight
 {
-    int m_TypePad;
-    uint m_Index;
+    vec2 m_Position;
     float m_Range;
-    float m_Angle;
-    vec4 m_Color;
-    vec4 m_Position;
-    vec4 m_Direction;
-    float m_OrthogonalRange;
-    int m_PadA;
-    int m_PadB;
-    int m_PadC;
+    vec3 m_Color;
+    float m_RangeProfile;
 };
 
-struct DirectionalLight
+struct ConicalLight
 {
-    int m_TypePad;
-    int m_IndexPad;
-    int m_RangePad;
-    int m_Pad;
-    vec4 m_Color;
-    vec4 m_PositionPad;
-    vec4 m_Direction;
+    vec2 m_Position;
+    vec2 m_Direction;
+    vec3 m_Color;
+    float m_Range;
+    float m_CosAngle;
+    float m_RangeProfile;
+    float m_EdgeProfile;
 };
 
-layout (std140) uniform PointLightData
+struct CylindricalLight
 {
-    Light _PointLight[32];
+    vec2 m_Start;
+    vec2 m_End;
+    vec3 m_Color;
+    float m_OrthogonalRange;
+    float m_RangeProfile;
+    float m_EdgeProfile;
 };
 
-layout (std140) uniform ConicalLightData
+struct DirectionalLight
 {
-    Light _ConicalLight[32];
+    vec3 m_Direction;
+    vec3 m_Color;
 };
 
-layout (std140) uniform CylindricalLightData
+// this frame's slice of the light buffer, and where each type's array starts in it, in texels
+uniform samplerBuffer _Lights;
+uniform ivec4 _LightOffsets; // point, conical, cylindrical, directional
+uniform ivec4 _LightCounts;  // same order, for loops over every light rather than a tile's
+uniform uint numDirectionalLights;
+
+PointLight fetchPointLight(int slot)
 {
-    Light _CylindricalLight[32];
-};
+    int base = _LightOffsets.x + slot*2;
+    vec4 t0 = texelFetch(_Lights, base);
+    vec4 t1 = texelFetch(_Lights, base+1);
+    return PointLight(t0.xy, t0.z, t1.rgb, t0.w);
+}
 
-layout (std140) uniform DirectionalLightData
+ConicalLight fetchConicalLight(int slot)
 {
-    Light _DirectionalLight[32];
-};
-uniform uint numDirectionalLights;
+    int base = _LightOffsets.y + slot*3;
+    vec4 t0 = texelFetch(_Lights, base);
+    vec4 t1 = texelFetch(_Lights, base+1);
+    vec4 t2 = texelFetch(_Lights, base+2);
+    return ConicalLight(t0.xy, t0.zw, t1.rgb, t1.w, t2.x, t2.y, t2.z);
+}
+
+CylindricalLight fetchCylindricalLight(int slot)
+{
+    int base = _LightOffsets.z + slot*3;
+    vec4 t0 = texelFetch(_Lights, base);
+    vec4 t1 = texelFetch(_Lights, base+1);
+    vec4 t2 = texelFetch(_Lights, base+2);
+    return CylindricalLight(t0.xy, t0.zw, t1.rgb, t1.w, t2.x, t2.y);
+}
+
+DirectionalLight fetchDirectionalLight(int index)
+{
+    int base = _LightOffsets.w + index*2;
+    return DirectionalLight(texelFetch(_Lights, base).xyz, texelFetch(_Lights, base+1).rgb);
+}
+
+// per tile light lists, laid out as described in Render/LightTiles.h
+uniform usamplerBuffer _LightTiles;
+uniform vec4 _LightTileParams; // xy tiles per unit of screen uv, zw tile counts
+
+// list offset, then point, conical and cylindrical light counts for the tile under screen uv
+uvec4 lightTileHeader(vec2 uv)
+{
+    ivec2 tile = clamp(ivec2(uv*_LightTileParams.xy), ivec2(0, 0), ivec2(_LightTileParams.zw) - 1);
+    int base = (tile.y*int(_LightTileParams.z) + tile.x)*4;
+    return uvec4(texelFetch(_LightTiles, base).x,
+                 texelFetch(_LightTiles, base+1).x,
+                 texelFetch(_LightTiles, base+2).x,
+                 texelFetch(_LightTiles, base+3).x);
+}
+
+// slot of the index'th light in a tile list
+int lightTileSlot(uint index)
+{
+    return int(texelFetch(_LightTiles, int(index)).x);
+}
+
+// attenuation curves, one per row, see Render/LightProfiles.h
+uniform sampler2D _LightProfiles;
+
+// a profile's attenuation at x across its falloff, clamped to 0..1
+float lightProfile(float profile, float x)
+{
+    vec2 size = vec2(textureSize(_LightProfiles, 0));
+    vec2 uv = vec2((clamp(x, 0.0f, 1.0f)*(size.x - 1.0f) + 0.5f) / size.x, (profile + 0.5f) / size.y);
+    return textureLod(_LightProfiles, uv, 0.0f).r;
+}
+
+// each light's falloff at fragmentPos, before the surface's facing is taken into account
+float pointLightAttenuation(PointLight pointLight, vec2 fragmentPos)
+{
+    // screenspace distance based attenuation
+    float d0 = distance(pointLight.m_Position, fragmentPos.xy);
+    return lightProfile(pointLight.m_RangeProfile, d0*pointLight.m_Range);
+}
 
-uniform uint pointLightMask;
-uniform uint conicalLightMask;
-uniform uint cylindricalLightMask;
+float conicalLightAttenuation(ConicalLight conicalLight, vec2 fragmentPos)
+{
+    // angle attenuation, from the center ray out to the cone's edge
+    vec2 ray = normalize(conicalLight.m_Position - fragmentPos);
+    float theta = dot(ray, -normalize(conicalLight.m_Direction));
+    if (theta <= conicalLight.m_CosAngle)
+        return 0.0f;
+    
+    float phi = lightProfile(conicalLight.m_EdgeProfile, (1.0f - theta) / (1.0f - conicalLight.m_CosAngle));
+    
+    // screenspace distance based attenuation
+    float d0 = distance(conicalLight.m_Position, fragmentPos.xy);
+    return phi*lightProfile(conicalLight.m_RangeProfile, d0*conicalLight.m_Range);
+}
+
+float cylindricalLightAttenuation(CylindricalLight cylindricalLight, vec2 fragmentPos)
+{
+    vec2 lightAxis = cylindricalLight.m_End - cylindricalLight.m_Start;
+    float t = pointOnLineSegmentT(cylindricalLight.m_Start, cylindricalLight.m_End, fragmentPos.xy);
+    if (t < 0.0f || t > 1.0f)
+        return 0.0f;
+    
+    vec2 q0 = cylindricalLight.m_Start+lightAxis*t;
+    vec2 orthogonalProjection = fragmentPos.xy - q0;
+    float orthogonalAttenuation = lightProfile(cylindricalLight.m_RangeProfile, length(orthogonalProjection)*cylindricalLight.m_OrthogonalRange);
+    
+    // along the axis toward the end
+    float distanceAttenuation = lightProfile(cylindricalLight.m_EdgeProfile, t);
+    return distanceAttenuation*orthogonalAttenuation;
+}
+
+// lights past the budget, merged into one term without direction or shadow
+uniform vec3 _AmbientLight;
+
+// static lights baked with their shadows, see Render/Lightmap.h.  Weight 0 without a lightmap
+uniform sampler2D _Lightmap;
+uniform vec4 _LightmapTransform;   // xy scale, zw offset from screen space into lightmap uv
+uniform float _LightmapWeight;
+
+// baked light at fragmentPos (screen space), none outside the lightmap
+vec3 bakedLighting(vec2 fragmentPos)
+{
+    vec2 uv = fragmentPos*_LightmapTransform.xy + _LightmapTransform.zw;
+    if (_LightmapWeight <= 0.0f || any(lessThan(uv, vec2(0, 0))) || any(greaterThan(uv, vec2(1, 1))))
+        return vec3(0, 0, 0);
+    
+    return _LightmapWeight*textureLod(_Lightmap, uv, 0.0f).rgb;
+}
+
+// The part of planarLighting that doesn't come from the tile lists: ambient, baked and directional
+vec3 planarBaseLighting(vec2 fragmentPos, vec2 normal)
+{
+    vec3 color = _AmbientLight + bakedLighting(fragmentPos);
+    for (uint i=0u; i<numDirectionalLights; ++i)
+    {
+        DirectionalLight directionalLight = fetchDirectionalLight(int(i));
+        float c0 = clamp(dot(normal, directionalLight.m_Direction.xy), 0.0f, 1.0f);
+        color.rgb += c0*directionalLight.m_Color.rgb;
+    }
+    return color;
+}
+
+// one light's contribution to a planar surface, facing included
+vec3 pointLightTerm(PointLight pointLight, vec2 fragmentPos, vec2 normal)
+{
+    vec2 ray = normalize(pointLight.m_Position - fragmentPos);
+    float c0 = clamp(dot(normal, ray), 0.0f, 1.0f);
+    return c0*pointLightAttenuation(pointLight, fragmentPos)*pointLight.m_Color.rgb;
+}
+
+vec3 conicalLightTerm(ConicalLight conicalLight, vec2 fragmentPos, vec2 normal)
+{
+    vec2 ray = normalize(conicalLight.m_Position - fragmentPos);
+    float c0 = clamp(dot(normal, ray), 0.0f, 1.0f);
+    return c0*conicalLightAttenuation(conicalLight, fragmentPos)*conicalLight.m_Color.rgb;
+}
+
+vec3 cylindricalLightTerm(CylindricalLight cylindricalLight, vec2 fragmentPos, vec2 normal)
+{
+    return cylindricalLightAttenuation(cylindricalLight, fragmentPos)*cylindricalLight.m_Color.rgb;
+}
+
+// segments around a point light's disc and across a conical light's fan, three vertices each
+#define kLightVolumeSegments 16
+
+// stands in for 1/range when the range is zero, which lights the whole screen
+#define kLightVolumeUnbounded 1.0e4f
+
+// vertex of a fan of kLightVolumeSegments triangles around center, from angle0 to angle1.  The
+// outer edge is pushed out so the segments circumscribe the arc rather than cut into it
+vec2 lightVolumeFanVertex(vec2 center, float radius, float angle0, float angle1, int vertex)
+{
+    int segment = vertex / 3;
+    int corner = vertex - segment*3;
+    if (corner == 0)
+        return center;
+    
+    float step = (angle1 - angle0) / float(kLightVolumeSegments);
+    float angle = angle0 + step*float(segment + corner - 1);
+    return center + vec2(cos(angle), sin(angle))*radius/cos(0.5f*step);
+}
+
+// Vertex of a triangle list in ndc around just the pixels a light's attenuation reaches: a disc for
+// point lights, a fan for conical lights and the band along the segment for cylindrical lights.
+// lightClass is the LightTiles class (point, conical, cylindrical).  Black lights, which is what
+// disabled lights and free slots are, collapse to a point.
+vec2 lightVolumeVertex(float lightClass, int slot, int vertex)
+{
+    if (lightClass < 0.5f)
+    {
+        PointLight pointLight = fetchPointLight(slot);
+        if (pointLight.m_Color == vec3(0.0f))
+            return vec2(0.0f, 0.0f);
+        
+        float radius = pointLight.m_Range > 0.0f ? 1.0f / pointLight.m_Range : kLightVolumeUnbounded;
+        return lightVolumeFanVertex(pointLight.m_Position, radius, 0.0f, kTwoPi, vertex);
+    }
+    
+    if (lightClass < 1.5f)
+    {
+        ConicalLight conicalLight = fetchConicalLight(slot);
+        if (conicalLight.m_Color == vec3(0.0f))
+            return vec2(0.0f, 0.0f);
+        
+        float radius = conicalLight.m_Range > 0.0f ? 1.0f / conicalLight.m_Range : kLightVolumeUnbounded;
+        float axis = atan(conicalLight.m_Direction.y, conicalLight.m_Direction.x);
+        float halfAngle = acos(clamp(conicalLight.m_CosAngle, -1.0f, 1.0f));
+        return lightVolumeFanVertex(conicalLight.m_Position, radius, axis - halfAngle, axis + halfAngle, vertex);
+    }
+    
+    // t runs along the axis in aspect corrected space and the distance from it is taken in ndc, so
+    // the band's sides follow the aspect corrected normal
+    CylindricalLight cylindricalLight = fetchCylindricalLight(slot);
+    vec2 axis = cylindricalLight.m_End - cylindricalLight.m_Start;
+    vec2 side = vec2(-axis.y / _AspectRatio, axis.x*_AspectRatio);
+    if (cylindricalLight.m_Color == vec3(0.0f) || dot(side, side) <= 0.0f)
+        return vec2(0.0f, 0.0f);
+    
+    float halfWidth = cylindricalLight.m_OrthogonalRange > 0.0f ? 1.0f / cylindricalLight.m_OrthogonalRange : kLightVolumeUnbounded;
+    const vec2 corners[6] = vec2[6](vec2(0, -1), vec2(1, -1), vec2(1, 1), vec2(0, -1), vec2(1, 1), vec2(0, 1));
+    vec2 corner = corners[vertex];
+    return cylindricalLight.m_Start + axis*corner.x + normalize(side)*halfWidth*corner.y;
+}
+
+// Light reaching a planar surface at fragmentPos (screen space) whose normal is the decoded
+// _PlanarTex rg.  Shared by the forward (Planar.fsh) and deferred (DeferredLighting.fsh) paths.
+vec3 planarLighting(vec2 fragmentPos, vec2 normal)
+{
+    vec3 color = planarBaseLighting(fragmentPos, normal);
+    
+    // this pixel's tile lists the point, conical and cylindrical lights in order
+    uvec4 tile = lightTileHeader(toZeroOne(fragmentPos.xy));
+    uint itr = tile.x;
+    uint pointEnd = itr + tile.y;
+    uint conicalEnd = pointEnd + tile.z;
+    uint cylindricalEnd = conicalEnd + tile.w;
+    
+    for (; itr<pointEnd; ++itr)
+        color.rgb += pointLightTerm(fetchPointLight(lightTileSlot(itr)), fragmentPos, normal);
+    
+    for (; itr<conicalEnd; ++itr)
+        color.rgb += conicalLightTerm(fetchConicalLight(lightTileSlot(itr)), fragmentPos, normal);
+    
+    for (; itr<cylindricalEnd; ++itr)
+        color.rgb += cylindricalLightTerm(fetchCylindricalLight(lightTileSlot(itr)), fragmentPos, normal);
+    
+    return color;
+}
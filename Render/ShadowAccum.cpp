@@ -0,0 +1,81 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/ShadowAccum.h"
+#include "Render/Material.h"
+#include "Render/Render.h"
+#include "Render/Shader.h"
+#include "Render/Texture.h"
+
+// how fast a low resolution tap's weight falls off as its caster coverage departs from the pixel's
+#define kGuideSharpness 4.0f
+
+// -------------------------------------------------------------------------------------------------
+ShadowAccum* ShadowAccumCreate()
+{
+    ShadowAccum* ret = new ShadowAccum();
+    ret->m_Texture = nullptr;
+    ret->m_Resolution = kFull;
+    ret->m_Width = 0;
+    ret->m_Height = 0;
+    
+    // writes alpha 1, blending overwrites the frame buffer without writing depth
+    ret->m_UpsampleShader = ShaderCreate("obj/Shader/ShadowAccumUpsample");
+    ret->m_UpsampleMaterial = MaterialCreate(ret->m_UpsampleShader, nullptr);
+    ret->m_UpsampleMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_UpsampleMaterial->ReserveProperties(2);
+    ret->m_GuideTexIndex = ret->m_UpsampleMaterial->SetPropertyType("_GuideTex", Material::MaterialPropertyType::kTexture);
+    ret->m_GuideParamsIndex = ret->m_UpsampleMaterial->SetPropertyType("_GuideParams", Material::MaterialPropertyType::kVec4);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void ShadowAccumDestroy(ShadowAccum* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    MaterialDestroy(victim->m_UpsampleMaterial);
+    ShaderDestroy(victim->m_UpsampleShader);
+    TextureDestroy(victim->m_Texture);
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowAccumBegin
+void ShadowAccumBegin(RenderContext* renderContext, ShadowAccum* shadowAccum, PostEffectResolution resolution)
+{
+    const int divisor = PostEffectResolutionDivisor(resolution);
+    const int width = Max(renderContext->m_Width / divisor, 1);
+    const int height = Max(renderContext->m_Height / divisor, 1);
+    
+    // follow window resizes and resolution changes
+    if (shadowAccum->m_Texture == nullptr || width != shadowAccum->m_Width || height != shadowAccum->m_Height)
+    {
+        TextureDestroy(shadowAccum->m_Texture);
+        shadowAccum->m_Texture = TextureCreateRenderTexture(width, height, 0);
+        shadowAccum->m_Width = width;
+        shadowAccum->m_Height = height;
+    }
+    shadowAccum->m_Resolution = resolution;
+    
+    const Vec3& clearColor = renderContext->m_ClearColor;
+    shadowAccum->m_Texture->SetClearFlags(Texture::RenderTextureFlags::kClearColor, clearColor.m_X[0], clearColor.m_X[1], clearColor.m_X[2]);
+    RenderSetRenderTarget(renderContext, shadowAccum->m_Texture);
+    
+    // passes that rebind it mid frame keep what's been accumulated
+    shadowAccum->m_Texture->SetClearFlags(Texture::RenderTextureFlags::kClearNone);
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowAccumResolve
+void ShadowAccumResolve(RenderContext* renderContext, ShadowAccum* shadowAccum, Texture* guide)
+{
+    Material* material = shadowAccum->m_UpsampleMaterial;
+    material->SetTexture(shadowAccum->m_GuideTexIndex, guide);
+    material->SetVector(shadowAccum->m_GuideParamsIndex, Vec4(guide ? kGuideSharpness : 0.0f, 0.0f, 0.0f, 0.0f));
+    
+    RenderSetRenderTarget(renderContext, nullptr);
+    RenderDrawFullscreen(renderContext, material, shadowAccum->m_Texture);
+}
@@ -0,0 +1,36 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/PostEffect.h"
+
+struct Material;
+struct RenderContext;
+struct Shader;
+struct Texture;
+
+// Reduced resolution target for the shadow resolves and their blur.  At this point in the frame the
+// frame buffer holds nothing but the clear color and the shadow layer, so the buffer starts from the
+// clear color and replaces the frame buffer wholesale once it's done.
+struct ShadowAccum
+{
+    Texture* m_Texture;
+    PostEffectResolution m_Resolution;
+    int m_Width;
+    int m_Height;
+    
+    Shader* m_UpsampleShader;
+    Material* m_UpsampleMaterial;
+    int m_GuideTexIndex;
+    int m_GuideParamsIndex;
+};
+
+ShadowAccum* ShadowAccumCreate();
+void         ShadowAccumDestroy(ShadowAccum* victim);
+
+// size the buffer for the current screen at resolution, clear it and make it the render target
+void         ShadowAccumBegin(RenderContext* renderContext, ShadowAccum* shadowAccum, PostEffectResolution resolution);
+
+// Joint bilateral upsample into the frame buffer.  guide is the screen space caster target, whose
+// silhouettes are the edges the shadow layer shouldn't be filtered across; null upsamples bilinearly.
+void         ShadowAccumResolve(RenderContext* renderContext, ShadowAccum* shadowAccum, Texture* guide);
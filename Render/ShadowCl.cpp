@@ -0,0 +1,269 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/ShadowCl.h"
+#include "Render/Material.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Shader.h"
+#include "Render/Texture.h"
+#include "Engine/Utils.h"
+
+#include <string.h>
+
+#if USE_CL
+
+#define kKernelPath "Render/Kernels/Shadow.cl"
+
+// -------------------------------------------------------------------------------------------------
+// s_ShadowClBuild
+static bool s_ShadowClBuild(RenderContext* renderContext, ShadowCl* shadowCl)
+{
+    shadowCl->m_Program = RenderClBuildProgram(renderContext, kKernelPath);
+    if (!shadowCl->m_Program)
+        return false;
+    
+    int err = CL_SUCCESS;
+    shadowCl->m_RaymarchKernel = clCreateKernel(shadowCl->m_Program, "ShadowRaymarch", &err);
+    shadowCl->m_ResolveKernel = clCreateKernel(shadowCl->m_Program, "ShadowResolve", &err);
+    
+    return shadowCl->m_RaymarchKernel && shadowCl->m_ResolveKernel;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_ShadowClCreateImages
+//
+// Alias the GL textures directly when we can.  Otherwise the caster target comes over with
+// glReadPixels and the output goes back with glTexSubImage2D.
+static bool s_ShadowClCreateImages(RenderContext* renderContext, ShadowCl* shadowCl)
+{
+    int err = CL_SUCCESS;
+    
+    if (renderContext->m_ClGlSharing)
+    {
+        shadowCl->m_Casters = clCreateFromGLTexture(renderContext->m_Context, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, shadowCl->m_CasterTexture->m_TextureId, &err);
+        shadowCl->m_Output = clCreateFromGLTexture(renderContext->m_Context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, shadowCl->m_OutputTexture->m_TextureId, &err);
+        
+        shadowCl->m_Shared = shadowCl->m_Casters && shadowCl->m_Output;
+        if (shadowCl->m_Shared)
+            return true;
+        
+        // driver shares some formats but not these, fall back to copies
+        if (shadowCl->m_Casters)
+            clReleaseMemObject(shadowCl->m_Casters);
+        if (shadowCl->m_Output)
+            clReleaseMemObject(shadowCl->m_Output);
+    }
+    
+    shadowCl->m_Shared = false;
+    
+    const int width = shadowCl->m_CasterTexture->m_Width;
+    const int height = shadowCl->m_CasterTexture->m_Height;
+    
+    cl_image_format imageFormat;
+    imageFormat.image_channel_order = CL_RGBA;
+    imageFormat.image_channel_data_type = CL_UNORM_INT8;
+    
+    cl_image_desc imageDesc;
+    memset(&imageDesc, 0, sizeof imageDesc);
+    imageDesc.image_type = CL_MEM_OBJECT_IMAGE2D;
+    imageDesc.image_width = width;
+    imageDesc.image_height = height;
+    
+    shadowCl->m_Casters = clCreateImage(renderContext->m_Context, CL_MEM_READ_ONLY, &imageFormat, &imageDesc, nullptr, &err);
+    shadowCl->m_Output = clCreateImage(renderContext->m_Context, CL_MEM_WRITE_ONLY, &imageFormat, &imageDesc, nullptr, &err);
+    shadowCl->m_Staging = new uint8_t[width*height*4];
+    
+    return shadowCl->m_Casters && shadowCl->m_Output;
+}
+
+#endif
+
+// -------------------------------------------------------------------------------------------------
+ShadowCl* ShadowClCreate(RenderContext* renderContext, Texture* casterTexture, int shadowMapSize)
+{
+#if USE_CL
+    GL_ERROR_SCOPE();
+    
+    if (renderContext->m_Context == nullptr)
+        return nullptr;
+    
+    ShadowCl* ret = new ShadowCl();
+    memset(ret, 0, sizeof *ret);
+    
+    ret->m_ShadowMapSize = shadowMapSize;
+    ret->m_CasterTexture = TextureRef(casterTexture);
+    ret->m_OutputTexture = TextureCreateRenderTexture(casterTexture->m_Width, casterTexture->m_Height, 0);
+    
+    // output is lower resolution than the screen, filter it on the way up
+    RenderStateBindTexture(0, GL_TEXTURE_2D, ret->m_OutputTexture->m_TextureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    
+    ret->m_CompositeMaterial = MaterialCreate(g_SimpleTransparentShader, ret->m_OutputTexture);
+    ret->m_CompositeMaterial->m_BlendMode = Material::BlendMode::kBlend;
+    ret->m_CompositeMaterial->ReserveProperties(1);
+    int tintColor = ret->m_CompositeMaterial->SetPropertyType("TintColor", Material::MaterialPropertyType::kVec4);
+    ret->m_CompositeMaterial->SetVector(tintColor, Vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    
+    if (!s_ShadowClBuild(renderContext, ret) || !s_ShadowClCreateImages(renderContext, ret))
+    {
+        ShadowClDestroy(ret);
+        return nullptr;
+    }
+    
+    int err = CL_SUCCESS;
+    ret->m_Lights = clCreateBuffer(renderContext->m_Context, CL_MEM_READ_ONLY, ShadowCl::kMaxLights*sizeof(ShadowClLight), nullptr, &err);
+    ret->m_ShadowMaps = clCreateBuffer(renderContext->m_Context, CL_MEM_READ_WRITE, ShadowCl::kMaxLights*shadowMapSize*sizeof(float), nullptr, &err);
+    ret->m_ShadowMapsHost = new float[ShadowCl::kMaxLights*shadowMapSize];
+    
+    if (!ret->m_Lights || !ret->m_ShadowMaps)
+    {
+        Printf("Error: Failed to allocate compute buffers!\n");
+        ShadowClDestroy(ret);
+        return nullptr;
+    }
+    
+    return ret;
+#else
+    return nullptr;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+void ShadowClDestroy(ShadowCl* victim)
+{
+    if (victim == nullptr)
+        return;
+
+#if USE_CL
+    cl_mem memObjects[] = { victim->m_Casters, victim->m_Output, victim->m_Lights, victim->m_ShadowMaps };
+    for (int i=0; i<(int)ELEMENTSOF(memObjects); ++i)
+    {
+        if (memObjects[i])
+            clReleaseMemObject(memObjects[i]);
+    }
+    
+    if (victim->m_RaymarchKernel)
+        clReleaseKernel(victim->m_RaymarchKernel);
+    if (victim->m_ResolveKernel)
+        clReleaseKernel(victim->m_ResolveKernel);
+    if (victim->m_Program)
+        clReleaseProgram(victim->m_Program);
+    
+    delete[] victim->m_Staging;
+    delete[] victim->m_ShadowMapsHost;
+#endif
+
+    MaterialDestroy(victim->m_CompositeMaterial);
+    TextureDestroy(victim->m_OutputTexture);
+    TextureDestroy(victim->m_CasterTexture);
+    
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowClRender
+//
+// Everything on the CL queue is in order.  The 1d maps are read back right after the raymarch, so the
+// only host wait is for them while the resolve is still running; the composite itself reaches GL
+// through the shared texture, or through one more wait on the staging copy without sharing.
+void ShadowClRender(RenderContext* renderContext, ShadowCl* shadowCl, const ShadowClLight* lights, Texture** shadow1dMaps, int numLights)
+{
+#if USE_CL
+    GL_ERROR_SCOPE();
+    
+    numLights = Min(numLights, (int) ShadowCl::kMaxLights);
+    if (numLights == 0)
+        return;
+    
+    cl_command_queue commands = renderContext->m_CommandQueue;
+    const int width = shadowCl->m_OutputTexture->m_Width;
+    const int height = shadowCl->m_OutputTexture->m_Height;
+    const int shadowMapSize = shadowCl->m_ShadowMapSize;
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { (size_t) width, (size_t) height, 1 };
+    
+    cl_mem glObjects[] = { shadowCl->m_Casters, shadowCl->m_Output };
+    if (shadowCl->m_Shared)
+    {
+        RenderClAcquireGLObjects(renderContext, glObjects, ELEMENTSOF(glObjects));
+    }
+    else
+    {
+        const GLuint prevReadFrameBuffer = RenderStateGetFrameBuffer(GL_READ_FRAMEBUFFER);
+        
+        RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, shadowCl->m_CasterTexture->m_FrameBufferId);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, shadowCl->m_Staging);
+        RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, prevReadFrameBuffer);
+        
+        clEnqueueWriteImage(commands, shadowCl->m_Casters, CL_FALSE, origin, region, 0, 0, shadowCl->m_Staging, 0, nullptr, nullptr);
+    }
+    
+    // lights has to outlive the write; it does, since we wait below on a read queued after it
+    clEnqueueWriteBuffer(commands, shadowCl->m_Lights, CL_FALSE, 0, numLights*sizeof(ShadowClLight), lights, 0, nullptr, nullptr);
+    
+    // raymarch, (shadowMapSize, numLights)
+    {
+        cl_kernel kernel = shadowCl->m_RaymarchKernel;
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &shadowCl->m_Casters);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &shadowCl->m_Lights);
+        clSetKernelArg(kernel, 2, sizeof(cl_mem), &shadowCl->m_ShadowMaps);
+        clSetKernelArg(kernel, 3, sizeof(int), &shadowMapSize);
+        
+        const size_t globalSize[2] = { (size_t) shadowMapSize, (size_t) numLights };
+        clEnqueueNDRangeKernel(commands, kernel, 2, nullptr, globalSize, nullptr, 0, nullptr, nullptr);
+    }
+    
+    cl_event shadowMapsRead = nullptr;
+    clEnqueueReadBuffer(commands, shadowCl->m_ShadowMaps, CL_FALSE, 0, numLights*shadowMapSize*sizeof(float), shadowCl->m_ShadowMapsHost, 0, nullptr, &shadowMapsRead);
+    
+    // resolve, (width, height)
+    {
+        cl_kernel kernel = shadowCl->m_ResolveKernel;
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &shadowCl->m_Lights);
+        clSetKernelArg(kernel, 1, sizeof(int), &numLights);
+        clSetKernelArg(kernel, 2, sizeof(cl_mem), &shadowCl->m_ShadowMaps);
+        clSetKernelArg(kernel, 3, sizeof(int), &shadowMapSize);
+        clSetKernelArg(kernel, 4, sizeof(cl_mem), &shadowCl->m_Output);
+        
+        const size_t globalSize[2] = { (size_t) width, (size_t) height };
+        clEnqueueNDRangeKernel(commands, kernel, 2, nullptr, globalSize, nullptr, 0, nullptr, nullptr);
+    }
+    
+    cl_event outputRead = nullptr;
+    if (shadowCl->m_Shared)
+    {
+        RenderClReleaseGLObjects(renderContext, glObjects, ELEMENTSOF(glObjects));
+    }
+    else
+    {
+        clEnqueueReadImage(commands, shadowCl->m_Output, CL_FALSE, origin, region, 0, 0, shadowCl->m_Staging, 0, nullptr, &outputRead);
+        clFlush(commands);
+    }
+    
+    // 1d maps are float rgb, which CL can't alias, so they're always a copy
+    clWaitForEvents(1, &shadowMapsRead);
+    clReleaseEvent(shadowMapsRead);
+    
+    for (int i=0; i<numLights; ++i)
+    {
+        Texture* shadow1dMap = shadow1dMaps[i];
+        RenderStateBindTexture(0, GL_TEXTURE_2D, shadow1dMap->m_TextureId);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, Min(shadowMapSize, (int) shadow1dMap->m_Width), 1, GL_RED, GL_FLOAT, &shadowCl->m_ShadowMapsHost[i*shadowMapSize]);
+    }
+    
+    if (outputRead)
+    {
+        clWaitForEvents(1, &outputRead);
+        clReleaseEvent(outputRead);
+        
+        RenderStateBindTexture(0, GL_TEXTURE_2D, shadowCl->m_OutputTexture->m_TextureId);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, shadowCl->m_Staging);
+    }
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    
+    RenderDrawFullscreen(renderContext, shadowCl->m_CompositeMaterial, shadowCl->m_OutputTexture);
+#endif
+}
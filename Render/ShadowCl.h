@@ -0,0 +1,55 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+#include "Engine/Matrix.h"
+
+struct Material;
+struct RenderContext;
+struct Texture;
+
+// per light kernel input.  Layout must match Render/Kernels/Shadow.cl
+struct ShadowClLight
+{
+    Vec4 m_Position; // xy screen position in 0..1
+    Vec4 m_Facing;   // xy cone direction, w cos of the half angle.  w < -1 for lights without a cone
+    Vec4 m_Color;
+};
+
+// OpenCL raymarch + resolve for all shadowed lights at once.  The caster target is read and the
+// composite written through shared GL textures when the context supports it, otherwise both are
+// copied through host memory.  The 1d maps always come back to the host (a few KB per light) so each
+// light's m_Shadow1dMap stays current for ShadowReadback.
+struct ShadowCl
+{
+    enum { kMaxLights = 32 };
+    
+    Texture* m_CasterTexture;
+    Texture* m_OutputTexture;
+    Material* m_CompositeMaterial;
+    int m_ShadowMapSize;
+
+#if USE_CL
+    cl_program m_Program;
+    cl_kernel m_RaymarchKernel;
+    cl_kernel m_ResolveKernel;
+    
+    cl_mem m_Casters;
+    cl_mem m_Output;
+    cl_mem m_Lights;
+    cl_mem m_ShadowMaps;
+    
+    bool m_Shared;
+    uint8_t* m_Staging;    // w*h rgba8, only without sharing
+    float* m_ShadowMapsHost;
+#endif
+};
+
+// null if OpenCL isn't available or the kernels don't build; callers keep using the GL passes
+ShadowCl* ShadowClCreate(RenderContext* renderContext, Texture* casterTexture, int shadowMapSize);
+void      ShadowClDestroy(ShadowCl* victim);
+
+// raymarch and resolve numLights lights against the caster texture, upload the resulting 1d maps into
+// shadow1dMaps[] and blend the combined shadow layer over the current render target
+void      ShadowClRender(RenderContext* renderContext, ShadowCl* shadowCl, const ShadowClLight* lights, Texture** shadow1dMaps, int numLights);
@@ -0,0 +1,177 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#include "slib/Common/Util.h"
+#include "Render/ShadowReadback.h"
+#include "Render/Render.h"
+#include "Render/RenderState.h"
+#include "Render/Texture.h"
+
+#define _USE_MATH_DEFINES 1
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+// -------------------------------------------------------------------------------------------------
+ShadowReadback* ShadowReadbackCreate(int width)
+{
+    GL_ERROR_SCOPE();
+    
+    ShadowReadback* ret = new ShadowReadback();
+    ret->m_Width = width;
+    ret->m_Distances = new float[width];
+    ret->m_WriteIndex = 0;
+    ret->m_Requested = false;
+    ret->m_Valid = false;
+    
+    glGenBuffers(ShadowReadback::kNumBuffers, ret->m_PixelBufferIds);
+    for (int i=0; i<ShadowReadback::kNumBuffers; ++i)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, ret->m_PixelBufferIds[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width*sizeof(float), nullptr, GL_STREAM_READ);
+        ret->m_Pending[i] = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+void ShadowReadbackDestroy(ShadowReadback* victim)
+{
+    if (victim == nullptr)
+        return;
+    
+    glDeleteBuffers(ShadowReadback::kNumBuffers, victim->m_PixelBufferIds);
+    delete[] victim->m_Distances;
+    delete victim;
+}
+
+// -------------------------------------------------------------------------------------------------
+void ShadowReadbackRequest(ShadowReadback* shadowReadback)
+{
+    if (shadowReadback)
+        shadowReadback->m_Requested = true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowReadbackUpdate
+//
+// Reads go into alternating pixel buffers.  The buffer we map here was filled a frame ago, so by now
+// the copy has long since landed and the map doesn't wait on the GPU.
+void ShadowReadbackUpdate(RenderContext* renderContext, ShadowReadback* shadowReadback, const Texture* shadow1dMap, const Vec4& lightPos, const Vec4& screenToCrop)
+{
+    GL_ERROR_SCOPE();
+    
+    const int writeIndex = shadowReadback->m_WriteIndex;
+    const int readIndex = (writeIndex+1) % ShadowReadback::kNumBuffers;
+    const int width = shadowReadback->m_Width;
+    
+    // retire last frame's read
+    bool retired = false;
+    if (shadowReadback->m_Pending[readIndex])
+    {
+        const ShadowReadback::Capture& capture = shadowReadback->m_InFlight[readIndex];
+        if (capture.m_HasShadowMap)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, shadowReadback->m_PixelBufferIds[readIndex]);
+            const void* p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width*sizeof(float), GL_MAP_READ_BIT);
+            if (p)
+            {
+                memcpy(shadowReadback->m_Distances, p, width*sizeof(float));
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        
+        shadowReadback->m_Current = capture;
+        shadowReadback->m_Pending[readIndex] = false;
+        shadowReadback->m_Valid = true;
+        retired = true;
+    }
+    
+    // nobody asked, so skip the transfer.  What just retired stays good for this frame's late queries,
+    // anything older is stale
+    if (!shadowReadback->m_Requested)
+    {
+        if (!retired)
+            shadowReadback->m_Valid = false;
+        
+        shadowReadback->m_WriteIndex = readIndex;
+        return;
+    }
+    shadowReadback->m_Requested = false;
+    
+    // queue this frame's read
+    ShadowReadback::Capture* capture = &shadowReadback->m_InFlight[writeIndex];
+    capture->m_View = renderContext->m_View;
+    capture->m_Projection = renderContext->m_Projection;
+    capture->m_LightPos = lightPos;
+    capture->m_ScreenToCrop = screenToCrop;
+    capture->m_HasShadowMap = shadow1dMap != nullptr;
+    
+    if (shadow1dMap)
+    {
+        const GLuint prevReadFrameBuffer = RenderStateGetFrameBuffer(GL_READ_FRAMEBUFFER);
+        
+        RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, shadow1dMap->m_FrameBufferId);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, shadowReadback->m_PixelBufferIds[writeIndex]);
+        glReadPixels(0, 0, Min(width, (int) shadow1dMap->m_Width), 1, GL_RED, GL_FLOAT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        
+        RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, prevReadFrameBuffer);
+    }
+    
+    shadowReadback->m_Pending[writeIndex] = true;
+    shadowReadback->m_WriteIndex = readIndex;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ShadowReadbackIsOccluded
+//
+// Mirrors SampleShadowMap.fsh: extend the ray from the light through the point out to the edge of the
+// map's box, index the 1d map by the angle of that exit point, and compare occluder distance against
+// distance to the light.  Everything is in the 0..1 space the map was rendered in, either the screen
+// or the light's caster crop.
+bool ShadowReadbackIsOccluded(const ShadowReadback* shadowReadback, const Vec3& worldPos)
+{
+    if (!shadowReadback || !shadowReadback->m_Valid)
+        return false;
+    
+    const ShadowReadback::Capture& capture = shadowReadback->m_Current;
+    if (!capture.m_HasShadowMap)
+        return false;
+    
+    // width and height cancel out, RenderGetScreenPos lands in 0..1 either way
+    const Vec2 screenUv = RenderGetScreenPos(capture.m_View, capture.m_Projection, 1.0f, 1.0f, worldPos).xy();
+    const Vec2 uv = screenUv*capture.m_ScreenToCrop.xy() + capture.m_ScreenToCrop.zw();
+    
+    // casters are only rasterized inside the map's box, so nothing outside it can be in shadow
+    if (uv.m_X[0] < 0.0f || uv.m_X[0] > 1.0f || uv.m_X[1] < 0.0f || uv.m_X[1] > 1.0f)
+        return false;
+    
+    const Vec2 lsp = capture.m_LightPos.xy();
+    const float lr = (lsp - uv).Length();
+    if (lr <= 0.0f)
+        return false;
+    
+    // clip the ray to the -1,1 box
+    const Vec2 p0 = lsp*2.0f - Vec2(1.0f, 1.0f);
+    const Vec2 dir = ((uv*2.0f - Vec2(1.0f, 1.0f)) - p0).Normalized();
+    
+    float t = FLT_MAX;
+    for (int i=0; i<2; ++i)
+    {
+        if (dir.m_X[i] > 0.0f)
+            t = Min(t, ( 1.0f - p0.m_X[i]) / dir.m_X[i]);
+        else if (dir.m_X[i] < 0.0f)
+            t = Min(t, (-1.0f - p0.m_X[i]) / dir.m_X[i]);
+    }
+    
+    const Vec2 exitPoint = p0 + dir*t;
+    const float theta = (atan2f(exitPoint.m_X[1], exitPoint.m_X[0]) + float(M_PI)) / (2.0f*float(M_PI));
+    
+    const int width = shadowReadback->m_Width;
+    const int texel = Max(0, Min(width-1, (int) (theta * width)));
+    
+    return shadowReadback->m_Distances[texel] <= lr;
+}
@@ -0,0 +1,55 @@
+// -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+
+#pragma once
+
+#include "Render/GL.h"
+#include "Engine/Matrix.h"
+
+struct RenderContext;
+struct Texture;
+
+// CPU copy of a light's 1d shadow map, read back through a pair of pixel buffers so the GPU never
+// stalls.  Results are always one frame old.  Reads are only queued while something asks for them
+// (ShadowReadbackRequest), so lights nobody queries cost no transfer.
+struct ShadowReadback
+{
+    enum { kNumBuffers = 2 };
+    
+    // everything needed to map a world position into the space the 1d map was rendered in
+    struct Capture
+    {
+        Mat4 m_View;
+        Mat4 m_Projection;
+        Vec4 m_LightPos;       // in the space the map was built in
+        Vec4 m_ScreenToCrop;   // xy scale, zw offset from screen uv to that space
+        bool m_HasShadowMap;
+    };
+    
+    GLuint m_PixelBufferIds[kNumBuffers];
+    Capture m_InFlight[kNumBuffers];
+    bool m_Pending[kNumBuffers];
+    int m_WriteIndex;
+    bool m_Requested;          // a query asked since the last update
+    
+    int m_Width;
+    float* m_Distances;
+    Capture m_Current;
+    bool m_Valid;
+};
+
+ShadowReadback* ShadowReadbackCreate(int width);
+void            ShadowReadbackDestroy(ShadowReadback* victim);
+
+// ask for the next ShadowReadbackUpdate to queue a read.  Queries call this every time they look, so
+// the reads keep coming for as long as someone keeps asking
+void            ShadowReadbackRequest(ShadowReadback* shadowReadback);
+
+// retire the read queued last frame and, if one was requested, queue an asynchronous read of
+// shadow1dMap.  Pass a null shadow1dMap when the light skipped its shadow passes this frame; it then
+// occludes nothing.
+// lightPos and screenToCrop are the _LightPosition and _ScreenToCrop SampleShadowMap.fsh was given.
+void            ShadowReadbackUpdate(RenderContext* renderContext, ShadowReadback* shadowReadback, const Texture* shadow1dMap, const Vec4& lightPos, const Vec4& screenToCrop);
+
+// true if worldPos was behind a shadow caster as seen from the light, as of the last retired read.
+// Until a requested read retires, nothing is occluded
+bool            ShadowReadbackIsOccluded(const ShadowReadback* shadowReadback, const Vec3& worldPos);
@@ -5,18 +5,22 @@
 #include "Render/Texture.h"
 #include "Render/Material.h"
 #include "Render/Render.h"
+#include "Render/RenderState.h"
 #include "Engine/Utils.h"
 #include "Render/GL.h"
 
 #include "lodepng/lodepng.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #if !defined(WINDOWS)
 #include <execinfo.h>
 #endif
 
 struct TextureManager : SimpleAssetManager<Texture>
 {
-    Texture* CreateTexture(const char* fname, uint32_t crc);
+    Texture* CreateTexture(const char* fname, uint32_t crc, Texture::Usage usage);
     Texture* CreateRenderTexture(int width, int height, int depth, Texture::RenderTextureFormat format);
     void DestroyTexture(Texture* victim);
 
@@ -45,9 +49,8 @@ Texture* TextureManager::CreateRenderTexture(int width, int height, int depth, T
     texture->m_Depth = depth;
     texture->m_TextureId = -1;
     
-    glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &texture->m_TextureId);
-    glBindTexture(GL_TEXTURE_2D, texture->m_TextureId);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, texture->m_TextureId);
     
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -72,6 +75,11 @@ Texture* TextureManager::CreateRenderTexture(int width, int height, int depth, T
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32UI, width, height, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
             break;
         }
+        case Texture::RenderTextureFormat::kHalf:
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            break;
+        }
         default:
         {
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
@@ -79,18 +87,118 @@ Texture* TextureManager::CreateRenderTexture(int width, int height, int depth, T
         }
     }
     
-    glBindTexture(GL_TEXTURE_2D, 0);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, 0);
+    
+    // put back whatever was being drawn to, render textures get made mid frame
+    const GLuint drawFrameBuffer = RenderStateGetFrameBuffer(GL_DRAW_FRAMEBUFFER);
+    const GLuint readFrameBuffer = RenderStateGetFrameBuffer(GL_READ_FRAMEBUFFER);
     
     glGenFramebuffers(1, &texture->m_FrameBufferId);
-    glBindFramebuffer(GL_FRAMEBUFFER, texture->m_FrameBufferId);
+    RenderStateBindFrameBuffer(GL_FRAMEBUFFER, texture->m_FrameBufferId);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->m_TextureId, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0); // jiv fixme: should save/restore
+    RenderStateBindFrameBuffer(GL_DRAW_FRAMEBUFFER, drawFrameBuffer);
+    RenderStateBindFrameBuffer(GL_READ_FRAMEBUFFER, readFrameBuffer);
     
     return texture;
 }
 
 // -------------------------------------------------------------------------------------------------
-Texture* TextureManager::CreateTexture(const char* filename, uint32_t crc)
+// s_TextureEncodeBc4
+//
+// One channel of a 4x4 block: the block's max and min as endpoints, in the eight value mode, and
+// each texel's nearest of the six values between them.
+static void s_TextureEncodeBc4(uint8_t* dest, const uint8_t values[16])
+{
+    int lo = 255;
+    int hi = 0;
+    for (int i=0; i<16; ++i)
+    {
+        lo = Min(lo, (int) values[i]);
+        hi = Max(hi, (int) values[i]);
+    }
+    
+    uint64_t bits = 0;
+    if (hi > lo)
+    {
+        const int range = hi - lo;
+        for (int i=0; i<16; ++i)
+        {
+            // steps from hi (0) to lo (7), then the palette's order: hi, lo, the six in between
+            const int step = ((hi - values[i])*7 + range/2) / range;
+            const uint64_t index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+            bits |= index << (3*i);
+        }
+    }
+    
+    dest[0] = (uint8_t) hi;
+    dest[1] = (uint8_t) lo;
+    for (int i=0; i<6; ++i)
+        dest[2+i] = (uint8_t) (bits >> (8*i));
+}
+
+// -------------------------------------------------------------------------------------------------
+// TextureEncodeBc5
+//
+// Red then green per block, edge blocks clamped.
+uint8_t* TextureEncodeBc5(const uint8_t* rgba, int width, int height, int* size)
+{
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    *size = blocksX*blocksY*16;
+    
+    uint8_t* ret = (uint8_t*) malloc(*size);
+    uint8_t* dest = ret;
+    for (int by=0; by<blocksY; ++by)
+    {
+        for (int bx=0; bx<blocksX; ++bx)
+        {
+            uint8_t red[16];
+            uint8_t green[16];
+            for (int i=0; i<16; ++i)
+            {
+                const int x = Min(bx*4 + (i & 3), width - 1);
+                const int y = Min(by*4 + (i >> 2), height - 1);
+                const uint8_t* texel = &rgba[(y*width + x)*4];
+                red[i] = texel[0];
+                green[i] = texel[1];
+            }
+            
+            s_TextureEncodeBc4(dest, red);
+            s_TextureEncodeBc4(dest + 8, green);
+            dest += 16;
+        }
+    }
+    
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_TextureUploadPlanarNormal
+//
+// Planar.fsh only reads rg of a normal map, so it goes up as BC5, a quarter of the RGBA8 size.
+// RGTC is core from GL 3.0, so the 3.2 core context always has it.
+static void s_TextureUploadPlanarNormal(const unsigned char* data, int width, int height)
+{
+    int size;
+    uint8_t* blocks = TextureEncodeBc5(data, width, height, &size);
+    glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RG_RGTC2, width, height, 0, size, blocks);
+    free(blocks);
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_TextureHashPixels
+//
+// FNV-1a over the decoded image, once per load.
+static uint32_t s_TextureHashPixels(const unsigned char* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<size; ++i)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+// -------------------------------------------------------------------------------------------------
+Texture* TextureManager::CreateTexture(const char* filename, uint32_t crc, Texture::Usage usage)
 {
     unsigned int width;
     unsigned int height;
@@ -103,12 +211,26 @@ Texture* TextureManager::CreateTexture(const char* filename, uint32_t crc)
     texture.m_FrameBufferId = -1;
     
     texture.m_DebugName = filename;
+    texture.m_ContentHash = s_TextureHashPixels(data, (size_t) width*height*4);
     
-    glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &texture.m_TextureId);
-    glBindTexture(GL_TEXTURE_2D, texture.m_TextureId);
+    RenderStateBindTexture(0, GL_TEXTURE_2D, texture.m_TextureId);
+    
+    switch (usage)
+    {
+        case Texture::kUsagePlanarNormal:
+        {
+            s_TextureUploadPlanarNormal(data, width, height);
+            break;
+        }
+        default:
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+            break;
+        }
+    }
+    free(data);
     
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -122,6 +244,7 @@ Texture* TextureManager::CreateTexture(const char* filename, uint32_t crc)
 // -------------------------------------------------------------------------------------------------
 void TextureManager::DestroyTexture(Texture* victim)
 {
+    RenderStateForgetTexture(victim->m_TextureId);
     glDeleteTextures(1, &victim->m_TextureId);
     victim->m_TextureId = -1;
     
@@ -132,6 +255,7 @@ void TextureManager::DestroyTexture(Texture* victim)
     
     if (victim->m_Flags == Texture::kRenderTexture)
     {
+        RenderStateForgetFrameBuffer(victim->m_FrameBufferId);
         glDeleteFramebuffers(1, &victim->m_FrameBufferId);
         victim->m_FrameBufferId = -1;
         delete victim;
@@ -147,13 +271,13 @@ void TextureManager::DumpInternal(const Texture* texture)
 }
 
 // -------------------------------------------------------------------------------------------------
-Texture* TextureCreateFromFile(const char* filename)
+Texture* TextureCreateFromFile(const char* filename, Texture::Usage usage)
 {
     Texture* ret = nullptr;
-    const uint32_t crc = Djb(filename);
+    const uint32_t crc = Djb(filename) + usage*0x9e3779b9u;
     const int index = g_TextureManager->Find(crc);
     if (index<0)
-        ret = g_TextureManager->CreateTexture(filename, crc);
+        ret = g_TextureManager->CreateTexture(filename, crc, usage);
     else
         ret = &g_TextureManager->m_Assets[index];
     if (ret != nullptr)
@@ -192,6 +316,8 @@ void TextureDestroy(Texture* victim)
     {
         if (victim->m_Flags == Texture::kRenderTexture)
         {
+            RenderStateForgetTexture(victim->m_TextureId);
+            RenderStateForgetFrameBuffer(victim->m_FrameBufferId);
             glDeleteTextures(1, &victim->m_TextureId);
             glDeleteFramebuffers(1, &victim->m_FrameBufferId);
             delete victim;
@@ -20,7 +20,8 @@ struct Texture
         kRgb,
         kRgba,
         kFloat,
-        kUInt
+        kUInt,
+        kHalf                  // RGBA16F, for values 8 bits can't resolve
     };
     
     enum RenderTextureFlags : uint32_t
@@ -30,6 +31,13 @@ struct Texture
         kClearDepth
     };
     
+    // what a file texture is sampled for, which picks its internal format
+    enum Usage : uint32_t
+    {
+        kUsageColor,           // RGBA8
+        kUsagePlanarNormal     // _PlanarTex, rg only: BC5 (RGTC2)
+    };
+    
     Flags m_Flags;
     RenderTextureFlags m_RenderTextureFlags;
     int32_t m_Depth;
@@ -42,12 +50,14 @@ struct Texture
     int m_RefCount;
     const char* m_DebugName;
     uint32_t m_Format;
+    uint32_t m_ContentHash;    // of a file texture's decoded pixels, so edits to the image show; 0 otherwise
     
     inline void Invalidate()
     {
         m_TextureId = -1;
         m_FrameBufferId = -1;
         m_DebugName = nullptr;
+        m_ContentHash = 0;
     }
     
     Texture() : m_ClearColor(0,0,0), m_ClearDepth(1.0f), m_RefCount(0)
@@ -71,7 +81,8 @@ struct Texture
         m_ClearColor(rhs.m_ClearColor), 
         m_ClearDepth(rhs.m_ClearDepth),
         m_RefCount(rhs.m_RefCount),
-        m_DebugName(nullptr)
+        m_DebugName(nullptr),
+        m_ContentHash(rhs.m_ContentHash)
     {
     }
     
@@ -81,9 +92,13 @@ struct Texture
 void      TextureInit();
 void      TextureFini();
 
-// create/destroy material
-Texture*  TextureCreateFromFile(const char* path);
+// create/destroy material.  The same file loaded for different usages is two textures
+Texture*  TextureCreateFromFile(const char* path, Texture::Usage usage = Texture::kUsageColor);
 Texture*  TextureCreateRenderTexture(int width, int height, int depth, Texture::RenderTextureFormat format = Texture::RenderTextureFormat::kRgb);
 void      TextureDestroy(Texture* victim);
 
 Texture*  TextureRef(Texture* texture);
+
+// rg of an RGBA8 image as BC5 (RGTC2) blocks, as kUsagePlanarNormal uploads it.  Returns malloc'ed
+// blocks and their size in bytes.
+uint8_t*  TextureEncodeBc5(const uint8_t* rgba, int width, int height, int* size);
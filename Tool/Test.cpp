@@ -1,15 +1,26 @@
 // -*- mode: c++; tab-width: 4; c-basic-offset: 4; -*-
+#include "slib/Common/Util.h"
 #include "Engine/Matrix.h"
+#include "Engine/Scene.h"
 #include "Engine/Utils.h"
+#include "Render/LightTiles.h"
+#include "Render/Render.h"
+#include "Render/Texture.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define _TEST(func, funcString) if (!func()) { Printf(funcString " failed!\n"); exit(1); }
 #define TEST(func) _TEST(func, #func)
+#define TEST_CONTEXT(func) if (!func(renderContext)) { Printf(#func " failed!\n"); exit(1); }
 
 static bool Mat3MakeZero();
 static bool Mat3DiagonalizeTest();
 static bool MatrixMultiplyVecTest();
+static bool Bc5RoundTripTest();
+static bool LightTilesBinTest();
+static bool SceneLightSlotTest();
+static bool SceneLightBudgetTest(RenderContext* renderContext);
 
 void MatrixTest()
 {
@@ -18,6 +29,18 @@ void MatrixTest()
     TEST(Mat3DiagonalizeTest);
 }
 
+void TextureTest()
+{
+    TEST(Bc5RoundTripTest);
+}
+
+void LightingTest(RenderContext* renderContext)
+{
+    TEST(LightTilesBinTest);
+    TEST(SceneLightSlotTest);
+    TEST_CONTEXT(SceneLightBudgetTest);
+}
+
 static bool MatrixMultiplyVecTest()
 {
   Vec3 v;
@@ -47,7 +70,7 @@ static bool MatrixMultiplyVecTest()
     MatrixDump(r, "r");
     VectorDump(dest, "dest: ");
   }
-    
+  
   return true;
 }
 
@@ -89,19 +112,19 @@ static bool Mat3DiagonalizeTest()
     
     float lambdas[3];
     Mat3Diagonalize(&s, lambdas, &sInv, a);
-
+    
     Mat3 d;
     MatrixMakeDiagonal(&d, lambdas);
-
+    
     Mat3 sd;
     MatrixMultiply(&sd, s, d);
-
+    
     Mat3 sdsInv;
     MatrixMultiply(&sdsInv, sd, sInv);
-
+    
     Mat3 sdsInvInv;
     MatrixInvert(&sdsInvInv, sdsInv);
-
+    
     Mat3 ident;    
     MatrixMultiply(&ident, sdsInvInv, a);
     
@@ -115,3 +138,285 @@ static bool Mat3DiagonalizeTest()
     
     return false;
 }
+
+// -------------------------------------------------------------------------------------------------
+// Bc5RoundTripTest
+//
+// Decodes with the eight value palette of the spec.  Each texel has to land on the nearest of the
+// block's eight steps, so it's off by at most half a step plus the palette's rounding.
+static bool Bc5RoundTripTest()
+{
+    // not a multiple of four, so the last row and column of blocks are clamped
+    const int width = 10;
+    const int height = 6;
+    uint8_t rgba[width*height*4];
+    for (int y=0; y<height; ++y)
+    {
+        for (int x=0; x<width; ++x)
+        {
+            uint8_t* texel = &rgba[(y*width + x)*4];
+            texel[0] = (uint8_t) (x*25);
+            texel[1] = (uint8_t) (x < 4 && y < 4 ? 128 : (x*37 + y*71) & 0xff);
+            texel[2] = 0;
+            texel[3] = 255;
+        }
+    }
+    
+    int size = 0;
+    uint8_t* blocks = TextureEncodeBc5(rgba, width, height, &size);
+    
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    bool ret = size == blocksX*blocksY*16;
+    
+    for (int by=0; ret && by<blocksY; ++by)
+    {
+        for (int bx=0; bx<blocksX; ++bx)
+        {
+            for (int c=0; c<2; ++c)
+            {
+                const uint8_t* block = &blocks[(by*blocksX + bx)*16 + c*8];
+                const int e0 = block[0];
+                const int e1 = block[1];
+                
+                int palette[8] = { e0, e1 };
+                for (int i=1; i<7; ++i)
+                    palette[i+1] = e0 > e1 ? ((7-i)*e0 + i*e1) / 7 : e0;
+                
+                uint64_t bits = 0;
+                for (int i=0; i<6; ++i)
+                    bits |= (uint64_t) block[2+i] << (8*i);
+                
+                for (int i=0; i<16; ++i)
+                {
+                    const int x = Min(bx*4 + (i & 3), width - 1);
+                    const int y = Min(by*4 + (i >> 2), height - 1);
+                    const int original = rgba[(y*width + x)*4 + c];
+                    const int decoded = palette[(bits >> (3*i)) & 7];
+                    
+                    // flat blocks are exact
+                    const int bound = e0 == e1 ? 0 : (e0 - e1 + 13)/14 + 1;
+                    if (abs(decoded - original) > bound)
+                    {
+                        Printf("bc5 block %d,%d channel %d texel %d: %d decoded as %d\n", bx, by, c, i, original, decoded);
+                        ret = false;
+                    }
+                }
+            }
+        }
+    }
+    
+    free(blocks);
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// s_TestScreenLight
+//
+// A white light centered on screen uv (u, v) reaching radius of it, in the ndc and reciprocal range
+// Planar.fsh gets.  A radius of 0 is unbounded.
+static Light s_TestScreenLight(float u, float v, float radius)
+{
+    Light ret;
+    memset(&ret, 0, sizeof ret);
+    ret.m_Color = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    ret.m_Position = Vec4(u*2.0f - 1.0f, v*2.0f - 1.0f, 0.0f, 1.0f);
+    ret.m_Range = radius > 0.0f ? 0.5f / radius : 0.0f;
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LightTilesBinTest
+//
+// A 64x64 screen is 4x4 tiles, a quarter of screen uv each.  Every tile's header has to point at its
+// own run of the data, counted and listed class by class in slot order.
+static bool LightTilesBinTest()
+{
+    LightTiles* lightTiles = LightTilesCreate();
+    
+    Light pointLights[5];
+    pointLights[0] = s_TestScreenLight(0.125f, 0.125f, 0.05f);   // inside tile 0
+    pointLights[1] = s_TestScreenLight(0.125f, 0.125f, 0.05f);   // black, reaches nothing
+    pointLights[1].m_Color = Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    pointLights[2] = s_TestScreenLight(0.5f, 0.5f, 0.0f);        // everywhere
+    pointLights[3] = s_TestScreenLight(1.5f, 1.5f, 0.05f);       // off screen
+    pointLights[4] = s_TestScreenLight(0.5f, 0.5f, 0.3f);        // its rectangle is every tile, its circle misses the corners
+    
+    Light conicalLight = s_TestScreenLight(0.5f, 0.5f, 0.1f);    // the middle four
+    
+    // from uv (0.1, 0.9) to (0.4, 0.9), 0.05 either side: tiles 12 and 13
+    Light cylindricalLight = s_TestScreenLight(0.1f, 0.9f, 0.0f);
+    cylindricalLight.m_Direction = Vec4(0.4f*2.0f - 1.0f, 0.9f*2.0f - 1.0f, 0.0f, 1.0f);
+    cylindricalLight.m_OrthogonalRange = 0.5f / 0.05f;
+    
+    LightTilesSetLights(lightTiles, LightTiles::kPoint, pointLights, 5);
+    LightTilesSetLights(lightTiles, LightTiles::kConical, &conicalLight, 1);
+    LightTilesSetLights(lightTiles, LightTiles::kCylindrical, &cylindricalLight, 1);
+    LightTilesBuild(lightTiles, 64, 64);
+    
+    bool ret = lightTiles->m_TilesX == 4 && lightTiles->m_TilesY == 4;
+    
+    const uint32_t* data = lightTiles->m_Data;
+    uint32_t offset = 16*LightTiles::kHeaderSize;
+    for (int tile=0; ret && tile<16; ++tile)
+    {
+        const int tx = tile % 4;
+        const int ty = tile / 4;
+        const bool corner = (tx == 0 || tx == 3) && (ty == 0 || ty == 3);
+        
+        uint32_t expected[LightTiles::kNumClasses][5];
+        uint32_t counts[LightTiles::kNumClasses] = { 0, 0, 0 };
+        if (tile == 0)
+            expected[LightTiles::kPoint][counts[LightTiles::kPoint]++] = 0;
+        expected[LightTiles::kPoint][counts[LightTiles::kPoint]++] = 2;
+        if (!corner)
+            expected[LightTiles::kPoint][counts[LightTiles::kPoint]++] = 4;
+        if (tx >= 1 && tx <= 2 && ty >= 1 && ty <= 2)
+            expected[LightTiles::kConical][counts[LightTiles::kConical]++] = 0;
+        if (tile == 12 || tile == 13)
+            expected[LightTiles::kCylindrical][counts[LightTiles::kCylindrical]++] = 0;
+        
+        const uint32_t* header = &data[tile*LightTiles::kHeaderSize];
+        if (header[0] != offset)
+        {
+            Printf("tile %d: list at %u, expected %u\n", tile, header[0], offset);
+            ret = false;
+        }
+        
+        for (int c=0; c<LightTiles::kNumClasses; ++c)
+        {
+            if (header[1+c] != counts[c])
+            {
+                Printf("tile %d class %d: %u lights, expected %u\n", tile, c, header[1+c], counts[c]);
+                ret = false;
+                continue;
+            }
+            
+            for (uint32_t i=0; i<counts[c]; ++i)
+            {
+                if (data[offset+i] != expected[c][i])
+                {
+                    Printf("tile %d class %d: slot %u at %u, expected %u\n", tile, c, data[offset+i], i, expected[c][i]);
+                    ret = false;
+                }
+            }
+            offset += counts[c];
+        }
+    }
+    
+    if (ret && (lightTiles->m_DataSize != (int) offset || lightTiles->m_MaxLightsPerTile != 3))
+    {
+        Printf("light tiles: %d words and %d lights per tile at most, expected %u and 3\n", lightTiles->m_DataSize, lightTiles->m_MaxLightsPerTile, offset);
+        ret = false;
+    }
+    
+    LightTilesDestroy(lightTiles);
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// SceneLightSlotTest
+//
+// Slots are handed out in order and reused once freed; versions only move for slots that changed.
+static bool SceneLightSlotTest()
+{
+    Scene scene;
+    SceneCreate(&scene, 16);
+    const SceneLightArray* pointLights = &scene.m_PointLights;
+    
+    const LightOptions lightOptions = LightOptions::MakePointLight(Vec3(0.0f, 0.0f, 0.0f), Vec4(1.0f, 1.0f, 1.0f, 1.0f), 5.0f);
+    SceneObject* lights[3];
+    for (int i=0; i<3; ++i)
+        lights[i] = SceneCreateLight(&scene, lightOptions);
+    
+    bool ret = pointLights->m_Count == 3 && pointLights->m_NumFreeSlots == 0;
+    for (int i=0; i<3; ++i)
+        ret = ret && lights[i]->m_LightSlot == i && pointLights->m_Versions[i] == scene.m_LightVersion+1;
+    
+    // new slots upload with the next update, then stay put while nothing changes
+    SceneUpdate(&scene);
+    for (int i=0; i<3; ++i)
+        ret = ret && pointLights->m_Versions[i] == scene.m_LightVersion;
+    
+    const uint32_t firstVersion = scene.m_LightVersion;
+    SceneUpdate(&scene);
+    for (int i=0; i<3; ++i)
+        ret = ret && pointLights->m_Versions[i] == firstVersion;
+    
+    lights[1]->m_Light.m_Color = Vec4(0.5f, 0.5f, 0.5f, 1.0f);
+    SceneUpdate(&scene);
+    ret = ret && pointLights->m_Versions[0] == firstVersion && pointLights->m_Versions[1] == scene.m_LightVersion && pointLights->m_Versions[2] == firstVersion;
+    
+    // a freed slot goes black for the next update and is the next one handed out
+    SceneObjectDestroy(&scene, lights[1]);
+    ret = ret && pointLights->m_NumFreeSlots == 1 && pointLights->m_Versions[1] == scene.m_LightVersion+1;
+    ret = ret && pointLights->m_Lights[1].m_Color.m_X[0] == 0.0f;
+    
+    lights[1] = SceneCreateLight(&scene, lightOptions);
+    ret = ret && lights[1]->m_LightSlot == 1 && pointLights->m_Count == 3 && pointLights->m_NumFreeSlots == 0;
+    
+    // reserved blocks come off the end, even with free slots around
+    SceneObjectDestroy(&scene, lights[0]);
+    const int first = SceneReserveLights(&scene, LightType::kPoint, 4);
+    ret = ret && first == 3 && pointLights->m_Count == 7 && pointLights->m_NumFreeSlots == 1;
+    
+    SceneReleaseLights(&scene, LightType::kPoint, first, 4);
+    ret = ret && pointLights->m_Count == 7 && pointLights->m_NumFreeSlots == 5;
+    
+    if (!ret)
+        Printf("point light slots: %d handed out, %d free, version %u\n", pointLights->m_Count, pointLights->m_NumFreeSlots, scene.m_LightVersion);
+    
+    SceneDestroy(&scene);
+    return ret;
+}
+
+// -------------------------------------------------------------------------------------------------
+// SceneLightBudgetTest
+//
+// Four lights the same size in the same place, so they rank by intensity: the budget shadows one,
+// lights two more and merges the last into the ambient term.  A light off screen isn't ranked.
+static bool SceneLightBudgetTest(RenderContext* renderContext)
+{
+    renderContext->m_Camera.SetTranslation(0.0f, 0.0f, 40.0f);
+    MatrixInvert(&renderContext->m_View, renderContext->m_Camera);
+    
+    Scene scene;
+    SceneCreate(&scene, 16);
+    scene.m_LightBudget.m_ShadowMs = 1.0f;
+    scene.m_LightBudget.m_ShadowCostMs = 1.0f;
+    scene.m_LightBudget.m_LightingMs = 1.0f;
+    scene.m_LightBudget.m_LightingCostMs = 0.5f;
+    
+    const float intensities[4] = { 0.25f, 1.0f, 0.5f, 0.75f };
+    SceneObject* lights[4];
+    for (int i=0; i<4; ++i)
+    {
+        const float intensity = intensities[i];
+        lights[i] = SceneCreateLight(&scene, LightOptions::MakePointLight(Vec3(0.0f, 0.0f, 0.0f), Vec4(intensity, intensity, intensity, 1.0f), 5.0f));
+    }
+    SceneObject* offscreen = SceneCreateLight(&scene, LightOptions::MakePointLight(Vec3(1000.0f, 0.0f, 0.0f), Vec4(2.0f, 2.0f, 2.0f, 1.0f), 1.0f));
+    
+    SceneUpdate(&scene, renderContext);
+    
+    const uint32_t tiers = SceneObject::kVisible|SceneObject::kShadowed;
+    bool ret = scene.m_NumVisibleLights == 3 && scene.m_NumAmbientLights == 1;
+    ret = ret && scene.m_VisibleLights[0] == lights[1] && (lights[1]->m_Flags & tiers) == tiers;
+    ret = ret && scene.m_VisibleLights[1] == lights[3] && (lights[3]->m_Flags & tiers) == SceneObject::kVisible;
+    ret = ret && scene.m_VisibleLights[2] == lights[2] && (lights[2]->m_Flags & tiers) == SceneObject::kVisible;
+    ret = ret && (lights[0]->m_Flags & tiers) == 0 && lights[0]->m_Importance > 0.0f;
+    ret = ret && (offscreen->m_Flags & tiers) == 0 && offscreen->m_Importance == 0.0f;
+    
+    // past the budget, so it uploads black
+    ret = ret && scene.m_PointLights.m_Lights[lights[0]->m_LightSlot].m_Color.m_X[0] == 0.0f;
+    ret = ret && scene.m_AmbientLight.m_X[0] > 0.0f;
+    
+    if (!ret)
+    {
+        for (int i=0; i<4; ++i)
+            Printf("light %d: importance %f, flags %x\n", i, lights[i]->m_Importance, lights[i]->m_Flags);
+        Printf("%d visible, %d merged\n", scene.m_NumVisibleLights, scene.m_NumAmbientLights);
+    }
+    
+    SceneDestroy(&scene);
+    return ret;
+}
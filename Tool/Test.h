@@ -2,4 +2,10 @@
 
 #pragma once
 
+struct RenderContext;
+
 void MatrixTest();
+void TextureTest();
+
+// light tiles and scene lights make GL objects, so these want RenderInit's context
+void LightingTest(RenderContext* renderContext);